@@ -25,6 +25,8 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include "ImageWin.h"
 #include "MainWin.h"
 #include "lib/renderer.h"
+#include "lib/render_cache.h"
+#include "lib/render_export.h"
 #include "lib/logic_model.h"
 #include "lib/graphics.h"
 #include "lib/scaling_manager.h"
@@ -35,29 +37,89 @@ void ImageWin::setup_renderer() {
 
   rendering_buffer = NULL;
   rendering_buffer_backup = NULL;
+  render_cache = NULL;
   renderer = renderer_create();;
+  render_thread = NULL;
+  show_render_stats = false;
   set_grid(NULL);
   renderer_initialize_params(&render_params);
+  render_params.lod_cache = lodcache_create();
+  render_params.sprite_cache = spcache_create(SPCACHE_DEFAULT_SIZE);
 
   renderer_add_layer(renderer, (render_func_t) &render_background, &render_params, 1, "Background");
   renderer_add_layer(renderer, (render_func_t) &render_to_grayscale, &render_params, 0, "Background to grayscale");
-  //  renderer_add_layer(renderer, (render_func_t) &render_color_similarity, &render_params, 0, "Color similarity");
+  renderer_add_layer(renderer, (render_func_t) &render_color_similarity, &render_params, 0, "Color similarity");
   renderer_add_layer(renderer, (render_func_t) &render_grid, &render_params, 1, "Grid");
   renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
   renderer_add_layer(renderer, (render_func_t) &render_wires, &render_params, 1, "Wires");
   renderer_add_layer(renderer, (render_func_t) &render_vias, &render_params, 1, "Vias");
   renderer_add_layer(renderer, (render_func_t) &render_alignment_markers, &render_params, 1, "Alignment markers");
 
+  // the cache lives as long as the window, because the damage callback may run on any thread
+  if((render_cache = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(0, 0))) == NULL)
+    debug(TM, "rcache_create() failed");
+
+  // changes in the logic model invalidate cached tiles
+  lmodel_set_damage_callback(&ImageWin::on_lmodel_damage, this);
+
+  // frames are rendered in the background and presented from the main loop
+  signal_frame_ready_.connect(sigc::mem_fun(*this, &ImageWin::on_frame_ready));
+  if((render_thread = rthread_create(renderer, &ImageWin::on_render_thread_frame, this)) == NULL)
+    debug(TM, "rthread_create() failed, rendering synchronously");
+  else if(render_cache != NULL) rthread_set_render_cache(render_thread, render_cache);
+
   current_layer = -1;
 }
 
+void ImageWin::on_lmodel_damage(void * arg, LM_OBJECT_TYPE object_type, void * obj_ptr) {
+  ImageWin * image_win = (ImageWin *) arg;
+  // the object may be destroyed after the callback, the frame in progress is stale
+  if(image_win->render_thread != NULL) rthread_cancel(image_win->render_thread);
+  if(image_win->render_cache != NULL) 
+    rcache_invalidate_object(image_win->render_cache, object_type, obj_ptr);
+}
+
+/** Called on the render thread. Only the dispatcher may be touched here. */
+void ImageWin::on_render_thread_frame(void * arg) {
+  ImageWin * image_win = (ImageWin *) arg;
+  image_win->signal_frame_ready_();
+}
+
+void ImageWin::on_frame_ready() {
+  if(render_thread != NULL && rendering_buffer != NULL &&
+     RET_IS_OK(rthread_get_frame(render_thread, rendering_buffer, NULL))) {
+    gr_clone_image_data(rendering_buffer_backup, rendering_buffer);
+    present_frame();
+  }
+}
+
+void ImageWin::lock_rendering() {
+  if(render_thread != NULL) rthread_lock(render_thread);
+}
+
+void ImageWin::unlock_rendering() {
+  if(render_thread != NULL) rthread_unlock(render_thread);
+}
+
 void ImageWin::set_render_logic_model(logic_model_t  * lmodel) {
+  lock_rendering();
   render_params.lmodel = lmodel;
+  if(render_params.lod_cache != NULL) lodcache_invalidate(render_params.lod_cache);
+  if(render_params.sprite_cache != NULL) spcache_invalidate(render_params.sprite_cache);
+  if(render_cache != NULL) rcache_invalidate_all(render_cache);
+  unlock_rendering();
 }
 
 void ImageWin::set_render_background_images(image_t ** bg_images, scaling_manager_t * scaling_manager) {
+  lock_rendering();
   render_params.bg_images = bg_images;
   render_params.scaling_manager = scaling_manager;
+
+  if(render_params.similarity_cache != NULL) simcache_destroy(render_params.similarity_cache);
+  render_params.similarity_cache = scaling_manager != NULL ? simcache_create(scaling_manager) : NULL;
+
+  if(render_cache != NULL) rcache_invalidate_all(render_cache);
+  unlock_rendering();
 }
 
 void ImageWin::set_current_layer(int layer) {
@@ -76,6 +138,8 @@ ImageWin::ImageWin() {
   max_x = 100;
   max_y = 100;
 
+  last_min_x = last_max_x = last_min_y = last_max_y = 0;
+
   last_click_on_x = 0;
   last_click_on_y = 0;
   mouse_button_pressed = false;
@@ -106,6 +170,12 @@ ImageWin::ImageWin() {
 
 
 ImageWin::~ImageWin() {
+  lmodel_set_damage_callback(NULL, NULL);
+  if(render_thread != NULL) rthread_destroy(render_thread);
+  if(render_cache != NULL) rcache_destroy(render_cache);
+  if(render_params.similarity_cache != NULL) simcache_destroy(render_params.similarity_cache);
+  if(render_params.lod_cache != NULL) lodcache_destroy(render_params.lod_cache);
+  if(render_params.sprite_cache != NULL) spcache_destroy(render_params.sprite_cache);
   renderer_destroy(renderer);
 }
 
@@ -270,6 +340,16 @@ void ImageWin::resize_rendering_buffer(unsigned int new_width, unsigned int new_
       return;
     }
 
+    // the buffers are presented, before the render thread delivers the first frame
+    gr_map_clear(rendering_buffer);
+    gr_map_clear(rendering_buffer_backup);
+
+    lock_rendering();
+    if(render_cache != NULL && 
+       RET_IS_NOT_OK(rcache_set_num_tiles(render_cache, rcache_get_num_tiles_for_view(new_width, new_height))))
+      debug(TM, "rcache_set_num_tiles() failed");
+    unlock_rendering();
+
     curr_width = new_width;
     curr_height = new_height;
     
@@ -285,51 +365,170 @@ void ImageWin::update_screen() {
     const unsigned int width = allocation.get_width();
     const unsigned int height = allocation.get_height();
 
-    Glib::RefPtr<Gdk::GC> gc = this->get_style()->get_black_gc();
     resize_rendering_buffer(width, height);
 
     if(current_layer >= 0) {
-      render_region(renderer, rendering_buffer, current_layer, min_x, min_y, max_x, max_y);
-      gr_clone_image_data(rendering_buffer_backup, rendering_buffer);
+      // the last frame is presented, until the render thread delivers the new one
+      if(render_thread != NULL) {
+	if(RET_IS_NOT_OK(rthread_request_view(render_thread, current_layer, width, height,
+					      min_x, min_y, max_x, max_y)))
+	  debug(TM, "rthread_request_view() failed");
+      }
+      else {
+	renderer_begin_frame(renderer);
+	if(render_cache == NULL || 
+	   RET_IS_NOT_OK(rcache_render_region(render_cache, rendering_buffer, current_layer, 
+					      min_x, min_y, max_x, max_y)))
+	  render_region(renderer, rendering_buffer, current_layer, min_x, min_y, max_x, max_y);
+	renderer_end_frame(renderer);
+	gr_clone_image_data(rendering_buffer_backup, rendering_buffer);
+      }
+      prefetch_next_view();
     }
     else {
+      if(render_thread != NULL) rthread_cancel(render_thread);
       gr_map_clear(rendering_buffer);
       gr_map_clear(rendering_buffer_backup);
     }
 
-    window->draw_rgb_32_image(gc, 0, 0, width, height, Gdk::RGB_DITHER_NONE, 
-			      (guchar *)rendering_buffer->map->mem, width * BYTES_PER_PIXEL);
+    present_frame();
+  }
+}
+
+/**
+ * Draw the rendering buffer and the overlays to the window.
+ */
+void ImageWin::present_frame() {
+
+  Glib::RefPtr<Gdk::Window> window = get_window();
+
+  if(window && rendering_buffer != NULL) {
+    Glib::RefPtr<Gdk::GC> gc = this->get_style()->get_black_gc();
+
+    window->draw_rgb_32_image(gc, 0, 0, curr_width, curr_height, Gdk::RGB_DITHER_NONE, 
+			      (guchar *)rendering_buffer->map->mem, curr_width * BYTES_PER_PIXEL);
 
     if(selection_active()) draw_selection_box();
     else if(in_line_mode) draw_wire();
     else if(object_selection_active) draw_object_info();
+
+    if(show_render_stats) draw_render_stats();
+  }
+}
+
+/**
+ * Show or hide the frame statistics in the upper left corner of the view.
+ */
+void ImageWin::toggle_render_stats() {
+  show_render_stats = !show_render_stats;
+  if(show_render_stats) renderer_reset_stats(renderer);
+  present_frame();
+}
+
+/**
+ * Draw the statistics of the last frame: frame times and the cost of each 
+ * enabled render function.
+ */
+void ImageWin::draw_render_stats() {
+  renderer_stats_t stats;
+  std::vector<Glib::ustring> lines;
+  char line[200];
+  int i;
+
+  if(RET_IS_NOT_OK(renderer_get_stats(renderer, &stats))) return;
+
+  snprintf(line, sizeof(line), "frame %.1f ms, p50 %.1f ms, p99 %.1f ms (%d frames)",
+	   stats.frame_time, stats.frame_time_p50, stats.frame_time_p99, stats.num_frames);
+  lines.push_back(line);
+
+  unsigned long tiles = stats.cache_hits + stats.cache_misses;
+  if(tiles > 0) {
+    snprintf(line, sizeof(line), "tile cache: %lu of %lu tiles hit (%.0f%%)", 
+	     stats.cache_hits, tiles, 100.0 * stats.cache_hits / tiles);
+    lines.push_back(line);
+  }
+
+  for(i = 0; i < renderer_get_num_render_func(renderer); i++) {
+    if(renderer_render_func_enabled(renderer, i)) {
+      const renderer_func_stats_t * f = &stats.funcs[i];
+      if(f->objects_visited > 0)
+	snprintf(line, sizeof(line), "%s: %.1f ms, %lu of %lu objects drawn", 
+		 renderer_get_name_render_func(renderer, i), f->time, f->objects_drawn, f->objects_visited);
+      else
+	snprintf(line, sizeof(line), "%s: %.1f ms", renderer_get_name_render_func(renderer, i), f->time);
+      lines.push_back(line);
+    }
+  }
+
+  Glib::RefPtr<Gdk::Window> window = get_window();
+  if(!window) return;
+
+  const double line_height = 14, border = 6;
+  Cairo::RefPtr<Cairo::Context> cr = window->create_cairo_context();
+  cr->set_font_size(11);
+
+  cr->set_source_rgba(0, 0, 0, 0.6);
+  cr->rectangle(0, 0, 400, 2 * border + lines.size() * line_height);
+  cr->fill();
+
+  cr->set_source_rgb(1, 1, 1);
+  for(unsigned int n = 0; n < lines.size(); n++) {
+    cr->move_to(border, border + (n + 1) * line_height - 3);
+    cr->show_text(lines[n]);
   }
 }
 
+/**
+ * If the view was moved without zooming, prefetch the area, that becomes visible
+ * if the view keeps moving in the same direction.
+ */
+void ImageWin::prefetch_next_view() {
+  int dx = (int)min_x - (int)last_min_x;
+  int dy = (int)min_y - (int)last_min_y;
+  bool same_size = max_x - min_x == last_max_x - last_min_x && 
+    max_y - min_y == last_max_y - last_min_y;
+
+  last_min_x = min_x;
+  last_max_x = max_x;
+  last_min_y = min_y;
+  last_max_y = max_y;
+
+  if(!same_size || (dx == 0 && dy == 0) || render_params.scaling_manager == NULL) return;
+
+  int next_min_x = MAX(0, (int)min_x + dx);
+  int next_min_y = MAX(0, (int)min_y + dy);
+  int next_max_x = (int)max_x + dx;
+  int next_max_y = (int)max_y + dy;
+  if(next_max_x < next_min_x || next_max_y < next_min_y) return;
+
+  if(RET_IS_NOT_OK(scalmgr_prefetch_region(render_params.scaling_manager, current_layer, 
+					   get_scaling_x(), next_min_x, next_min_y, 
+					   next_max_x, next_max_y)))
+    debug(TM, "prefetching failed");
+}
+
 bool ImageWin::on_expose_event(GdkEventExpose * event) {
-  
-  update_screen();
+
+  // changes of the view call update_screen(), an expose only has to present the 
+  // last frame, unless the window was resized
+  Gtk::Allocation allocation = get_allocation();
+  if(render_thread == NULL || rendering_buffer == NULL ||
+     (unsigned int)allocation.get_width() != curr_width || 
+     (unsigned int)allocation.get_height() != curr_height) update_screen();
+  else present_frame();
   return true;
 }
 
 bool ImageWin::render_to_file(const char * const filename, 
 			      unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
 
-  unsigned int width = (max_x - min_x);
-  unsigned int height = (max_y - min_y);
-  image_t * img = gr_create_memory_image(width, height, IMAGE_TYPE_RGBA);
-  if(img == NULL) return false;
-  
-  render_region(renderer, img, current_layer, min_x, min_y, max_x, max_y);
+  // The region is streamed band by band, so layers larger than memory can be exported.
+  lock_rendering();
+  ret_t ret = rexport_render_to_file(renderer, current_layer, min_x, min_y, max_x, max_y,
+				     rexport_get_format_by_filename(filename), filename, NULL, NULL);
+  unlock_rendering();
 
-  if(RET_IS_NOT_OK(renderer_write_image(img, filename))) {
-    gr_image_destroy(img);
-    return false;
-  }
-  else {
-    gr_image_destroy(img);
-    return true;
-  }
+  return RET_IS_OK(ret);
 }
 
 void ImageWin::draw_selection_box() {
@@ -643,14 +842,16 @@ void ImageWin::set_tool(TOOL tool) {
 
 void ImageWin::toggle_render_info_layer(int slot_pos) {
   if(renderer) {
+    lock_rendering();
     renderer_toggle_render_func(renderer, slot_pos);
+    unlock_rendering();
   }
 }
 
 void ImageWin::set_render_info_layer_state(int slot_pos, bool state) {
   if(renderer) {
     if(get_renderer_func_enabled(slot_pos) != state)
-      renderer_toggle_render_func(renderer, slot_pos);
+      toggle_render_info_layer(slot_pos);
   }
 }
 
@@ -24,7 +24,10 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 #include <gtkmm/drawingarea.h>
 #include <gtkmm/tooltips.h>
+#include <glibmm/dispatcher.h>
 #include "lib/renderer.h"
+#include "lib/render_cache.h"
+#include "lib/render_thread.h"
 #include "lib/logic_model.h"
 #include "lib/graphics.h"
 #include "lib/scaling_manager.h"
@@ -87,6 +90,7 @@ class ImageWin : public Gtk::DrawingArea {
   void set_render_background_images(image_t ** bg_images, scaling_manager_t * scaling_manager);
   void set_current_layer(int layer);
   void toggle_render_info_layer(int slot_pos);
+  void toggle_render_stats();
   void set_render_info_layer_state(int slot_pos, bool state);
   void set_renderer_info_layer_state(const std::vector<bool> & new_states);
 
@@ -111,6 +115,10 @@ class ImageWin : public Gtk::DrawingArea {
 
   void set_shift_key_state(bool state);
 
+  // threads, that modify the logic model or background images, hold this lock
+  void lock_rendering();
+  void unlock_rendering();
+
  protected:
 
   virtual bool on_expose_event(GdkEventExpose * event);
@@ -136,8 +144,12 @@ class ImageWin : public Gtk::DrawingArea {
   image_t * rendering_buffer_backup;
   renderer_t * renderer;
   render_params_t render_params;
+  rcache_t * render_cache;
+  rthread_t * render_thread;
+  Glib::Dispatcher signal_frame_ready_;
   int current_layer;
   bool shift_key_pressed;
+  bool show_render_stats;
 
   unsigned int curr_width;
   unsigned int curr_height;
@@ -156,6 +168,9 @@ class ImageWin : public Gtk::DrawingArea {
   // real coords
   unsigned int min_x, max_x, min_y, max_y;
 
+  // real coords of the last rendered view, to detect scrolling
+  unsigned int last_min_x, last_max_x, last_min_y, last_max_y;
+
 
   unsigned int object_selection_x, object_selection_y;
   bool object_selection_active;
@@ -174,6 +189,14 @@ class ImageWin : public Gtk::DrawingArea {
   void draw_object_info();
   void reset_wire();
   void setup_renderer();
+  void prefetch_next_view();
+  void present_frame();
+  void draw_render_stats();
+  void on_frame_ready();
+
+  static void on_render_thread_frame(void * arg);
+
+  static void on_lmodel_damage(void * arg, LM_OBJECT_TYPE object_type, void * obj_ptr);
 
 
 };
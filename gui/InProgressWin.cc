@@ -34,6 +34,7 @@ Glib::StaticMutex mutex = GLIBMM_STATIC_MUTEX_INIT;
 InProgressWin::InProgressWin(Gtk::Window *parent, const Glib::ustring& title, const Glib::ustring& message) {
 
   running = true;
+  progress = -1;
 
 #ifdef IMPL_WITH_THREAD
   thread = NULL;
@@ -85,9 +86,19 @@ void InProgressWin::close() {
 #endif
 }
 
+/**
+ * Set the progress to display. The progress is a value between 0 and 1. A negative
+ * value switches back to a pulsing progress bar. The method might be called from a
+ * worker thread. The progress bar itself is updated from the GUI thread.
+ */
+void InProgressWin::set_progress(double progress) {
+  this->progress = progress > 1 ? 1 : progress;
+}
+
 bool InProgressWin::update_progress_bar() {
   //puts("update");
-  m_ProgressBar.pulse();
+  if(progress < 0) m_ProgressBar.pulse();
+  else m_ProgressBar.set_fraction(progress);
   return running;
 }
 
@@ -29,10 +29,12 @@ class InProgressWin : public Gtk::Window {
   InProgressWin(Gtk::Window *parent, const Glib::ustring& title, const Glib::ustring& message);
   virtual ~InProgressWin();
   void close();
+  void set_progress(double progress);
 
  private:
 
   bool running;
+  volatile double progress;
 #ifdef IMPL_WITH_THREAD
   Glib::Thread * thread;
   Glib::Dispatcher   signal_progress_;
@@ -51,6 +51,8 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include "lib/logic_model.h"
 #include "lib/alignment_marker.h"
 #include "lib/plugins.h"
+#include "lib/mosaic.h"
+#include "lib/registration.h"
 
 #define ZOOM_STEP 1.3
 #define ZOOM_STEP_MOUSE_SCROLL 2.0
@@ -186,6 +188,10 @@ void MainWin::on_menu_view_toggle_all_info_layers() {
   imgWin.update_screen();
 }
 
+void MainWin::on_menu_view_toggle_render_stats() {
+  imgWin.toggle_render_stats();
+}
+
 
 
 
@@ -668,14 +674,18 @@ void MainWin::goto_object(LM_OBJECT_TYPE object_type, object_ptr_t * obj_ptr) {
     if(RET_IS_OK(lmodel_get_view_for_object(main_project->lmodel, object_type, obj_ptr,
 					    &center_x, &center_y, &layer))) {
 
+      imgWin.lock_rendering();
       highlighted_objects.add(object_type, obj_ptr);
+      imgWin.unlock_rendering();
 
       //int old_state = lmodel_get_select_state(object_type, obj_ptr);
       //lmodel_set_select_state(object_type, obj_ptr, SELECT_STATE_DIRECT);
       center_view(center_x, center_y, layer);
       //lmodel_set_select_state(object_type, obj_ptr, old_state);
 
+      imgWin.lock_rendering();
       highlighted_objects.remove(object_type, obj_ptr);
+      imgWin.unlock_rendering();
 
     }
     
@@ -885,7 +895,10 @@ void MainWin::on_algorithm_finished(int slot_pos, plugin_params_t * plugin_param
 void MainWin::algorithm_calc_thread(int slot_pos, plugin_params_t * plugin_params) {
 
   debug(TM, "Calculating ...");
+  // the plugin may modify the logic model, while the render thread reads it
+  imgWin.lock_rendering();
   plugin_func_ret_status = plugin_calc_slot(plugin_func_table, slot_pos, PLUGIN_FUNC_CALC, plugin_params, this);  
+  imgWin.unlock_rendering();
   (*signal_algorithm_finished_)();
 }
 
@@ -964,7 +977,10 @@ void MainWin::on_menu_goto_gate_by_id() {
 void MainWin::on_menu_gate_port_colors() {
   if(main_project != NULL) {
     PortColorsWin pcWin(this, main_project->lmodel, main_project->port_color_manager);
+    // the dialog modifies the logic model, while the render thread reads it
+    imgWin.lock_rendering();
     pcWin.run();
+    imgWin.unlock_rendering();
 
     imgWin.update_screen();
     project_changed();
@@ -975,13 +991,16 @@ void MainWin::on_menu_gate_port_colors() {
 void MainWin::on_menu_gate_list() {
   if(main_project != NULL) {
     GateListWin glWin(this, main_project->lmodel);
+    // the dialog modifies the gate templates, while the render thread reads them
+    imgWin.lock_rendering();
     glWin.run();
+    ret_t ret = lmodel_apply_colors_to_ports(main_project->lmodel, main_project->port_color_manager);
+    imgWin.unlock_rendering();
 
     imgWin.update_screen();
     project_changed();
 
-    if(RET_IS_NOT_OK(lmodel_apply_colors_to_ports(main_project->lmodel, 
-						  main_project->port_color_manager))) {
+    if(RET_IS_NOT_OK(ret)) {
 
       error_dialog("Error", "Can't update port colors.");
       return;
@@ -1003,7 +1022,11 @@ void MainWin::on_menu_gate_orientation() {
     LM_TEMPLATE_ORIENTATION new_ori = oWin.run();
 
     if(new_ori != gate->template_orientation) {
-      if(RET_IS_NOT_OK(lmodel_set_gate_orientation(gate, new_ori)))
+      imgWin.lock_rendering();
+      ret_t ret = lmodel_set_gate_orientation(gate, new_ori);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret))
 	error_dialog("Error", 
 		     "Can't set orientation. Probably it is not possible, "
 		     "because the gate represents a master template.");
@@ -1034,10 +1057,12 @@ void MainWin::remove_gate_by_type(GS_DESTROY_MODE destroy_mode) {
       while(set_ptr != NULL) {
 	assert(set_ptr->gate != NULL);
 
-	if(set_ptr->gate != NULL &&
-	   RET_IS_NOT_OK(lmodel_destroy_gates_by_template_type(main_project->lmodel, 
-							       set_ptr->gate, 
-							       destroy_mode))) {
+	imgWin.lock_rendering();
+	ret_t ret = set_ptr->gate != NULL ?
+	  lmodel_destroy_gates_by_template_type(main_project->lmodel, set_ptr->gate, destroy_mode) : RET_OK;
+	imgWin.unlock_rendering();
+
+	if(RET_IS_NOT_OK(ret)) {
 	  error_dialog("Error", "Can't remove gate.");
 	  goto end;
 	}
@@ -1049,7 +1074,11 @@ void MainWin::remove_gate_by_type(GS_DESTROY_MODE destroy_mode) {
 	dialog2.hide();
 	if(dialog.run() == Gtk::RESPONSE_YES) {
 
-	  if(RET_IS_NOT_OK(lmodel_remove_gate_template(main_project->lmodel, set_ptr->gate))) {
+	  imgWin.lock_rendering();
+	  ret = lmodel_remove_gate_template(main_project->lmodel, set_ptr->gate);
+	  imgWin.unlock_rendering();
+
+	  if(RET_IS_NOT_OK(ret)) {
 	    error_dialog("Error", "Can't remove template gate.");
 	    goto end;
 	  }
@@ -1106,24 +1135,27 @@ void MainWin::on_menu_gate_set_as_master() {
       return;
     }
 
-    if(RET_IS_NOT_OK(lmodel_set_gate_orientation(gate, LM_TEMPLATE_ORIENTATION_NORMAL))) {
-      error_dialog("Error", "Can't reset gate's orientation to normal orientation.");
-      return;
-    }
+    const char * error = NULL;
+    imgWin.lock_rendering();
 
-    if(RET_IS_NOT_OK(lmodel_adjust_gate_orientation_for_all_gates(main_project->lmodel, gate, 
-								  orig_orient))) {
-      error_dialog("Error", "Can't adjust other gates orientation relative to the new master template.");
-      return;
-    }
+    if(RET_IS_NOT_OK(lmodel_set_gate_orientation(gate, LM_TEMPLATE_ORIENTATION_NORMAL)))
+      error = "Can't reset gate's orientation to normal orientation.";
 
-    if(RET_IS_NOT_OK(lmodel_gate_template_set_master_region(tmpl, gate->min_x, gate->min_y, gate->max_x, gate->max_y))) {
-      error_dialog("Error", "Cant set this gate as master template.");
-      return;
-    }
+    else if(RET_IS_NOT_OK(lmodel_adjust_gate_orientation_for_all_gates(main_project->lmodel, gate, 
+								       orig_orient)))
+      error = "Can't adjust other gates orientation relative to the new master template.";
+
+    else if(RET_IS_NOT_OK(lmodel_gate_template_set_master_region(tmpl, gate->min_x, gate->min_y, 
+								 gate->max_x, gate->max_y)))
+      error = "Cant set this gate as master template.";
 
-    if(RET_IS_NOT_OK(lmodel_adjust_templates_port_locations(tmpl, orig_orient))) {
-      error_dialog("Error", "Can't adjust templates port locations.");
+    else if(RET_IS_NOT_OK(lmodel_adjust_templates_port_locations(tmpl, orig_orient)))
+      error = "Can't adjust templates port locations.";
+
+    imgWin.unlock_rendering();
+
+    if(error != NULL) {
+      error_dialog("Error", error);
       return;
     }
 
@@ -1158,7 +1190,11 @@ void MainWin::on_menu_gate_set() {
 	if(RET_IS_NOT_OK(lmodel_reset_gate_shape(new_gate)))
 	  error_dialog("Error", "Can't reset gate shape");
 
-	if(RET_IS_NOT_OK(lmodel_add_gate(main_project->lmodel, layer, new_gate)))
+	imgWin.lock_rendering();
+	ret_t ret = lmodel_add_gate(main_project->lmodel, layer, new_gate);
+	imgWin.unlock_rendering();
+
+	if(RET_IS_NOT_OK(ret))
 	  error_dialog("Error", "Can't add gate to logic model.");
 	else {
 	  imgWin.reset_selection();
@@ -1181,10 +1217,15 @@ void MainWin::on_menu_gate_set() {
     if(tmpl) {
 
       debug(TM, "new template");
-      if(RET_IS_NOT_OK(lmodel_reset_gate_shape(gate)))
+      imgWin.lock_rendering();
+      ret_t ret_shape = lmodel_reset_gate_shape(gate);
+      ret_t ret = lmodel_set_template_for_gate(main_project->lmodel, gate, tmpl);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret_shape))
 	error_dialog("Error", "Can't reset gate shape.");
 
-      if(RET_IS_NOT_OK(lmodel_set_template_for_gate(main_project->lmodel, gate, tmpl))) {
+      if(RET_IS_NOT_OK(ret)) {
 	error_dialog("Error", "Can't set template.");
       }
       else {
@@ -1218,7 +1259,11 @@ void MainWin::on_menu_gate_create_by_selection() {
 
     GateConfigWin gcWin(this, main_project->lmodel, tmpl);
     if(gcWin.run() == true) {
-      if(RET_IS_NOT_OK(lmodel_add_gate_template(main_project->lmodel, tmpl, 0))) {
+      imgWin.lock_rendering();
+      ret_t ret = lmodel_add_gate_template(main_project->lmodel, tmpl, 0);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret)) {
 	error_dialog("Error", "Can't add gate template to logic model.");
       }
       else {
@@ -1239,7 +1284,11 @@ void MainWin::on_menu_gate_create_by_selection() {
 	  error_dialog("Error", "Can't set orientation.");
 	}
 	
-	if(RET_IS_NOT_OK(lmodel_add_gate(main_project->lmodel, layer, new_gate)))
+	imgWin.lock_rendering();
+	ret = lmodel_add_gate(main_project->lmodel, layer, new_gate);
+	imgWin.unlock_rendering();
+
+	if(RET_IS_NOT_OK(ret))
 	  error_dialog("Error", "Can't add gate to logic model.");
 	else {
 	  imgWin.reset_selection();
@@ -1279,7 +1328,11 @@ void MainWin::on_wire_tool_release() {
 						main_project->wire_diameter, NULL, 0);
   assert(new_wire);
 
-  if(RET_IS_NOT_OK(lmodel_add_wire_with_autojoin(main_project->lmodel, main_project->current_layer, new_wire)))
+  imgWin.lock_rendering();
+  ret_t ret = lmodel_add_wire_with_autojoin(main_project->lmodel, main_project->current_layer, new_wire);
+  imgWin.unlock_rendering();
+
+  if(RET_IS_NOT_OK(ret))
     error_dialog("Error", "Can't place wire");
   else
     project_changed();
@@ -1364,7 +1417,11 @@ bool MainWin::on_imgwin_clicked(GdkEventButton * event) {
 						   main_project->pin_diameter, NULL, 0);
 	assert(new_via);
 						   
-	if(RET_IS_NOT_OK(lmodel_add_via_with_autojoin(main_project->lmodel, main_project->current_layer, new_via)))
+	imgWin.lock_rendering();
+	ret_t ret = lmodel_add_via_with_autojoin(main_project->lmodel, main_project->current_layer, new_via);
+	imgWin.unlock_rendering();
+
+	if(RET_IS_NOT_OK(ret))
 	  error_dialog("Error", "Can't place a via");
 	else {
 	  project_changed();
@@ -1429,7 +1486,10 @@ void MainWin::clear_selection() {
     debug(TM, "\tunselect %s", s);
   }
 
+  // the select states are read by the render thread
+  imgWin.lock_rendering();
   highlighted_objects.clear();
+  imgWin.unlock_rendering();
   selected_objects.erase(selected_objects.begin(), selected_objects.end());
 }
 
@@ -1516,6 +1576,7 @@ void MainWin::object_clicked(unsigned int real_x, unsigned int real_y) {
   m_statusbar.push(msg);
 
   std::set< std::pair<void *, LM_OBJECT_TYPE> >::const_iterator it;
+  imgWin.lock_rendering();
 
   // try to remove a single object
   if(obj_ptr != NULL && control_key_pressed == true) {
@@ -1545,6 +1606,7 @@ void MainWin::object_clicked(unsigned int real_x, unsigned int real_y) {
       highlighted_objects.add(object_type, (object_ptr_t *)obj_ptr);
     }
   }
+  imgWin.unlock_rendering();
  
   imgWin.update_screen();
   update_gui_on_selection_change();
@@ -1662,9 +1724,12 @@ void MainWin::on_popup_menu_set_port() {
     lmodel_gate_template_port_t * template_port = psWin.run();
     if(template_port != NULL) {
       debug(TM, "x=%d y=%d", x, y);
+      imgWin.lock_rendering();
       template_port->relative_x_coord = x; 
       template_port->relative_y_coord = y; 
       template_port->diameter = main_project->pin_diameter;
+      lmodel_report_damage(LM_TYPE_UNDEF, NULL);
+      imgWin.unlock_rendering();
 
       project_changed();
       imgWin.update_screen();
@@ -1692,11 +1757,15 @@ void MainWin::on_popup_menu_set_name() {
     Glib::ustring str;
     if(input.run(name)) {
     
-      for(it = selected_objects.begin(); it != selected_objects.end(); it++) {
-	if(RET_IS_NOT_OK(lmodel_set_name( (*it).second, (*it).first, name.c_str() ))) {
-	  error_dialog("Error", "Can't set name.");
-	  return;
-	}
+      ret_t ret = RET_OK;
+      imgWin.lock_rendering();
+      for(it = selected_objects.begin(); it != selected_objects.end() && RET_IS_OK(ret); it++)
+	ret = lmodel_set_name( (*it).second, (*it).first, name.c_str() );
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret)) {
+	error_dialog("Error", "Can't set name.");
+	return;
       }
       project_changed();
       imgWin.update_screen();
@@ -1710,7 +1779,11 @@ void MainWin::on_popup_menu_add_vertical_grid_line() {
     if(main_project->grid->grid_mode != USE_UNREGULAR_GRID)
       error_dialog("Error", "Please set the unregular grid mode in the grid configuration.");
     else {
-      if(RET_IS_NOT_OK(grid_add_vertical_grid_line(main_project->grid, last_click_on_real_x)))
+      imgWin.lock_rendering();
+      ret_t ret = grid_add_vertical_grid_line(main_project->grid, last_click_on_real_x);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret))
 	error_dialog("Error", "Can't add grid line.");
       else {
 	gcWin->update_grid_entries();
@@ -1726,7 +1799,11 @@ void MainWin::on_popup_menu_add_horizontal_grid_line() {
     if(main_project->grid->grid_mode != USE_UNREGULAR_GRID)
       error_dialog("Error", "Please set the unregular grid mode in the grid configuration.");
     else {
-      if(RET_IS_NOT_OK(grid_add_horizontal_grid_line(main_project->grid, last_click_on_real_y)))
+      imgWin.lock_rendering();
+      ret_t ret = grid_add_horizontal_grid_line(main_project->grid, last_click_on_real_y);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret))
 	error_dialog("Error", "Can't add grid line.");
       else {
 	gcWin->update_grid_entries();
@@ -1747,18 +1824,26 @@ void MainWin::on_popup_menu_set_alignment_marker(MARKER_TYPE marker_type) {
 				true, Gtk::MESSAGE_QUESTION, Gtk::BUTTONS_YES_NO);
       dialog.set_title("Warning");      
       if(dialog.run() == Gtk::RESPONSE_YES) {
-	if(RET_IS_NOT_OK(amset_replace_marker(main_project->alignment_marker_set, 
-					      main_project->current_layer, 
-					      marker_type, 
-					      last_click_on_real_x, last_click_on_real_y)))
+	imgWin.lock_rendering();
+	ret_t ret = amset_replace_marker(main_project->alignment_marker_set, 
+					 main_project->current_layer, 
+					 marker_type, 
+					 last_click_on_real_x, last_click_on_real_y);
+	imgWin.unlock_rendering();
+
+	if(RET_IS_NOT_OK(ret))
 	  error_dialog("Error", "Error: Can't replace marker.");	
       }
     }
     else {
-      if(RET_IS_NOT_OK(amset_add_marker(main_project->alignment_marker_set, 
-					main_project->current_layer, 
-					marker_type, 
-					last_click_on_real_x, last_click_on_real_y)))
+      imgWin.lock_rendering();
+      ret_t ret = amset_add_marker(main_project->alignment_marker_set, 
+				   main_project->current_layer, 
+				   marker_type, 
+				   last_click_on_real_x, last_click_on_real_y);
+      imgWin.unlock_rendering();
+
+      if(RET_IS_NOT_OK(ret))
 	error_dialog("Error", "Error: Can't add marker.");	      
     }
     //amset_print(main_project->alignment_marker_set);
@@ -1801,7 +1886,9 @@ void MainWin::on_menu_logic_auto_name_gates(AUTONAME_ORIENTATION orientation) {
 
 void MainWin::auto_name_gates_thread(AUTONAME_ORIENTATION orientation) {
   int layer = lmodel_get_layer_num_by_type(main_project->lmodel, LM_LAYER_TYPE_LOGIC);
+  imgWin.lock_rendering();
   ret_t ret = lmodel_autoname_gates(main_project->lmodel, layer, orientation);
+  imgWin.unlock_rendering();
   signal_auto_name_finished_(ret);
 }
 
@@ -1836,15 +1923,19 @@ void MainWin::on_menu_logic_interconnect() {
     
 
     it1 = selected_objects.begin();
+    bool failed = false;
 
+    imgWin.lock_rendering();
     for(it2 = selected_objects.begin(); it2 != selected_objects.end(); it2++) {
 
       if(RET_IS_NOT_OK(lmodel_connect_objects((*it1).second, (*it1).first,
 					      (*it2).second, (*it2).first))) {
-	error_dialog("Error", "Can't connect objects.");
-	  
+	failed = true;
       }
     }
+    imgWin.unlock_rendering();
+
+    if(failed) error_dialog("Error", "Can't connect objects.");
 
     //for(it1 = selected_objects.begin(); it1 != selected_objects.end(); it1++)
     //  lmodel_set_select_state((*it1).second, (*it1).first, SELECT_STATE_DIRECT);
@@ -1858,14 +1949,20 @@ void MainWin::on_menu_logic_isolate() {
   std::set< std::pair<void *, LM_OBJECT_TYPE> >::const_iterator it;
   if(selected_objects.size() >= 1) {
 
+    bool failed = false;
+
+    imgWin.lock_rendering();
     for(it = selected_objects.begin(); it != selected_objects.end(); it++) {
   
       //lmodel_set_select_state((*it).second, (*it).first, SELECT_STATE_NOT);
       if(RET_IS_NOT_OK(lmodel_remove_all_connections_from_object((*it).second, (*it).first))) {
-	error_dialog("Error", "Can't isolate object.");
+	failed = true;
       }
       //lmodel_set_select_state((*it).second, (*it).first, SELECT_STATE_DIRECT);
     }
+    imgWin.unlock_rendering();
+
+    if(failed) error_dialog("Error", "Can't isolate object.");
     project_changed();
     imgWin.update_screen();
   }
@@ -1892,7 +1989,7 @@ void MainWin::on_grid_config_changed() {
   }
 }
 
-/*void MainWin::on_distance_to_col_changed(Gtk::ColorSelection * pColorSel) {
+void MainWin::on_distance_to_col_changed(Gtk::ColorSelection * pColorSel) {
   render_params_t * render_params = imgWin.get_render_params();
   Gdk::Color col = pColorSel->get_current_color();
   render_params->distance_to_color = MERGE_CHANNELS(col.get_red() >> 8, col.get_green() >> 8, col.get_blue() >> 8, 0xff);
@@ -1924,7 +2021,6 @@ void MainWin::on_menu_view_distance_to_color() {
  
 }
 
-*/
 
 void MainWin::on_menu_layer_import_background() {
   Gtk::FileChooserDialog dialog("Please select a background image", Gtk::FILE_CHOOSER_ACTION_OPEN);
@@ -1958,6 +2054,35 @@ void MainWin::on_menu_layer_import_background() {
 }
 
 
+void MainWin::on_menu_layer_import_mosaic() {
+  Gtk::FileChooserDialog dialog("Please select a tile list", Gtk::FILE_CHOOSER_ACTION_OPEN);
+  dialog.set_transient_for(*this);
+
+  dialog.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+  dialog.add_button("Select", Gtk::RESPONSE_OK);
+
+  int result = dialog.run();
+
+  Glib::ustring filename = dialog.get_filename();
+  dialog.hide();
+  
+  switch(result) {
+  case(Gtk::RESPONSE_OK):
+
+    ipWin = new InProgressWin(this, "Importing", 
+			      "Please wait while aligning and stitching the image tiles and calculate the prescaled images.");
+    ipWin->show();
+    project_changed();
+    signal_bg_import_finished_.connect(sigc::mem_fun(*this, &MainWin::on_background_import_finished));
+    Glib::Thread::create(sigc::bind<const Glib::ustring>(sigc::mem_fun(*this, &MainWin::mosaic_import_thread), filename), false);
+
+    break;
+  case(Gtk::RESPONSE_CANCEL):
+    break;
+  }
+  
+}
+
 // in GUI-thread
 void MainWin::on_background_import_finished() {
 
@@ -1969,12 +2094,23 @@ void MainWin::on_background_import_finished() {
   imgWin.update_screen();
 }
 
+// called from the import worker threads
+void background_import_progress(double progress, void * arg) {
+  InProgressWin * ipWin = (InProgressWin *) arg;
+  if(ipWin != NULL) ipWin->set_progress(progress);
+}
+
 void MainWin::background_import_thread(Glib::ustring bg_filename) {
+  imgWin.lock_rendering();
   if(RET_IS_NOT_OK(gr_import_background_image(main_project->bg_images[main_project->current_layer], 
-				 0, 0, bg_filename.c_str()))) {
+					      0, 0, bg_filename.c_str(),
+					      &background_import_progress, ipWin))) {
     debug(TM, "Can't import image file");
   }
   else {
+    // there is no progress information for the prescaling
+    if(ipWin != NULL) ipWin->set_progress(-1);
+
     if(RET_IS_NOT_OK(scalmgr_recreate_scalings_for_layer(main_project->scaling_manager, 
 							 main_project->current_layer)))
       debug(TM, "Can't recreate scaled images.");
@@ -1988,10 +2124,48 @@ void MainWin::background_import_thread(Glib::ustring bg_filename) {
 
   }
 
+  imgWin.unlock_rendering();
   signal_bg_import_finished_();
 }
 
 
+void MainWin::mosaic_import_thread(Glib::ustring tile_list_filename) {
+  imgWin.lock_rendering();
+  mosaic_t * mosaic = mosaic_load_tile_list(tile_list_filename.c_str());
+
+  if(mosaic == NULL) {
+    debug(TM, "Can't load tile list");
+  }
+  else {
+    if(RET_IS_NOT_OK(mosaic_refine_offsets(mosaic, MOSAIC_DEFAULT_MAX_SHIFT, 
+					   &background_import_progress, ipWin)))
+      debug(TM, "Can't refine the tile positions. Using the nominal positions.");
+
+    if(RET_IS_NOT_OK(mosaic_import(main_project->bg_images[main_project->current_layer], mosaic,
+				   &background_import_progress, ipWin))) {
+      debug(TM, "Can't import the mosaic");
+    }
+    else {
+      if(ipWin != NULL) ipWin->set_progress(-1);
+
+      if(RET_IS_NOT_OK(scalmgr_recreate_scalings_for_layer(main_project->scaling_manager, 
+							   main_project->current_layer)))
+	debug(TM, "Can't recreate scaled images.");
+
+#ifdef MAP_FILES_ON_DEMAND
+      if(RET_IS_NOT_OK(gr_reactivate_mapping(main_project->bg_images[main_project->current_layer]))) {
+	debug(TM, "mapping image failed");
+      }
+#endif
+    }
+
+    mosaic_destroy(mosaic);
+  }
+
+  imgWin.unlock_rendering();
+  signal_bg_import_finished_();
+}
+
 void MainWin::on_menu_layer_set_transistor() { 
 
   if(main_project) {
@@ -2004,7 +2178,9 @@ void MainWin::on_menu_layer_set_transistor() {
       warning_dialog("Warning", "There is already a transistor layer.");
 
     project_changed();
+    imgWin.lock_rendering();
     lmodel_set_layer_type(main_project->lmodel, main_project->current_layer, LM_LAYER_TYPE_TRANSISTOR);
+    imgWin.unlock_rendering();
   }
 }
 
@@ -2016,7 +2192,9 @@ void MainWin::on_menu_layer_set_logic() {
     if(-1 != lmodel_get_layer_num_by_type(main_project->lmodel, LM_LAYER_TYPE_LOGIC))
       warning_dialog("Warning", "There is already a logic layer.");
 
+    imgWin.lock_rendering();
     lmodel_set_layer_type(main_project->lmodel, main_project->current_layer, LM_LAYER_TYPE_LOGIC);
+    imgWin.unlock_rendering();
     project_changed();
   }
 }
@@ -2025,7 +2203,9 @@ void MainWin::on_menu_layer_set_metal() {
   if(main_project) {
     if(main_project->lmodel->layer_type[main_project->current_layer] == LM_LAYER_TYPE_METAL) return;
 
+    imgWin.lock_rendering();
     lmodel_set_layer_type(main_project->lmodel, main_project->current_layer, LM_LAYER_TYPE_METAL);
+    imgWin.unlock_rendering();
     project_changed();
   }
 }
@@ -2038,9 +2218,14 @@ void MainWin::on_menu_logic_clear_logic_model() {
 			    Gtk::BUTTONS_OK_CANCEL);
   dialog.set_secondary_text("Are you sure you want to clear the complete logic model for the current layer?");
   int result = dialog.run();
+  ret_t ret;
   switch(result) {
   case(Gtk::RESPONSE_OK):
-    if(RET_IS_NOT_OK(lmodel_clear_layer(main_project->lmodel, main_project->current_layer)))
+    imgWin.lock_rendering();
+    ret = lmodel_clear_layer(main_project->lmodel, main_project->current_layer);
+    imgWin.unlock_rendering();
+
+    if(RET_IS_NOT_OK(ret))
       error_dialog("Error", "Can't clear logic model for current layer. It is possible, that the logic model for the current layer is in a bad state.");
     else {
       project_changed();
@@ -2065,16 +2250,21 @@ void MainWin::remove_objects() {
     }
     else {
       std::set< std::pair<void *, LM_OBJECT_TYPE> >::const_iterator it;
+      bool failed = false;
 
+      imgWin.lock_rendering();
       for(it = selected_objects.begin(); it != selected_objects.end(); it++) {
 	
 	if(RET_IS_NOT_OK(lmodel_remove_object_by_ptr(main_project->lmodel, layer, (*it).first, (*it).second))) {
-	  error_dialog("Error", "Can't remove object(s) from logic model");
+	  failed = true;
 	}
       }
       
       selected_objects.erase(selected_objects.begin(), selected_objects.end());
       highlighted_objects.clear();
+      imgWin.unlock_rendering();
+
+      if(failed) error_dialog("Error", "Can't remove object(s) from logic model");
 
       menu_manager->set_menu_item_sensitivity("/MenuBar/LogicMenu/LogicClearLogicModelInSelection", false);
       imgWin.update_screen(); 
@@ -2089,9 +2279,18 @@ void MainWin::on_menu_layer_clear_background_image() {
 			    Gtk::BUTTONS_OK_CANCEL);
   dialog.set_secondary_text("Are you sure you want to clear the background image for the current layer?");
   int result = dialog.run();
+  ret_t ret;
   switch(result) {
   case(Gtk::RESPONSE_OK):
-    if(RET_IS_NOT_OK(gr_map_clear(main_project->bg_images[main_project->current_layer])))
+    imgWin.lock_rendering();
+    ret = gr_map_clear(main_project->bg_images[main_project->current_layer]);
+    if(RET_IS_OK(ret) &&
+       RET_IS_NOT_OK(scalmgr_recreate_scalings_for_layer(main_project->scaling_manager, 
+							 main_project->current_layer)))
+      debug(TM, "Can't recreate scaled images.");
+    imgWin.unlock_rendering();
+
+    if(RET_IS_NOT_OK(ret))
       error_dialog("Error", "Error: Can't clear background image for current layer.");
     else {
       project_changed();
@@ -2159,18 +2358,30 @@ void MainWin::on_menu_layer_align() {
   }
 }
 
+/**
+ * Check if a layer is changed by the alignment transformation.
+ */
+static bool layer_needs_alignment(double scaling_x, double scaling_y, int shift_x, int shift_y) {
+  return scaling_x != 1 || scaling_y != 1 || shift_x != 0 || shift_y != 0;
+}
+
 void MainWin::layer_alignment_thread(double * scaling_x, double * scaling_y, int * shift_x, int * shift_y) {
 
-  for(int i = 0; i < main_project->num_layers; i++) {
+  layer_alignment_ret = RET_OK;
+
+  for(int i = 0; i < main_project->num_layers && RET_IS_OK(layer_alignment_ret); i++) {
 
-    printf("align layer i=%d\n", i);
     assert(main_project->bg_images[i]);
     assert(main_project->lmodel->root[i]);
 
-    // transform background images
-    gr_scale_and_shift_in_place(main_project->bg_images[i],
-				scaling_x[i], scaling_y[i], 
-				shift_x[i], shift_y[i]);
+    // transform background images into new data files, they are swapped in the GUI thread
+    if(layer_needs_alignment(scaling_x[i], scaling_y[i], shift_x[i], shift_y[i])) {
+      printf("align layer i=%d\n", i);
+      layer_alignment_ret = project_resample_layer(main_project, i,
+						   scaling_x[i], scaling_y[i], 
+						   shift_x[i], shift_y[i],
+						   GR_INTERPOLATION_BILINEAR);
+    }
   }
   signal_layer_alignment_finished_();  
 }
@@ -2186,11 +2397,23 @@ void MainWin::on_layer_alignment_finished(double * scaling_x, double * scaling_y
   }
   
   if(main_project) {
+    // the background images and markers are swapped, while the render thread may read them
+    imgWin.lock_rendering();
+    for(int i = 0; i < main_project->num_layers && RET_IS_OK(layer_alignment_ret); i++)
+      if(layer_needs_alignment(scaling_x[i], scaling_y[i], shift_x[i], shift_y[i]))
+	layer_alignment_ret = project_commit_resampled_layer(main_project, i);
+
 #ifdef DEBUG
     amset_print(main_project->alignment_marker_set);
 #endif
-    if(RET_IS_NOT_OK(amset_apply_transformation_to_markers(main_project->alignment_marker_set,
-							   scaling_x, scaling_y, shift_x, shift_y))) {
+    ret_t ret = RET_IS_OK(layer_alignment_ret) ?
+      amset_apply_transformation_to_markers(main_project->alignment_marker_set,
+					    scaling_x, scaling_y, shift_x, shift_y) : RET_OK;
+    imgWin.unlock_rendering();
+
+    if(RET_IS_NOT_OK(layer_alignment_ret))
+      error_dialog("Error", "Can't align layers.");
+    else if(RET_IS_NOT_OK(ret)) {
       error_dialog("Error", "Can't apply transformation.");
     }
 #ifdef DEBUG
@@ -2209,6 +2432,65 @@ void MainWin::on_layer_alignment_finished(double * scaling_x, double * scaling_y
 }
 
 
+void MainWin::on_menu_layer_register() {
+  assert(main_project);
+  assert(main_project->scaling_manager);
+  assert(main_project->alignment_marker_set);
+
+  if(main_project->num_layers < 2) {
+    error_dialog("Error", "There must be at least two layers for a registration.");
+    return;
+  }
+
+  ipWin = new InProgressWin(this, "Layer registration", 
+			    "Please wait while placing alignment markers.");
+  ipWin->show();
+
+  layer_registration_connection = 
+    signal_layer_registration_finished_.connect(sigc::mem_fun(*this, &MainWin::on_layer_registration_finished));
+  Glib::Thread::create(sigc::mem_fun(*this, &MainWin::layer_registration_thread), false);
+}
+
+void MainWin::layer_registration_thread() {
+  scaling_manager_t * sm = main_project->scaling_manager;
+  alignment_marker_set_t * amset = main_project->alignment_marker_set;
+  unsigned int num_layers = MIN((unsigned int)amset->num_layers, sm->num_layers);
+  reg_match_t * matches = (reg_match_t *)malloc((num_layers - 1) * sizeof(reg_match_t));
+
+  // the registration reads the zoom levels only, the markers are drawn by the renderer
+  if(matches == NULL) layer_registration_ret = RET_MALLOC_FAILED;
+  else if(RET_IS_OK(layer_registration_ret = reg_match_all_layers(sm, num_layers, matches))) {
+    imgWin.lock_rendering();
+    layer_registration_ret = reg_place_alignment_markers(amset, num_layers, matches);
+    imgWin.unlock_rendering();
+  }
+
+  if(matches) free(matches);
+  signal_layer_registration_finished_();
+}
+
+// in GUI-thread
+void MainWin::on_layer_registration_finished() {
+
+  layer_registration_connection.disconnect();
+
+  if(ipWin) {
+    ipWin->close();
+    delete ipWin;
+    ipWin = NULL;
+  }
+
+  if(RET_IS_NOT_OK(layer_registration_ret))
+    error_dialog("Error", "The layers could not be registered. Please place the alignment markers manually.");
+  else if(main_project) {
+#ifdef DEBUG
+    amset_print(main_project->alignment_marker_set);
+#endif
+    project_changed();
+    imgWin.update_screen();
+  }
+}
+
 void MainWin::error_dialog(const char * const title, const char * const message) {
 
   Gtk::MessageDialog dialog(*this, message, true, Gtk::MESSAGE_ERROR);
@@ -90,16 +90,20 @@ class MainWin : public Gtk::Window  {
   virtual void on_menu_view_next_layer();
   virtual void on_menu_view_prev_layer();
   virtual void on_menu_view_grid_config();
+  virtual void on_menu_view_distance_to_color();
   virtual void on_menu_view_toggle_all_info_layers();
+  virtual void on_menu_view_toggle_render_stats();
 
 
   // Layer menu
   virtual void on_menu_layer_import_background();
+  virtual void on_menu_layer_import_mosaic();
   virtual void on_menu_layer_set_transistor();
   virtual void on_menu_layer_set_logic();
   virtual void on_menu_layer_set_metal();
   virtual void on_menu_layer_clear_background_image();
   virtual void on_menu_layer_align();
+  virtual void on_menu_layer_register();
 
   // Logic menu
   virtual void on_menu_logic_interconnect();
@@ -200,7 +204,9 @@ class MainWin : public Gtk::Window  {
 
   void project_open_thread(Glib::ustring project_dir);
   void background_import_thread(Glib::ustring bg_filename);
+  void mosaic_import_thread(Glib::ustring tile_list_filename);
   void layer_alignment_thread(double * scaling_x, double * scaling_y, int * shift_x, int * shift_y);
+  void layer_registration_thread();
   void algorithm_calc_thread(int slot_pos, plugin_params_t * plugin_params);
   void project_export_thread(const char * const project_dir, const char * const dst_file);
   void auto_name_gates_thread(AUTONAME_ORIENTATION orientation);
@@ -208,6 +214,7 @@ class MainWin : public Gtk::Window  {
   void on_project_load_finished();
   void on_background_import_finished();
   void on_layer_alignment_finished(double * scaling_x, double * scaling_y, int * shift_x, int * shift_y);
+  void on_layer_registration_finished();
   void on_algorithm_finished(int slot_pos, plugin_params_t * plugin_params);
   void on_export_finished(bool success);
   void on_auto_name_finished(ret_t ret);
@@ -215,6 +222,10 @@ class MainWin : public Gtk::Window  {
   Glib::Dispatcher signal_project_open_finished_;
   Glib::Dispatcher signal_bg_import_finished_;
   Glib::Dispatcher signal_layer_alignment_finished_;
+  ret_t layer_alignment_ret;
+  Glib::Dispatcher signal_layer_registration_finished_;
+  sigc::connection layer_registration_connection;
+  ret_t layer_registration_ret;
   Glib::Dispatcher * signal_algorithm_finished_;
   sigc::signal<void, bool> signal_export_finished_;
   sigc::signal<void, ret_t> signal_auto_name_finished_;
@@ -231,6 +242,7 @@ class MainWin : public Gtk::Window  {
 
   void on_view_info_layer_toggled(int slot_pos);
   void on_grid_config_changed();
+  void on_distance_to_col_changed(Gtk::ColorSelection * pColorSel);
 
 
 
@@ -12,6 +12,7 @@ MenuManager::MenuManager(MainWin * wnd) {
   window = wnd;
 
   toolbar_visible = true;
+  render_stats_visible = false;
   info_layers_visible = true;
   info_layers_checkbox_ignore_sig = false;
 
@@ -187,10 +188,13 @@ void MenuManager::create_and_bind_view_menu() {
 			Gtk::AccelKey("<control>T"),
 			sigc::mem_fun(*this, &MenuManager::toggle_toolbar_visibility));
 
-  /*  m_refActionGroup->add(Gtk::Action::create("ViewDistanceToColor", "Define color for similarity filter", 
+  m_refActionGroup->add(Gtk::Action::create("ViewToggleRenderStats", 
+					    "Show render statistics", "Toggle render statistics"),
+			sigc::mem_fun(*this, &MenuManager::toggle_render_stats));
+
+  m_refActionGroup->add(Gtk::Action::create("ViewDistanceToColor", "Define color for similarity filter", 
 					    "Define color for similarity filter"),
 			sigc::mem_fun(*window, &MainWin::on_menu_view_distance_to_color));
-  */
 
 }
 
@@ -224,6 +228,11 @@ void MenuManager::create_and_bind_tools_menu() {
 					    "Import background for current layer"),
 			sigc::mem_fun(*window, &MainWin::on_menu_layer_import_background));
 
+  m_refActionGroup->add(Gtk::Action::create("LayerImportMosaic",
+					    "Import image _mosaic", 
+					    "Stitch image tiles from a tile list into the background of the current layer"),
+			sigc::mem_fun(*window, &MainWin::on_menu_layer_import_mosaic));
+
   m_refActionGroup->add(Gtk::Action::create("LayerClearBackgroundImage",
 					    Gtk::Stock::CLEAR, "Clear background image", 
 					    "Clear background image for current layer"),
@@ -235,6 +244,11 @@ void MenuManager::create_and_bind_tools_menu() {
 					    "Align layers"),
 			sigc::mem_fun(*window, &MainWin::on_menu_layer_align));
 
+  m_refActionGroup->add(Gtk::Action::create("LayerRegistration",
+					    "Place alignment markers automatically", 
+					    "Place alignment markers by registering adjacent layers"),
+			sigc::mem_fun(*window, &MainWin::on_menu_layer_register));
+
   Gtk::RadioAction::Group group_layer_type;
   m_refActionGroup->add(Gtk::Action::create("LayerType", "Layer type"));
   
@@ -409,9 +423,11 @@ void MenuManager::setup_menu_structure() {
         "      <menuitem action='ViewPrevLayer'/>"
         "      <separator/>"
         "      <menuitem action='ViewGridConfiguration'/>"  
+        "      <menuitem action='ViewDistanceToColor'/>"  
         "      <separator/>"
         "      <menuitem action='ViewToggleInfoLayer'/>"  
         "      <menuitem action='ViewToggleToolbar'/>"  
+        "      <menuitem action='ViewToggleRenderStats'/>"  
         "    </menu>"
         "    <menu action='ToolsMenu'>"
         "      <menuitem action='ToolSelect'/>"
@@ -423,8 +439,10 @@ void MenuManager::setup_menu_structure() {
 
         "    <menu action='LayerMenu'>"
         "      <menuitem action='LayerImportBackground'/>"
+        "      <menuitem action='LayerImportMosaic'/>"
         "      <menuitem action='LayerClearBackgroundImage'/>"
         "      <separator/>"
+        "      <menuitem action='LayerRegistration'/>"
         "      <menuitem action='LayerAlignment'/>"
         "      <separator/>"
         "      <menu action='LayerType'>"
@@ -650,6 +668,7 @@ void MenuManager::set_widget_sensitivity(bool state) {
   set_menu_item_sensitivity("/MenuBar/ViewMenu/ViewNextLayer", state);
   set_menu_item_sensitivity("/MenuBar/ViewMenu/ViewPrevLayer", state);
   set_menu_item_sensitivity("/MenuBar/ViewMenu/ViewGridConfiguration", state);
+  set_menu_item_sensitivity("/MenuBar/ViewMenu/ViewDistanceToColor", state);
   set_menu_item_sensitivity("/MenuBar/ViewMenu/ViewToggleInfoLayer", state);
 
   set_menu_item_sensitivity("/MenuBar/ToolsMenu/ToolSelect", state);
@@ -659,10 +678,12 @@ void MenuManager::set_widget_sensitivity(bool state) {
   set_menu_item_sensitivity("/MenuBar/ToolsMenu/ToolViaDown", state);
 
   set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerImportBackground", state);
+  set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerImportMosaic", state);
   set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerClearBackgroundImage", state);
   set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerType", state);
 
 
+  set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerRegistration", state);
   set_menu_item_sensitivity("/MenuBar/LayerMenu/LayerAlignment", state);
 
   if(state == false) {
@@ -726,6 +747,13 @@ void MenuManager::toggle_toolbar_visibility() {
 }
 
 
+void MenuManager::toggle_render_stats() {
+  window->on_menu_view_toggle_render_stats();
+  render_stats_visible = toggle_menu_item("/MenuBar/ViewMenu/ViewToggleRenderStats", render_stats_visible,
+					  "Show render statistics", "Hide render statistics");
+}
+
+
 void MenuManager::set_layer_type_in_menu(LAYER_TYPE layer_type) {
 
   /* Hack: If you defined a signal handler for radio button activation in a group and you want to
@@ -30,6 +30,7 @@ class MenuManager {
   void initialize_menu_algorithm_funcs(plugin_func_table_t * plugin_func_table);
 
   void toggle_toolbar_visibility();
+  void toggle_render_stats();
 
   void set_layer_type_in_menu(LAYER_TYPE layer_type);
 
@@ -44,6 +45,7 @@ class MenuManager {
  private:
 
   bool toolbar_visible;
+  bool render_stats_visible;
   bool info_layers_visible;
   bool info_layers_checkbox_ignore_sig; // if it is true, signals emitted by render-slot-checkboxes are ignored
 
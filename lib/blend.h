@@ -0,0 +1,180 @@
+/*
+
+This file is part of the IC reverse engineering tool degate.
+
+Copyright 2008, 2009 by Martin Schobert
+
+Degate is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+Degate is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with degate. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __BLEND_H__
+#define __BLEND_H__
+
+/**
+ * Alpha blending of spans of RGBA pixels with a constant color. The result of
+ * blending a pixel is ((0xff - alpha) * background + alpha * color) >> 8 for
+ * each channel and the result is opaque. Spans are blended in 16 bit fixed
+ * point with SSE2, four pixels at a time. The result is the same as blending
+ * each pixel with blend_alpha().
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "globals.h"
+#include "graphics.h"
+#include "image_view.h"
+
+static inline uint32_t blend_alpha(uint32_t bg_col, uint32_t col) {
+  unsigned int alpha = MASK_A(col);
+  unsigned int r = ((0xff - alpha) * MASK_R(bg_col) + alpha * MASK_R(col)) >> 8;
+  unsigned int g = ((0xff - alpha) * MASK_G(bg_col) + alpha * MASK_G(col)) >> 8;
+  unsigned int b = ((0xff - alpha) * MASK_B(bg_col) + alpha * MASK_B(col)) >> 8;
+
+  return MERGE_CHANNELS(r, g, b, 0xffU);
+}
+
+/** Scale the alpha channel of a color by coverage / 256. */
+static inline uint32_t blend_scale_alpha(uint32_t col, unsigned int coverage) {
+  return MERGE_CHANNELS(MASK_R(col), MASK_G(col), MASK_B(col), ((MASK_A(col) * coverage) >> 8));
+}
+
+/** Blend a color into a horizontal span of length pixels. */
+static inline void blend_span(uint32_t * dst, uint32_t col, unsigned int length) {
+#ifdef __SSE2__
+  if(length >= 4) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i inv_alpha = _mm_set1_epi16(0xff - MASK_A(col));
+    const __m128i opaque = _mm_set1_epi32(MERGE_CHANNELS(0, 0, 0, 0xffU));
+    // alpha * color for two pixels, the products fit into 16 bits
+    const __m128i fg = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32(col), zero), 
+				       _mm_set1_epi16(MASK_A(col)));
+
+    for(; length >= 4; length -= 4, dst += 4) {
+      __m128i pix = _mm_loadu_si128((__m128i *)dst);
+      __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(pix, zero), inv_alpha);
+      __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(pix, zero), inv_alpha);
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, fg), 8);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, fg), 8);
+      _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+  }
+#endif
+  for(; length > 0; length--, dst++) *dst = blend_alpha(*dst, col);
+}
+
+/**
+ * Blend a premultiplied pixel. Its color channels are added to the background,
+ * which is weighted by (256 - alpha) / 256. A pixel with an alpha of zero leaves
+ * the background unchanged.
+ */
+static inline uint32_t blend_premultiplied(uint32_t bg_col, uint32_t pix) {
+  unsigned int weight = 0x100 - MASK_A(pix);
+  unsigned int r = ((weight * MASK_R(bg_col)) >> 8) + MASK_R(pix);
+  unsigned int g = ((weight * MASK_G(bg_col)) >> 8) + MASK_G(pix);
+  unsigned int b = ((weight * MASK_B(bg_col)) >> 8) + MASK_B(pix);
+
+  return MERGE_CHANNELS(MIN(r, 0xffU), MIN(g, 0xffU), MIN(b, 0xffU), 0xffU);
+}
+
+/** Blend a span of premultiplied pixels, see blend_premultiplied(). */
+static inline void blend_premultiplied_span(uint32_t * dst, const uint32_t * src, unsigned int length) {
+#if defined(__SSE2__) && defined(IS_LITTLE_ENDIAN)
+  if(length >= 4) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(0x100);
+    const __m128i opaque = _mm_set1_epi32(MERGE_CHANNELS(0, 0, 0, 0xffU));
+
+    for(; length >= 4; length -= 4, dst += 4, src += 4) {
+      __m128i pix = _mm_loadu_si128((const __m128i *)src);
+      __m128i bg = _mm_loadu_si128((__m128i *)dst);
+      __m128i pix_lo = _mm_unpacklo_epi8(pix, zero), pix_hi = _mm_unpackhi_epi8(pix, zero);
+
+      // broadcast the alpha channel of each pixel to its color channels
+      __m128i weight_lo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(pix_lo, 0xff), 0xff));
+      __m128i weight_hi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(pix_hi, 0xff), 0xff));
+
+      __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(bg, zero), weight_lo), 8);
+      __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(bg, zero), weight_hi), 8);
+      lo = _mm_add_epi16(lo, pix_lo);
+      hi = _mm_add_epi16(hi, pix_hi);
+      _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+  }
+#endif
+  for(; length > 0; length--, dst++, src++) *dst = blend_premultiplied(*dst, *src);
+}
+
+/** Blend a color into a vertical span. The stride is given in pixels. */
+static inline void blend_column(uint32_t * dst, size_t stride, uint32_t col, unsigned int length) {
+  for(; length > 0; length--, dst += stride) *dst = blend_alpha(*dst, col);
+}
+
+/**
+ * Blend a color into a rectangle. The rectangle includes min_x and min_y and
+ * excludes max_x and max_y. It is clipped to the view.
+ */
+static inline void blend_rect(const rgba_view_t & dst, int min_x, int min_y, int max_x, int max_y, 
+			      uint32_t col) {
+  int y;
+  int from_x = MAX(min_x, 0), to_x = MIN(max_x, (int)dst.width);
+  int from_y = MAX(min_y, 0), to_y = MIN(max_y, (int)dst.height);
+  if(from_x >= to_x) return;
+
+  for(y = from_y; y < to_y; y++) blend_span(dst.ptr(from_x, y), col, to_x - from_x);
+}
+
+/**
+ * Blend an antialiased circle around the pixel center (x, y). Pixels, whose
+ * center is closer than radius - 0.5 to the center, are fully covered. Towards 
+ * radius + 0.5 the coverage falls off linearly. The circle is clipped to the view.
+ */
+static inline void blend_circle(const rgba_view_t & dst, int x, int y, double radius, uint32_t col) {
+  int _y, dx;
+  double outer = radius + 0.5, inner = radius - 0.5;
+
+  int from_y = MAX(y - (int)outer, 0), to_y = MIN(y + (int)outer + 1, (int)dst.height);
+
+  for(_y = from_y; _y < to_y; _y++) {
+    double dy2 = (double)(_y - y) * (_y - y);
+    if(dy2 >= outer * outer) continue;
+
+    uint32_t * row = dst.row(_y);
+    int outer_dx = (int)sqrt(outer * outer - dy2);
+    int inner_dx = inner > 0 && dy2 <= inner * inner ? (int)sqrt(inner * inner - dy2) : -1;
+
+    // fully covered span
+    if(inner_dx >= 0) {
+      int from_x = MAX(x - inner_dx, 0), to_x = MIN(x + inner_dx + 1, (int)dst.width);
+      if(from_x < to_x) blend_span(row + from_x, col, to_x - from_x);
+    }
+
+    // partially covered pixels on both sides
+    for(dx = inner_dx + 1; dx <= outer_dx; dx++) {
+      double coverage = outer - sqrt(dx * dx + dy2);
+      if(coverage <= 0) continue;
+      uint32_t c = blend_scale_alpha(col, coverage >= 1 ? 256 : (unsigned int)(coverage * 256));
+
+      if(x - dx >= 0 && x - dx < (int)dst.width) row[x - dx] = blend_alpha(row[x - dx], c);
+      if(dx > 0 && x + dx >= 0 && x + dx < (int)dst.width) row[x + dx] = blend_alpha(row[x + dx], c);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,476 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "ccl.h"
+#include "image_view.h"
+#include "parallel.h"
+
+/* Edge length of the tiles, that are labeled in parallel. */
+#define CCL_TILE_SIZE 256
+
+/** Moments and bounding box of a component within one tile in tile coordinates. */
+typedef struct {
+  uint64_t area;
+  uint64_t sum_x, sum_y, sum_xx, sum_yy, sum_xy;
+  unsigned int min_x, min_y, max_x, max_y;
+} ccl_tile_stats_t;
+
+typedef struct {
+  const image_t * img;
+  unsigned int min_x, min_y, width, height;
+  unsigned int tiles_x, tiles_y;
+  uint8_t threshold;
+  CCL_CONNECTIVITY connectivity;
+
+  memory_map_t * labels;
+
+  // per tile: number of labels, mapping from provisional to tile labels, 
+  // offset of the tile labels in the global label space, statistics
+  uint32_t * num_labels;
+  uint32_t ** tile_labels;
+  uint32_t * offsets;
+  ccl_tile_stats_t ** stats;
+
+  // mapping from global labels to component numbers
+  uint32_t * components;
+} ccl_params_t;
+
+
+static inline uint32_t uf_find(uint32_t * parent, uint32_t i) {
+  while(parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+/* Merge two sets. The smaller label becomes the root. */
+static inline uint32_t uf_union(uint32_t * parent, uint32_t a, uint32_t b) {
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  if(a < b) { parent[b] = a; return a; }
+  else { parent[a] = b; return b; }
+}
+
+static inline void ccl_get_tile_region(const ccl_params_t * params, unsigned int tile,
+				       unsigned int * x0, unsigned int * y0, 
+				       unsigned int * x1, unsigned int * y1) {
+  *x0 = (tile % params->tiles_x) * CCL_TILE_SIZE;
+  *y0 = (tile / params->tiles_x) * CCL_TILE_SIZE;
+  *x1 = MIN(*x0 + CCL_TILE_SIZE, params->width);
+  *y1 = MIN(*y0 + CCL_TILE_SIZE, params->height);
+}
+
+/**
+ * First pass: label a tile with provisional labels and resolve the equivalences
+ * within the tile. The label map keeps the provisional labels. They are translated
+ * to consecutive tile labels with params->tile_labels[tile].
+ */
+template<IMAGE_TYPE type>
+static ret_t ccl_label_tile(unsigned int tile, void * arg) {
+  ccl_params_t * params = (ccl_params_t *)arg;
+  image_view<type> img(params->img);
+  unsigned int x0, y0, x1, y1, x, y;
+  uint32_t next_label = 1, num_labels = 0, i;
+  int conn8 = params->connectivity == CCL_CONNECTIVITY_8;
+
+  ccl_get_tile_region(params, tile, &x0, &y0, &x1, &y1);
+
+  // there are never more provisional labels than every second pixel
+  size_t max_labels = (size_t)(x1 - x0) * (y1 - y0) / 2 + 2;
+  uint32_t * parent = (uint32_t *)malloc(max_labels * sizeof(uint32_t));
+  if(parent == NULL) return RET_MALLOC_FAILED;
+
+  for(y = y0; y < y1; y++) {
+    const typename image_view<type>::pixel_t * src = img.ptr(params->min_x, params->min_y + y);
+    uint32_t * row = (uint32_t *)mm_get_ptr(params->labels, 0, y);
+    uint32_t * prev = y > y0 ? (uint32_t *)mm_get_ptr(params->labels, 0, y - 1) : NULL;
+
+    for(x = x0; x < x1; x++) {
+      if(image_pixel_traits<type>::to_gs(src[x]) <= params->threshold) {
+	row[x] = 0;
+	continue;
+      }
+
+      uint32_t l = 0;
+      if(x > x0 && row[x - 1]) l = row[x - 1];
+      if(prev) {
+	if(prev[x]) l = l ? uf_union(parent, l, prev[x]) : prev[x];
+	if(conn8) {
+	  if(x > x0 && prev[x - 1]) l = l ? uf_union(parent, l, prev[x - 1]) : prev[x - 1];
+	  if(x + 1 < x1 && prev[x + 1]) l = l ? uf_union(parent, l, prev[x + 1]) : prev[x + 1];
+	}
+      }
+
+      if(l == 0) {
+	assert(next_label < max_labels);
+	l = next_label++;
+	parent[l] = l;
+      }
+      row[x] = l;
+    }
+  }
+
+  // translate provisional labels to consecutive tile labels
+  uint32_t * tile_labels = (uint32_t *)malloc(next_label * sizeof(uint32_t));
+  if(tile_labels == NULL) {
+    free(parent);
+    return RET_MALLOC_FAILED;
+  }
+
+  tile_labels[0] = 0;
+  for(i = 1; i < next_label; i++) 
+    tile_labels[i] = parent[i] == i ? ++num_labels : tile_labels[uf_find(parent, i)];
+
+  free(parent);
+  params->tile_labels[tile] = tile_labels;
+  params->num_labels[tile] = num_labels;
+  return RET_OK;
+}
+
+static ret_t ccl_label_tile_job(unsigned int tile, void * arg) {
+  ccl_params_t * params = (ccl_params_t *)arg;
+  switch(params->img->image_type) {
+  case IMAGE_TYPE_GS:
+    return ccl_label_tile<IMAGE_TYPE_GS>(tile, arg);
+  case IMAGE_TYPE_RGBA:
+    return ccl_label_tile<IMAGE_TYPE_RGBA>(tile, arg);
+  default:
+    return RET_ERR;
+  }
+}
+
+/* Get the global label for a position in the region from the provisional label map. */
+static inline uint32_t ccl_get_global_label(const ccl_params_t * params, unsigned int x, unsigned int y) {
+  uint32_t l = *(uint32_t *)mm_get_ptr(params->labels, x, y);
+  if(l == 0) return 0;
+  unsigned int tile = (y / CCL_TILE_SIZE) * params->tiles_x + x / CCL_TILE_SIZE;
+  return params->offsets[tile] + params->tile_labels[tile][l];
+}
+
+static inline void ccl_merge_neighbour(const ccl_params_t * params, uint32_t * parent, uint32_t l,
+				       unsigned int x, unsigned int y) {
+  uint32_t n = ccl_get_global_label(params, x, y);
+  if(n) uf_union(parent, l, n);
+}
+
+/**
+ * Merge the labels of components, that touch across tile borders. Only the 
+ * upper and left border of each tile have to be inspected.
+ */
+static void ccl_merge_tiles(const ccl_params_t * params, uint32_t * parent) {
+  unsigned int tile, x0, y0, x1, y1, x, y;
+  int conn8 = params->connectivity == CCL_CONNECTIVITY_8;
+
+  for(tile = 0; tile < params->tiles_x * params->tiles_y; tile++) {
+    ccl_get_tile_region(params, tile, &x0, &y0, &x1, &y1);
+
+    if(y0 > 0) {
+      for(x = x0; x < x1; x++) {
+	uint32_t l = ccl_get_global_label(params, x, y0);
+	if(l == 0) continue;
+	ccl_merge_neighbour(params, parent, l, x, y0 - 1);
+	if(conn8) {
+	  if(x > 0) ccl_merge_neighbour(params, parent, l, x - 1, y0 - 1);
+	  if(x + 1 < params->width) ccl_merge_neighbour(params, parent, l, x + 1, y0 - 1);
+	}
+      }
+    }
+
+    if(x0 > 0) {
+      for(y = y0; y < y1; y++) {
+	uint32_t l = ccl_get_global_label(params, x0, y);
+	if(l == 0) continue;
+	ccl_merge_neighbour(params, parent, l, x0 - 1, y);
+	if(conn8) {
+	  if(y > 0) ccl_merge_neighbour(params, parent, l, x0 - 1, y - 1);
+	  if(y + 1 < params->height) ccl_merge_neighbour(params, parent, l, x0 - 1, y + 1);
+	}
+      }
+    }
+  }
+}
+
+/**
+ * Second pass: replace the provisional labels with component numbers and 
+ * collect the statistics for each tile label.
+ */
+static ret_t ccl_resolve_tile_job(unsigned int tile, void * arg) {
+  ccl_params_t * params = (ccl_params_t *)arg;
+  unsigned int x0, y0, x1, y1, x, y;
+  const uint32_t * tile_labels = params->tile_labels[tile];
+  const uint32_t * components = params->components + params->offsets[tile];
+
+  ccl_get_tile_region(params, tile, &x0, &y0, &x1, &y1);
+
+  ccl_tile_stats_t * stats = (ccl_tile_stats_t *)
+    calloc(params->num_labels[tile] + 1, sizeof(ccl_tile_stats_t));
+  if(stats == NULL) return RET_MALLOC_FAILED;
+  params->stats[tile] = stats;
+
+  for(y = y0; y < y1; y++) {
+    uint32_t * row = (uint32_t *)mm_get_ptr(params->labels, 0, y);
+    uint64_t ly = y - y0;
+
+    for(x = x0; x < x1; x++) {
+      if(row[x] == 0) continue;
+
+      uint32_t l = tile_labels[row[x]];
+      uint64_t lx = x - x0;
+      ccl_tile_stats_t * s = &stats[l];
+
+      if(s->area == 0) {
+	s->min_x = s->max_x = lx;
+	s->min_y = s->max_y = ly;
+      }
+      else {
+	if(lx < s->min_x) s->min_x = lx;
+	if(lx > s->max_x) s->max_x = lx;
+	s->max_y = ly;
+      }
+
+      s->area++;
+      s->sum_x += lx;
+      s->sum_y += ly;
+      s->sum_xx += lx * lx;
+      s->sum_yy += ly * ly;
+      s->sum_xy += lx * ly;
+
+      row[x] = components[l];
+    }
+  }
+
+  return RET_OK;
+}
+
+/** Moments of a component in region coordinates. */
+typedef struct {
+  double area, sum_x, sum_y, sum_xx, sum_yy, sum_xy;
+} ccl_moments_t;
+
+static void ccl_add_tile_stats(ccl_component_t * c, ccl_moments_t * m, const ccl_tile_stats_t * s,
+			       unsigned int x0, unsigned int y0) {
+  double n = s->area;
+
+  if(m->area == 0) {
+    c->min_x = x0 + s->min_x;
+    c->min_y = y0 + s->min_y;
+    c->max_x = x0 + s->max_x;
+    c->max_y = y0 + s->max_y;
+  }
+  else {
+    c->min_x = MIN(c->min_x, x0 + s->min_x);
+    c->min_y = MIN(c->min_y, y0 + s->min_y);
+    c->max_x = MAX(c->max_x, x0 + s->max_x);
+    c->max_y = MAX(c->max_y, y0 + s->max_y);
+  }
+
+  m->area += n;
+  m->sum_x += s->sum_x + n * x0;
+  m->sum_y += s->sum_y + n * y0;
+  m->sum_xx += s->sum_xx + 2.0 * x0 * s->sum_x + n * x0 * x0;
+  m->sum_yy += s->sum_yy + 2.0 * y0 * s->sum_y + n * y0 * y0;
+  m->sum_xy += s->sum_xy + (double)x0 * s->sum_y + (double)y0 * s->sum_x + n * x0 * y0;
+}
+
+/**
+ * Calculate center, orientation and axis lengths from the moments. Pixels are 
+ * treated as unit squares, so that a straight line of width w and length l has
+ * axis lengths l and w.
+ */
+static void ccl_calc_shape(ccl_component_t * c, const ccl_moments_t * m, 
+			   unsigned int min_x, unsigned int min_y) {
+  double mean_x = m->sum_x / m->area;
+  double mean_y = m->sum_y / m->area;
+  double mu20 = m->sum_xx / m->area - mean_x * mean_x + 1.0 / 12.0;
+  double mu02 = m->sum_yy / m->area - mean_y * mean_y + 1.0 / 12.0;
+  double mu11 = m->sum_xy / m->area - mean_x * mean_y;
+
+  double d = sqrt(0.25 * (mu20 - mu02) * (mu20 - mu02) + mu11 * mu11);
+  double l1 = 0.5 * (mu20 + mu02) + d;
+  double l2 = 0.5 * (mu20 + mu02) - d;
+
+  c->area = (unsigned long)m->area;
+  c->center_x = min_x + mean_x;
+  c->center_y = min_y + mean_y;
+  c->orientation = 0.5 * atan2(2.0 * mu11, mu20 - mu02);
+  c->major_axis = sqrt(12.0 * l1);
+  c->minor_axis = l2 > 0 ? sqrt(12.0 * l2) : 0;
+
+  c->min_x += min_x;
+  c->max_x += min_x;
+  c->min_y += min_y;
+  c->max_y += min_y;
+}
+
+static void ccl_free_params(ccl_params_t * params) {
+  unsigned int tile, num_tiles = params->tiles_x * params->tiles_y;
+  for(tile = 0; tile < num_tiles; tile++) {
+    if(params->tile_labels) free(params->tile_labels[tile]);
+    if(params->stats) free(params->stats[tile]);
+  }
+  free(params->tile_labels);
+  free(params->stats);
+  free(params->num_labels);
+  free(params->offsets);
+  free(params->components);
+}
+
+/**
+ * Label the connected foreground components in the region (min_x, min_y) .. (max_x, max_y)
+ * of an image. The upper limits are exclusive and clipped to the image. The label map is
+ * allocated as scratch memory.
+ * @param threshold Pixels with a greyscale value above the threshold are foreground.
+ * @param project_dir The directory for temp files, if the scratch memory budget is exceeded.
+ * @param result The result is written to this structure. It must be freed with 
+ *   ccl_destroy_result().
+ */
+ret_t ccl_label_image(const image_t * const img, 
+		      unsigned int min_x, unsigned int min_y, 
+		      unsigned int max_x, unsigned int max_y,
+		      uint8_t threshold, CCL_CONNECTIVITY connectivity,
+		      const char * const project_dir,
+		      ccl_result_t * result) {
+  ccl_params_t params;
+  unsigned int tile, num_tiles, i;
+  uint32_t num_global_labels = 0;
+  ret_t ret;
+
+  assert(img != NULL);
+  assert(result != NULL);
+  if(img == NULL || result == NULL) return RET_INV_PTR;
+
+  max_x = MIN(max_x, img->width);
+  max_y = MIN(max_y, img->height);
+  if(min_x >= max_x || min_y >= max_y) return RET_ERR;
+
+  memset(result, 0, sizeof(ccl_result_t));
+  memset(&params, 0, sizeof(ccl_params_t));
+  params.img = img;
+  params.min_x = min_x;
+  params.min_y = min_y;
+  params.width = max_x - min_x;
+  params.height = max_y - min_y;
+  params.tiles_x = (params.width + CCL_TILE_SIZE - 1) / CCL_TILE_SIZE;
+  params.tiles_y = (params.height + CCL_TILE_SIZE - 1) / CCL_TILE_SIZE;
+  params.threshold = threshold;
+  params.connectivity = connectivity;
+  num_tiles = params.tiles_x * params.tiles_y;
+
+  if((params.labels = mm_create(params.width, params.height, sizeof(uint32_t))) == NULL)
+    return RET_ERR;
+
+  if(RET_IS_NOT_OK(ret = mm_map_scratch(params.labels, project_dir))) {
+    mm_destroy(params.labels);
+    return ret;
+  }
+
+  params.num_labels = (uint32_t *)calloc(num_tiles, sizeof(uint32_t));
+  params.offsets = (uint32_t *)calloc(num_tiles, sizeof(uint32_t));
+  params.tile_labels = (uint32_t **)calloc(num_tiles, sizeof(uint32_t *));
+  params.stats = (ccl_tile_stats_t **)calloc(num_tiles, sizeof(ccl_tile_stats_t *));
+
+  if(!params.num_labels || !params.offsets || !params.tile_labels || !params.stats) {
+    ret = RET_MALLOC_FAILED;
+    goto error;
+  }
+
+  if(RET_IS_NOT_OK(ret = par_run(num_tiles, &ccl_label_tile_job, &params))) goto error;
+
+  for(tile = 0; tile < num_tiles; tile++) {
+    params.offsets[tile] = num_global_labels;
+    num_global_labels += params.num_labels[tile];
+  }
+
+  // merge labels across tile borders and number the components
+  if((params.components = (uint32_t *)malloc((num_global_labels + 1) * sizeof(uint32_t))) == NULL) {
+    ret = RET_MALLOC_FAILED;
+    goto error;
+  }
+
+  for(i = 0; i <= num_global_labels; i++) params.components[i] = i;
+  ccl_merge_tiles(&params, params.components);
+
+  // roots are the smallest labels of their sets, so after flattening the
+  // parent array can be overwritten with the component numbers in place
+  for(i = 1; i <= num_global_labels; i++) 
+    params.components[i] = uf_find(params.components, i);
+  for(i = 1; i <= num_global_labels; i++)
+    params.components[i] = params.components[i] == i ? 
+      ++result->num_components : params.components[params.components[i]];
+
+  if(RET_IS_NOT_OK(ret = par_run(num_tiles, &ccl_resolve_tile_job, &params))) goto error;
+
+  // collect the statistics
+  if(result->num_components > 0) {
+    ccl_moments_t * moments = (ccl_moments_t *)calloc(result->num_components, sizeof(ccl_moments_t));
+    result->components = (ccl_component_t *)calloc(result->num_components, sizeof(ccl_component_t));
+    if(moments == NULL || result->components == NULL) {
+      free(moments);
+      ret = RET_MALLOC_FAILED;
+      goto error;
+    }
+
+    for(tile = 0; tile < num_tiles; tile++) {
+      unsigned int x0 = (tile % params.tiles_x) * CCL_TILE_SIZE;
+      unsigned int y0 = (tile / params.tiles_x) * CCL_TILE_SIZE;
+      for(i = 1; i <= params.num_labels[tile]; i++) {
+	uint32_t c = params.components[params.offsets[tile] + i] - 1;
+	ccl_add_tile_stats(&result->components[c], &moments[c], &params.stats[tile][i], x0, y0);
+      }
+    }
+
+    for(i = 0; i < result->num_components; i++)
+      ccl_calc_shape(&result->components[i], &moments[i], min_x, min_y);
+
+    free(moments);
+  }
+
+  ccl_free_params(&params);
+  result->min_x = min_x;
+  result->min_y = min_y;
+  result->labels = params.labels;
+  return RET_OK;
+
+ error:
+  ccl_free_params(&params);
+  mm_destroy(params.labels);
+  free(result->components);
+  memset(result, 0, sizeof(ccl_result_t));
+  return ret;
+}
+
+ret_t ccl_destroy_result(ccl_result_t * result) {
+  assert(result != NULL);
+  if(result == NULL) return RET_INV_PTR;
+
+  if(result->labels) mm_destroy(result->labels);
+  free(result->components);
+  memset(result, 0, sizeof(ccl_result_t));
+  return RET_OK;
+}
@@ -0,0 +1,85 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __CCL_H__
+#define __CCL_H__
+
+#include <stdint.h>
+#include "globals.h"
+#include "graphics.h"
+#include "memory_map.h"
+
+/**
+ * Connected component labeling. Foreground pixels are pixels with a greyscale
+ * value above a threshold. The image region is split into tiles, that are
+ * labeled in parallel. Labels that touch across tile borders are merged with
+ * a union-find structure afterwards.
+ */
+
+enum CCL_CONNECTIVITY {
+  CCL_CONNECTIVITY_4 = 4,
+  CCL_CONNECTIVITY_8 = 8
+};
+
+/**
+ * A connected component. Coordinates are image coordinates. The orientation
+ * is the angle of the major axis in radians in the range (-pi/2, pi/2], where
+ * 0 is horizontal. Axis lengths are the side lengths of the rectangle, that
+ * has the same second order moments as the component.
+ */
+typedef struct {
+  unsigned int min_x, min_y, max_x, max_y;
+  unsigned long area;
+  double center_x, center_y;
+  double orientation;
+  double major_axis, minor_axis;
+} ccl_component_t;
+
+/**
+ * The result of a labeling. The label map has one 32 bit label per pixel of
+ * the labeled region. Label 0 is background, label n > 0 belongs to 
+ * components[n - 1].
+ */
+typedef struct {
+  unsigned int min_x, min_y;
+  memory_map_t * labels;
+  unsigned int num_components;
+  ccl_component_t * components;
+} ccl_result_t;
+
+ret_t ccl_label_image(const image_t * const img, 
+		      unsigned int min_x, unsigned int min_y, 
+		      unsigned int max_x, unsigned int max_y,
+		      uint8_t threshold, CCL_CONNECTIVITY connectivity,
+		      const char * const project_dir,
+		      ccl_result_t * result);
+
+ret_t ccl_destroy_result(ccl_result_t * result);
+
+/**
+ * Get the label for an image coordinate inside the labeled region.
+ */
+inline uint32_t ccl_get_label(const ccl_result_t * const result, unsigned int x, unsigned int y) {
+  return *(uint32_t *)mm_get_ptr(result->labels, x - result->min_x, y - result->min_y);
+}
+
+#endif
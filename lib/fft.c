@@ -0,0 +1,242 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "fft.h"
+#include "parallel.h"
+
+int fft_is_power_of_two(unsigned int n) {
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+/**
+ * In-place radix-2 fourier transformation.
+ * @param n the number of elements. It must be a power of two.
+ * @param inverse If inverse is non-zero, the inverse transformation is calculated.
+ *   The result is scaled by 1/n.
+ */
+ret_t fft_1d(fft_complex_t * data, unsigned int n, int inverse) {
+  unsigned int i, j, len;
+
+  assert(data != NULL);
+  if(data == NULL) return RET_INV_PTR;
+  assert(fft_is_power_of_two(n));
+  if(!fft_is_power_of_two(n)) return RET_ERR;
+
+  // bit reversal permutation
+  for(i = 1, j = 0; i < n; i++) {
+    unsigned int bit = n >> 1;
+    for(; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if(i < j) {
+      fft_complex_t tmp = data[i];
+      data[i] = data[j];
+      data[j] = tmp;
+    }
+  }
+
+  for(len = 2; len <= n; len <<= 1) {
+    double angle = (inverse ? 2 : -2) * M_PI / len;
+    double w_re = cos(angle), w_im = sin(angle);
+
+    for(i = 0; i < n; i += len) {
+      double cur_re = 1, cur_im = 0;
+
+      for(j = 0; j < len / 2; j++) {
+	fft_complex_t * u = &data[i + j];
+	fft_complex_t * v = &data[i + j + len / 2];
+	double t_re = v->re * cur_re - v->im * cur_im;
+	double t_im = v->re * cur_im + v->im * cur_re;
+
+	v->re = u->re - t_re;
+	v->im = u->im - t_im;
+	u->re += t_re;
+	u->im += t_im;
+
+	double next_re = cur_re * w_re - cur_im * w_im;
+	cur_im = cur_re * w_im + cur_im * w_re;
+	cur_re = next_re;
+      }
+    }
+  }
+
+  if(inverse) 
+    for(i = 0; i < n; i++) {
+      data[i].re /= n;
+      data[i].im /= n;
+    }
+
+  return RET_OK;
+}
+
+typedef struct {
+  fft_complex_t * data;
+  unsigned int width, height;
+  int inverse;
+} fft_2d_params_t;
+
+static ret_t fft_row(unsigned int row, void * arg) {
+  fft_2d_params_t * params = (fft_2d_params_t *)arg;
+  return fft_1d(params->data + (size_t)row * params->width, params->width, params->inverse);
+}
+
+static ret_t fft_column(unsigned int column, void * arg) {
+  fft_2d_params_t * params = (fft_2d_params_t *)arg;
+  unsigned int y;
+  ret_t ret;
+  fft_complex_t * buf = (fft_complex_t *)malloc(params->height * sizeof(fft_complex_t));
+  if(buf == NULL) return RET_MALLOC_FAILED;
+
+  for(y = 0; y < params->height; y++) buf[y] = params->data[(size_t)y * params->width + column];
+
+  if(RET_IS_OK(ret = fft_1d(buf, params->height, params->inverse)))
+    for(y = 0; y < params->height; y++) params->data[(size_t)y * params->width + column] = buf[y];
+
+  free(buf);
+  return ret;
+}
+
+/**
+ * In-place two dimensional fourier transformation of row-major data. Rows and
+ * columns are transformed in parallel.
+ * @param width, height the size of the data. Both must be a power of two.
+ */
+ret_t fft_2d(fft_complex_t * data, unsigned int width, unsigned int height, int inverse) {
+  ret_t ret;
+
+  assert(data != NULL);
+  if(data == NULL) return RET_INV_PTR;
+  if(!fft_is_power_of_two(width) || !fft_is_power_of_two(height)) return RET_ERR;
+
+  fft_2d_params_t params = { data, width, height, inverse };
+  if(RET_IS_NOT_OK(ret = par_run(height, &fft_row, &params))) return ret;
+  return par_run(width, &fft_column, &params);
+}
+
+/**
+ * Prepare a square window of size x size values for a phase correlation. The
+ * mean is subtracted and a Hann window is applied, so that the image borders
+ * do not dominate the correlation.
+ */
+void fft_apply_window(double * data, unsigned int size) {
+  unsigned int x, y;
+  double mean = 0;
+
+  assert(data != NULL);
+  if(data == NULL || size == 0) return;
+
+  for(y = 0; y < size * size; y++) mean += data[y];
+  mean /= (double)size * size;
+
+  for(y = 0; y < size; y++) {
+    double w_y = 0.5 - 0.5 * cos(2 * M_PI * y / size);
+    for(x = 0; x < size; x++) {
+      double w_x = 0.5 - 0.5 * cos(2 * M_PI * x / size);
+      data[y * size + x] = (data[y * size + x] - mean) * w_x * w_y;
+    }
+  }
+}
+
+/** Subpixel offset of a peak from the neighbour values with a parabolic fit. */
+static double fft_peak_offset(double left, double center, double right) {
+  double denom = left - 2 * center + right;
+  if(denom >= 0) return 0;
+  double offs = 0.5 * (left - right) / denom;
+  return offs < -0.5 ? -0.5 : offs > 0.5 ? 0.5 : offs;
+}
+
+/**
+ * Estimate the translation between two square windows with a phase correlation.
+ * The windows should be prepared with fft_apply_window().
+ * @param a, b two windows of size x size values.
+ * @param size the window size. It must be a power of two.
+ * @param shift_x, shift_y the estimated translation with subpixel precision, so
+ *   that b(x, y) matches a(x - shift_x, y - shift_y). The translation is in the 
+ *   range [-size/2, size/2).
+ * @param peak If not NULL, the height of the correlation peak is stored here.
+ *   It is close to 1 for a perfect match and close to 0 for uncorrelated windows.
+ */
+ret_t fft_phase_correlation(const double * a, const double * b, unsigned int size,
+			    double * shift_x, double * shift_y, double * peak) {
+  unsigned int i, n = size * size, max_i = 0;
+  ret_t ret;
+  fft_complex_t * fa, * fb;
+
+  assert(a != NULL && b != NULL && shift_x != NULL && shift_y != NULL);
+  if(a == NULL || b == NULL || shift_x == NULL || shift_y == NULL) return RET_INV_PTR;
+  if(!fft_is_power_of_two(size)) return RET_ERR;
+
+  fa = (fft_complex_t *)malloc(n * sizeof(fft_complex_t));
+  fb = (fft_complex_t *)malloc(n * sizeof(fft_complex_t));
+  if(fa == NULL || fb == NULL) {
+    if(fa != NULL) free(fa);
+    if(fb != NULL) free(fb);
+    return RET_MALLOC_FAILED;
+  }
+
+  for(i = 0; i < n; i++) {
+    fa[i].re = a[i]; fa[i].im = 0;
+    fb[i].re = b[i]; fb[i].im = 0;
+  }
+
+  if(RET_IS_OK(ret = fft_2d(fa, size, size, 0)) &&
+     RET_IS_OK(ret = fft_2d(fb, size, size, 0))) {
+
+    // normalized cross power spectrum B * conj(A)
+    for(i = 0; i < n; i++) {
+      double re = fb[i].re * fa[i].re + fb[i].im * fa[i].im;
+      double im = fb[i].im * fa[i].re - fb[i].re * fa[i].im;
+      double mag = sqrt(re * re + im * im);
+      if(mag > 1e-12) {
+	fa[i].re = re / mag;
+	fa[i].im = im / mag;
+      }
+      else 
+	fa[i].re = fa[i].im = 0;
+    }
+
+    if(RET_IS_OK(ret = fft_2d(fa, size, size, 1))) {
+
+      for(i = 1; i < n; i++) 
+	if(fa[i].re > fa[max_i].re) max_i = i;
+
+      unsigned int px = max_i % size, py = max_i / size;
+      double offs_x = fft_peak_offset(fa[py * size + (px + size - 1) % size].re, fa[max_i].re,
+				      fa[py * size + (px + 1) % size].re);
+      double offs_y = fft_peak_offset(fa[((py + size - 1) % size) * size + px].re, fa[max_i].re,
+				      fa[((py + 1) % size) * size + px].re);
+
+      *shift_x = (px >= size / 2 ? (double)px - size : (double)px) + offs_x;
+      *shift_y = (py >= size / 2 ? (double)py - size : (double)py) + offs_y;
+      if(peak != NULL) *peak = fa[max_i].re;
+    }
+  }
+
+  free(fa);
+  free(fb);
+  return ret;
+}
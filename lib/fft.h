@@ -0,0 +1,47 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include "globals.h"
+
+/**
+ * Fast fourier transformation for power of two sizes and phase correlation
+ * of image windows.
+ */
+
+typedef struct {
+  double re, im;
+} fft_complex_t;
+
+int fft_is_power_of_two(unsigned int n);
+
+ret_t fft_1d(fft_complex_t * data, unsigned int n, int inverse);
+ret_t fft_2d(fft_complex_t * data, unsigned int width, unsigned int height, int inverse);
+
+void fft_apply_window(double * data, unsigned int size);
+
+ret_t fft_phase_correlation(const double * a, const double * b, unsigned int size,
+			    double * shift_x, double * shift_y, double * peak);
+
+#endif
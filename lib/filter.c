@@ -0,0 +1,754 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "globals.h"
+#include "filter.h"
+#include "image_view.h"
+#include "parallel.h"
+
+/* Edge length of the tiles, that are filtered in parallel. */
+#define FILTER_TILE_SIZE 256
+
+/* Local contrast normalization maps the local mean to 128 and the mean
+   absolute deviation to +/- FILTER_LCN_GAIN. */
+#define FILTER_LCN_GAIN 64
+
+/* Lower limit for the deviation, so that noise in flat areas is not amplified. */
+#define FILTER_LCN_MIN_DEVIATION 4
+
+enum FILTER_OP {
+  FILTER_OP_CONVOLVE,
+  FILTER_OP_MIN,
+  FILTER_OP_MAX
+};
+
+/**
+ * A one dimensional kernel. Convolution results are calculated in 16 bit fixed 
+ * point as ((sum of weight * pixel) + round) * scale / 65536.
+ */
+typedef struct {
+  FILTER_OP op;
+  unsigned int radius;
+  uint16_t weights[2 * FILTER_MAX_RADIUS + 1];
+  uint16_t round, scale;
+} filter_kernel_t;
+
+static const struct {
+  FILTER_TYPE type;
+  const char * name;
+} filter_names[] = {
+  { FILTER_BOX_BLUR, "box" },
+  { FILTER_GAUSSIAN_BLUR, "gauss" },
+  { FILTER_ERODE, "erode" },
+  { FILTER_DILATE, "dilate" },
+  { FILTER_OPEN, "open" },
+  { FILTER_CLOSE, "close" },
+  { FILTER_LOCAL_CONTRAST, "lcn" }
+};
+
+#define FILTER_NUM_NAMES (sizeof(filter_names) / sizeof(filter_names[0]))
+
+
+void filter_pipeline_init(filter_pipeline_t * pipeline) {
+  assert(pipeline != NULL);
+  memset(pipeline, 0, sizeof(filter_pipeline_t));
+}
+
+/**
+ * Append a stage to a pipeline.
+ * @param param The sigma for a gaussian blur, else the radius.
+ */
+ret_t filter_pipeline_add(filter_pipeline_t * pipeline, FILTER_TYPE type, double param) {
+  assert(pipeline != NULL);
+  if(pipeline == NULL) return RET_INV_PTR;
+  if(pipeline->num_stages >= FILTER_MAX_STAGES) return RET_ERR;
+
+  filter_stage_t * stage = &pipeline->stages[pipeline->num_stages];
+  memset(stage, 0, sizeof(filter_stage_t));
+  stage->type = type;
+
+  switch(type) {
+  case FILTER_GAUSSIAN_BLUR:
+    if(!(param > 0)) return RET_ERR;
+    stage->sigma = param;
+    stage->radius = MIN(FILTER_MAX_RADIUS, MAX(1, (unsigned int)ceil(3.0 * param)));
+    break;
+  case FILTER_BOX_BLUR:
+  case FILTER_ERODE:
+  case FILTER_DILATE:
+  case FILTER_OPEN:
+  case FILTER_CLOSE:
+  case FILTER_LOCAL_CONTRAST:
+    if(param < 1 || param > FILTER_MAX_RADIUS) return RET_ERR;
+    stage->radius = lrint(param);
+    break;
+  default:
+    return RET_ERR;
+  }
+
+  pipeline->num_stages++;
+  return RET_OK;
+}
+
+int filter_pipeline_equal(const filter_pipeline_t * const a, const filter_pipeline_t * const b) {
+  unsigned int i;
+  assert(a != NULL && b != NULL);
+
+  if(a->num_stages != b->num_stages) return 0;
+  for(i = 0; i < a->num_stages; i++)
+    if(a->stages[i].type != b->stages[i].type ||
+       a->stages[i].radius != b->stages[i].radius ||
+       a->stages[i].sigma != b->stages[i].sigma) return 0;
+  return 1;
+}
+
+/**
+ * Get the number of pixels around an area, that influence the filter 
+ * result within the area.
+ */
+unsigned int filter_pipeline_get_border(const filter_pipeline_t * const pipeline) {
+  unsigned int i, border = 0;
+  assert(pipeline != NULL);
+
+  for(i = 0; i < pipeline->num_stages; i++) {
+    const filter_stage_t * stage = &pipeline->stages[i];
+    if(stage->type == FILTER_OPEN || stage->type == FILTER_CLOSE || 
+       stage->type == FILTER_LOCAL_CONTRAST)
+      border += 2 * stage->radius;
+    else
+      border += stage->radius;
+  }
+  return border;
+}
+
+/**
+ * Parse a pipeline from a string like "gauss:1.5,open:1,lcn:16". Each stage
+ * is a filter name and the parameter for filter_pipeline_add(). The pipeline 
+ * is not modified, if the string is invalid.
+ */
+ret_t filter_pipeline_parse(filter_pipeline_t * pipeline, const char * const str) {
+  filter_pipeline_t p;
+  char * copy, * token, * saveptr = NULL;
+  ret_t ret = RET_OK;
+
+  assert(pipeline != NULL && str != NULL);
+  if(pipeline == NULL || str == NULL) return RET_INV_PTR;
+
+  filter_pipeline_init(&p);
+  if((copy = strdup(str)) == NULL) return RET_MALLOC_FAILED;
+
+  for(token = strtok_r(copy, ", ", &saveptr); token != NULL && RET_IS_OK(ret);
+      token = strtok_r(NULL, ", ", &saveptr)) {
+
+    char * param = strchr(token, ':');
+    unsigned int i;
+    if(param == NULL) {
+      ret = RET_ERR;
+      break;
+    }
+    *param++ = '\0';
+
+    for(i = 0; i < FILTER_NUM_NAMES && strcmp(filter_names[i].name, token); i++);
+    if(i == FILTER_NUM_NAMES) {
+      debug(TM, "unknown filter '%s'", token);
+      ret = RET_ERR;
+    }
+    else ret = filter_pipeline_add(&p, filter_names[i].type, atof(param));
+  }
+
+  free(copy);
+  if(RET_IS_OK(ret)) memcpy(pipeline, &p, sizeof(filter_pipeline_t));
+  return ret;
+}
+
+/**
+ * Write a pipeline in the format, that is read by filter_pipeline_parse().
+ */
+ret_t filter_pipeline_format(const filter_pipeline_t * const pipeline, char * str, size_t len) {
+  unsigned int i, j;
+  size_t pos = 0;
+
+  assert(pipeline != NULL && str != NULL);
+  if(pipeline == NULL || str == NULL) return RET_INV_PTR;
+  if(len == 0) return RET_ERR;
+
+  str[0] = '\0';
+  for(i = 0; i < pipeline->num_stages; i++) {
+    const filter_stage_t * stage = &pipeline->stages[i];
+    for(j = 0; j < FILTER_NUM_NAMES && filter_names[j].type != stage->type; j++);
+    if(j == FILTER_NUM_NAMES) return RET_ERR;
+
+    int n = stage->type == FILTER_GAUSSIAN_BLUR ?
+      snprintf(str + pos, len - pos, "%s%s:%g", i ? "," : "", filter_names[j].name, stage->sigma) :
+      snprintf(str + pos, len - pos, "%s%s:%u", i ? "," : "", filter_names[j].name, stage->radius);
+    if(n < 0 || (size_t)n >= len - pos) return RET_ERR;
+    pos += n;
+  }
+  return RET_OK;
+}
+
+
+static void filter_init_box_kernel(filter_kernel_t * k, unsigned int radius) {
+  unsigned int i, n = 2 * radius + 1;
+  k->op = FILTER_OP_CONVOLVE;
+  k->radius = radius;
+  for(i = 0; i < n; i++) k->weights[i] = 1;
+  k->round = n / 2;
+  k->scale = 65536 / n;
+}
+
+/**
+ * Gaussian weights sum up to 256. The rounding remainder is spread 
+ * symmetrically around the center.
+ */
+static void filter_init_gaussian_kernel(filter_kernel_t * k, unsigned int radius, double sigma) {
+  double w[2 * FILTER_MAX_RADIUS + 1], sum = 0;
+  unsigned int i, n = 2 * radius + 1, total = 0, j;
+
+  for(i = 0; i < n; i++) {
+    double d = (double)i - (double)radius;
+    w[i] = exp(-d * d / (2.0 * sigma * sigma));
+    sum += w[i];
+  }
+
+  for(i = 0; i < n; i++) {
+    k->weights[i] = (uint16_t)floor(256.0 * w[i] / sum);
+    total += k->weights[i];
+  }
+
+  int remainder = 256 - total;
+  if(remainder & 1) {
+    k->weights[radius]++;
+    remainder--;
+  }
+  for(j = 1; remainder > 0; j = j % radius + 1, remainder -= 2) {
+    k->weights[radius - j]++;
+    k->weights[radius + j]++;
+  }
+
+  k->op = FILTER_OP_CONVOLVE;
+  k->radius = radius;
+  k->round = 128;
+  k->scale = 256;
+}
+
+static void filter_init_rank_kernel(filter_kernel_t * k, FILTER_OP op, unsigned int radius) {
+  memset(k, 0, sizeof(filter_kernel_t));
+  k->op = op;
+  k->radius = radius;
+}
+
+/**
+ * Apply a one dimensional kernel to a span of width pixels. src[i] points to
+ * the input span for the i-th kernel tap.
+ */
+static void filter_span(const filter_kernel_t * k, uint8_t * dst, const uint8_t * const * src,
+			unsigned int width) {
+  unsigned int n = 2 * k->radius + 1, x = 0, t;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(k->round);
+  const __m128i scale = _mm_set1_epi16(k->scale);
+
+  for(; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src[0] + x));
+
+    if(k->op == FILTER_OP_CONVOLVE) {
+      // the weighted sums fit into unsigned 16 bit words
+      __m128i w = _mm_set1_epi16(k->weights[0]);
+      __m128i acc_lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w);
+      __m128i acc_hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w);
+
+      for(t = 1; t < n; t++) {
+	v = _mm_loadu_si128((const __m128i *)(src[t] + x));
+	w = _mm_set1_epi16(k->weights[t]);
+	acc_lo = _mm_add_epi16(acc_lo, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w));
+	acc_hi = _mm_add_epi16(acc_hi, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w));
+      }
+
+      acc_lo = _mm_mulhi_epu16(_mm_add_epi16(acc_lo, round), scale);
+      acc_hi = _mm_mulhi_epu16(_mm_add_epi16(acc_hi, round), scale);
+      v = _mm_packus_epi16(acc_lo, acc_hi);
+    }
+    else if(k->op == FILTER_OP_MIN) {
+      for(t = 1; t < n; t++) v = _mm_min_epu8(v, _mm_loadu_si128((const __m128i *)(src[t] + x)));
+    }
+    else {
+      for(t = 1; t < n; t++) v = _mm_max_epu8(v, _mm_loadu_si128((const __m128i *)(src[t] + x)));
+    }
+
+    _mm_storeu_si128((__m128i *)(dst + x), v);
+  }
+#endif
+
+  for(; x < width; x++) {
+    unsigned int v = src[0][x];
+
+    if(k->op == FILTER_OP_CONVOLVE) {
+      v *= k->weights[0];
+      for(t = 1; t < n; t++) v += k->weights[t] * src[t][x];
+      v = ((v + k->round) * k->scale) >> 16;
+    }
+    else if(k->op == FILTER_OP_MIN) {
+      for(t = 1; t < n; t++) v = MIN(v, src[t][x]);
+    }
+    else {
+      for(t = 1; t < n; t++) v = MAX(v, src[t][x]);
+    }
+
+    dst[x] = v;
+  }
+}
+
+/**
+ * Apply a kernel horizontally and then vertically. Pixels outside the buffer
+ * are continued with the edge pixels. Source and destination may be the 
+ * same buffer.
+ * @param tmp Buffer for the intermediate image.
+ * @param padded Buffer for a row with borders, width + 2 * FILTER_MAX_RADIUS bytes.
+ */
+static void filter_separable(const filter_kernel_t * k, uint8_t * dst, const uint8_t * src,
+			     uint8_t * tmp, uint8_t * padded, unsigned int width, unsigned int height) {
+  const uint8_t * taps[2 * FILTER_MAX_RADIUS + 1];
+  unsigned int r = k->radius, n = 2 * r + 1, y, t;
+
+  for(y = 0; y < height; y++) {
+    const uint8_t * row = src + (size_t)y * width;
+    memset(padded, row[0], r);
+    memcpy(padded + r, row, width);
+    memset(padded + r + width, row[width - 1], r);
+
+    for(t = 0; t < n; t++) taps[t] = padded + t;
+    filter_span(k, tmp + (size_t)y * width, taps, width);
+  }
+
+  for(y = 0; y < height; y++) {
+    for(t = 0; t < n; t++) {
+      int ty = (int)y + (int)t - (int)r;
+      ty = ty < 0 ? 0 : (ty >= (int)height ? (int)height - 1 : ty);
+      taps[t] = tmp + (size_t)ty * width;
+    }
+    filter_span(k, dst + (size_t)y * width, taps, width);
+  }
+}
+
+/** Working memory for filtering a tile. */
+typedef struct {
+  unsigned int width, height;
+  uint8_t * img, * tmp, * mean, * dev, * padded;
+} filter_buffers_t;
+
+/**
+ * Local contrast normalization. The image is shifted by the local mean and 
+ * scaled by the local mean absolute deviation.
+ */
+static void filter_local_contrast(const filter_kernel_t * box, filter_buffers_t * b) {
+  size_t i = 0, size = (size_t)b->width * b->height;
+  int gain[256];
+
+  filter_separable(box, b->mean, b->img, b->tmp, b->padded, b->width, b->height);
+
+#ifdef __SSE2__
+  for(; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(b->img + i));
+    __m128i m = _mm_loadu_si128((const __m128i *)(b->mean + i));
+    _mm_storeu_si128((__m128i *)(b->dev + i), _mm_or_si128(_mm_subs_epu8(v, m), _mm_subs_epu8(m, v)));
+  }
+#endif
+  for(; i < size; i++) 
+    b->dev[i] = b->img[i] > b->mean[i] ? b->img[i] - b->mean[i] : b->mean[i] - b->img[i];
+
+  filter_separable(box, b->dev, b->dev, b->tmp, b->padded, b->width, b->height);
+
+  for(i = 0; i < 256; i++) gain[i] = (FILTER_LCN_GAIN << 8) / MAX(i, FILTER_LCN_MIN_DEVIATION);
+
+  for(i = 0; i < size; i++) {
+    int v = 128 + ((int)b->img[i] - (int)b->mean[i]) * gain[b->dev[i]] / 256;
+    b->img[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+  }
+}
+
+typedef struct {
+  const filter_pipeline_t * pipeline;
+  filter_kernel_t kernels[FILTER_MAX_STAGES][2];
+  unsigned int border;
+
+  image_t * src, * dst;
+  const unsigned int * tiles;
+  unsigned int tiles_x;
+} filter_params_t;
+
+static void filter_init_kernels(filter_params_t * params) {
+  unsigned int i;
+  for(i = 0; i < params->pipeline->num_stages; i++) {
+    const filter_stage_t * stage = &params->pipeline->stages[i];
+    filter_kernel_t * k = params->kernels[i];
+
+    switch(stage->type) {
+    case FILTER_BOX_BLUR:
+    case FILTER_LOCAL_CONTRAST:
+      filter_init_box_kernel(&k[0], stage->radius);
+      break;
+    case FILTER_GAUSSIAN_BLUR:
+      filter_init_gaussian_kernel(&k[0], stage->radius, stage->sigma);
+      break;
+    case FILTER_ERODE:
+    case FILTER_OPEN:
+      filter_init_rank_kernel(&k[0], FILTER_OP_MIN, stage->radius);
+      filter_init_rank_kernel(&k[1], FILTER_OP_MAX, stage->radius);
+      break;
+    case FILTER_DILATE:
+    case FILTER_CLOSE:
+      filter_init_rank_kernel(&k[0], FILTER_OP_MAX, stage->radius);
+      filter_init_rank_kernel(&k[1], FILTER_OP_MIN, stage->radius);
+      break;
+    }
+  }
+  params->border = filter_pipeline_get_border(params->pipeline);
+}
+
+static void filter_run_stages(const filter_params_t * params, filter_buffers_t * b) {
+  unsigned int i;
+  for(i = 0; i < params->pipeline->num_stages; i++) {
+    const filter_kernel_t * k = params->kernels[i];
+
+    switch(params->pipeline->stages[i].type) {
+    case FILTER_LOCAL_CONTRAST:
+      filter_local_contrast(&k[0], b);
+      break;
+    case FILTER_OPEN:
+    case FILTER_CLOSE:
+      filter_separable(&k[0], b->img, b->img, b->tmp, b->padded, b->width, b->height);
+      filter_separable(&k[1], b->img, b->img, b->tmp, b->padded, b->width, b->height);
+      break;
+    default:
+      filter_separable(&k[0], b->img, b->img, b->tmp, b->padded, b->width, b->height);
+    }
+  }
+}
+
+/**
+ * Filter a tile. The tile is loaded with the pipeline border, so that the
+ * pixels within the tile are the same as if the whole image was filtered.
+ */
+template<IMAGE_TYPE type>
+static ret_t filter_tile(unsigned int job, void * arg) {
+  filter_params_t * params = (filter_params_t *)arg;
+  image_view<type> src(params->src);
+  gs_view_t dst(params->dst);
+  filter_buffers_t b;
+  unsigned int y;
+
+  unsigned int min_x = (params->tiles[job] % params->tiles_x) * FILTER_TILE_SIZE;
+  unsigned int min_y = (params->tiles[job] / params->tiles_x) * FILTER_TILE_SIZE;
+  unsigned int max_x = MIN(min_x + FILTER_TILE_SIZE, dst.width);
+  unsigned int max_y = MIN(min_y + FILTER_TILE_SIZE, dst.height);
+
+  unsigned int buf_min_x = min_x > params->border ? min_x - params->border : 0;
+  unsigned int buf_min_y = min_y > params->border ? min_y - params->border : 0;
+  b.width = MIN(max_x + params->border, dst.width) - buf_min_x;
+  b.height = MIN(max_y + params->border, dst.height) - buf_min_y;
+
+  size_t size = (size_t)b.width * b.height;
+  uint8_t * mem = (uint8_t *)malloc(4 * size + b.width + 2 * FILTER_MAX_RADIUS);
+  if(mem == NULL) return RET_MALLOC_FAILED;
+
+  b.img = mem;
+  b.tmp = mem + size;
+  b.mean = mem + 2 * size;
+  b.dev = mem + 3 * size;
+  b.padded = mem + 4 * size;
+
+  for(y = 0; y < b.height; y++)
+    imgview_convert_row<IMAGE_TYPE_GS, type>(b.img + (size_t)y * b.width, 
+					     src.ptr(buf_min_x, buf_min_y + y), b.width);
+
+  filter_run_stages(params, &b);
+
+  for(y = min_y; y < max_y; y++)
+    memcpy(dst.ptr(min_x, y), 
+	   b.img + (size_t)(y - buf_min_y) * b.width + (min_x - buf_min_x), 
+	   max_x - min_x);
+
+  free(mem);
+  return RET_OK;
+}
+
+static ret_t filter_apply_tiles(const filter_pipeline_t * const pipeline, image_t * dst, image_t * src,
+				const unsigned int * tiles, unsigned int num_tiles, unsigned int tiles_x) {
+  filter_params_t params;
+
+  memset(&params, 0, sizeof(filter_params_t));
+  params.pipeline = pipeline;
+  params.src = src;
+  params.dst = dst;
+  params.tiles = tiles;
+  params.tiles_x = tiles_x;
+  filter_init_kernels(&params);
+
+  switch(src->image_type) {
+  case IMAGE_TYPE_GS:
+    return par_run(num_tiles, &filter_tile<IMAGE_TYPE_GS>, &params);
+  case IMAGE_TYPE_RGBA:
+    return par_run(num_tiles, &filter_tile<IMAGE_TYPE_RGBA>, &params);
+  default:
+    return RET_ERR;
+  }
+}
+
+/**
+ * Filter the region (min_x, min_y) .. (max_x, max_y) of an image. The region
+ * is inclusive and clipped to the image. Color images are converted to greyscale.
+ * @param dst A greyscale image with the size of the source image. It must not be
+ *   the source image.
+ */
+ret_t filter_apply(const filter_pipeline_t * const pipeline, image_t * dst, image_t * src,
+		   unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+  unsigned int tx, ty, num_tiles = 0;
+  ret_t ret;
+
+  assert(pipeline != NULL && dst != NULL && src != NULL);
+  assert(dst != src);
+  if(pipeline == NULL || dst == NULL || src == NULL) return RET_INV_PTR;
+  if(dst == src || dst->image_type != IMAGE_TYPE_GS ||
+     dst->width != src->width || dst->height != src->height) return RET_ERR;
+
+  if(max_x >= dst->width) max_x = dst->width - 1;
+  if(max_y >= dst->height) max_y = dst->height - 1;
+  if(dst->width == 0 || dst->height == 0 || min_x > max_x || min_y > max_y) return RET_OK;
+
+  unsigned int tiles_x = (dst->width + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE;
+  unsigned int * tiles = (unsigned int *)
+    malloc((max_x / FILTER_TILE_SIZE - min_x / FILTER_TILE_SIZE + 1) *
+	   (max_y / FILTER_TILE_SIZE - min_y / FILTER_TILE_SIZE + 1) * sizeof(unsigned int));
+  if(tiles == NULL) return RET_MALLOC_FAILED;
+
+  for(ty = min_y / FILTER_TILE_SIZE; ty <= max_y / FILTER_TILE_SIZE; ty++)
+    for(tx = min_x / FILTER_TILE_SIZE; tx <= max_x / FILTER_TILE_SIZE; tx++)
+      tiles[num_tiles++] = ty * tiles_x + tx;
+
+  ret = filter_apply_tiles(pipeline, dst, src, tiles, num_tiles, tiles_x);
+  free(tiles);
+  return ret;
+}
+
+
+/**
+ * Create a cache for filtered background images of a scaling manager. The 
+ * pipeline is empty.
+ */
+filter_cache_t * filter_cache_create(scaling_manager_t * sm) {
+  filter_cache_t * fc;
+  unsigned int layer;
+
+  assert(sm != NULL);
+  if(sm == NULL) return NULL;
+
+  if((fc = (filter_cache_t *)malloc(sizeof(filter_cache_t))) == NULL) return NULL;
+  memset(fc, 0, sizeof(filter_cache_t));
+
+  fc->sm = sm;
+  fc->num_layers = sm->num_layers;
+  filter_pipeline_init(&fc->pipeline);
+
+  if((fc->images = (image_t **)calloc(fc->num_layers, sizeof(image_t *))) == NULL ||
+     (fc->valid_tiles = (memory_map_t **)calloc(fc->num_layers, sizeof(memory_map_t *))) == NULL ||
+     (fc->layer_versions = (unsigned long *)malloc(fc->num_layers * sizeof(unsigned long))) == NULL) {
+    free(fc->images);
+    free(fc->valid_tiles);
+    free(fc);
+    return NULL;
+  }
+
+  for(layer = 0; layer < fc->num_layers; layer++)
+    fc->layer_versions[layer] = scalmgr_get_layer_version(sm, layer);
+
+  pthread_mutex_init(&fc->mutex, NULL);
+  return fc;
+}
+
+/**
+ * Destroy a filter cache. The scaling manager is not destroyed.
+ */
+ret_t filter_cache_destroy(filter_cache_t * fc) {
+  unsigned int layer;
+  assert(fc != NULL);
+  if(fc == NULL) return RET_INV_PTR;
+
+  for(layer = 0; layer < fc->num_layers; layer++) {
+    if(fc->images[layer] != NULL) gr_image_destroy(fc->images[layer]);
+    if(fc->valid_tiles[layer] != NULL) mm_destroy(fc->valid_tiles[layer]);
+  }
+  free(fc->images);
+  free(fc->valid_tiles);
+  free(fc->layer_versions);
+  pthread_mutex_destroy(&fc->mutex);
+
+  memset(fc, 0, sizeof(filter_cache_t));
+  free(fc);
+  return RET_OK;
+}
+
+/**
+ * Set the filter pipeline. The cache is only invalidated, if the pipeline changes.
+ */
+ret_t filter_cache_set_pipeline(filter_cache_t * fc, const filter_pipeline_t * const pipeline) {
+  unsigned int layer;
+  assert(fc != NULL && pipeline != NULL);
+  if(fc == NULL || pipeline == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&fc->mutex);
+  if(!filter_pipeline_equal(&fc->pipeline, pipeline)) {
+    memcpy(&fc->pipeline, pipeline, sizeof(filter_pipeline_t));
+    for(layer = 0; layer < fc->num_layers; layer++)
+      if(fc->valid_tiles[layer] != NULL) mm_clear(fc->valid_tiles[layer]);
+  }
+  pthread_mutex_unlock(&fc->mutex);
+  return RET_OK;
+}
+
+/**
+ * Get the filtered image of a layer. It is created on first use. The caller
+ * must hold the mutex.
+ */
+static image_t * filter_cache_get_layer(filter_cache_t * fc, unsigned int layer) {
+  if(layer >= fc->num_layers) return NULL;
+
+  if(fc->images[layer] == NULL) {
+    image_t * bg = fc->sm->bg_images[layer];
+    image_t * img;
+    memory_map_t * valid_tiles = NULL;
+
+    if((img = gr_create_image(bg->width, bg->height, IMAGE_TYPE_GS)) == NULL) return NULL;
+    if(RET_IS_NOT_OK(gr_map_scratch(img, fc->sm->project_dir)) ||
+       (valid_tiles = mm_create((bg->width + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE,
+				(bg->height + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE, 1)) == NULL ||
+       RET_IS_NOT_OK(mm_alloc_memory(valid_tiles))) {
+      gr_image_destroy(img);
+      if(valid_tiles != NULL) mm_destroy(valid_tiles);
+      return NULL;
+    }
+
+    fc->images[layer] = img;
+    fc->valid_tiles[layer] = valid_tiles;
+  }
+  return fc->images[layer];
+}
+
+/**
+ * Make sure, that the filtered image of a layer is calculated for the region
+ * (min_x, min_y) .. (max_x, max_y). The region is inclusive.
+ */
+ret_t filter_cache_ensure_region(filter_cache_t * fc, unsigned int layer,
+				 unsigned int min_x, unsigned int min_y, 
+				 unsigned int max_x, unsigned int max_y) {
+  ret_t ret = RET_OK;
+  unsigned int tx, ty, num_tiles = 0;
+  unsigned int * tiles = NULL;
+
+  assert(fc != NULL);
+  if(fc == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&fc->mutex);
+
+  image_t * img = filter_cache_get_layer(fc, layer);
+  if(img == NULL) {
+    pthread_mutex_unlock(&fc->mutex);
+    return RET_ERR;
+  }
+
+  memory_map_t * valid_tiles = fc->valid_tiles[layer];
+
+  // the background image has changed since the tiles were calculated
+  unsigned long version = scalmgr_get_layer_version(fc->sm, layer);
+  if(version != fc->layer_versions[layer]) {
+    mm_clear(valid_tiles);
+    fc->layer_versions[layer] = version;
+  }
+
+  if(max_x >= img->width) max_x = img->width - 1;
+  if(max_y >= img->height) max_y = img->height - 1;
+  if(img->width == 0 || img->height == 0 || min_x > max_x || min_y > max_y) {
+    pthread_mutex_unlock(&fc->mutex);
+    return RET_OK;
+  }
+
+  unsigned int tile_min_x = min_x / FILTER_TILE_SIZE, tile_max_x = max_x / FILTER_TILE_SIZE;
+  unsigned int tile_min_y = min_y / FILTER_TILE_SIZE, tile_max_y = max_y / FILTER_TILE_SIZE;
+
+  for(ty = tile_min_y; ty <= tile_max_y; ty++)
+    for(tx = tile_min_x; tx <= tile_max_x; tx++)
+      if(*(uint8_t *)mm_get_ptr(valid_tiles, tx, ty) == 0) {
+	if(tiles == NULL &&
+	   (tiles = (unsigned int *)malloc((tile_max_x - tile_min_x + 1) * 
+					   (tile_max_y - tile_min_y + 1) * 
+					   sizeof(unsigned int))) == NULL) {
+	  pthread_mutex_unlock(&fc->mutex);
+	  return RET_MALLOC_FAILED;
+	}
+	tiles[num_tiles++] = ty * valid_tiles->width + tx;
+      }
+
+  if(num_tiles > 0) {
+    image_t * src = fc->sm->bg_images[layer];
+
+    if(src == NULL || src->map->mem == NULL) {
+      debug(TM, "background image of layer %d is not available", layer);
+      ret = RET_ERR;
+    }
+    else if(RET_IS_OK(ret = filter_apply_tiles(&fc->pipeline, img, src, tiles, num_tiles, 
+					       valid_tiles->width))) {
+      unsigned int i;
+      for(i = 0; i < num_tiles; i++) valid_tiles->mem[tiles[i]] = 1;
+    }
+    free(tiles);
+  }
+
+  pthread_mutex_unlock(&fc->mutex);
+  return ret;
+}
+
+/**
+ * Get the filtered image of a layer. Use filter_cache_ensure_region() to
+ * calculate the image data for a region.
+ * @return NULL on error
+ */
+image_t * filter_cache_get_image(filter_cache_t * fc, unsigned int layer) {
+  assert(fc != NULL);
+  if(fc == NULL) return NULL;
+
+  pthread_mutex_lock(&fc->mutex);
+  image_t * img = filter_cache_get_layer(fc, layer);
+  pthread_mutex_unlock(&fc->mutex);
+  return img;
+}
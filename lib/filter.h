@@ -0,0 +1,107 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stddef.h>
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "scaling_manager.h"
+
+/**
+ * Image filter pipeline for greyscale images. A pipeline is a list of separable
+ * filter stages, that are applied one after another. Images are filtered in
+ * tiles. Each tile is processed with a border that is large enough for all
+ * stages, so that the result does not depend on the tiling.
+ */
+
+#define FILTER_MAX_STAGES 8
+#define FILTER_MAX_RADIUS 32
+
+enum FILTER_TYPE {
+  FILTER_BOX_BLUR = 0,
+  FILTER_GAUSSIAN_BLUR = 1,
+  FILTER_ERODE = 2,
+  FILTER_DILATE = 3,
+  FILTER_OPEN = 4,
+  FILTER_CLOSE = 5,
+  FILTER_LOCAL_CONTRAST = 6
+};
+
+/**
+ * A filter stage. The radius is the half size of the square filter window. For
+ * the gaussian blur the radius is derived from sigma. Local contrast normalization
+ * uses the radius for the window, in which mean and deviation are estimated.
+ */
+typedef struct {
+  FILTER_TYPE type;
+  unsigned int radius;
+  double sigma;
+} filter_stage_t;
+
+typedef struct {
+  unsigned int num_stages;
+  filter_stage_t stages[FILTER_MAX_STAGES];
+} filter_pipeline_t;
+
+void filter_pipeline_init(filter_pipeline_t * pipeline);
+ret_t filter_pipeline_add(filter_pipeline_t * pipeline, FILTER_TYPE type, double param);
+int filter_pipeline_equal(const filter_pipeline_t * const a, const filter_pipeline_t * const b);
+unsigned int filter_pipeline_get_border(const filter_pipeline_t * const pipeline);
+
+ret_t filter_pipeline_parse(filter_pipeline_t * pipeline, const char * const str);
+ret_t filter_pipeline_format(const filter_pipeline_t * const pipeline, char * str, size_t len);
+
+ret_t filter_apply(const filter_pipeline_t * const pipeline, image_t * dst, image_t * src,
+		   unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y);
+
+
+/**
+ * Cache for filtered background images. The filtered image of a layer is a 
+ * greyscale image in full resolution. Tiles are calculated on demand and 
+ * recalculated, if the pipeline or the background image of the layer changes.
+ */
+typedef struct {
+  scaling_manager_t * sm;
+  filter_pipeline_t pipeline;
+
+  unsigned int num_layers;
+  image_t ** images;              // NULL, if a layer was not requested yet
+  memory_map_t ** valid_tiles;    // one byte per tile, 0 if the tile must be calculated
+  unsigned long * layer_versions; // background versions, the tiles were calculated for
+
+  pthread_mutex_t mutex;
+} filter_cache_t;
+
+filter_cache_t * filter_cache_create(scaling_manager_t * sm);
+ret_t filter_cache_destroy(filter_cache_t * fc);
+
+ret_t filter_cache_set_pipeline(filter_cache_t * fc, const filter_pipeline_t * const pipeline);
+
+ret_t filter_cache_ensure_region(filter_cache_t * fc, unsigned int layer,
+				 unsigned int min_x, unsigned int min_y, 
+				 unsigned int max_x, unsigned int max_y);
+image_t * filter_cache_get_image(filter_cache_t * fc, unsigned int layer);
+
+#endif
@@ -0,0 +1,301 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "globals.h"
+#include "graphics.h"
+#include "glyph_cache.h"
+
+/**
+ * Render the coverage masks of all characters into a new atlas.
+ * @param font_file the font file
+ * @param size the pixel size of the font
+ * @returns the atlas or NULL on failure
+ */
+gcache_atlas_t * gcache_atlas_create(const char * const font_file, unsigned int size) {
+  FT_Library library;
+  FT_Face face;
+  unsigned int c;
+  size_t mem_size = 0;
+
+  assert(font_file != NULL);
+  if(font_file == NULL) return NULL;
+
+  gcache_atlas_t * atlas = (gcache_atlas_t *)malloc(sizeof(gcache_atlas_t));
+  if(atlas == NULL) return NULL;
+  memset(atlas, 0, sizeof(gcache_atlas_t));
+  atlas->size = size;
+
+  if(FT_Init_FreeType(&library)) {
+    free(atlas);
+    return NULL;
+  }
+
+  if(FT_New_Face(library, font_file, 0, &face) ||
+     FT_Set_Pixel_Sizes(face, 0, size)) {
+    debug(TM, "Can't load font %s", font_file);
+    FT_Done_FreeType(library);
+    free(atlas);
+    return NULL;
+  }
+
+  // two passes: get the mask sizes first, then copy the masks
+  int pass;
+  for(pass = 0; pass < 2; pass++) {
+
+    if(pass == 1 && (atlas->mem = (uint8_t *)malloc(mem_size > 0 ? mem_size : 1)) == NULL) break;
+    mem_size = 0;
+
+    for(c = 0; c < GCACHE_NUM_GLYPHS; c++) {
+      gcache_glyph_t * glyph = &atlas->glyphs[c];
+      unsigned int row;
+
+      int glyph_index = FT_Get_Char_Index(face, c);
+      if(FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT) ||
+	 FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) {
+	glyph->width = glyph->rows = 0;
+	continue;
+      }
+
+      FT_Bitmap * bitmap = &face->glyph->bitmap;
+      glyph->width = bitmap->width;
+      glyph->rows = bitmap->rows;
+      glyph->offset = mem_size;
+
+      if(pass == 1)
+	for(row = 0; row < glyph->rows; row++)
+	  memcpy(atlas->mem + glyph->offset + row * glyph->width, 
+		 bitmap->buffer + row * bitmap->pitch, glyph->width);
+
+      mem_size += glyph->width * glyph->rows;
+    }
+  }
+
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+
+  if(atlas->mem == NULL) {
+    free(atlas);
+    return NULL;
+  }
+  return atlas;
+}
+
+void gcache_atlas_destroy(gcache_atlas_t * atlas) {
+  if(atlas) {
+    if(atlas->mem) free(atlas->mem);
+    free(atlas);
+  }
+}
+
+/**
+ * Create a label cache with num_entries slots. Labels are stored in the slot
+ * given by the hash of their text. A label replaces the label in its slot.
+ */
+gcache_labels_t * gcache_labels_create(const gcache_atlas_t * atlas, unsigned int num_entries) {
+  assert(atlas != NULL);
+  assert(num_entries > 0);
+  if(atlas == NULL || num_entries == 0) return NULL;
+
+  gcache_labels_t * lc = (gcache_labels_t *)malloc(sizeof(gcache_labels_t));
+  if(lc == NULL) return NULL;
+
+  if((lc->entries = (gcache_label_t *)calloc(num_entries, sizeof(gcache_label_t))) == NULL) {
+    free(lc);
+    return NULL;
+  }
+  lc->atlas = atlas;
+  lc->num_entries = num_entries;
+  return lc;
+}
+
+static void gcache_clear_label(gcache_label_t * label) {
+  if(label->text) free(label->text);
+  if(label->mask) free(label->mask);
+  memset(label, 0, sizeof(gcache_label_t));
+}
+
+void gcache_labels_destroy(gcache_labels_t * lc) {
+  if(lc) {
+    unsigned int i;
+    for(i = 0; i < lc->num_entries; i++) gcache_clear_label(&lc->entries[i]);
+    free(lc->entries);
+    free(lc);
+  }
+}
+
+static uint32_t gcache_hash(const char * text) {
+  uint32_t h = 2166136261U;
+  for(; *text; text++) h = (h ^ (uint8_t)*text) * 16777619U;
+  return h;
+}
+
+static inline const gcache_glyph_t * gcache_get_glyph(const gcache_atlas_t * atlas, char c) {
+  // labels are drawn in upper case
+  return &atlas->glyphs[(uint8_t)(islower(c) ? toupper(c) : c)];
+}
+
+/**
+ * Lay out a string into the coverage mask of a label. Glyphs are aligned at 
+ * the top and separated by two pixels.
+ */
+static ret_t gcache_layout_label(const gcache_atlas_t * atlas, gcache_label_t * label, 
+				 const char * const text) {
+  const char * c;
+  unsigned int x_offs = 0, row;
+
+  label->width = label->height = 0;
+  for(c = text; *c; c++) {
+    const gcache_glyph_t * glyph = gcache_get_glyph(atlas, *c);
+    label->width = x_offs + glyph->width;
+    label->height = MAX(label->height, glyph->rows);
+    x_offs += glyph->width + 2;
+  }
+
+  if(label->width > 0 && label->height > 0) {
+    if((label->mask = (uint8_t *)calloc(label->width * label->height, 1)) == NULL) 
+      return RET_MALLOC_FAILED;
+
+    x_offs = 0;
+    for(c = text; *c; c++) {
+      const gcache_glyph_t * glyph = gcache_get_glyph(atlas, *c);
+      for(row = 0; row < glyph->rows; row++)
+	memcpy(label->mask + row * label->width + x_offs, 
+	       atlas->mem + glyph->offset + row * glyph->width, glyph->width);
+      x_offs += glyph->width + 2;
+    }
+  }
+
+  if((label->text = strdup(text)) == NULL) return RET_MALLOC_FAILED;
+  return RET_OK;
+}
+
+/**
+ * Get the label for a string. The label is laid out, if it is not in the cache.
+ * The label is valid until the next call of gcache_get_label().
+ * @returns the label or NULL on failure
+ */
+const gcache_label_t * gcache_get_label(gcache_labels_t * lc, const char * const text) {
+  assert(lc != NULL);
+  assert(text != NULL);
+  if(lc == NULL || text == NULL) return NULL;
+
+  uint32_t hash = gcache_hash(text);
+  gcache_label_t * label = &lc->entries[hash % lc->num_entries];
+
+  if(label->text != NULL && label->hash == hash && !strcmp(label->text, text)) return label;
+
+  gcache_clear_label(label);
+  label->hash = hash;
+  if(RET_IS_NOT_OK(gcache_layout_label(lc->atlas, label, text))) {
+    gcache_clear_label(label);
+    return NULL;
+  }
+  return label;
+}
+
+static inline uint32_t gcache_blend(uint32_t bg_col, uint32_t col, uint8_t alpha) {
+  uint8_t r = ((0xff - alpha) * MASK_R(bg_col) + alpha * MASK_R(col)) >> 8;
+  uint8_t g = ((0xff - alpha) * MASK_G(bg_col) + alpha * MASK_G(col)) >> 8;
+  uint8_t b = ((0xff - alpha) * MASK_B(bg_col) + alpha * MASK_B(col)) >> 8;
+  return MERGE_CHANNELS(r, g, b, 0xffU);
+}
+
+/**
+ * Blend a span of pixels with a color. The alpha values are taken from the 
+ * coverage mask. Pixels with zero coverage are not changed.
+ */
+static void gcache_blend_span(uint32_t * dst, const uint8_t * coverage, unsigned int width, 
+			      uint32_t color) {
+  unsigned int x = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi16(0xff);
+  const __m128i opaque = _mm_set1_epi32(0xff000000);
+  const __m128i col = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+
+  for(; x + 4 <= width; x += 4) {
+    uint32_t cov4;
+    memcpy(&cov4, coverage + x, sizeof(cov4));
+    if(cov4 == 0) continue;
+
+    // replicate each coverage value to the four channels of its pixel
+    __m128i a = _mm_cvtsi32_si128(cov4);
+    a = _mm_unpacklo_epi8(a, a);
+    a = _mm_unpacklo_epi16(a, a);
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+    __m128i pix = _mm_loadu_si128((const __m128i *)(dst + x));
+    __m128i p_lo = _mm_unpacklo_epi8(pix, zero);
+    __m128i p_hi = _mm_unpackhi_epi8(pix, zero);
+
+    // (0xff - a) * p + a * c fits into an unsigned 16 bit word
+    p_lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(ff, a_lo), p_lo),
+					_mm_mullo_epi16(a_lo, col)), 8);
+    p_hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(ff, a_hi), p_hi),
+					_mm_mullo_epi16(a_hi, col)), 8);
+    __m128i res = _mm_or_si128(_mm_packus_epi16(p_lo, p_hi), opaque);
+
+    // keep pixels without coverage
+    __m128i keep = _mm_cmpeq_epi32(a, zero);
+    res = _mm_or_si128(_mm_and_si128(keep, pix), _mm_andnot_si128(keep, res));
+    _mm_storeu_si128((__m128i *)(dst + x), res);
+  }
+#endif
+
+  for(; x < width; x++)
+    if(coverage[x]) dst[x] = gcache_blend(dst[x], color, coverage[x]);
+}
+
+/**
+ * Draw a label. The upper left corner is given in screen coordinates. The label
+ * is clipped to the image.
+ */
+void gcache_draw_label(image_t * dst_img, const gcache_label_t * label, int x, int y, uint32_t color) {
+  assert(dst_img != NULL);
+  assert(label != NULL);
+  assert(dst_img->image_type == IMAGE_TYPE_RGBA);
+  if(dst_img == NULL || label == NULL || dst_img->image_type != IMAGE_TYPE_RGBA) return;
+
+  int from_x = MAX(x, 0), to_x = MIN(x + (int)label->width, (int)dst_img->width);
+  int from_y = MAX(y, 0), to_y = MIN(y + (int)label->height, (int)dst_img->height);
+  int _y;
+  if(from_x >= to_x) return;
+
+  for(_y = from_y; _y < to_y; _y++)
+    gcache_blend_span((uint32_t *)mm_get_ptr(dst_img->map, from_x, _y),
+		      label->mask + (_y - y) * label->width + (from_x - x),
+		      to_x - from_x, color);
+}
@@ -0,0 +1,77 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#ifndef __GLYPH_CACHE_H__
+#define __GLYPH_CACHE_H__
+
+#include <stdint.h>
+#include "globals.h"
+#include "graphics.h"
+
+/**
+ * Cache for rendered text. The glyph atlas holds the coverage masks of all
+ * characters for one font size. It is rendered once with FreeType and is
+ * read only afterwards, so it can be shared between threads.
+ *
+ * A label cache holds the coverage masks of complete strings, that are laid
+ * out from the atlas. Label caches are not thread safe. Each thread needs
+ * its own label cache.
+ */
+
+#define GCACHE_NUM_GLYPHS 256
+
+typedef struct {
+  unsigned int width, rows;
+  size_t offset; // position of the coverage mask in the atlas memory
+} gcache_glyph_t;
+
+typedef struct {
+  unsigned int size; // pixel size of the font
+  gcache_glyph_t glyphs[GCACHE_NUM_GLYPHS];
+  uint8_t * mem;
+} gcache_atlas_t;
+
+typedef struct {
+  char * text;         // NULL, if the entry is unused
+  uint32_t hash;
+  unsigned int width, height;
+  uint8_t * mask;      // width * height coverage values
+} gcache_label_t;
+
+typedef struct {
+  const gcache_atlas_t * atlas;
+  unsigned int num_entries;
+  gcache_label_t * entries;
+} gcache_labels_t;
+
+gcache_atlas_t * gcache_atlas_create(const char * const font_file, unsigned int size);
+void gcache_atlas_destroy(gcache_atlas_t * atlas);
+
+gcache_labels_t * gcache_labels_create(const gcache_atlas_t * atlas, unsigned int num_entries);
+void gcache_labels_destroy(gcache_labels_t * lc);
+
+const gcache_label_t * gcache_get_label(gcache_labels_t * lc, const char * const text);
+
+void gcache_draw_label(image_t * dst_img, const gcache_label_t * label, int x, int y, uint32_t color);
+
+#endif
@@ -33,9 +33,15 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "graphics.h"
 #include "memory_map.h"
+#include "image_view.h"
+#include "parallel.h"
 
 #ifdef HAVE_MMAP64
 #define MMAP mmap64
@@ -229,6 +235,17 @@ ret_t gr_map_temp_file(image_t * img, const char * const project_dir) {
   return mm_map_temp_file(img->map, project_dir);
 }
 
+/**
+ * Use memory from the scratch pool as storage for the image data.
+ * @see mm_map_scratch()
+ */
+ret_t gr_map_scratch(image_t * img, const char * const project_dir) {
+  
+  assert(img != NULL);
+  if(img == NULL) return RET_INV_PTR;
+  return mm_map_scratch(img->map, project_dir);
+}
+
 /**
  * Use storage in file as storage for image data
  */
@@ -306,12 +323,20 @@ ret_t gr_copy_image(image_t * dst_img, image_t * src_img,
   // real width and height for copy
   unsigned int width = MIN(MIN(max_x, src_img->width) - min_x, dst_img->width);
   unsigned int height = MIN(MIN(max_y, src_img->height) - min_y, dst_img->height);
-  unsigned int dst_x, dst_y;
 
-  for(dst_y = 0; dst_y < height; dst_y++)
-    for(dst_x = 0; dst_x < width; dst_x++)
-      gr_copy_pixel(dst_img, dst_x, dst_y, src_img, min_x + dst_x, min_y + dst_y);
-      
+  // dispatch once on the image types, the views handle the conversion
+  if(dst_img->image_type == IMAGE_TYPE_GS && src_img->image_type == IMAGE_TYPE_GS)
+    imgview_copy(gs_view_t(dst_img), gs_view_t(src_img), min_x, min_y, width, height);
+  else if(dst_img->image_type == IMAGE_TYPE_RGBA && src_img->image_type == IMAGE_TYPE_RGBA)
+    imgview_copy(rgba_view_t(dst_img), rgba_view_t(src_img), min_x, min_y, width, height);
+  else if(dst_img->image_type == IMAGE_TYPE_RGBA && src_img->image_type == IMAGE_TYPE_GS)
+    imgview_copy(rgba_view_t(dst_img), gs_view_t(src_img), min_x, min_y, width, height);
+  else if(dst_img->image_type == IMAGE_TYPE_GS && src_img->image_type == IMAGE_TYPE_RGBA)
+    imgview_copy(gs_view_t(dst_img), rgba_view_t(src_img), min_x, min_y, width, height);
+  else {
+    debug(TM, "copying images of this type is not implemented");
+    return RET_ERR;
+  }
 
   return RET_OK;
 }
@@ -383,55 +408,195 @@ void gr_copy_pixel(image_t * dst_img, unsigned int dst_x, unsigned int dst_y,
 		   
 
 
-/* imports a graphics file, decompress it and store data
-   in a new file */
+/**
+ * Get the dimension of an image file without decoding the image data.
+ * @returns RET_OK on success
+ */
+ret_t gr_get_image_file_size(const char * const filename, unsigned int * width, unsigned int * height) {
+  assert(filename != NULL && width != NULL && height != NULL);
+  if(filename == NULL || width == NULL || height == NULL) return RET_INV_PTR;
+
+  MagickWandGenesis();
+  MagickWand * magick_wand = NewMagickWand();
+  ret_t ret = RET_OK;
+
+  if(MagickPingImage(magick_wand, filename) == MagickFalse) {
+    debug(TM, "Can't read image file %s", filename);
+    ret = RET_ERR;
+  }
+  else {
+    *width = MagickGetImageWidth(magick_wand);
+    *height = MagickGetImageHeight(magick_wand);
+  }
+
+  magick_wand = DestroyMagickWand(magick_wand);
+  return ret;
+}
+
+/* Number of image rows, that are fetched from the image library with a single call. */
+#define IMPORT_BAND_HEIGHT 128
+
+/* If an image has more pixels, ImageMagick is told to keep its pixel cache on disk. */
+#define IMPORT_MAX_PIXELS_IN_MEMORY (64 * 1024 * 1024)
+
+typedef struct {
+  image_t * img;
+  MagickWand * magick_wand;
+  unsigned int offs_x, offs_y;
+  unsigned int width, height; // clipped region to import
+
+  pthread_mutex_t mutex; // protects the wand and the progress counter
+  unsigned int num_bands;
+  unsigned int bands_done;
+  gr_progress_func_t progress_func;
+  void * progress_arg;
+} import_params_t;
+
+static ret_t import_band(unsigned int band, void * arg) {
+  import_params_t * params = (import_params_t *)arg;
+  unsigned int min_y = band * IMPORT_BAND_HEIGHT;
+  unsigned int rows = MIN(IMPORT_BAND_HEIGHT, params->height - min_y);
+  unsigned int y;
+  MagickBooleanType status;
+
+  uint32_t * buffer = (uint32_t *)malloc((size_t)params->width * rows * sizeof(uint32_t));
+  if(buffer == NULL) return RET_MALLOC_FAILED;
+
+  // the decoding is serialized, the conversion runs in parallel
+  pthread_mutex_lock(&params->mutex);
+  status = MagickExportImagePixels(params->magick_wand, 0, min_y, params->width, rows, 
+				   "RGBA", CharPixel, buffer);
+  pthread_mutex_unlock(&params->mutex);
+
+  if(status == MagickFalse) {
+    debug(TM, "Can't read pixel rows %d .. %d", min_y, min_y + rows);
+    free(buffer);
+    return RET_ERR;
+  }
+
+  for(y = 0; y < rows; y++) {
+    void * dst = mm_get_ptr(params->img->map, params->offs_x, params->offs_y + min_y + y);
+    const uint32_t * src = buffer + (size_t)y * params->width;
+
+    if(params->img->image_type == IMAGE_TYPE_GS)
+      imgview_convert_row<IMAGE_TYPE_GS, IMAGE_TYPE_RGBA>((uint8_t *)dst, src, params->width);
+    else
+      imgview_convert_row<IMAGE_TYPE_RGBA, IMAGE_TYPE_RGBA>((uint32_t *)dst, src, params->width);
+  }
+
+  free(buffer);
 
+  pthread_mutex_lock(&params->mutex);
+  params->bands_done++;
+  if(params->progress_func != NULL) 
+    (*params->progress_func)((double)params->bands_done / (double)params->num_bands, 
+			     params->progress_arg);
+  pthread_mutex_unlock(&params->mutex);
 
+  return RET_OK;
+}
+
+/* The resource limits are process wide, but several images may be imported
+   concurrently. The first large import lowers the limits, the last one restores
+   them. */
+static pthread_mutex_t import_limits_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int import_limits_refs = 0;
+static MagickSizeType import_memory_limit, import_map_limit;
+
+static void import_lower_limits() {
+  pthread_mutex_lock(&import_limits_mutex);
+  if(import_limits_refs++ == 0) {
+    import_memory_limit = MagickGetResourceLimit(MemoryResource);
+    import_map_limit = MagickGetResourceLimit(MapResource);
+    MagickSetResourceLimit(MemoryResource, IMPORT_MAX_PIXELS_IN_MEMORY);
+    MagickSetResourceLimit(MapResource, 2 * (MagickSizeType)IMPORT_MAX_PIXELS_IN_MEMORY);
+  }
+  pthread_mutex_unlock(&import_limits_mutex);
+}
+
+static void import_restore_limits() {
+  pthread_mutex_lock(&import_limits_mutex);
+  assert(import_limits_refs > 0);
+  if(--import_limits_refs == 0) {
+    MagickSetResourceLimit(MemoryResource, import_memory_limit);
+    MagickSetResourceLimit(MapResource, import_map_limit);
+  }
+  pthread_mutex_unlock(&import_limits_mutex);
+}
+
+/**
+ * Import a graphics file, decompress it and store the data into the image at position
+ * (offs_x, offs_y). Pixel data is fetched in bands of rows. The bands are converted and 
+ * stored in parallel. For very large images ImageMagick is limited to a disk based pixel 
+ * cache, so that the decoded image must not fit into memory.
+ * @param progress_func a callback to report the progress or NULL
+ * @param progress_arg argument for the progress callback
+ */
 ret_t gr_import_background_image(image_t * img, 
 				 unsigned int offs_x, unsigned int offs_y,
-				 const char * const filename) {
+				 const char * const filename,
+				 gr_progress_func_t progress_func, void * progress_arg) {
   MagickWand *magick_wand;
   MagickBooleanType status;
-  unsigned int src_x, src_y;
-	
+  ret_t ret;
+
   assert(img != NULL);
   assert(img->map != NULL);
-  if(img == NULL || img->map == NULL) return RET_INV_PTR;
+  assert(filename != NULL);
+  if(img == NULL || img->map == NULL || filename == NULL) return RET_INV_PTR;
+  if(img->image_type != IMAGE_TYPE_GS && img->image_type != IMAGE_TYPE_RGBA) {
+    debug(TM, "import for this image type is not implemented");
+    return RET_ERR;
+  }
+  if(offs_x >= img->width || offs_y >= img->height) return RET_ERR;
+
   MagickWandGenesis();
 	
-  magick_wand = NewMagickWand();  
-  status = MagickReadImage(magick_wand, filename);
+  magick_wand = NewMagickWand();
+
+  // get the image dimensions without decoding the image
+  status = MagickPingImage(magick_wand, filename);
   if(status == MagickFalse) ThrowWandException(magick_wand);
-	
+
   unsigned int width = MagickGetImageWidth(magick_wand);
   unsigned int height = MagickGetImageHeight(magick_wand);
-	
-  uint32_t pixel;
-
-  for(src_y = 0; src_y < MIN(height, img->height); src_y++) {
-    for(src_x = 0; src_x < MIN(width, img->width); src_x++) {
-
-      uint8_t * ptr = (uint8_t *)mm_get_ptr(img->map, src_x + offs_x, src_y + offs_y);
-      MagickGetImagePixels(magick_wand, src_x, src_y, 1, 1, "RGBA", CharPixel, &pixel);
-
-      switch(img->image_type) {
-      case IMAGE_TYPE_GS:
-	*ptr = RGBA_TO_GS(&pixel);
-	break;
-      case IMAGE_TYPE_RGBA:
-	*(uint32_t *)ptr = pixel;
-	break;
-      default:
-	puts("not implemented");
-	exit(1);
-      }
-     
-    }
+  ClearMagickWand(magick_wand);
+
+  // the resource limits are restored after the import
+  int limits_changed = (uint64_t)width * (uint64_t)height > IMPORT_MAX_PIXELS_IN_MEMORY;
+
+  if(limits_changed) {
+    debug(TM, "large image: %d x %d. Using a disk based pixel cache.", width, height);
+    import_lower_limits();
   }
-  
+
+  status = MagickReadImage(magick_wand, filename);
+  if(status == MagickFalse) ThrowWandException(magick_wand);
+	
+  import_params_t params;
+  params.img = img;
+  params.magick_wand = magick_wand;
+  params.offs_x = offs_x;
+  params.offs_y = offs_y;
+  params.width = MIN(width, img->width - offs_x);
+  params.height = MIN(height, img->height - offs_y);
+  params.num_bands = (params.height + IMPORT_BAND_HEIGHT - 1) / IMPORT_BAND_HEIGHT;
+  params.bands_done = 0;
+  params.progress_func = progress_func;
+  params.progress_arg = progress_arg;
+  pthread_mutex_init(&params.mutex, NULL);
+
+  MM_ACCESS_PATTERN prev_pattern = mm_get_access_pattern(img->map);
+  mm_advise(img->map, MM_ACCESS_SEQUENTIAL);
+  ret = par_run(params.num_bands, &import_band, &params);
+  mm_advise(img->map, prev_pattern);
+
+  pthread_mutex_destroy(&params.mutex);
   magick_wand = DestroyMagickWand(magick_wand);
+
+  if(limits_changed) import_restore_limits();
   //MagickWandTerminus();
-  return RET_OK;
+  return ret;
 }
 
 
@@ -464,14 +629,12 @@ void gr_set_pixval(image_t * img, unsigned int x, unsigned int y, uint32_t pix)
  * Works like the gr_get_pixval() function, but returns greyscaled pixel value.
  */
 uint8_t gr_get_greyscale_pixval(const image_t * const img, unsigned int x, unsigned int y) {
-  if(img->image_type == IMAGE_TYPE_RGBA) {
-    uint32_t * ptr = (uint32_t *)mm_get_ptr(img->map, x, y);
-    return RGBA_TO_GS(ptr);
-  }
-  else if(img->image_type == IMAGE_TYPE_GS) {
-    return *(uint8_t *)mm_get_ptr(img->map, x, y);
-  }
-  else {
+  switch(img->image_type) {
+  case IMAGE_TYPE_RGBA:
+    return rgba_view_t(img).get_gs(x, y);
+  case IMAGE_TYPE_GS:
+    return gs_view_t(img).get_gs(x, y);
+  default:
     puts("not implemented");
     exit(1);
   }
@@ -507,85 +670,342 @@ ret_t gr_scale_and_shift_in_place(image_t *img,
   return mm_scale_and_shift_in_place(img->map, scaling_x, scaling_y, shift_x, shift_y);
 }
 
+/* Edge length of the destination tiles, that are resampled in parallel. */
+#define RESAMPLE_TILE_SIZE 256
+
+typedef struct {
+  image_t * src;
+  image_t * dst;
+  double scaling_x, scaling_y;
+  double shift_x, shift_y;
+  GR_INTERPOLATION interpolation;
+  unsigned int tiles_x;
+} resample_params_t;
+
+/**
+ * Map a destination coordinate to the source image. For nearest neighbour sampling
+ * the weight is always zero. Returns 0, if the coordinate is outside of the source.
+ * The weight is an 8 bit fraction of the distance between src and src + 1.
+ */
+static int resample_coord(const resample_params_t * params, double pos, unsigned int src_len, 
+			  int * src, unsigned int * weight) {
+  if(params->interpolation == GR_INTERPOLATION_NEAREST) {
+    long p = lrint(pos);
+    if(p < 0 || p >= (long)src_len) return 0;
+    *src = p;
+    *weight = 0;
+  }
+  else {
+    double f = floor(pos);
+    if(f < 0 || f >= (double)src_len) return 0;
+    *src = (int)f;
+    *weight = (unsigned int)lrint((pos - f) * 256.0);
+    if(*weight == 256) { // rounded up to the next pixel
+      *weight = 0;
+      if(++*src >= (int)src_len) return 0;
+    }
+    if(*src == (int)src_len - 1) *weight = 0;
+  }
+  return 1;
+}
+
+/** Blend two RGBA pixels. Two channels are weighted with a single multiplication. */
+static inline uint32_t resample_lerp_rgba(uint32_t a, uint32_t b, unsigned int w) {
+  if(w == 0) return a;
+  uint32_t rb = ((a & 0x00ff00ffU) * (256 - w) + (b & 0x00ff00ffU) * w + 0x00800080U) >> 8;
+  uint32_t ga = ((a >> 8) & 0x00ff00ffU) * (256 - w) + ((b >> 8) & 0x00ff00ffU) * w + 0x00800080U;
+  return (rb & 0x00ff00ffU) | (ga & 0xff00ff00U);
+}
+
+static inline uint8_t resample_lerp_gs(uint8_t a, uint8_t b, unsigned int w) {
+  return (a * (256 - w) + b * w + 128) >> 8;
+}
+
+template<IMAGE_TYPE type>
+static void resample_tile(const resample_params_t * params, 
+			  unsigned int min_x, unsigned int min_y, 
+			  unsigned int max_x, unsigned int max_y) {
+
+  typedef typename image_view<type>::pixel_t pixel_t;
+  image_view<type> src(params->src);
+  image_view<type> dst(params->dst);
+
+  // the horizontal source positions are the same for all rows of the tile
+  int src_x[RESAMPLE_TILE_SIZE];
+  unsigned int weight_x[RESAMPLE_TILE_SIZE];
+  int valid_x[RESAMPLE_TILE_SIZE];
+  unsigned int x, y;
+
+  for(x = min_x; x <= max_x; x++)
+    valid_x[x - min_x] = resample_coord(params, ((double)x - params->shift_x) / params->scaling_x,
+					src.width, &src_x[x - min_x], &weight_x[x - min_x]);
+
+  for(y = min_y; y <= max_y; y++) {
+    pixel_t * dst_row = dst.row(y);
+    int sy;
+    unsigned int wy;
+
+    if(!resample_coord(params, ((double)y - params->shift_y) / params->scaling_y,
+		       src.height, &sy, &wy)) {
+      memset(dst_row + min_x, 0, (max_x - min_x + 1) * sizeof(pixel_t));
+      continue;
+    }
+
+    const pixel_t * row0 = src.row(sy);
+    const pixel_t * row1 = wy > 0 ? src.row(sy + 1) : row0;
+
+    for(x = min_x; x <= max_x; x++) {
+      unsigned int i = x - min_x;
+      if(!valid_x[i]) 
+	dst_row[x] = 0;
+      else if(params->interpolation == GR_INTERPOLATION_NEAREST)
+	dst_row[x] = row0[src_x[i]];
+      else {
+	unsigned int sx = src_x[i], sx1 = weight_x[i] > 0 ? sx + 1 : sx;
+	if(type == IMAGE_TYPE_RGBA)
+	  dst_row[x] = resample_lerp_rgba(resample_lerp_rgba(row0[sx], row0[sx1], weight_x[i]),
+					  resample_lerp_rgba(row1[sx], row1[sx1], weight_x[i]), wy);
+	else
+	  dst_row[x] = resample_lerp_gs(resample_lerp_gs(row0[sx], row0[sx1], weight_x[i]),
+					resample_lerp_gs(row1[sx], row1[sx1], weight_x[i]), wy);
+      }
+    }
+  }
+}
+
+static ret_t resample_tile_job(unsigned int job, void * arg) {
+  resample_params_t * params = (resample_params_t *)arg;
+  unsigned int min_x = (job % params->tiles_x) * RESAMPLE_TILE_SIZE;
+  unsigned int min_y = (job / params->tiles_x) * RESAMPLE_TILE_SIZE;
+  unsigned int max_x = MIN(min_x + RESAMPLE_TILE_SIZE, params->dst->width) - 1;
+  unsigned int max_y = MIN(min_y + RESAMPLE_TILE_SIZE, params->dst->height) - 1;
+
+  if(params->src->image_type == IMAGE_TYPE_RGBA)
+    resample_tile<IMAGE_TYPE_RGBA>(params, min_x, min_y, max_x, max_y);
+  else
+    resample_tile<IMAGE_TYPE_GS>(params, min_x, min_y, max_x, max_y);
+  return RET_OK;
+}
+
+/**
+ * Out of place scaling and translation. A destination pixel (x, y) is taken from
+ * the source position ((x - shift_x) / scaling_x, (y - shift_y) / scaling_y).
+ * Destination pixels, that are not covered by the source image are set to zero.
+ * In contrast to gr_scale_and_shift_in_place() the image may be shrunk, too.
+ * Tiles of the destination image are processed in parallel. Tiles are enumerated
+ * row by row, so the source image is read approximately in sequential order.
+ * @param dst the destination image. It must have the same image type as the 
+ *   source image, but it might have a different size.
+ */
+ret_t gr_resample_affine(image_t * src, image_t * dst,
+			 double scaling_x, double scaling_y, 
+			 double shift_x, double shift_y,
+			 GR_INTERPOLATION interpolation) {
+  assert(src != NULL);
+  assert(dst != NULL);
+  if(src == NULL || dst == NULL) return RET_INV_PTR;
+  assert(src != dst);
+  assert(src->image_type == dst->image_type);
+  if(src == dst || src->image_type != dst->image_type) return RET_ERR;
+
+  if(src->image_type != IMAGE_TYPE_RGBA && src->image_type != IMAGE_TYPE_GS) {
+    debug(TM, "resampling of this image type is not implemented");
+    return RET_ERR;
+  }
+
+  assert(scaling_x > 0 && scaling_y > 0);
+  if(scaling_x <= 0 || scaling_y <= 0) return RET_ERR;
+  if(dst->width == 0 || dst->height == 0) return RET_OK;
+
+  debug(TM, "resampling: sx=%f sy=%f dx=%f dy=%f", scaling_x, scaling_y, shift_x, shift_y);
 
-#define P3(s) (s < 0 ? 0 : pow(s, 3))
-#define CUBICAL_WEIGHTING(s) (1.0/6.0 * ( P3(s+2.) - 4.*P3(s+1.) + 6.*P3(s) - 4.*P3(s-1.)))
+  resample_params_t params = { src, dst, scaling_x, scaling_y, shift_x, shift_y, interpolation,
+			       (dst->width + RESAMPLE_TILE_SIZE - 1) / RESAMPLE_TILE_SIZE };
+  unsigned int tiles_y = (dst->height + RESAMPLE_TILE_SIZE - 1) / RESAMPLE_TILE_SIZE;
 
-uint8_t ROUND_AND_CHECK_LIMITS(double val) {
-  int v = rint(val);
-  if(v > 255) return 255;
-  else if(v < 0) return 0;
-  else return v;
+  return par_run(params.tiles_x * tiles_y, &resample_tile_job, &params);
 }
 
+
 /**
  * Scale a source image to destination image. The function implements a bicubic interpolation.
- * 
+ * Both images must have the same image type.
  */
 
 ret_t gr_scale_image(image_t * src, image_t * dst) {
   assert(src != NULL);
   assert(dst != NULL);
-  assert(src->image_type == IMAGE_TYPE_RGBA);
-  assert(dst->image_type == IMAGE_TYPE_RGBA);
   if(src == NULL || dst == NULL) return RET_INV_PTR;
-  if(src->image_type != IMAGE_TYPE_RGBA || dst->image_type != IMAGE_TYPE_RGBA) {
-    debug(TM, "scaling of not RGBA type images is not implemented");
+  assert(src->image_type == dst->image_type);
+  if(src->image_type != dst->image_type) return RET_ERR;
+
+  debug(TM, "\tscaling: sx=%f sy=%f", 
+	(double)src->width / (double)dst->width, (double)src->height / (double)dst->height);
+
+  switch(src->image_type) {
+  case IMAGE_TYPE_GS:
+    imgview_scale_bicubic(gs_view_t(dst), gs_view_t(src));
+    break;
+  case IMAGE_TYPE_RGBA:
+    imgview_scale_bicubic(rgba_view_t(dst), rgba_view_t(src));
+    break;
+  default:
+    debug(TM, "scaling of this image type is not implemented");
     return RET_ERR;
   }
+  
+  return RET_OK;
+}
 
-  unsigned int dst_x, dst_y;
-  double scaling_x = src->width / dst->width;
-  double scaling_y = src->height / dst->height;
-
-  debug(TM, "\tscaling: sx=%f sy=%f", scaling_x, scaling_y);
-
-  for(dst_y = 0; dst_y < dst->height; dst_y++) {
-    double src_y = (double)dst_y * scaling_y;
-    int src_j = lrint(src_y);
-    double src_dy = src_y - src_j;
-
-    for(dst_x = 0; dst_x < dst->width; dst_x++) {
-      double src_x = (double)dst_x * scaling_x;
-      int src_i = lrint(src_x);
-      double src_dx = src_x - src_i;
-      
-      int m, n;
-      double F_dsti_dstj_R = 0;
-      double F_dsti_dstj_G = 0;
-      double F_dsti_dstj_B = 0;
-      double weight;
-      uint32_t pix;
-
-      for(m = -1; m <= 2; m++)
-	for(n = -1; n <= 2; n++) {
-
-	  pix = 0;
-	  if(src_x > 1 && src_y > 1 &&
-	     src_x < src->width - 2 && src_y < src->height - 2) 
-	    pix = gr_get_pixval(src, src_x + m, src_y + n);
-	  
-	  weight = 
-	    CUBICAL_WEIGHTING((double)m - src_dx) * 
-	    CUBICAL_WEIGHTING(src_dy - (double)n);
-
-	  F_dsti_dstj_R += (double)MASK_R(pix) * weight;
-	  F_dsti_dstj_G += (double)MASK_G(pix) * weight;
-	  F_dsti_dstj_B += (double)MASK_B(pix) * weight;
-	}
-
-      pix = MERGE_CHANNELS(ROUND_AND_CHECK_LIMITS(F_dsti_dstj_R),
-			   ROUND_AND_CHECK_LIMITS(F_dsti_dstj_G),
-			   ROUND_AND_CHECK_LIMITS(F_dsti_dstj_B),
-			   MASK_A(pix));
-      //debug(TM, "%X", pix );
-      gr_set_pixval(dst, dst_x, dst_y, pix);
-    }
+/* Number of destination rows per job for gr_downsample(). */
+#define DOWNSAMPLE_BAND_HEIGHT 64
+
+typedef struct {
+  image_t * src;
+  image_t * dst;
+  unsigned int min_x, min_y, max_x, max_y;
+} downsample_params_t;
+
+static void downsample_row_rgba(const uint32_t * row0, const uint32_t * row1, 
+				uint32_t * dst, unsigned int dst_width) {
+  unsigned int x = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+
+  // 8 source pixels from each row give 4 destination pixels
+  for(; x + 4 <= dst_width; x += 4) {
+    __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(row0 + 2 * x)));
+    __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(row0 + 2 * x + 4)));
+    __m128 c = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(row1 + 2 * x)));
+    __m128 d = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(row1 + 2 * x + 4)));
+
+    __m128i even0 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd0 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i even1 = _mm_castps_si128(_mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd1 = _mm_castps_si128(_mm_shuffle_ps(c, d, _MM_SHUFFLE(3, 1, 3, 1)));
+
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero)),
+			       _mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero)),
+			       _mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+#endif
+
+  for(; x < dst_width; x++) {
+    uint32_t p0 = row0[2 * x], p1 = row0[2 * x + 1], p2 = row1[2 * x], p3 = row1[2 * x + 1];
+    dst[x] = MERGE_CHANNELS(((MASK_R(p0) + MASK_R(p1) + MASK_R(p2) + MASK_R(p3) + 2) >> 2),
+			    ((MASK_G(p0) + MASK_G(p1) + MASK_G(p2) + MASK_G(p3) + 2) >> 2),
+			    ((MASK_B(p0) + MASK_B(p1) + MASK_B(p2) + MASK_B(p3) + 2) >> 2),
+			    ((MASK_A(p0) + MASK_A(p1) + MASK_A(p2) + MASK_A(p3) + 2) >> 2));
+  }
+}
+
+/**
+ * Average 2x2 blocks of two greyscale source rows into one destination row.
+ */
+static void downsample_row_gs(const uint8_t * row0, const uint8_t * row1, 
+			      uint8_t * dst, unsigned int dst_width) {
+  unsigned int x = 0;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi16(0xff);
+  const __m128i two = _mm_set1_epi16(2);
+
+  // 32 source pixels from each row give 16 destination pixels
+  for(; x + 16 <= dst_width; x += 16) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + 2 * x));
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + 2 * x + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + 2 * x));
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + 2 * x + 16));
+
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, mask), _mm_srli_epi16(a0, 8)),
+			       _mm_add_epi16(_mm_and_si128(b0, mask), _mm_srli_epi16(b0, 8)));
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, mask), _mm_srli_epi16(a1, 8)),
+			       _mm_add_epi16(_mm_and_si128(b1, mask), _mm_srli_epi16(b1, 8)));
+
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+#endif
+
+  for(; x < dst_width; x++)
+    dst[x] = (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2;
+}
+
+static ret_t downsample_band(unsigned int band, void * arg) {
+  downsample_params_t * params = (downsample_params_t *)arg;
+  image_t * src = params->src;
+  image_t * dst = params->dst;
+  unsigned int x = params->min_x, width = params->max_x - params->min_x + 1;
+  unsigned int y = params->min_y + band * DOWNSAMPLE_BAND_HEIGHT;
+  unsigned int max_y = MIN(y + DOWNSAMPLE_BAND_HEIGHT - 1, params->max_y);
+
+  for(; y <= max_y; y++) {
+    if(src->image_type == IMAGE_TYPE_RGBA)
+      downsample_row_rgba((const uint32_t *)mm_get_ptr(src->map, 2 * x, 2 * y),
+			  (const uint32_t *)mm_get_ptr(src->map, 2 * x, 2 * y + 1),
+			  (uint32_t *)mm_get_ptr(dst->map, x, y), width);
+    else
+      downsample_row_gs((const uint8_t *)mm_get_ptr(src->map, 2 * x, 2 * y),
+			(const uint8_t *)mm_get_ptr(src->map, 2 * x, 2 * y + 1),
+			(uint8_t *)mm_get_ptr(dst->map, x, y), width);
   }
-  
   return RET_OK;
 }
 
+/**
+ * Scale a region of an image down by a factor of two with a 2x2 box filter. The
+ * destination image must have half the size of the source image (rounded down).
+ * Bands of rows are processed in parallel.
+ * @param min_x, min_y, max_x, max_y the region in destination image coordinates. 
+ *   The upper bounds are inclusive.
+ */
+ret_t gr_downsample_region(image_t * src, image_t * dst, 
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y) {
+  assert(src != NULL);
+  assert(dst != NULL);
+  if(src == NULL || dst == NULL) return RET_INV_PTR;
+
+  assert(src->image_type == dst->image_type);
+  assert(dst->width == src->width / 2 && dst->height == src->height / 2);
+  if(src->image_type != dst->image_type || 
+     dst->width != src->width / 2 || dst->height != src->height / 2) return RET_ERR;
+
+  if(src->image_type != IMAGE_TYPE_RGBA && src->image_type != IMAGE_TYPE_GS) {
+    debug(TM, "downsampling of this image type is not implemented");
+    return RET_ERR;
+  }
+
+  assert(min_x <= max_x && min_y <= max_y);
+  assert(max_x < dst->width && max_y < dst->height);
+  if(min_x > max_x || min_y > max_y || max_x >= dst->width || max_y >= dst->height) 
+    return RET_ERR;
+
+  downsample_params_t params = { src, dst, min_x, min_y, max_x, max_y };
+  return par_run((max_y - min_y + DOWNSAMPLE_BAND_HEIGHT) / DOWNSAMPLE_BAND_HEIGHT, 
+		 &downsample_band, &params);
+}
+
+/**
+ * Scale an image down by a factor of two with a 2x2 box filter.
+ * @see gr_downsample_region()
+ */
+ret_t gr_downsample(image_t * src, image_t * dst) {
+  assert(src != NULL);
+  assert(dst != NULL);
+  if(src == NULL || dst == NULL) return RET_INV_PTR;
+  if(dst->width == 0 || dst->height == 0) return RET_OK;
+  return gr_downsample_region(src, dst, 0, 0, dst->width - 1, dst->height - 1);
+}
+
 /** In-place flipping of RBGA an GS images. */
 ret_t gr_flip_up_down(image_t * img) {
   assert(img != NULL);
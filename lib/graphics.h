@@ -65,6 +65,12 @@ struct image {
 
 typedef struct image image_t;
 
+/** Interpolation methods for gr_resample_affine(). */
+enum GR_INTERPOLATION {
+  GR_INTERPOLATION_NEAREST = 0,
+  GR_INTERPOLATION_BILINEAR = 1
+};
+
 image_t * gr_create_image(unsigned int width, unsigned int height, IMAGE_TYPE image_type);
 image_t * gr_create_memory_image(unsigned int width, unsigned int height, IMAGE_TYPE image_type);
 
@@ -81,6 +87,7 @@ ret_t gr_destroy_and_unlink(image_t * img);
 ret_t gr_map_clear(image_t * img);
 
 ret_t gr_map_temp_file(image_t * img, const char * const project_dir);
+ret_t gr_map_scratch(image_t * img, const char * const project_dir);
 ret_t gr_map_file(image_t * img, const char * const project_dir, const char * const filename);
 ret_t gr_map_file_by_fd(image_t * img, const char * const project_dir, int fd, const char * const filename);
 
@@ -92,9 +99,18 @@ ret_t gr_copy_image(image_t * dst_img, image_t * src_img,
 
 ret_t gr_clone_image_data(image_t * dst_img, image_t * src_img);
 
+/**
+ * Progress callback for long running operations. The progress is a value between 0 and 1.
+ * The callback might be called from worker threads.
+ */
+typedef void (*gr_progress_func_t)(double progress, void * arg);
+
+ret_t gr_get_image_file_size(const char * const filename, unsigned int * width, unsigned int * height);
+
 ret_t gr_import_background_image(image_t * img, 
 				 unsigned int offs_x, unsigned int offs_y,
-				 const char * const filename);
+				 const char * const filename,
+				 gr_progress_func_t progress_func, void * progress_arg);
 
 
 
@@ -116,7 +132,16 @@ ret_t gr_scale_and_shift_in_place(image_t *img,
 				  double scaling_x, double scaling_y, 
 				  unsigned int shift_x, unsigned int shift_y);
 
+ret_t gr_resample_affine(image_t * src, image_t * dst,
+			 double scaling_x, double scaling_y, 
+			 double shift_x, double shift_y,
+			 GR_INTERPOLATION interpolation);
+
 ret_t gr_scale_image(image_t * src, image_t * dst);
+ret_t gr_downsample(image_t * src, image_t * dst);
+ret_t gr_downsample_region(image_t * src, image_t * dst, 
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y);
 
 ret_t gr_flip_left_right(image_t * image);
 ret_t gr_flip_up_down(image_t * image);
@@ -0,0 +1,216 @@
+/*
+
+This file is part of the IC reverse engineering tool degate.
+
+Copyright 2008, 2009 by Martin Schobert
+
+Degate is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+Degate is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with degate. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __IMAGE_VIEW_H__
+#define __IMAGE_VIEW_H__
+
+/**
+ * Typed views on image data. An image_view<IMAGE_TYPE_GS> or image_view<IMAGE_TYPE_RGBA>
+ * is created once per call from an image_t and gives inline access to pixels and rows,
+ * so hot loops do not have to branch on image_t::image_type for every pixel.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "graphics.h"
+
+template<IMAGE_TYPE type> struct image_pixel_traits;
+
+/** Pixel traits for greyscale images: one byte per pixel. */
+template<> struct image_pixel_traits<IMAGE_TYPE_GS> {
+  typedef uint8_t pixel_t;
+
+  static inline uint8_t to_gs(pixel_t pix) { return pix; }
+  static inline uint32_t to_rgba(pixel_t pix) { return MERGE_CHANNELS(pix, pix, pix, 0xffU); }
+  static inline pixel_t from_gs(uint8_t gs_val) { return gs_val; }
+  static inline pixel_t from_rgba(uint32_t pix) { return RGBA_TO_GS(&pix); }
+};
+
+/** Pixel traits for RGBA images: one 32 bit word per pixel. */
+template<> struct image_pixel_traits<IMAGE_TYPE_RGBA> {
+  typedef uint32_t pixel_t;
+
+  static inline uint8_t to_gs(pixel_t pix) { return RGBA_TO_GS(&pix); }
+  static inline uint32_t to_rgba(pixel_t pix) { return pix; }
+  static inline pixel_t from_gs(uint8_t gs_val) { return MERGE_CHANNELS(gs_val, gs_val, gs_val, 0xffU); }
+  static inline pixel_t from_rgba(uint32_t pix) { return pix; }
+};
+
+/**
+ * A view on the pixel data of an image with a compile time image type. The view
+ * does not own the data. It is only valid as long as the mapping of the image
+ * does not change.
+ */
+template<IMAGE_TYPE type>
+struct image_view {
+  typedef image_pixel_traits<type> traits;
+  typedef typename traits::pixel_t pixel_t;
+
+  unsigned int width, height;
+  pixel_t * mem;
+
+  image_view(const image_t * const img) :
+    width(img->width), height(img->height), mem((pixel_t *)img->map->mem) {
+    assert(img->image_type == type);
+    assert(img->map->bytes_per_elem == sizeof(pixel_t));
+  }
+
+  inline pixel_t * row(unsigned int y) const { return mem + (size_t)y * width; }
+  inline pixel_t * ptr(unsigned int x, unsigned int y) const { return row(y) + x; }
+
+  inline pixel_t get(unsigned int x, unsigned int y) const { return *ptr(x, y); }
+  inline void set(unsigned int x, unsigned int y, pixel_t pix) const { *ptr(x, y) = pix; }
+
+  inline uint8_t get_gs(unsigned int x, unsigned int y) const { return traits::to_gs(get(x, y)); }
+  inline uint32_t get_rgba(unsigned int x, unsigned int y) const { return traits::to_rgba(get(x, y)); }
+
+  inline void set_gs(unsigned int x, unsigned int y, uint8_t gs_val) const {
+    set(x, y, traits::from_gs(gs_val));
+  }
+};
+
+typedef image_view<IMAGE_TYPE_GS> gs_view_t;
+typedef image_view<IMAGE_TYPE_RGBA> rgba_view_t;
+
+
+/** Convert a single pixel from source to destination pixel type. */
+template<IMAGE_TYPE dst_type, IMAGE_TYPE src_type>
+inline typename image_pixel_traits<dst_type>::pixel_t
+imgview_convert_pixel(typename image_pixel_traits<src_type>::pixel_t pix) {
+  return image_pixel_traits<dst_type>::from_rgba(image_pixel_traits<src_type>::to_rgba(pix));
+}
+
+template<>
+inline uint8_t imgview_convert_pixel<IMAGE_TYPE_GS, IMAGE_TYPE_GS>(uint8_t pix) { return pix; }
+
+template<>
+inline uint8_t imgview_convert_pixel<IMAGE_TYPE_GS, IMAGE_TYPE_RGBA>(uint32_t pix) { return RGBA_TO_GS(&pix); }
+
+
+/**
+ * Copy a row of width pixels with implicit type conversion. Rows of the same
+ * type are copied with memcpy().
+ */
+template<IMAGE_TYPE dst_type, IMAGE_TYPE src_type>
+inline void imgview_convert_row(typename image_pixel_traits<dst_type>::pixel_t * dst,
+				const typename image_pixel_traits<src_type>::pixel_t * src,
+				unsigned int width) {
+  if(dst_type == src_type)
+    memcpy(dst, src, width * sizeof(*dst));
+  else {
+    unsigned int x;
+    for(x = 0; x < width; x++) dst[x] = imgview_convert_pixel<dst_type, src_type>(src[x]);
+  }
+}
+
+/**
+ * Copy the region (min_x, min_y) .. (min_x + width, min_y + height) from the
+ * source view to the upper left corner of the destination view. The caller
+ * has to clip the region.
+ */
+template<IMAGE_TYPE dst_type, IMAGE_TYPE src_type>
+void imgview_copy(const image_view<dst_type> & dst, const image_view<src_type> & src,
+		  unsigned int min_x, unsigned int min_y,
+		  unsigned int width, unsigned int height) {
+  unsigned int y;
+  assert(min_x + width <= src.width && min_y + height <= src.height);
+  assert(width <= dst.width && height <= dst.height);
+
+  for(y = 0; y < height; y++)
+    imgview_convert_row<dst_type, src_type>(dst.row(y), src.ptr(min_x, min_y + y), width);
+}
+
+
+#define P3(s) (s < 0 ? 0 : pow(s, 3))
+#define CUBICAL_WEIGHTING(s) (1.0/6.0 * ( P3(s+2.) - 4.*P3(s+1.) + 6.*P3(s) - 4.*P3(s-1.)))
+
+static inline uint8_t imgview_round_and_check_limits(double val) {
+  int v = lrint(val);
+  if(v > 255) return 255;
+  else if(v < 0) return 0;
+  else return v;
+}
+
+/**
+ * Bicubic scaling from source view to destination view. For greyscale views only
+ * one channel is interpolated.
+ */
+template<IMAGE_TYPE type>
+void imgview_scale_bicubic(const image_view<type> & dst, const image_view<type> & src) {
+
+  typedef image_pixel_traits<type> traits;
+  unsigned int dst_x, dst_y;
+  double scaling_x = (double)src.width / (double)dst.width;
+  double scaling_y = (double)src.height / (double)dst.height;
+
+  for(dst_y = 0; dst_y < dst.height; dst_y++) {
+    double src_y = (double)dst_y * scaling_y;
+    int src_j = lrint(src_y);
+    double src_dy = src_y - src_j;
+
+    double weights_y[4];
+    int n;
+    for(n = -1; n <= 2; n++) weights_y[n + 1] = CUBICAL_WEIGHTING(src_dy - (double)n);
+
+    for(dst_x = 0; dst_x < dst.width; dst_x++) {
+      double src_x = (double)dst_x * scaling_x;
+      int src_i = lrint(src_x);
+      double src_dx = src_x - src_i;
+      bool inner = src_x > 1 && src_y > 1 && src_x < src.width - 2 && src_y < src.height - 2;
+
+      int m;
+      double F_R = 0, F_G = 0, F_B = 0;
+      uint32_t pix = 0;
+
+      for(m = -1; m <= 2; m++) {
+	double weight_x = CUBICAL_WEIGHTING((double)m - src_dx);
+
+	for(n = -1; n <= 2; n++) {
+	  pix = inner ? traits::to_rgba(src.get(src_x + m, src_y + n)) : 0;
+	  double weight = weight_x * weights_y[n + 1];
+
+	  F_R += (double)MASK_R(pix) * weight;
+	  if(type != IMAGE_TYPE_GS) {
+	    F_G += (double)MASK_G(pix) * weight;
+	    F_B += (double)MASK_B(pix) * weight;
+	  }
+	}
+      }
+
+      if(type == IMAGE_TYPE_GS)
+	dst.set(dst_x, dst_y, traits::from_gs(imgview_round_and_check_limits(F_R)));
+      else
+	dst.set(dst_x, dst_y, traits::from_rgba(MERGE_CHANNELS(imgview_round_and_check_limits(F_R),
+							       imgview_round_and_check_limits(F_G),
+							       imgview_round_and_check_limits(F_B),
+							       MASK_A(pix))));
+    }
+  }
+}
+
+#undef P3
+#undef CUBICAL_WEIGHTING
+
+#endif
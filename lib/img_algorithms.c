@@ -28,38 +28,142 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "globals.h"
 #include "graphics.h"
 #include "logic_model.h"
 #include "img_algorithms.h"
+#include "image_view.h"
 #include "grid.h"
+#include "parallel.h"
+#include "ccl.h"
 
 #define COL_UNDEF 255
 #define COL_PIN_DETECTED 254
 #define COL_TMP 253
 #define COL_DONE 252
 
-/**
- * convert a RGB value to a hue value
+/*
+ * Hue lookup table, indexed by [sector][delta][diff + 255]. The sector is 0, 1 or 2,
+ * if red, green or blue is the maximum channel. The delta is max - min and diff 
+ * is the difference of the other two channels in the order of the hue formula.
  */
-uint8_t rgb_to_h(uint8_t red, uint8_t green, uint8_t blue) {
+#define HUE_LUT_DIFF_RANGE 511
+#define HUE_LUT_SECTOR_SIZE (256 * HUE_LUT_DIFF_RANGE)
 
-  int max = MAX(red, MAX(green, blue));
-  int min = MIN(red, MIN(green, blue));
-  double delta = max - min;
+static uint8_t hue_lut[3 * HUE_LUT_SECTOR_SIZE];
+static pthread_once_t hue_lut_once = PTHREAD_ONCE_INIT;
+
+static uint8_t calc_hue(int sector, int delta, int diff) {
   double h = 0;
 
-  if(max == min) h = 0;
-  else if(max == red) h = 60 *  (green-blue)/delta;
-  else if(max == green) h = 60 * (2+(blue-red)/delta);
-  else if(max == blue) h = 60 * (4 + (red-green)/delta);
-  if(h < 0) h+=360;
+  if(delta == 0) h = 0;
+  else if(sector == 0) h = 60 * diff / (double)delta;
+  else if(sector == 1) h = 60 * (2 + diff / (double)delta);
+  else h = 60 * (4 + diff / (double)delta);
+  if(h < 0) h += 360;
 
   h *= 255.0/360.0;
   return (uint8_t)rint(h);
 }
 
+static void init_hue_lut() {
+  int sector, delta, diff;
+  for(sector = 0; sector < 3; sector++)
+    for(delta = 0; delta < 256; delta++)
+      for(diff = -delta; diff <= delta; diff++)
+	hue_lut[sector * HUE_LUT_SECTOR_SIZE + delta * HUE_LUT_DIFF_RANGE + diff + 255] = 
+	  calc_hue(sector, delta, diff);
+}
+
+static inline unsigned int hue_lut_index(int red, int green, int blue) {
+  int max = MAX(red, MAX(green, blue));
+  int min = MIN(red, MIN(green, blue));
+  unsigned int base = (max - min) * HUE_LUT_DIFF_RANGE + 255;
+
+  if(max == red) return base + green - blue;
+  else if(max == green) return HUE_LUT_SECTOR_SIZE + base + blue - red;
+  else return 2 * HUE_LUT_SECTOR_SIZE + base + red - green;
+}
+
+/**
+ * convert a RGB value to a hue value
+ */
+uint8_t rgb_to_h(uint8_t red, uint8_t green, uint8_t blue) {
+  pthread_once(&hue_lut_once, &init_hue_lut);
+  return hue_lut[hue_lut_index(red, green, blue)];
+}
+
+#ifdef __SSE2__
+/**
+ * Calculate the hue lookup table indices for four RGBA pixels.
+ */
+static inline __m128i hue_lut_index_sse2(__m128i pix) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i r = _mm_and_si128(pix, mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi32(pix, 8), mask);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(pix, 16), mask);
+
+  // channel values fit into 16 bit, so the 16 bit min/max works on 32 bit lanes
+  __m128i max = _mm_max_epi16(r, _mm_max_epi16(g, b));
+  __m128i min = _mm_min_epi16(r, _mm_min_epi16(g, b));
+  __m128i delta = _mm_sub_epi32(max, min);
+
+  __m128i is_r = _mm_cmpeq_epi32(max, r);
+  __m128i is_g = _mm_andnot_si128(is_r, _mm_cmpeq_epi32(max, g));
+  __m128i is_b = _mm_andnot_si128(_mm_or_si128(is_r, is_g), _mm_set1_epi32(-1));
+
+  __m128i diff = _mm_or_si128(_mm_and_si128(is_r, _mm_sub_epi32(g, b)),
+			      _mm_or_si128(_mm_and_si128(is_g, _mm_sub_epi32(b, r)),
+					   _mm_and_si128(is_b, _mm_sub_epi32(r, g))));
+  __m128i sector = _mm_or_si128(_mm_and_si128(is_g, _mm_set1_epi32(HUE_LUT_SECTOR_SIZE)),
+				_mm_and_si128(is_b, _mm_set1_epi32(2 * HUE_LUT_SECTOR_SIZE)));
+
+  // delta * 511 = (delta << 9) - delta
+  __m128i index = _mm_sub_epi32(_mm_slli_epi32(delta, 9), delta);
+  index = _mm_add_epi32(index, _mm_add_epi32(sector, diff));
+  return _mm_add_epi32(index, _mm_set1_epi32(255));
+}
+#endif
+
+/**
+ * Calculate the hue distance to a reference hue for a row of RGBA pixels.
+ * The lookup table indices are calculated with SSE2, if available.
+ */
+void imgalgo_color_similarity_row(const uint32_t * src, uint8_t * dst, unsigned int width,
+				  uint8_t ref_hue) {
+  unsigned int x = 0;
+  pthread_once(&hue_lut_once, &init_hue_lut);
+
+#ifdef __SSE2__
+  const __m128i ref = _mm_set1_epi8(ref_hue);
+  uint32_t idx[16] __attribute__((aligned(16)));
+  uint8_t hue[16] __attribute__((aligned(16)));
+  unsigned int i;
+
+  for(; x + 16 <= width; x += 16) {
+    for(i = 0; i < 16; i += 4)
+      _mm_store_si128((__m128i *)(idx + i), 
+		      hue_lut_index_sse2(_mm_loadu_si128((const __m128i *)(src + x + i))));
+    for(i = 0; i < 16; i++) hue[i] = hue_lut[idx[i]];
+
+    // absolute difference of unsigned bytes
+    __m128i h = _mm_load_si128((const __m128i *)hue);
+    _mm_storeu_si128((__m128i *)(dst + x), 
+		     _mm_or_si128(_mm_subs_epu8(h, ref), _mm_subs_epu8(ref, h)));
+  }
+#endif
+
+  for(; x < width; x++) {
+    uint8_t h = hue_lut[hue_lut_index(MASK_R(src[x]), MASK_G(src[x]), MASK_B(src[x]))];
+    dst[x] = ref_hue > h ? ref_hue - h : h - ref_hue;
+  }
+}
+
 /** 
  * Convert pixels of a RGBA image to greyscaled pixels.
  * Afterwards the model is still RGBA, but with R == G == B
@@ -78,29 +182,48 @@ ret_t imgalgo_to_grayscale(image_t * img) {
   return RET_OK;
 }
 
+/* Number of rows per job for imgalgo_to_color_similarity(). */
+#define COLOR_SIMILARITY_BAND_HEIGHT 64
+
+typedef struct {
+  image_t * img;
+  uint8_t ref_hue;
+} color_similarity_params_t;
+
+static ret_t color_similarity_band(unsigned int band, void * arg) {
+  color_similarity_params_t * params = (color_similarity_params_t *)arg;
+  rgba_view_t img(params->img);
+  unsigned int x, y = band * COLOR_SIMILARITY_BAND_HEIGHT;
+  unsigned int max_y = MIN(y + COLOR_SIMILARITY_BAND_HEIGHT, img.height);
+
+  uint8_t * buf = (uint8_t *)malloc(img.width);
+  if(buf == NULL) return RET_MALLOC_FAILED;
+
+  for(; y < max_y; y++) {
+    uint32_t * row = img.row(y);
+    imgalgo_color_similarity_row(row, buf, img.width, params->ref_hue);
+    for(x = 0; x < img.width; x++) row[x] = MERGE_CHANNELS(buf[x], buf[x], buf[x], 0xffU);
+  }
+
+  free(buf);
+  return RET_OK;
+}
+
 /**
- * Transform an image to a hue-distance image.
+ * Transform an image to a hue-distance image. Bands of rows are processed in parallel.
  *
  * @param img
  * @param color an RGB value as reference
  */
 ret_t imgalgo_to_color_similarity(image_t * img, uint32_t color) {
-  unsigned int dst_x, dst_y;
 
   if(img->image_type != IMAGE_TYPE_RGBA) return RET_ERR;
 
-  uint8_t dst_hue = rgb_to_h(MASK_R(color), MASK_G(color), MASK_B(color));
-  printf("dst_hue = %d\n", dst_hue);
+  color_similarity_params_t params = { img, rgb_to_h(MASK_R(color), MASK_G(color), MASK_B(color)) };
+  debug(TM, "dst_hue = %d", params.ref_hue);
 
-  for(dst_y = 0; dst_y < img->height; dst_y++) {
-    for(dst_x = 0; dst_x < img->width; dst_x++) {			
-      uint32_t * pix = (uint32_t *)mm_get_ptr(img->map, dst_x, dst_y);
-      uint8_t h = rgb_to_h(MASK_R(*pix), MASK_G(*pix), MASK_B(*pix));
-      uint8_t pix_val = dst_hue > h ? dst_hue - h : h - dst_hue;
-      *pix = MERGE_CHANNELS(pix_val, pix_val, pix_val, 0xff);
-    }
-  }
-  return RET_OK;
+  return par_run((img->height + COLOR_SIMILARITY_BAND_HEIGHT - 1) / COLOR_SIMILARITY_BAND_HEIGHT, 
+		 &color_similarity_band, &params);
 }
 
 /** 
@@ -120,309 +243,282 @@ ret_t imgalgo_separate_by_threshold(image_t * img, unsigned int threshold) {
 }
 
 
-// flood_trace() is a modified and bug fixed implementation of the seed fill algorithm by Paul Heckbert.
-// The original was published in "Graphics Gems", Academic Press, 1990.
+/**
+ * Check if a component is small enough to be a via. Components that cover
+ * less than a quarter of the pin diameter square are treated as noise.
+ */
+static int imgalgo_is_via_component(const ccl_component_t * const c, unsigned int pin_diameter) {
+  return c->max_x - c->min_x <= pin_diameter && 
+    c->max_y - c->min_y <= pin_diameter &&
+    c->area >= MAX(2UL, (unsigned long)pin_diameter * pin_diameter / 4);
+}
+
+static inline unsigned int imgalgo_clip_coord(double v, unsigned int min_v, unsigned int max_v) {
+  long l = lrint(v);
+  if(l < (long)min_v) return min_v;
+  if(l > (long)max_v) return max_v;
+  return l;
+}
 
-#define GetPixelFF(x, y) (MASK_R(*(uint32_t *)mm_get_ptr(img->map, x, y)))
-#define SetPixelFF(x, y, col) { *(uint32_t *)mm_get_ptr(img->map, x, y) = MERGE_CHANNELS(col, col, col, 0xff);}
+/**
+ * Create wires from connected components. Components, that fit into the pin
+ * diameter, are ignored. A wire runs along the major axis of its component
+ * and is as thick as the component's minor axis.
+ */
+ret_t imgalgo_match_wires(const ccl_result_t * const components, matching_params_t * m_params) {
+  unsigned int i, num_wires = 0;
+  ret_t ret;
 
-typedef struct { unsigned int x1, x2, y, dy; } LINESEGMENT;
+  if(!m_params || !components) return RET_INV_PTR;
+  if(!m_params->lmodel) return RET_OK;
 
-#define MAXDEPTH 1000000
+  for(i = 0; i < components->num_components; i++) {
+    const ccl_component_t * c = &components->components[i];
 
-#define PUSH(XL, XR, Y, DY) \
-    if( sp < stack+MAXDEPTH && Y+(DY) >= 0 && Y+(DY) <= img->height -1 ) \
-    { sp->x1 = XL; sp->x2 = XR; sp->y = Y; sp->dy = DY; ++sp; }
+    // if it is to small (noise or pins), ignore it
+    if(c->max_x - c->min_x <= m_params->pin_diameter && 
+       c->max_y - c->min_y <= m_params->pin_diameter) continue;
 
-#define POP(XL, XR, Y, DY) \
-    { --sp; XL = sp->x1; XR = sp->x2; Y = sp->y+(DY = sp->dy); }
+    double dir_x = cos(c->orientation), dir_y = sin(c->orientation);
+    int horizontal = fabs(dir_x) >= fabs(dir_y);
 
-void imgalgo_flood_trace(image_t * img, //uint8_t *pixels, unsigned int img_width, unsigned int img_height,
-			 unsigned int x, unsigned int y, 
-			 uint8_t old_col, uint8_t new_col,
-			 unsigned int *lowest_x, unsigned int * lowest_y, 
-			 unsigned int * highest_x, unsigned int * highest_y) {
-    
-  unsigned int left, x1, x2, dy;
+    if((horizontal && !m_params->match_horizontal_objects) ||
+       (!horizontal && !m_params->match_vertical_objects)) continue;
 
-  LINESEGMENT stack[MAXDEPTH], *sp = stack;
+    // the wire ends are rounded, so the end points are inset by the radius
+    double half_length = MAX(0.0, (c->major_axis - c->minor_axis) / 2.0);
+    unsigned int diameter = MAX(1, lrint(c->minor_axis));
 
-  PUSH(x, x, y, 1);        // needed in some cases 
-  PUSH(x, x, y+1, -1);    // seed segment (popped 1st)
+    lmodel_wire_t * wire = 
+      lmodel_create_wire(m_params->lmodel,
+			 imgalgo_clip_coord(c->center_x - half_length * dir_x, c->min_x, c->max_x),
+			 imgalgo_clip_coord(c->center_y - half_length * dir_y, c->min_y, c->max_y),
+			 imgalgo_clip_coord(c->center_x + half_length * dir_x, c->min_x, c->max_x),
+			 imgalgo_clip_coord(c->center_y + half_length * dir_y, c->min_y, c->max_y),
+			 diameter, NULL, 0);
+    if(wire == NULL) return RET_ERR;
 
-  while( sp > stack ) {
-    POP(x1, x2, y, dy);
+    if(RET_IS_NOT_OK(ret = lmodel_add_wire(m_params->lmodel, m_params->layer, wire))) return ret;
+    num_wires++;
+  }
 
-    if(highest_y != NULL && y > *highest_y) *highest_y = y;
-    if(lowest_y != NULL && y < *lowest_y) *lowest_y = y;
+  debug(TM, "created %u wires from %u components", num_wires, components->num_components);
+  return RET_OK;
+}
 
-    // goto left
-    for(x = x1; x > 0 && GetPixelFF(x, y) == old_col; --x) {
-      SetPixelFF(x, y, new_col);
-      //if(add_feature_func) (*add_feature_func)(lmodel, layer, x, y, obj);
-      if(lowest_x != NULL && x < *lowest_x) *lowest_x = x;
-      if(highest_x != NULL && x > *highest_x) *highest_x = x;
-    }
+/**
+ * Create vias from connected components, that fit into the pin diameter. Vias 
+ * are joined with touching objects.
+ */
+ret_t imgalgo_match_pins(const ccl_result_t * const components, matching_params_t * m_params) {
+  unsigned int i, num_vias = 0;
+  ret_t ret;
 
-    if(x >= x1 ) goto SKIP;
+  if(!m_params || !components) return RET_INV_PTR;
+  if(!m_params->lmodel) return RET_OK;
 
-    left = x+1;
-    if(left < x1 ) PUSH(left, x1-1, y, -dy);    // leak on left? 
+  for(i = 0; i < components->num_components; i++) {
+    const ccl_component_t * c = &components->components[i];
+    if(!imgalgo_is_via_component(c, m_params->pin_diameter)) continue;
 
-    x = x1+1;
+    lmodel_via_t * via = lmodel_create_via(m_params->lmodel,
+					   lrint(c->center_x), lrint(c->center_y),
+					   LM_VIA_UP, m_params->pin_diameter, NULL, 0);
+    if(via == NULL) return RET_ERR;
 
-    do {
-      if(lowest_y != NULL && y < *lowest_y) *lowest_y = y;
-      if(highest_y != NULL && y > *highest_y) *highest_y = y;
+    if(RET_IS_NOT_OK(ret = lmodel_add_via_with_autojoin(m_params->lmodel, m_params->layer, via))) 
+      return ret;
+    num_vias++;
+  }
 
-      for( ; x <= img->width - 1 && GetPixelFF(x, y) == old_col; ++x) {
-	SetPixelFF(x, y, new_col);
-	//if(add_feature_func) (*add_feature_func)(lmodel, layer, x, y, obj);
-	if(lowest_x != NULL && x < *lowest_x) *lowest_x = x;
-	if(highest_x != NULL && x > *highest_x) *highest_x = x;
-      }
+  debug(TM, "created %u vias from %u components", num_vias, components->num_components);
+  return RET_OK;
+}
 
-      PUSH(left, x-1, y, dy);
-      if( x > x2+1 )  PUSH(x2+1, x-1, y, -dy);    // leak on right?
+/**
+ * Detect wires or vias in the matching area of an image. Foreground objects
+ * are pixels above the separation threshold. They are labeled as connected
+ * components and converted into logic model objects.
+ */
+ret_t imgalgo_run_object_matching(matching_params_t * m_params) {
+  ccl_result_t components;
+  ret_t ret;
 
-    SKIP: 
-      for( ++x; x <= x2 && GetPixelFF(x, y) != old_col; ++x );
+  if(!m_params || !m_params->img) return RET_INV_PTR;
 
-      left = x;
-    } while( x<=x2 );
+  if(RET_IS_NOT_OK(ret = ccl_label_image(m_params->img, 
+					 m_params->min_x, m_params->min_y,
+					 m_params->max_x, m_params->max_y,
+					 m_params->threshold_col_separation, CCL_CONNECTIVITY_4,
+					 m_params->project_dir, &components))) {
+    debug(TM, "Can't label image");
+    return ret;
   }
 
+  if(m_params->match_object_type == LM_TYPE_WIRE)
+    ret = imgalgo_match_wires(&components, m_params);
+  else if(m_params->match_object_type == LM_TYPE_VIA)
+    ret = imgalgo_match_pins(&components, m_params);
+  else 
+    ret = RET_ERR;
+
+  ccl_destroy_result(&components);
+  return ret;
 }
-/*
-ret_t imgalgo_trace_area(image_t * img,
-			 unsigned int lowest_x, unsigned int lowest_y, 
-			 unsigned int highest_x, unsigned int highest_y,
-			 uint8_t col,
-			 grid_t * grid,
-			 logic_model_t * const lmodel, int layer, uint32_t obj, unsigned int object_id) {
-  unsigned int _x, _y;
 
-  if(!img || !lmodel) return RET_INV_PTR;
-
-  for(_y = lowest_y; _y < highest_y; _y++)
-    for(_x = lowest_x; _x < highest_x; _x++) {
-      uint8_t pix_val = MASK_R(*(uint32_t *)mm_get_ptr(img->map, _x, _y));
-      if(pix_val == col) {
-	
-	lmodel_add_feature(lmodel, layer, _x, _y, obj);
-	lmodel_set_object_id(lmodel, layer, _x, _y, object_id);
-	
-      }
-    }
+/**
+ * Calculate summation tables (integral images) over the pixel values and over the
+ * squared pixel values of a greyscale image. The tables are maps of doubles with
+ * the size of the image.
+ */
+ret_t imgalgo_precalc_summation_tables(image_t * master_img, 
+				       memory_map_t * summation_table_single, 
+				       memory_map_t * summation_table_squared) {
 
-  return RET_OK;
-}
+  assert(master_img->image_type == IMAGE_TYPE_GS);
+  if(master_img->image_type != IMAGE_TYPE_GS) return RET_ERR;
 
-bool imgalgo_is_pin_at(image_t * img, unsigned int x, unsigned int y, 
-		       unsigned int pin_diameter, uint8_t col,
-		       unsigned int *lowest_x, unsigned int * lowest_y, 
-		       unsigned int * highest_x, unsigned int * highest_y) {
-
-  unsigned int _x = x, _y = y;
-
-  uint8_t pix_val = MASK_R(*(uint32_t *)mm_get_ptr(img->map, x, y));
-
-  if(pix_val == col) {
-    *lowest_x = _x;
-    *lowest_y = _y;
-    *highest_x = _x;
-    *highest_y = _y;
-    
-    imgalgo_flood_trace(img, _x, _y, COL_UNDEF, COL_TMP, lowest_x, lowest_y, highest_x, highest_y);
-
-
-    if((*highest_x - *lowest_x <= pin_diameter) && (*highest_y - *lowest_y <= pin_diameter) &&
-       !((*highest_x - *lowest_x == 1) && (*highest_y - *lowest_y == 1))) {
-      
-      if(*lowest_x > pin_diameter && *highest_x < img->width - pin_diameter - 1) {
-	*lowest_x = _x - (pin_diameter >> 1);
-	*highest_x = _x + (pin_diameter >> 1);
-      }
-      if(*lowest_y > pin_diameter && *highest_y < img->height - pin_diameter - 1) {
-	*lowest_y = _y - (pin_diameter >> 1);
-	*highest_y = _y + (pin_diameter >> 1);
-      }
-      imgalgo_flood_trace(img, _x, _y, COL_TMP, COL_DONE, NULL, NULL, NULL, NULL);
-      return TRUE;
-    }
-    else {
-      imgalgo_flood_trace(img, _x, _y, COL_TMP, COL_DONE, NULL, NULL, NULL, NULL);
-      
-    }
-  }
+  gs_view_t master(master_img);
+  unsigned int x, y;
 
-  return FALSE;
-}
+  MM_ACCESS_PATTERN prev_master = mm_get_access_pattern(master_img->map);
+  MM_ACCESS_PATTERN prev_single = mm_get_access_pattern(summation_table_single);
+  MM_ACCESS_PATTERN prev_squared = mm_get_access_pattern(summation_table_squared);
 
-#define POINT_IN_AREA(check_x, check_y, minx, miny, maxx, maxy)	\
-  ((check_x > minx) && (check_x < maxx) && (check_y > miny) && (check_y < maxy))
+  mm_advise(master_img->map, MM_ACCESS_SEQUENTIAL);
+  mm_advise(summation_table_single, MM_ACCESS_SEQUENTIAL);
+  mm_advise(summation_table_squared, MM_ACCESS_SEQUENTIAL);
 
-ret_t imgalgo_match_wires(image_t * img, matching_params_t * m_params) {
+  for(y = 0; y < master.height; y++) {
+    const uint8_t * src_row = master.row(y);
+    double * single_row = (double *)mm_get_ptr(summation_table_single, 0, y);
+    double * squared_row = (double *)mm_get_ptr(summation_table_squared, 0, y);
+    const double * single_row_above = y > 0 ? single_row - summation_table_single->width : NULL;
+    const double * squared_row_above = y > 0 ? squared_row - summation_table_squared->width : NULL;
 
-  unsigned int dst_x, dst_y;
-  
-  if(!m_params || !img) return RET_INV_PTR;
-
-  for(dst_y = m_params->min_y; 
-      dst_y < MIN(img->height, m_params->max_y); 
-      dst_y++) {
-
-    for(dst_x = m_params->min_x; 
-	dst_x < MIN(img->width, m_params->max_x);
-	dst_x++) {
-
-      uint32_t * pix = (uint32_t *)mm_get_ptr(img->map, dst_x, dst_y);
-      uint8_t pix_val = MASK_R(*pix);
-
-      unsigned int lowest_x = dst_x, lowest_y = dst_y, highest_x = dst_x, highest_y = dst_y;
-
-      if(pix_val == COL_UNDEF) {
-
-	imgalgo_flood_trace(img, dst_x, dst_y, COL_UNDEF, COL_TMP, &lowest_x, &lowest_y, &highest_x, &highest_y);
-
-	// if it is to small (noise or pins), ignore it
-	if((highest_x - lowest_x <= m_params->pin_diameter) && (highest_y - lowest_y <= m_params->pin_diameter) ) {
-	  imgalgo_flood_trace(img, dst_x, dst_y, COL_TMP, 0, NULL, NULL, NULL, NULL);
-	}
-	
-	// horizontal or "quadratic" object
-	if(highest_x - lowest_x >= highest_y - lowest_y) { 
-	  if(m_params->match_horizontal_objects == FALSE) {
-	    imgalgo_flood_trace(img, dst_x, dst_y, COL_TMP, 0, NULL, NULL, NULL, NULL);
-	  }
-	  else {
-
-	    if(m_params->lmodel)
-	      imgalgo_trace_area(img, lowest_x, lowest_y, highest_x, highest_y,
-				 COL_TMP, m_params->grid,
-				 m_params->lmodel, m_params->layer, LM_WIRE_HORIZONTAL | LM_WIRE_VERTICAL, 
-				 m_params->lmodel->object_id_counter++);
-	    imgalgo_flood_trace(img, dst_x, dst_y, COL_TMP, COL_DONE, NULL, NULL, NULL, NULL);
-	  }
-	}	
-	// vertical object
-	if(highest_x - lowest_x < highest_y - lowest_y) { 
-	  if(m_params->match_vertical_objects == FALSE) {
-	    imgalgo_flood_trace(img, dst_x, dst_y, COL_TMP, 0, NULL, NULL, NULL, NULL);
-	  }
-	  else {
-	    
-	    if(m_params->lmodel)
-	      imgalgo_trace_area(img, lowest_x, lowest_y, highest_x, highest_y,
-				 COL_TMP, m_params->grid,
-				 m_params->lmodel, m_params->layer, 
-				 LM_WIRE_HORIZONTAL | LM_WIRE_VERTICAL, 
-				 m_params->lmodel->object_id_counter++);
-	    
-	    imgalgo_flood_trace(img, dst_x, dst_y, COL_TMP, COL_DONE, NULL, NULL, NULL, NULL);
-	  }
-                        
-	}
-      } 
+    // running sums over the current row plus the table entry above
+    double row_sum = 0, row_sum2 = 0;
+
+    for(x = 0; x < master.width; x++) {
+      double f = src_row[x];
+      row_sum += f;
+      row_sum2 += f * f;
+
+      single_row[x] = y > 0 ? row_sum + single_row_above[x] : row_sum;
+      squared_row[x] = y > 0 ? row_sum2 + squared_row_above[x] : row_sum2;
     }
   }
+
+  // the tables are read in random order by the correlation
+  mm_advise(master_img->map, prev_master);
+  mm_advise(summation_table_single, prev_single == MM_ACCESS_NORMAL ? MM_ACCESS_RANDOM : prev_single);
+  mm_advise(summation_table_squared, prev_squared == MM_ACCESS_NORMAL ? MM_ACCESS_RANDOM : prev_squared);
   return RET_OK;
 }
 
-ret_t imgalgo_match_pins(image_t * img, matching_params_t * m_params) {
-
-  unsigned int dst_x, dst_y;
+/**
+ * Store the zero mean pixel values of a greyscale image into a map of doubles.
+ * @returns the sum over the squared zero mean values
+ */
+double imgalgo_subtract_mean(image_t * img, memory_map_t * zero_mean_img) {
   
-  if(!m_params || !img) return RET_INV_PTR;
-
-  for(dst_y = m_params->min_y; 
-      dst_y < MIN(img->height, m_params->max_y); 
-      dst_y++) {
-
-    for(dst_x = m_params->min_x; 
-	dst_x < MIN(img->width, m_params->max_x);
-	dst_x++) {
-
-      //uint32_t * pix = (uint32_t *)mm_get_ptr(img, dst_x, dst_y);
-      //uint8_t pix_val = MASK_R(*pix);
-
-      // check pin
-      unsigned int lowest_x = dst_x, lowest_y = dst_y, highest_x = dst_x, highest_y = dst_y;
-
-      if(imgalgo_is_pin_at(img, dst_x, dst_y, 
-			   m_params->pin_diameter, COL_UNDEF,
-			   &lowest_x, &lowest_y, &highest_x, &highest_y)) {
-	
-	if(m_params->lmodel && 
-	   !LM_BIT_SET(lmodel_get_object(m_params->lmodel, m_params->layer, dst_x, dst_y), 
-		       LM_IL_DOWN| LM_IL_UP)) {
-
-	  unsigned int x,y;
-	  lmodel_find_nearest_wire_endings(m_params->lmodel, m_params->layer, dst_x, dst_y, m_params->pin_diameter,
-					   m_params->lmodel->object_id_counter);
-	  
-	  for(y = lowest_y; y <= highest_y; y++)
-	    for(x = lowest_x; x <= highest_x; x++) {
-	      lmodel_add_feature(m_params->lmodel, m_params->layer, x, y, LM_IL_UP |  LM_WIRE_HORIZONTAL | LM_WIRE_VERTICAL);
-	      lmodel_set_object_id(m_params->lmodel, m_params->layer, x, y, m_params->lmodel->object_id_counter);
-	    }
-
-	  m_params->lmodel->object_id_counter++;
-	}
-      } 
+  double mean = imgalgo_calc_mean_for_img_area(img, 0, 0, img->width, img->height);
+  double sum_over_zero_mean_img = 0;
+  unsigned int x, y;
+  gs_view_t src(img);
+
+  for(y = 0; y < src.height; y++) {
+    const uint8_t * src_row = src.row(y);
+    double * dst_row = (double *)mm_get_ptr(zero_mean_img, 0, y);
+
+    for(x = 0; x < src.width; x++) {
+      double tmp = (double)src_row[x] - mean;
+      dst_row[x] = tmp;
+      sum_over_zero_mean_img += tmp * tmp;
     }
   }
-  return RET_OK;
+
+  return sum_over_zero_mean_img;
 }
-*/
 
+/**
+ * Calculate the mean pixel value of a region in a greyscale image.
+ */
+double imgalgo_calc_mean_for_img_area(image_t * img, unsigned int min_x, unsigned int min_y, 
+				      unsigned int width, unsigned int height) {
+  double mean = 0;
+  unsigned int x,y;
+  assert(width > 0 && height > 0);
+  assert(min_x + width <= img->width);
+  assert(min_y + height <= img->height);
+
+  gs_view_t src(img);
+  for(y = min_y; y < min_y + height; y++) {
+    const uint8_t * src_row = src.row(y);
+    unsigned int row_sum = 0;
+    for(x = min_x; x < min_x + width; x++) row_sum += src_row[x];
+    mean += row_sum;
+  }
 
-ret_t imgalgo_run_object_matching(matching_params_t * m_params) {
-  if(!m_params) return RET_INV_PTR;
-  ret_t ret;
+  return mean / (width * height);
+}
 
-  image_t * temp = gr_create_image(m_params->img->width, m_params->img->height, m_params->img->image_type);
-  if(!temp) return RET_ERR;
-	
-  if(!RET_IS_OK(ret = gr_map_temp_file(temp, m_params->project_dir))) {
-    gr_image_destroy(temp);
-    return ret;
+/**
+ * Calculate the normalized cross correlation between a zero mean template and the
+ * greyscale image master at position (local_x, local_y). The denominator is taken
+ * from the summation tables of the master image.
+ * @see imgalgo_precalc_summation_tables()
+ * @see imgalgo_subtract_mean()
+ */
+double imgalgo_calc_single_xcorr(const image_t * const master, 
+				 memory_map_t * const zero_mean_template, 
+				 memory_map_t * const summation_table_single,
+				 memory_map_t * const summation_table_squared,
+				 double sum_over_zero_mean_template,
+				 unsigned int local_x, unsigned int local_y) {
+
+  double template_size = zero_mean_template->width * zero_mean_template->height;
+
+  unsigned int 
+    x_plus_w = local_x + zero_mean_template->width -1,
+    y_plus_h = local_y + zero_mean_template->height -1,
+    lxm1 = local_x - 1,
+    lym1 = local_y - 1;
+  
+  // calulate denominator
+  double 
+    f1 = mm_get_double(summation_table_single, x_plus_w, y_plus_h),
+    f2 = mm_get_double(summation_table_squared, x_plus_w, y_plus_h);
+  
+  if(local_x > 0) {
+    f1 -= mm_get_double(summation_table_single, lxm1, y_plus_h);
+    f2 -= mm_get_double(summation_table_squared, lxm1, y_plus_h);
   }
-
-  if(!RET_IS_OK(ret = gr_copy_image(temp, m_params->img,
-			      0, 0, m_params->img->width, m_params->img->height))) {
-    puts("Can't copy image");
-    gr_image_destroy(temp);
-    return ret;
+  if(local_y > 0) {
+    f1 -= mm_get_double(summation_table_single, x_plus_w, lym1);
+    f2 -= mm_get_double(summation_table_squared, x_plus_w, lym1);
   }
-
-  if(!RET_IS_OK(ret = imgalgo_to_grayscale(temp))) {
-    puts("Can't convert image to grayscale");
-    gr_image_destroy(temp);
-    return ret;
+  if(local_x > 0 && local_y > 0) {
+    f1 += mm_get_double(summation_table_single, lxm1, lym1);
+    f2 += mm_get_double(summation_table_squared, lxm1, lym1);
   }
+  
+  double denominator = sqrt((f2 - f1*f1/template_size) * sum_over_zero_mean_template);
+  
+  // calculate nummerator
+  
+  unsigned int _x, _y;
+  double nummerator = 0;
 
-  if(!RET_IS_OK(ret = imgalgo_separate_by_threshold(temp, m_params->threshold_col_separation))) {
-    gr_image_destroy(temp);
-    return ret;
-  }
+  gs_view_t master_view(master);
 
-  /*
-  if(m_params->match_object_type == LM_OBJECT_TYPE_METAL)
-    if(!RET_IS_OK(ret = imgalgo_match_wires(temp, m_params))) {
-      gr_image_destroy(temp);
-      return ret;
-    }
+  for(_y = 0; _y < zero_mean_template->height; _y ++) {
+    const uint8_t * f_row = master_view.ptr(local_x, local_y + _y);
+    const double * t_row = (const double *)mm_get_ptr(zero_mean_template, 0, _y);
 
-  if(m_params->match_object_type == LM_OBJECT_TYPE_PIN)
-    if(!RET_IS_OK(ret = imgalgo_match_pins(temp, m_params))) {
-      gr_image_destroy(temp);
-      return ret;
-    }
-  */
-  if(!RET_IS_OK(ret = gr_image_destroy(temp))) {
-    return ret;
+    for(_x = 0; _x < zero_mean_template->width; _x ++)
+      nummerator += (double)f_row[_x] * t_row[_x];
   }
-  return RET_OK;
+  
+  return nummerator/denominator;
 }
-
@@ -24,6 +24,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 #include "grid.h"
 #include "logic_model.h"
+#include "ccl.h"
 
 struct matching_params {
   image_t * img;
@@ -37,7 +38,7 @@ struct matching_params {
   unsigned int pin_diameter;
   int match_horizontal_objects;
   int match_vertical_objects;
-  //OBJECT_TYPE match_object_type;
+  LM_OBJECT_TYPE match_object_type; // LM_TYPE_WIRE or LM_TYPE_VIA
 
   unsigned int threshold_col_separation;
   grid_t * grid;
@@ -45,13 +46,31 @@ struct matching_params {
 
 typedef struct matching_params matching_params_t;
 
+uint8_t rgb_to_h(uint8_t red, uint8_t green, uint8_t blue);
+void imgalgo_color_similarity_row(const uint32_t * src, uint8_t * dst, unsigned int width,
+				  uint8_t ref_hue);
+
 ret_t imgalgo_to_grayscale(image_t * img);
 ret_t imgalgo_to_color_similarity(image_t * img, uint32_t color);
 ret_t imgalgo_separate_by_threshold(image_t * img, unsigned int threshold);
 ret_t imgalgo_run_object_matching(matching_params_t * m_params);
 
-ret_t imgalgo_match_wires(image_t * img, matching_params_t * m_params);
-ret_t imgalgo_match_pin(image_t * img, matching_params_t * m_params);
+ret_t imgalgo_match_wires(const ccl_result_t * const components, matching_params_t * m_params);
+ret_t imgalgo_match_pins(const ccl_result_t * const components, matching_params_t * m_params);
+
+// normalized cross correlation
+ret_t imgalgo_precalc_summation_tables(image_t * master_img, 
+				       memory_map_t * summation_table_single, 
+				       memory_map_t * summation_table_squared);
+double imgalgo_subtract_mean(image_t * img, memory_map_t * zero_mean_img);
+double imgalgo_calc_mean_for_img_area(image_t * img, unsigned int min_x, unsigned int min_y, 
+				      unsigned int width, unsigned int height);
+double imgalgo_calc_single_xcorr(const image_t * const master, 
+				 memory_map_t * const zero_mean_template, 
+				 memory_map_t * const summation_table_single,
+				 memory_map_t * const summation_table_squared,
+				 double sum_over_zero_mean_template,
+				 unsigned int local_x, unsigned int local_y);
 
 
 
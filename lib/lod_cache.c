@@ -0,0 +1,401 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "lod_cache.h"
+#include "quadtree.h"
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+/**
+ * Level 0 rasters are padded to a multiple of this number of cells, so that each
+ * level has exactly half the size of the level below.
+ */
+#define LODCACHE_PAD ((1U << (LODCACHE_NUM_LEVELS - 1)))
+
+typedef struct {
+  float * acc;  // per cell: premultiplied red, green, blue and the alpha, weighted by area
+  unsigned int width, height;
+  unsigned int cell_size;
+  LODCACHE_CLASS cls;
+  const lodcache_colors_t * colors;
+  lodcache_raster_t * raster;
+} lodcache_build_params_t;
+
+/**
+ * Create an empty LOD cache. Rasters are built, when they are requested.
+ */
+lodcache_t * lodcache_create() {
+  lodcache_t * lc;
+  if((lc = (lodcache_t *)malloc(sizeof(lodcache_t))) == NULL) return NULL;
+  memset(lc, 0, sizeof(lodcache_t));
+  pthread_mutex_init(&lc->mutex, NULL);
+  return lc;
+}
+
+static void lodcache_free_raster(lodcache_raster_t * raster) {
+  unsigned int level;
+  for(level = 0; level < LODCACHE_NUM_LEVELS; level++)
+    if(raster->levels[level] != NULL) gr_image_destroy(raster->levels[level]);
+  free(raster->selected);
+  free(raster);
+}
+
+/**
+ * Remove a raster from the cache. A raster, that is in use, is freed after the
+ * last release. The caller must hold the mutex.
+ */
+static void lodcache_drop_raster(lodcache_raster_t * raster) {
+  if(raster->refs > 0) raster->stale = 1;
+  else lodcache_free_raster(raster);
+}
+
+static void lodcache_destroy_rasters(lodcache_t * lc) {
+  unsigned int i;
+  if(lc->rasters == NULL) return;
+
+  for(i = 0; i < lc->num_layers * LODCACHE_NUM_CLASSES; i++)
+    if(lc->rasters[i] != NULL) lodcache_drop_raster(lc->rasters[i]);
+
+  free(lc->rasters);
+  lc->rasters = NULL;
+  lc->num_layers = 0;
+  lc->lmodel = NULL;
+}
+
+/**
+ * Destroy a LOD cache. The logic model is not destroyed.
+ */
+ret_t lodcache_destroy(lodcache_t * lc) {
+  assert(lc != NULL);
+  if(lc == NULL) return RET_INV_PTR;
+
+  lodcache_destroy_rasters(lc);
+  pthread_mutex_destroy(&lc->mutex);
+  memset(lc, 0, sizeof(lodcache_t));
+  free(lc);
+  return RET_OK;
+}
+
+/**
+ * Drop all rasters, e.g. if another logic model is rendered.
+ */
+ret_t lodcache_invalidate(lodcache_t * lc) {
+  assert(lc != NULL);
+  if(lc == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&lc->mutex);
+  lodcache_destroy_rasters(lc);
+  pthread_mutex_unlock(&lc->mutex);
+  return RET_OK;
+}
+
+/**
+ * Get the number of real pixels per cell of the level 0 raster for a logic model.
+ * Cells are at least LODCACHE_MIN_CELL_SIZE pixels wide. For large dies the cell 
+ * size is doubled, until the raster has at most LODCACHE_MAX_RASTER_SIZE cells in
+ * each dimension.
+ */
+unsigned int lodcache_get_cell_size(const logic_model_t * lmodel) {
+  assert(lmodel != NULL);
+  if(lmodel == NULL) return 0;
+
+  unsigned int cell_size = LODCACHE_MIN_CELL_SIZE;
+  unsigned int size = MAX(lmodel->width, lmodel->height);
+  while(cell_size * LODCACHE_MAX_RASTER_SIZE < size) cell_size <<= 1;
+  return cell_size;
+}
+
+static uint32_t lodcache_hash_colors(const lodcache_colors_t * colors) {
+  const uint8_t * data = (const uint8_t *)colors;
+  uint32_t h = FNV_OFFSET_BASIS;
+  size_t i;
+  for(i = 0; i < sizeof(lodcache_colors_t); i++) h = (h ^ data[i]) * FNV_PRIME;
+  return h;
+}
+
+/** Add a coloured area to the cell, that contains the real position (x, y). */
+static inline void lodcache_add_area(lodcache_build_params_t * params, double x, double y, 
+				     double area, color_t color) {
+  if(x < 0 || y < 0) return;
+  unsigned int cx = (unsigned int)x / params->cell_size;
+  unsigned int cy = (unsigned int)y / params->cell_size;
+  if(cx >= params->width || cy >= params->height) return;
+
+  float * cell = params->acc + 4 * ((size_t)cy * params->width + cx);
+  float a = area * MASK_A(color) / 255.0;
+  cell[0] += a * MASK_R(color);
+  cell[1] += a * MASK_G(color);
+  cell[2] += a * MASK_B(color);
+  cell[3] += a * 255.0;
+}
+
+/** 
+ * Add a rectangle in real coordinates. The upper bounds are exclusive. The area 
+ * is split exactly between the cells, the rectangle overlaps.
+ */
+static void lodcache_add_rect(lodcache_build_params_t * params, 
+			      double min_x, double min_y, double max_x, double max_y, 
+			      color_t color) {
+  double cs = params->cell_size;
+  unsigned int cx, cy;
+  unsigned int from_cx = (unsigned int)(min_x / cs), to_cx = (unsigned int)ceil(max_x / cs);
+  unsigned int from_cy = (unsigned int)(min_y / cs), to_cy = (unsigned int)ceil(max_y / cs);
+
+  for(cy = from_cy; cy < MIN(to_cy, params->height); cy++) {
+    double h = MIN(max_y, (cy + 1) * cs) - MAX(min_y, cy * cs);
+    for(cx = from_cx; cx < MIN(to_cx, params->width); cx++) {
+      double w = MIN(max_x, (cx + 1) * cs) - MAX(min_x, cx * cs);
+      if(w > 0 && h > 0) lodcache_add_area(params, cx * cs, cy * cs, w * h, color);
+    }
+  }
+}
+
+/** 
+ * Wires are sampled along their center line with two samples per cell. Each 
+ * sample gets the same share of the wire's area.
+ */
+static void lodcache_add_wire(lodcache_build_params_t * params, const lmodel_wire_t * wire) {
+  double dx = (double)wire->to_x - (double)wire->from_x;
+  double dy = (double)wire->to_y - (double)wire->from_y;
+  double len = sqrt(dx * dx + dy * dy);
+  double dia = MAX(wire->diameter, 1);
+  unsigned int i, num_samples = (unsigned int)ceil(2.0 * len / params->cell_size) + 1;
+  double area = (len + dia) * dia / num_samples;
+
+  for(i = 0; i < num_samples; i++) {
+    double t = num_samples > 1 ? (double)i / (num_samples - 1) : 0;
+    lodcache_add_area(params, wire->from_x + t * dx, wire->from_y + t * dy, area, 
+		      params->colors->wire_color);
+  }
+}
+
+static int lodcache_class_of(LM_OBJECT_TYPE object_type) {
+  switch(object_type) {
+  case LM_TYPE_GATE: return LODCACHE_CLASS_GATES;
+  case LM_TYPE_WIRE: return LODCACHE_CLASS_WIRES;
+  case LM_TYPE_VIA: return LODCACHE_CLASS_VIAS;
+  default: return -1;
+  }
+}
+
+/** Remember a selected object, that is drawn over the raster. */
+static ret_t lodcache_add_selected(lodcache_raster_t * raster, void * obj_ptr) {
+  if(raster->num_selected == raster->max_selected) {
+    unsigned int max_selected = MAX(2 * raster->max_selected, 16);
+    void ** selected = (void **)realloc(raster->selected, max_selected * sizeof(void *));
+    if(selected == NULL) return RET_MALLOC_FAILED;
+    raster->selected = selected;
+    raster->max_selected = max_selected;
+  }
+  raster->selected[raster->num_selected++] = obj_ptr;
+  return RET_OK;
+}
+
+static ret_t lodcache_cb_add_objects(quadtree_t * qtree, void * data_ptr) {
+  lodcache_build_params_t * params = (lodcache_build_params_t *)data_ptr;
+  quadtree_object_t * object;
+  ret_t ret;
+
+  for(object = qtree->objects; object != NULL; object = object->next) {
+
+    if(lmodel_get_select_state((LM_OBJECT_TYPE)object->object_type, object->object) != SELECT_STATE_NOT) {
+      if(lodcache_class_of((LM_OBJECT_TYPE)object->object_type) == params->cls &&
+	 RET_IS_NOT_OK(ret = lodcache_add_selected(params->raster, object->object))) return ret;
+      continue;
+    }
+
+    if(object->object_type == LM_TYPE_GATE && params->cls == LODCACHE_CLASS_GATES) {
+      lmodel_gate_t * gate = (lmodel_gate_t *)object->object;
+      color_t col = gate->gate_template != NULL ? gate->gate_template->fill_color : 0;
+      if(col == 0) col = params->colors->gate_area_color;
+      lodcache_add_rect(params, gate->min_x, gate->min_y, gate->max_x + 1, gate->max_y + 1, col);
+    }
+    else if(object->object_type == LM_TYPE_WIRE && params->cls == LODCACHE_CLASS_WIRES) {
+      lodcache_add_wire(params, (lmodel_wire_t *)object->object);
+    }
+    else if(object->object_type == LM_TYPE_VIA && params->cls == LODCACHE_CLASS_VIAS) {
+      lmodel_via_t * via = (lmodel_via_t *)object->object;
+      double r = MAX(via->diameter, 1) / 2.0;
+      lodcache_add_area(params, via->x, via->y, M_PI * r * r, 
+			via->direction == LM_VIA_UP ? params->colors->il_up_color : params->colors->il_down_color);
+    }
+  }
+  return RET_OK;
+}
+
+/**
+ * Convert the accumulated areas into premultiplied RGBA pixels. If objects overlap,
+ * the coverage is limited to the full cell.
+ */
+static void lodcache_store_cells(const lodcache_build_params_t * params, image_t * img) {
+  unsigned int x, y;
+  double cell_area = (double)params->cell_size * params->cell_size;
+
+  for(y = 0; y < params->height; y++) {
+    uint32_t * row = (uint32_t *)mm_get_ptr(img->map, 0, y);
+    const float * cell = params->acc + 4 * (size_t)y * params->width;
+
+    for(x = 0; x < params->width; x++, cell += 4) {
+      double alpha = cell[3] / cell_area;
+      double f = alpha > 255.0 ? 255.0 / alpha : 1.0;
+      unsigned int r = lrint(cell[0] * f / cell_area);
+      unsigned int g = lrint(cell[1] * f / cell_area);
+      unsigned int b = lrint(cell[2] * f / cell_area);
+      unsigned int a = lrint(alpha * f);
+      row[x] = MERGE_CHANNELS(MIN(r, a), MIN(g, a), MIN(b, a), a);
+    }
+  }
+}
+
+/**
+ * Build all levels of a raster and collect the selected objects. The caller must 
+ * hold the mutex.
+ */
+static ret_t lodcache_build(lodcache_t * lc, lodcache_raster_t * raster, logic_model_t * lmodel,
+			    unsigned int layer, LODCACHE_CLASS cls, const lodcache_colors_t * colors) {
+  ret_t ret;
+  unsigned int level;
+  unsigned int width = (lmodel->width + lc->cell_size - 1) / lc->cell_size;
+  unsigned int height = (lmodel->height + lc->cell_size - 1) / lc->cell_size;
+  width = MAX((width + LODCACHE_PAD - 1) / LODCACHE_PAD, 1) * LODCACHE_PAD;
+  height = MAX((height + LODCACHE_PAD - 1) / LODCACHE_PAD, 1) * LODCACHE_PAD;
+
+  for(level = 0; level < LODCACHE_NUM_LEVELS; level++) {
+    if(raster->levels[level] == NULL &&
+       (raster->levels[level] = gr_create_memory_image(width >> level, height >> level, 
+							IMAGE_TYPE_RGBA)) == NULL)
+      return RET_MALLOC_FAILED;
+  }
+
+  raster->num_selected = 0;
+  lodcache_build_params_t params = { NULL, width, height, lc->cell_size, cls, colors, raster };
+  if((params.acc = (float *)calloc((size_t)width * height * 4, sizeof(float))) == NULL) 
+    return RET_MALLOC_FAILED;
+
+  if(RET_IS_NOT_OK(ret = quadtree_traverse_complete(lmodel->root[layer], 
+						    &lodcache_cb_add_objects, &params))) {
+    free(params.acc);
+    return ret;
+  }
+
+  lodcache_store_cells(&params, raster->levels[0]);
+  free(params.acc);
+
+  for(level = 1; level < LODCACHE_NUM_LEVELS; level++)
+    if(RET_IS_NOT_OK(ret = gr_downsample(raster->levels[level - 1], raster->levels[level])))
+      return ret;
+
+  return RET_OK;
+}
+
+/**
+ * Get a raster of the gates, wires or vias of a layer. The raster is built or 
+ * rebuilt, if necessary. Each cell of level n covers (cell_size << n) real pixels 
+ * per dimension, see lodcache_get_cell_size(). The raster must not be modified.
+ * It stays valid, until it is released with lodcache_release(), even if the
+ * logic model changes meanwhile.
+ * @return Returns NULL on error.
+ */
+lodcache_raster_t * lodcache_get_raster(lodcache_t * lc, logic_model_t * lmodel, unsigned int layer,
+					LODCACHE_CLASS cls, const lodcache_colors_t * colors) {
+  assert(lc != NULL);
+  assert(lmodel != NULL);
+  assert(colors != NULL);
+  if(lc == NULL || lmodel == NULL || colors == NULL) return NULL;
+  if(layer >= (unsigned int)lmodel->num_layers || cls >= LODCACHE_NUM_CLASSES) return NULL;
+
+  pthread_mutex_lock(&lc->mutex);
+
+  unsigned int cell_size = lodcache_get_cell_size(lmodel);
+  if(lc->lmodel != lmodel || lc->num_layers != (unsigned int)lmodel->num_layers || 
+     lc->cell_size != cell_size) {
+    
+    lodcache_destroy_rasters(lc);
+    size_t size = lmodel->num_layers * LODCACHE_NUM_CLASSES * sizeof(lodcache_raster_t *);
+    if((lc->rasters = (lodcache_raster_t **)malloc(size)) == NULL) {
+      pthread_mutex_unlock(&lc->mutex);
+      return NULL;
+    }
+    memset(lc->rasters, 0, size);
+    lc->lmodel = lmodel;
+    lc->num_layers = lmodel->num_layers;
+    lc->cell_size = cell_size;
+  }
+
+  lodcache_raster_t ** slot = &lc->rasters[layer * LODCACHE_NUM_CLASSES + cls];
+  lodcache_raster_t * raster = *slot;
+  // changes of other object classes do not affect this raster
+  static const LM_OBJECT_TYPE class_types[LODCACHE_NUM_CLASSES] = 
+    { LM_TYPE_GATE, LM_TYPE_WIRE, LM_TYPE_VIA };
+  unsigned long version = lmodel_get_damage_version_of_type(class_types[cls]);
+  uint32_t colors_hash = lodcache_hash_colors(colors);
+
+  if(raster == NULL || raster->damage_version != version || raster->colors_hash != colors_hash) {
+
+    // a raster, that is in use, is replaced, else it is rebuilt in place
+    if(raster != NULL && raster->refs > 0) {
+      lodcache_drop_raster(raster);
+      raster = *slot = NULL;
+    }
+
+    if(raster == NULL && 
+       (raster = *slot = (lodcache_raster_t *)calloc(1, sizeof(lodcache_raster_t))) == NULL) {
+      pthread_mutex_unlock(&lc->mutex);
+      return NULL;
+    }
+
+    if(RET_IS_NOT_OK(lodcache_build(lc, raster, lmodel, layer, cls, colors))) {
+      lodcache_free_raster(raster);
+      *slot = NULL;
+      pthread_mutex_unlock(&lc->mutex);
+      return NULL;
+    }
+    raster->damage_version = version;
+    raster->colors_hash = colors_hash;
+  }
+
+  raster->refs++;
+  pthread_mutex_unlock(&lc->mutex);
+  return raster;
+}
+
+/**
+ * Release a raster, that was returned by lodcache_get_raster().
+ */
+void lodcache_release(lodcache_t * lc, lodcache_raster_t * raster) {
+  assert(lc != NULL);
+  assert(raster != NULL);
+  if(lc == NULL || raster == NULL) return;
+
+  pthread_mutex_lock(&lc->mutex);
+  assert(raster->refs > 0);
+  if(--raster->refs == 0 && raster->stale) lodcache_free_raster(raster);
+  pthread_mutex_unlock(&lc->mutex);
+}
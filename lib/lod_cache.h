@@ -0,0 +1,95 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#ifndef __LOD_CACHE_H__
+#define __LOD_CACHE_H__
+
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "logic_model.h"
+
+/**
+ * Coarse rasters of the logic model for rendering zoomed out views. Each cell of
+ * a raster holds the premultiplied mean colour of the objects within the cell,
+ * so a view, where objects shrink to a few pixels, is drawn from the raster
+ * instead of drawing each object.
+ *
+ * There is a raster for gates, wires and vias of each layer. Rasters are built on
+ * demand and rebuilt, if the logic model reported a change of an object of the
+ * raster's class since the last build or if the colours change. Higher levels are downsampled by factors of two.
+ * Selected objects are not part of the raster. They are listed, so that they can
+ * be drawn over it.
+ */
+
+#define LODCACHE_MIN_CELL_SIZE 16     // real pixels per cell of level 0
+#define LODCACHE_MAX_RASTER_SIZE 2048 // cells per dimension of level 0
+#define LODCACHE_NUM_LEVELS 6
+
+enum LODCACHE_CLASS {
+  LODCACHE_CLASS_GATES = 0,
+  LODCACHE_CLASS_WIRES = 1,
+  LODCACHE_CLASS_VIAS = 2,
+  LODCACHE_NUM_CLASSES = 3
+};
+
+/** Colours for objects, that have no colour on their own. */
+typedef struct {
+  color_t gate_area_color;
+  color_t wire_color;
+  color_t il_up_color;
+  color_t il_down_color;
+} lodcache_colors_t;
+
+typedef struct {
+  image_t * levels[LODCACHE_NUM_LEVELS];
+  unsigned long damage_version;          // version of the object class, the raster was built for
+  uint32_t colors_hash;
+
+  void ** selected;                      // selected gates, wires or vias
+  unsigned int num_selected, max_selected;
+
+  unsigned int refs;                     // rasters are not freed, while they are in use
+  int stale;                             // dropped from the cache, freed after the last release
+} lodcache_raster_t;
+
+typedef struct lod_cache {
+  logic_model_t * lmodel;  // model, the rasters were built for
+  unsigned int cell_size;  // real pixels per cell of level 0
+  unsigned int num_layers;
+  lodcache_raster_t ** rasters; // indexed by [layer][class], NULL if not built yet
+
+  pthread_mutex_t mutex;
+} lodcache_t;
+
+lodcache_t * lodcache_create();
+ret_t lodcache_destroy(lodcache_t * lc);
+ret_t lodcache_invalidate(lodcache_t * lc);
+
+unsigned int lodcache_get_cell_size(const logic_model_t * lmodel);
+
+lodcache_raster_t * lodcache_get_raster(lodcache_t * lc, logic_model_t * lmodel, unsigned int layer,
+					LODCACHE_CLASS cls, const lodcache_colors_t * colors);
+void lodcache_release(lodcache_t * lc, lodcache_raster_t * raster);
+
+#endif
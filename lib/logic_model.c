@@ -364,6 +364,7 @@ ret_t lmodel_destroy_gate_template(lmodel_gate_template_t * tmpl) {
   }
 
   free(tmpl);
+  lmodel_report_template_change();
   return RET_OK;
 }
 
@@ -770,9 +771,10 @@ ret_t lmodel_gate_template_add_port(logic_model_t * lmodel,
     ptr->next = port;
   }
 
-  if(RET_IS_NOT_OK(ret = lmodel_update_all_gate_ports(lmodel, tmpl))) return ret;
-
-  return RET_OK;
+  // the template changed, even if not all gates could be updated
+  ret = lmodel_update_all_gate_ports(lmodel, tmpl);
+  lmodel_report_template_change();
+  return ret;
 }
 
 /**
@@ -804,6 +806,7 @@ ret_t lmodel_gate_template_set_port(logic_model_t * lmodel,
       if(ptr->port_name) free(ptr->port_name);
       ptr->port_name = strdup(port_name);
       ptr->port_type = port_type;
+      lmodel_report_template_change();
       return RET_OK;
     }
     ptr = ptr->next;
@@ -829,6 +832,7 @@ ret_t lmodel_gate_template_remove_port(lmodel_gate_template_t * const tmpl, unsi
     if(ptr->port_name) free(ptr->port_name);
     tmpl->ports = ptr->next;
     free(ptr);
+    lmodel_report_template_change();
     return RET_OK;
   }
 
@@ -838,6 +842,7 @@ ret_t lmodel_gate_template_remove_port(lmodel_gate_template_t * const tmpl, unsi
       ptr_next = ptr->next->next;
       free(ptr->next);
       ptr->next = ptr_next;
+      lmodel_report_template_change();
       return RET_OK;
     }
     ptr = ptr->next;
@@ -1114,6 +1119,8 @@ ret_t lmodel_update_gate_ports(lmodel_gate_t * gate) {
   debug(TM, "update gate ports for %s", 
 	gate->gate_template != NULL ? gate->gate_template->short_name : "unid gate");
 
+  lmodel_report_damage(LM_TYPE_GATE, gate);
+
   if(gate_tmpl == NULL) {
     // no template, but defined ports -> destroy ports
     if(port_ptr != NULL) {
@@ -1894,6 +1901,7 @@ ret_t lmodel_remove_object_by_ptr(logic_model_t * const lmodel, int layer, void
   optr = quadtree_find_object(lmodel->root[layer], (quadobject_traverse_func_t) &cb_check_object_by_ptr, &data);
   if(!optr) return RET_OK;
 
+  lmodel_report_damage(object_type, ptr);
 
   switch(object_type) {
   case LM_TYPE_WIRE:
@@ -2121,6 +2129,7 @@ ret_t lmodel_set_layer_type(logic_model_t * const lmodel, int layer, LAYER_TYPE
   CHECK(lmodel, layer);
 
   lmodel->layer_type[layer] = layer_type;
+  lmodel_report_damage(LM_TYPE_UNDEF, NULL);
   return RET_OK;
 }
 
@@ -2166,6 +2175,7 @@ ret_t lmodel_set_layer_type_from_string(logic_model_t * const lmodel, int layer,
 ret_t lmodel_clear_layer(logic_model_t * const lmodel, int layer) {
   CHECK(lmodel, layer);
 
+  lmodel_report_damage(LM_TYPE_UNDEF, NULL);
   return quadtree_traverse_complete(lmodel->root[layer], (quadtree_traverse_func_t) &cb_destroy_objects, NULL);
 }
 
@@ -2258,6 +2268,7 @@ ret_t lmodel_add_via(logic_model_t * const lmodel, int layer,
     return RET_ERR;
   }
 
+  lmodel_report_damage(LM_TYPE_VIA, via);
   return RET_OK;
 }
 
@@ -2374,6 +2385,7 @@ ret_t lmodel_add_wire(logic_model_t * const lmodel, int layer,
     return RET_ERR;
   }
   
+  lmodel_report_damage(LM_TYPE_WIRE, wire);
   return RET_OK;
 }
 
@@ -2438,6 +2450,7 @@ ret_t lmodel_add_gate(logic_model_t * const lmodel, int layer,
   }
   
   if(RET_IS_NOT_OK(ret = lmodel_update_gate_ports(gate))) return ret;
+  lmodel_report_damage(LM_TYPE_GATE, gate);
 
   // add to gate list
   return lmodel_add_gate_to_gate_set(lmodel, gate);
@@ -2488,6 +2501,8 @@ ret_t lmodel_remove_refs_to_gate_template(logic_model_t * const lmodel, lmodel_g
   assert(tmpl);
   if(!lmodel || !tmpl || !lmodel->root) return RET_INV_PTR;
 
+  lmodel_report_damage(LM_TYPE_UNDEF, NULL);
+
   for(layer = 0; layer < lmodel->num_layers; layer++) {
     assert(lmodel->root[layer]);
     if(!lmodel->root[layer]) return RET_INV_PTR;
@@ -2520,6 +2535,7 @@ ret_t lmodel_gate_template_set_master_region(lmodel_gate_template_t * const tmpl
   tmpl->master_image_min_y = MIN(min_y, max_y);
   tmpl->master_image_max_x = MAX(min_x, max_x);
   tmpl->master_image_max_y = MAX(min_y, max_y);
+  lmodel_report_template_change();
   
   return RET_OK;
 }
@@ -2538,6 +2554,7 @@ ret_t lmodel_gate_template_set_text(lmodel_gate_template_t * const tmpl,
 
   tmpl->short_name = strdup(short_name);
   tmpl->description = strdup(description);
+  lmodel_report_template_change();
 
   return RET_OK;
 }
@@ -2773,6 +2790,7 @@ ret_t lmodel_adjust_templates_port_locations(lmodel_gate_template * const tmpl,
 
     port_ptr = port_ptr->next;
   }
+  lmodel_report_template_change();
   
   return RET_OK;
 }
@@ -3126,6 +3144,7 @@ ret_t lmodel_set_select_state(LM_OBJECT_TYPE object_type, void * obj_ptr, int st
     return RET_ERR;
   }
 
+  lmodel_report_damage(object_type, obj_ptr);
   
   while(adj_objects) {
     /// XXX
@@ -3150,6 +3169,7 @@ ret_t lmodel_set_gate_name(lmodel_gate_t * gate, const char * const new_name) {
 
   if(gate->name) free(gate->name);
   gate->name = strdup(new_name);
+  lmodel_report_damage(LM_TYPE_GATE, gate);
 
   return RET_OK;
 }
@@ -3160,6 +3180,7 @@ ret_t lmodel_set_wire_name(lmodel_wire_t * wire, const char * const new_name) {
 
   if(wire->name) free(wire->name);
   wire->name = strdup(new_name);
+  lmodel_report_damage(LM_TYPE_WIRE, wire);
 
   return RET_OK;
 }
@@ -3170,6 +3191,7 @@ ret_t lmodel_set_via_name(lmodel_via_t * via, const char * const new_name) {
 
   if(via->name) free(via->name);
   via->name = strdup(new_name);
+  lmodel_report_damage(LM_TYPE_VIA, via);
 
   return RET_OK;
 
@@ -3224,8 +3246,10 @@ ret_t lmodel_reset_gate_shape(lmodel_gate_t * gate) {
   unsigned int master_width = gate->gate_template->master_image_max_x - gate->gate_template->master_image_min_x;
   unsigned int master_height = gate->gate_template->master_image_max_y - gate->gate_template->master_image_min_y;
 
+  lmodel_report_damage(LM_TYPE_GATE, gate);
   gate->max_x = gate->min_x + master_width;
   gate->max_y = gate->min_y + master_height;
+  lmodel_report_damage(LM_TYPE_GATE, gate);
   return RET_OK;
 }
 
@@ -3312,6 +3336,7 @@ ret_t lmodel_set_gate_orientation(lmodel_gate_t * gate, LM_TEMPLATE_ORIENTATION
   else { 
     gate->template_orientation = orientation;
   }
+  lmodel_report_damage(LM_TYPE_GATE, gate);
   return RET_OK;
 }
 
@@ -3574,6 +3599,7 @@ ret_t lmodel_gate_template_set_color(lmodel_gate_template_t * gate_template,
 
   gate_template->fill_color = fill_color;
   gate_template->frame_color = frame_color;
+  lmodel_report_template_change();
   return RET_OK;
 }
 
@@ -3607,6 +3633,7 @@ ret_t lmodel_apply_colors_to_ports(logic_model_t * lmodel, const port_color_mana
   assert(pcm != NULL);
   if(lmodel == NULL || pcm == NULL) return RET_INV_PTR;
 
+  ret_t ret = RET_OK;
   lmodel_gate_template_set_t * tmpl_ptr = lmodel->gate_template_set;
   lmodel_gate_template_port_t * port_ptr = NULL;
 
@@ -3614,7 +3641,10 @@ ret_t lmodel_apply_colors_to_ports(logic_model_t * lmodel, const port_color_mana
 
   // reset all colors to 0
   while(tmpl_ptr != NULL) {
-    if(tmpl_ptr->gate == NULL) return RET_INV_PTR;
+    if(tmpl_ptr->gate == NULL) {
+      ret = RET_INV_PTR;
+      goto end;
+    }
     port_ptr = tmpl_ptr->gate->ports;
     while(port_ptr != NULL) {
       port_ptr->color = 0;
@@ -3626,7 +3656,10 @@ ret_t lmodel_apply_colors_to_ports(logic_model_t * lmodel, const port_color_mana
 
   tmpl_ptr = lmodel->gate_template_set;
   while(tmpl_ptr != NULL) {
-    if(tmpl_ptr->gate == NULL) return RET_INV_PTR;
+    if(tmpl_ptr->gate == NULL) {
+      ret = RET_INV_PTR;
+      goto end;
+    }
     port_ptr = tmpl_ptr->gate->ports;
     while(port_ptr != NULL) {
       port_ptr->color = pcm_get_color_for_port(pcm, port_ptr->port_name);
@@ -3635,7 +3668,10 @@ ret_t lmodel_apply_colors_to_ports(logic_model_t * lmodel, const port_color_mana
     tmpl_ptr = tmpl_ptr->next;
   }
 
-  return RET_OK;
+ end:
+  // colours of the preceding templates may have been changed
+  lmodel_report_template_change();
+  return ret;
 }
 
 
@@ -3830,3 +3866,72 @@ lmodel_gate_t * lmodel_get_gate_by_id(const logic_model_t * lmodel, unsigned int
 
   return lmodel_get_gate_from_set_by_id(lmodel->gate_set, obj_id);
 }
+
+static lmodel_damage_func_t damage_func = NULL;
+static void * damage_arg = NULL;
+static volatile unsigned long damage_version = 0;
+static volatile unsigned long template_version = 0;
+
+// per object class: gates (and their ports), wires, vias and anything else
+static volatile unsigned long damage_versions[4] = {0, 0, 0, 0};
+
+static int lmodel_damage_class_of(LM_OBJECT_TYPE object_type) {
+  switch(object_type) {
+  case LM_TYPE_GATE:
+  case LM_TYPE_GATE_PORT: return 0;
+  case LM_TYPE_WIRE: return 1;
+  case LM_TYPE_VIA: return 2;
+  default: return 3;
+  }
+}
+
+/**
+ * Register a callback, that is informed about objects, whose appearance changes,
+ * e.g. to invalidate cached renderings. Pass NULL to unregister.
+ */
+void lmodel_set_damage_callback(lmodel_damage_func_t func, void * arg) {
+  damage_func = func;
+  damage_arg = arg;
+}
+
+void lmodel_report_damage(LM_OBJECT_TYPE object_type, void * obj_ptr) {
+  // changes are reported from the GUI, plugin and autonaming threads
+  __sync_fetch_and_add(&damage_version, 1);
+  __sync_fetch_and_add(&damage_versions[lmodel_damage_class_of(object_type)], 1);
+  if(damage_func != NULL) (*damage_func)(damage_arg, object_type, obj_ptr);
+}
+
+/**
+ * Get a counter, that is incremented for each reported change. Caches, that are
+ * not informed by the damage callback, can compare it to detect changes.
+ */
+unsigned long lmodel_get_damage_version() {
+  return __sync_fetch_and_add(&damage_version, 0);
+}
+
+/**
+ * Get a counter, that is incremented for each reported change of an object of
+ * the given type and for each change, that may affect objects of any type.
+ */
+unsigned long lmodel_get_damage_version_of_type(LM_OBJECT_TYPE object_type) {
+  int cls = lmodel_damage_class_of(object_type);
+  unsigned long version = __sync_fetch_and_add(&damage_versions[3], 0);
+  if(cls != 3) version += __sync_fetch_and_add(&damage_versions[cls], 0);
+  return version;
+}
+
+/**
+ * Report a change of a gate template, e.g. of its colours, names or ports. All
+ * gates may look different afterwards.
+ */
+void lmodel_report_template_change() {
+  __sync_fetch_and_add(&template_version, 1);
+  lmodel_report_damage(LM_TYPE_UNDEF, NULL);
+}
+
+/**
+ * Get a counter, that is incremented for each change of any gate template.
+ */
+unsigned long lmodel_get_template_version() {
+  return __sync_fetch_and_add(&template_version, 0);
+}
@@ -421,5 +421,19 @@ ret_t lmodel_autoname_gates(logic_model_t * lmodel, unsigned int layer,
 lmodel_gate_t * lmodel_get_gate_by_name(const logic_model_t * lmodel, const char * const short_name);
 lmodel_gate_t * lmodel_get_gate_by_id(const logic_model_t * lmodel, unsigned int id);
 
+/**
+ * Callback, that is called, if the appearance of an object changes, e.g. if the
+ * object is added, removed, renamed or (un)selected. It is called before an object
+ * is destroyed. If obj_ptr is NULL, the appearance of any object may have changed.
+ */
+typedef void (*lmodel_damage_func_t)(void * arg, LM_OBJECT_TYPE object_type, void * obj_ptr);
+
+void lmodel_set_damage_callback(lmodel_damage_func_t func, void * arg);
+void lmodel_report_damage(LM_OBJECT_TYPE object_type, void * obj_ptr);
+unsigned long lmodel_get_damage_version();
+unsigned long lmodel_get_damage_version_of_type(LM_OBJECT_TYPE object_type);
+void lmodel_report_template_change();
+unsigned long lmodel_get_template_version();
+
 #endif
  
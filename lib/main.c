@@ -21,6 +21,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <assert.h>
 #include "renderer.h"
@@ -56,7 +57,32 @@ int main(void) {
 
 
 	puts("run matching");
-	if(!imgalgo_run_object_matching(project->matching_images[1], project->lmodel, 1, PROJECT_DIR, SIZE_X, SIZE_Y, 4, TRUE, TRUE, 128)) {
+	matching_params_t m_params;
+	memset(&m_params, 0, sizeof(matching_params_t));
+	// the filtered layer, if the project has a filter pipeline
+	if((m_params.img = project_get_matching_image(project, 1, 0, 0, SIZE_X - 1, SIZE_Y - 1)) == NULL) {
+		puts("can't get the image for matching");
+		exit(0);
+	}
+	m_params.max_x = SIZE_X - 1;
+	m_params.max_y = SIZE_Y - 1;
+	m_params.lmodel = project->lmodel;
+	m_params.layer = 1;
+	m_params.project_dir = PROJECT_DIR;
+	m_params.width = SIZE_X;
+	m_params.pin_diameter = 4;
+	m_params.match_horizontal_objects = TRUE;
+	m_params.match_vertical_objects = TRUE;
+	m_params.threshold_col_separation = 128;
+
+	m_params.match_object_type = LM_TYPE_WIRE;
+	if(RET_IS_NOT_OK(imgalgo_run_object_matching(&m_params))) {
+		puts("matching algorithms failed");
+		exit(0);
+	}
+
+	m_params.match_object_type = LM_TYPE_VIA;
+	if(RET_IS_NOT_OK(imgalgo_run_object_matching(&m_params))) {
 		puts("matching algorithms failed");
 		exit(0);
 	}
@@ -34,6 +34,8 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include <math.h>
 
 #include "memory_map.h"
+#include "residency_manager.h"
+#include "scratch_pool.h"
 
 #ifdef HAVE_MMAP64
 #define MMAP mmap64
@@ -43,6 +45,11 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 #define CHECK_XY_IN_MAP(map, x, y) (map != NULL && map->mem != NULL && x < map->width && y < map->height)
 
+#define MAP_SIZE(map) ((size_t)(map)->width * (size_t)(map)->height * (size_t)(map)->bytes_per_elem)
+
+/* Areas smaller than this are cleared with memset() instead of punching a hole. */
+#define MIN_HOLE_SIZE (256 * 1024)
+
 /**
  * Creates an empty memory map struct. It does not allocate memory for the data.
  * Use mm_alloc_momory() or mm_map_file() to do it.
@@ -76,10 +83,11 @@ ret_t mm_alloc_memory(memory_map_t * map) {
   assert(map->mem == NULL); // if it is not null, it would indicates, that there is already any allocation
 
   if(map->storage_type == MAP_STORAGE_TYPE_UNDEF) {
-    map->mem = (uint8_t *) malloc(map->width * map->height * map->bytes_per_elem);
+    // large blocks from calloc() are mapped lazily and read as zero
+    map->mem = (uint8_t *) calloc(MAP_SIZE(map), 1);
     if(!map->mem) return RET_MALLOC_FAILED;
-    memset(map->mem, 0, map->width * map->height * map->bytes_per_elem);
     map->storage_type = MAP_STORAGE_TYPE_MEM;
+    if(MAP_SIZE(map) >= 2 * 1024 * 1024) mm_advise(map, MM_ACCESS_HUGEPAGES);
   }
   assert(map->mem != NULL);
   return RET_OK;
@@ -97,6 +105,7 @@ ret_t mm_destroy(memory_map_t * map) {
   if(map->mem != NULL) {
 
     if(map->storage_type == MAP_STORAGE_TYPE_FILE) {
+      resmgr_unregister(map);
       if(msync(map->mem, map->filesize, MS_SYNC) == -1) {
 	debug(TM, "msync() failed");
 	ret = RET_ERR;
@@ -113,6 +122,10 @@ ret_t mm_destroy(memory_map_t * map) {
       free(map->mem);
       map->mem = NULL;
     }
+    else if(map->storage_type == MAP_STORAGE_TYPE_SCRATCH) {
+      scratch_free(map->mem, map->filesize);
+      map->mem = NULL;
+    }
   }
 	
   if(map->fd > 0) close(map->fd);
@@ -145,7 +158,7 @@ ret_t mm_destroy_and_unlink(memory_map_t * map) {
   strncpy(filename, map->filename, sizeof(filename));
   if(RET_IS_NOT_OK(ret = mm_destroy(map))) return ret;
 
-  if(unlink(map->filename) == -1) {
+  if(unlink(filename) == -1) {
     debug(TM, "Can't unlink file %s", filename);
     ret = RET_ERR;
   }
@@ -157,11 +170,38 @@ ret_t mm_destroy_and_unlink(memory_map_t * map) {
  * Clear map data.
  * @returns RET_OK on success
  */
+/**
+ * Set a range of bytes in the map to zero. For file backed maps, the pages within
+ * the range are released from the file by punching a hole, so the file system does
+ * not have to store zeros. Partial pages are cleared with memset().
+ */
+static ret_t mm_zero_range(memory_map_t * map, size_t offset, size_t len) {
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  if(map->storage_type == MAP_STORAGE_TYPE_FILE && len >= MIN_HOLE_SIZE) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t hole_start = (offset + page_size - 1) & ~(page_size - 1);
+    size_t hole_end = (offset + len) & ~(page_size - 1);
+
+    if(fallocate(map->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 
+		 hole_start, hole_end - hole_start) == 0) {
+      memset(map->mem + offset, 0, hole_start - offset);
+      memset(map->mem + hole_end, 0, offset + len - hole_end);
+      return RET_OK;
+    }
+    // the file system does not support holes
+  }
+#endif
+
+  memset(map->mem + offset, 0, len);
+  return RET_OK;
+}
+
 ret_t mm_clear(memory_map_t * map) {
   assert(map != NULL);
   if(map == NULL) return RET_INV_PTR;
-  memset(map->mem, 0, map->width * map->height * map->bytes_per_elem);
-  return RET_OK;
+  if(map->mem == NULL) return RET_ERR;
+  return mm_zero_range(map, 0, MAP_SIZE(map));
 }
 
 /** 
@@ -172,10 +212,20 @@ ret_t mm_clear_area(memory_map_t * map, unsigned int min_x, unsigned int min_y,
 		    unsigned int width, unsigned int height) {
   
   if(!map) return RET_INV_PTR;
-  unsigned int x, y;
-  for(y = min_y; y < min_y + height; y++)
-    for(x = min_x; x < min_x + width; x++)
-      memset(mm_get_ptr(map, x, y), 0, map->bytes_per_elem);
+  if(map->mem == NULL) return RET_ERR;
+  if(min_x >= map->width || min_y >= map->height) return RET_OK;
+  width = MIN(width, map->width - min_x);
+  height = MIN(height, map->height - min_y);
+
+  size_t row_size = (size_t)map->width * map->bytes_per_elem;
+  size_t offset = ((size_t)min_y * map->width + min_x) * map->bytes_per_elem;
+  unsigned int y;
+
+  // full rows are contiguous
+  if(width == map->width) return mm_zero_range(map, offset, height * row_size);
+
+  for(y = 0; y < height; y++, offset += row_size)
+    memset(map->mem + offset, 0, (size_t)width * map->bytes_per_elem);
 
   return RET_OK;
 }
@@ -209,6 +259,28 @@ ret_t mm_map_temp_file(memory_map_t * map, const char * const project_dir) {
   return mm_map_file_by_fd(map, project_dir, fd, filename);
 }
 
+/**
+ * Use memory from the scratch pool as storage for map data, that does not need
+ * to be stored. If the scratch memory budget is exhausted, the data is stored
+ * in a temp file in the project directory instead.
+ */
+ret_t mm_map_scratch(memory_map_t * map, const char * const project_dir) {
+
+  assert(map != NULL);
+  assert(map->mem == NULL);
+  if(map == NULL) return RET_INV_PTR;
+  if(map->mem != NULL) return RET_ERR;
+
+  if((map->mem = (uint8_t *)scratch_alloc(MAP_SIZE(map), &map->filesize)) != NULL) {
+    map->storage_type = MAP_STORAGE_TYPE_SCRATCH;
+    if(map->filesize >= 2 * 1024 * 1024) mm_advise(map, MM_ACCESS_HUGEPAGES);
+    return RET_OK;
+  }
+
+  debug(TM, "scratch memory budget exceeded - using a temp file");
+  return mm_map_temp_file(map, project_dir);
+}
+
 /**
  * Use storage in file as storage for memory map
  */
@@ -217,7 +289,8 @@ ret_t mm_map_file(memory_map_t * map, const char * const project_dir, const char
   if(!map) return RET_INV_PTR;
 	
   // reset existing resources
-  if(map->mem != NULL && (munmap(map->mem, map->width * map->height * map->bytes_per_elem) == -1)) {
+  if(map->mem != NULL) resmgr_unregister(map);
+  if(map->mem != NULL && (munmap(map->mem, map->filesize) == -1)) {
     puts("munmap failed");
     return RET_ERR;
   }
@@ -243,11 +316,11 @@ ret_t mm_map_file(memory_map_t * map, const char * const project_dir, const char
 	
   // get file size
   map->filesize = lseek(map->fd, 0, SEEK_END);
-  if(map->filesize < map->width * map->height * map->bytes_per_elem) {
-    map->filesize = map->width * map->height * map->bytes_per_elem;
-    lseek(map->fd, map->filesize - 1, SEEK_SET);
-    if(write(map->fd, "\0", 1) != 1) {
-      perror("can't open file");
+  if(map->filesize < MAP_SIZE(map)) {
+    map->filesize = MAP_SIZE(map);
+    // extend the file without allocating blocks, unwritten areas read as zero
+    if(ftruncate(map->fd, map->filesize) == -1) {
+      perror("can't extend file");
       free(map->filename);
       map->filename = NULL;
       return RET_ERR;
@@ -266,6 +339,7 @@ ret_t mm_map_file(memory_map_t * map, const char * const project_dir, const char
   }
 
   map->storage_type = MAP_STORAGE_TYPE_FILE;
+  resmgr_register(map);
 	
   return RET_OK;
 }
@@ -283,7 +357,8 @@ ret_t mm_map_file_by_fd(memory_map_t * map, const char * const project_dir, int
   if(map == NULL || project_dir == NULL || filename == NULL) return RET_INV_PTR;
 	
   // reset existing resources
-  if(map->mem != NULL && (munmap(map->mem, map->width * map->height * map->bytes_per_elem) == -1)) {
+  if(map->mem != NULL) resmgr_unregister(map);
+  if(map->mem != NULL && (munmap(map->mem, map->filesize) == -1)) {
     puts("munmap failed");
     return RET_ERR;
   }
@@ -295,10 +370,9 @@ ret_t mm_map_file_by_fd(memory_map_t * map, const char * const project_dir, int
 
   // get file size
   map->filesize = lseek(map->fd, 0, SEEK_END);
-  if(map->filesize < map->width * map->height * map->bytes_per_elem) {
-    map->filesize = map->width * map->height * map->bytes_per_elem;
-    lseek(map->fd, map->filesize - 1, SEEK_SET);
-    if(write(map->fd, "\0", 1) != 1) {
+  if(map->filesize < MAP_SIZE(map)) {
+    map->filesize = MAP_SIZE(map);
+    if(ftruncate(map->fd, map->filesize) == -1) {
       free(map->filename);
       map->filename = NULL;
       close(map->fd);
@@ -319,6 +393,7 @@ ret_t mm_map_file_by_fd(memory_map_t * map, const char * const project_dir, int
   }
 
   map->storage_type = MAP_STORAGE_TYPE_FILE;
+  resmgr_register(map);
   return RET_OK;
 }
 
@@ -337,6 +412,7 @@ ret_t mm_deactivate_mapping(memory_map_t * map) {
   if(map->mem != NULL) {
 
     if(map->storage_type == MAP_STORAGE_TYPE_FILE) {
+      resmgr_unregister(map);
       if(msync(map->mem, map->filesize, MS_SYNC) == -1) {
 	debug(TM, "msync() failed");
 	ret = RET_ERR;
@@ -366,13 +442,109 @@ ret_t mm_reactivate_mapping(memory_map_t * map) {
   if(map->fd == 0) return RET_ERR;
   if(map->storage_type != MAP_STORAGE_TYPE_FILE) return RET_ERR;
 
-  if(map->mem == NULL)
+  if(map->mem == NULL) {
     if((map->mem = (uint8_t *) MMAP(NULL, map->filesize,
 				    PROT_READ | PROT_WRITE, 
 				    MAP_FILE | MAP_SHARED, map->fd, 0)) == (void *)(-1)) {
+      map->mem = NULL;
       return RET_ERR;
     }
+    // the hints belong to the old mapping
+    if(map->access_pattern != MM_ACCESS_NORMAL) mm_advise(map, map->access_pattern);
+  }
+
+  return resmgr_register(map);
+}
+
+/**
+ * Call madvise() for the pages, that cover a range of bytes in the map.
+ */
+static ret_t mm_madvise_range(memory_map_t * map, size_t offset, size_t len, int advice) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)(map->mem + offset);
+  uintptr_t aligned_start = start & ~(page_size - 1);
+
+  if(len == 0) return RET_OK;
+  if(madvise((void *)aligned_start, start - aligned_start + len, advice) == -1) {
+    debug(TM, "madvise() failed");
+    return RET_ERR;
+  }
+  return RET_OK;
+}
+
+/**
+ * Give the kernel a hint, how the map data will be accessed. Sequential and random
+ * access hints are applied to file backed maps only. The hint is remembered and
+ * applied again, if the mapping is reactivated. Huge pages are requested for
+ * the page aligned part of the map, if the system supports them.
+ */
+ret_t mm_advise(memory_map_t * map, MM_ACCESS_PATTERN pattern) {
+  assert(map != NULL);
+  if(map == NULL) return RET_INV_PTR;
+  if(pattern != MM_ACCESS_HUGEPAGES) map->access_pattern = pattern;
+  if(map->mem == NULL) return RET_OK;
+
+  switch(pattern) {
+  case MM_ACCESS_NORMAL:
+    if(map->storage_type != MAP_STORAGE_TYPE_FILE) return RET_OK;
+    return mm_madvise_range(map, 0, map->filesize, MADV_NORMAL);
+  case MM_ACCESS_SEQUENTIAL:
+    if(map->storage_type != MAP_STORAGE_TYPE_FILE) return RET_OK;
+    return mm_madvise_range(map, 0, map->filesize, MADV_SEQUENTIAL);
+  case MM_ACCESS_RANDOM:
+    if(map->storage_type != MAP_STORAGE_TYPE_FILE) return RET_OK;
+    return mm_madvise_range(map, 0, map->filesize, MADV_RANDOM);
+  case MM_ACCESS_HUGEPAGES:
+#ifdef MADV_HUGEPAGE
+    {
+      size_t size = (size_t)map->width * map->height * map->bytes_per_elem;
+      size_t page_size = sysconf(_SC_PAGESIZE);
+      size_t skip = (page_size - ((uintptr_t)map->mem & (page_size - 1))) & (page_size - 1);
+      if(size <= skip) return RET_OK;
+      // the kernel may refuse huge pages for some kinds of mappings
+      madvise(map->mem + skip, (size - skip) & ~(page_size - 1), MADV_HUGEPAGE);
+    }
+#endif
+    return RET_OK;
+  }
+  return RET_ERR;
+}
+
+/**
+ * Get the access pattern, that was set with mm_advise(). Callers, that change the
+ * hint for a single pass, use it to restore the previous hint afterwards.
+ */
+MM_ACCESS_PATTERN mm_get_access_pattern(memory_map_t * map) {
+  assert(map != NULL);
+  return map != NULL ? map->access_pattern : MM_ACCESS_NORMAL;
+}
+
+/**
+ * Tell the kernel, that an area of the map will be needed soon. The kernel starts
+ * reading the pages in the background.
+ */
+ret_t mm_advise_willneed(memory_map_t * map, unsigned int min_x, unsigned int min_y, 
+			 unsigned int width, unsigned int height) {
+  ret_t ret;
+  unsigned int y;
+  assert(map != NULL);
+  if(map == NULL) return RET_INV_PTR;
+  if(map->mem == NULL || map->storage_type != MAP_STORAGE_TYPE_FILE) return RET_OK;
+
+  if(min_x >= map->width || min_y >= map->height) return RET_OK;
+  width = MIN(width, map->width - min_x);
+  height = MIN(height, map->height - min_y);
+
+  size_t row_size = (size_t)map->width * map->bytes_per_elem;
+  size_t offset = ((size_t)min_y * map->width + min_x) * map->bytes_per_elem;
+
+  // full rows are contiguous
+  if(width == map->width) 
+    return mm_madvise_range(map, offset, height * row_size, MADV_WILLNEED);
 
+  for(y = 0; y < height; y++, offset += row_size)
+    if(RET_IS_NOT_OK(ret = mm_madvise_range(map, offset, (size_t)width * map->bytes_per_elem,
+					    MADV_WILLNEED))) return ret;
   return RET_OK;
 }
 
@@ -383,7 +555,7 @@ void * mm_get_ptr(memory_map_t * map, unsigned int x, unsigned int y) {
   assert(x < map->width);
   assert(y < map->height);
 #endif
-  return map->mem + (y * map->width + x) * map->bytes_per_elem;
+  return map->mem + ((size_t)y * map->width + x) * map->bytes_per_elem;
 }
 
 
@@ -431,7 +603,7 @@ ret_t mm_clone_map_data(memory_map_t * const dst, memory_map_t * const src) {
      dst->height == src->height &&
      dst->bytes_per_elem == src->bytes_per_elem) {
 
-    memcpy(dst->mem, src->mem, src->width * src->height * src->bytes_per_elem);
+    memcpy(dst->mem, src->mem, MAP_SIZE(src));
 
     return RET_OK;
   }
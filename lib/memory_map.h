@@ -29,6 +29,15 @@ enum MAP_STORAGE_TYPE {
   MAP_STORAGE_TYPE_UNDEF = 0,
   MAP_STORAGE_TYPE_FILE = 1,
   MAP_STORAGE_TYPE_MEM = 2,
+  MAP_STORAGE_TYPE_SCRATCH = 3,
+};
+
+/** Access pattern hints for mm_advise(). */
+enum MM_ACCESS_PATTERN {
+  MM_ACCESS_NORMAL = 0,
+  MM_ACCESS_SEQUENTIAL = 1,
+  MM_ACCESS_RANDOM = 2,
+  MM_ACCESS_HUGEPAGES = 3,
 };
 
 struct memory_map {
@@ -40,8 +49,9 @@ struct memory_map {
   uint8_t * mem;
   char * filename;
   int fd;
-  size_t filesize;	
+  size_t filesize; // size of the mapping, for scratch maps the size of the buffer
   int is_temp_file;
+  MM_ACCESS_PATTERN access_pattern; // the last access hint, see mm_advise()
 };
 
 typedef struct memory_map memory_map_t;
@@ -56,6 +66,7 @@ ret_t mm_clear_area(memory_map_t * map, unsigned int min_x, unsigned int min_y,
 
 
 ret_t mm_map_temp_file(memory_map_t * img, const char * const project_dir);
+ret_t mm_map_scratch(memory_map_t * map, const char * const project_dir);
 ret_t mm_map_file(memory_map_t * img, const char * const project_dir, const char * const filename);
 ret_t mm_map_file_by_fd(memory_map_t * img, const char * const project_dir, int fd, const char * const filename);
 
@@ -65,10 +76,24 @@ ret_t mm_reactivate_mapping(memory_map_t * map);
 
 ret_t mm_clone_map_data(memory_map_t * const dst, memory_map_t * const src);
 
+ret_t mm_advise(memory_map_t * map, MM_ACCESS_PATTERN pattern);
+MM_ACCESS_PATTERN mm_get_access_pattern(memory_map_t * map);
+ret_t mm_advise_willneed(memory_map_t * map, unsigned int min_x, unsigned int min_y, 
+			 unsigned int width, unsigned int height);
+
 // get/set pixels
 
 void * mm_get_ptr(memory_map_t * map, unsigned int x, unsigned int y);
 
+// helper for maps of doubles
+inline double mm_get_double(memory_map_t * map, unsigned int x, unsigned int y) {
+  return *(double *)mm_get_ptr(map, x, y);
+}
+
+inline void mm_set_double(memory_map_t * map, unsigned int x, unsigned int y, double v) {
+  *(double *)mm_get_ptr(map, x, y) = v;
+}
+
 
 // misc
 ret_t mm_scale_and_shift_in_place(memory_map_t *map, 
@@ -0,0 +1,737 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "graphics.h"
+#include "memory_map.h"
+#include "img_algorithms.h"
+#include "parallel.h"
+#include "mosaic.h"
+
+/* Minimum size of an overlap, that is used for the offset refinement, not counting the search margin. */
+#define MOSAIC_MIN_OVERLAP 16
+
+/* Maximum edge length of the patch, that is correlated. */
+#define MOSAIC_MAX_PATCH 256
+
+/* Step size for the coarse search before the hill climbing. */
+#define MOSAIC_COARSE_STEP 4
+
+/* Pair measurements with a lower correlation are ignored. */
+#define MOSAIC_MIN_CORRELATION 0.5
+
+/* Weight of the nominal position in the position solver. */
+#define MOSAIC_PRIOR_WEIGHT 0.01
+
+#define MOSAIC_SOLVER_MAX_ITERATIONS 10000
+#define MOSAIC_SOLVER_EPSILON 0.01
+
+/* Number of rows, that are blended by a single job. */
+#define MOSAIC_BLEND_ROWS 16
+
+typedef struct {
+  unsigned int a, b; // tile indices
+  double dx, dy;     // measured position of tile b relative to tile a
+  double corr;       // correlation of the best match or 0, if it was not measured
+
+  int px, py;        // patch from the center of the overlap in layer coordinates
+  unsigned int pw, ph;
+  image_t * patch;   // patch from tile b
+  image_t * search;  // patch and search margin from tile a
+} mosaic_pair_t;
+
+typedef struct {
+  mosaic_t * mosaic;
+  mosaic_pair_t * pairs;
+  unsigned int num_pairs;
+  unsigned int max_shift;
+
+  // pair indices per tile
+  unsigned int * tile_pairs_start, * tile_pairs;
+
+  pthread_mutex_t mutex;
+  unsigned int jobs_done, num_jobs;
+  gr_progress_func_t progress_func;
+  void * progress_arg;
+} refine_params_t;
+
+typedef struct {
+  image_t * img;
+  const mosaic_t * mosaic;
+
+  image_t ** tile_images;    // decoded tiles, indexed like the tiles of the mosaic
+  unsigned int * active;     // tiles, that intersect the current band of rows
+  unsigned int num_active;
+  unsigned int * to_load;    // tiles, that are decoded for the current band
+  int band_min_y, band_max_y;
+} blend_params_t;
+
+typedef struct {
+  int y;
+  unsigned int tile;
+} tile_order_t;
+
+/**
+ * Split a line of a tile list into the filename and the position. The position
+ * is taken from the end of the line, so filenames may contain spaces.
+ */
+static ret_t parse_tile_entry(char * line, char * tile_file, size_t tile_file_size, int * x, int * y) {
+  char * end = line + strlen(line), * sep;
+  long v[2];
+  int i;
+
+  for(i = 1; i >= 0; i--) {
+    while(end > line && isspace(end[-1])) end--;
+    *end = '\0';
+    for(sep = end; sep > line && !isspace(sep[-1]); sep--);
+
+    char * num_end;
+    v[i] = strtol(sep, &num_end, 10);
+    if(sep == end || *num_end != '\0') return RET_ERR;
+    end = sep;
+  }
+
+  while(end > line && isspace(end[-1])) end--;
+  if(end == line || (size_t)(end - line) >= tile_file_size) return RET_ERR;
+
+  memcpy(tile_file, line, end - line);
+  tile_file[end - line] = '\0';
+  *x = v[0];
+  *y = v[1];
+  return RET_OK;
+}
+
+/**
+ * Load a tile list. The image files are only pinged to get the tile sizes.
+ * @returns a new mosaic or NULL on failure
+ * @see mosaic_destroy()
+ */
+mosaic_t * mosaic_load_tile_list(const char * const filename) {
+  assert(filename != NULL);
+  if(filename == NULL) return NULL;
+
+  char dir[PATH_MAX];
+  char line[2 * PATH_MAX];
+  char tile_file[PATH_MAX];
+  unsigned int capacity = 0, line_num = 0;
+  int x, y;
+
+  strncpy(dir, filename, sizeof(dir) - 1);
+  dir[sizeof(dir) - 1] = '\0';
+  char * slash = strrchr(dir, '/');
+  if(slash != NULL) *slash = '\0';
+  else strcpy(dir, ".");
+
+  FILE * f = fopen(filename, "r");
+  if(f == NULL) {
+    debug(TM, "Can't open tile list %s", filename);
+    return NULL;
+  }
+
+  mosaic_t * mosaic = (mosaic_t *)malloc(sizeof(mosaic_t));
+  if(mosaic == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  memset(mosaic, 0, sizeof(mosaic_t));
+
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char * p = line;
+    line_num++;
+    while(isspace(*p)) p++;
+    if(*p == '\0' || *p == '#') continue;
+
+    if(RET_IS_NOT_OK(parse_tile_entry(p, tile_file, sizeof(tile_file), &x, &y))) {
+      debug(TM, "Invalid entry in tile list %s, line %d", filename, line_num);
+      goto error;
+    }
+
+    if(mosaic->num_tiles == capacity) {
+      capacity = capacity == 0 ? 64 : capacity << 1;
+      mosaic_tile_t * tiles = (mosaic_tile_t *)realloc(mosaic->tiles, capacity * sizeof(mosaic_tile_t));
+      if(tiles == NULL) goto error;
+      mosaic->tiles = tiles;
+    }
+
+    mosaic_tile_t * tile = &mosaic->tiles[mosaic->num_tiles];
+    memset(tile, 0, sizeof(mosaic_tile_t));
+    tile->x = x;
+    tile->y = y;
+
+    if(tile_file[0] == '/') tile->filename = strdup(tile_file);
+    else if((tile->filename = (char *)malloc(strlen(dir) + strlen(tile_file) + 2)) != NULL)
+      sprintf(tile->filename, "%s/%s", dir, tile_file);
+
+    if(tile->filename == NULL) goto error;
+    mosaic->num_tiles++;
+
+    if(RET_IS_NOT_OK(gr_get_image_file_size(tile->filename, &tile->width, &tile->height)) ||
+       tile->width == 0 || tile->height == 0) {
+      debug(TM, "Can't read tile %s", tile->filename);
+      goto error;
+    }
+  }
+
+  fclose(f);
+  debug(TM, "tile list with %d tiles loaded", mosaic->num_tiles);
+  return mosaic;
+
+ error:
+  fclose(f);
+  mosaic_destroy(mosaic);
+  return NULL;
+}
+
+/**
+ * Destroy a mosaic.
+ */
+ret_t mosaic_destroy(mosaic_t * mosaic) {
+  unsigned int i;
+  assert(mosaic != NULL);
+  if(mosaic == NULL) return RET_INV_PTR;
+
+  for(i = 0; i < mosaic->num_tiles; i++)
+    if(mosaic->tiles[i].filename != NULL) free(mosaic->tiles[i].filename);
+
+  if(mosaic->tiles != NULL) free(mosaic->tiles);
+  free(mosaic);
+  return RET_OK;
+}
+
+/**
+ * Load a tile as a memory image.
+ */
+static image_t * load_tile(const mosaic_tile_t * tile, IMAGE_TYPE image_type) {
+  image_t * img = gr_create_memory_image(tile->width, tile->height, image_type);
+  if(img == NULL) return NULL;
+
+  if(RET_IS_NOT_OK(gr_import_background_image(img, 0, 0, tile->filename, NULL, NULL))) {
+    gr_image_destroy(img);
+    return NULL;
+  }
+  return img;
+}
+
+/**
+ * Calculate the intersection of two tiles. max_x and max_y are excluded.
+ * @returns true, if the tiles intersect
+ */
+static bool get_overlap(const mosaic_tile_t * a, const mosaic_tile_t * b,
+			int * min_x, int * min_y, int * max_x, int * max_y) {
+  *min_x = MAX(a->x, b->x);
+  *min_y = MAX(a->y, b->y);
+  *max_x = MIN(a->x + (int)a->width, b->x + (int)b->width);
+  *max_y = MIN(a->y + (int)a->height, b->y + (int)b->height);
+  return *min_x < *max_x && *min_y < *max_y;
+}
+
+static void report_progress(pthread_mutex_t * mutex, unsigned int * jobs_done, unsigned int num_jobs,
+			    gr_progress_func_t progress_func, void * progress_arg) {
+  pthread_mutex_lock(mutex);
+  (*jobs_done)++;
+  if(progress_func != NULL) (*progress_func)((double)*jobs_done / (double)num_jobs, progress_arg);
+  pthread_mutex_unlock(mutex);
+}
+
+/**
+ * Decode a tile once and cut out the patches and search areas of all pairs,
+ * the tile belongs to. Tiles without pairs are not decoded.
+ */
+static ret_t extract_tile_regions(unsigned int job, void * arg) {
+  refine_params_t * params = (refine_params_t *)arg;
+  const mosaic_tile_t * tile = &params->mosaic->tiles[job];
+  int s = params->max_shift;
+  unsigned int i;
+  ret_t ret = RET_OK;
+
+  if(params->tile_pairs_start[job] < params->tile_pairs_start[job + 1]) {
+    image_t * img = load_tile(tile, IMAGE_TYPE_GS);
+    if(img == NULL) return RET_ERR;
+
+    for(i = params->tile_pairs_start[job]; i < params->tile_pairs_start[job + 1]; i++) {
+      mosaic_pair_t * pair = &params->pairs[params->tile_pairs[i]];
+      image_t * region = pair->a == job ?
+	gr_extract_image_as_gs(img, pair->px - s - tile->x, pair->py - s - tile->y, 
+			       pair->pw + 2 * s, pair->ph + 2 * s) :
+	gr_extract_image_as_gs(img, pair->px - tile->x, pair->py - tile->y, pair->pw, pair->ph);
+
+      if(region == NULL) {
+	ret = RET_ERR;
+	break;
+      }
+      if(pair->a == job) pair->search = region;
+      else pair->patch = region;
+    }
+
+    gr_image_destroy(img);
+  }
+
+  if(RET_IS_OK(ret))
+    report_progress(&params->mutex, &params->jobs_done, params->num_jobs,
+		    params->progress_func, params->progress_arg);
+  return ret;
+}
+
+/**
+ * Measure the displacement between two overlapping tiles. The patch from the
+ * overlap of tile b is searched in tile a within +/- max_shift pixels around
+ * the nominal position. The search is a coarse grid search followed by a hill
+ * climbing on the normalized cross correlation.
+ */
+static ret_t measure_pair(unsigned int job, void * arg) {
+  refine_params_t * params = (refine_params_t *)arg;
+  mosaic_pair_t * pair = &params->pairs[job];
+  const mosaic_tile_t * ta = &params->mosaic->tiles[pair->a];
+  const mosaic_tile_t * tb = &params->mosaic->tiles[pair->b];
+  int s = params->max_shift;
+  ret_t ret = RET_OK;
+
+  image_t * patch = pair->patch, * search = pair->search;
+  memory_map_t * zero_mean_patch = NULL, * table_single = NULL, * table_squared = NULL;
+
+  pair->corr = 0;
+  pair->patch = pair->search = NULL;
+  if(patch == NULL || search == NULL) { ret = RET_ERR; goto finish; }
+
+  if((zero_mean_patch = mm_create(pair->pw, pair->ph, sizeof(double))) == NULL ||
+     (table_single = mm_create(search->width, search->height, sizeof(double))) == NULL ||
+     (table_squared = mm_create(search->width, search->height, sizeof(double))) == NULL) {
+    ret = RET_MALLOC_FAILED;
+    goto finish;
+  }
+
+  if(RET_IS_NOT_OK(ret = mm_alloc_memory(zero_mean_patch)) ||
+     RET_IS_NOT_OK(ret = mm_alloc_memory(table_single)) ||
+     RET_IS_NOT_OK(ret = mm_alloc_memory(table_squared)) ||
+     RET_IS_NOT_OK(ret = imgalgo_precalc_summation_tables(search, table_single, table_squared))) goto finish;
+
+  {
+    double sum_over_zero_mean_patch = imgalgo_subtract_mean(patch, zero_mean_patch);
+    if(sum_over_zero_mean_patch <= 0) goto finish; // a flat patch can't be matched
+
+    int dx, dy, best_dx = 0, best_dy = 0;
+    double best = -2;
+
+    for(dy = -s; dy <= s; dy += MOSAIC_COARSE_STEP)
+      for(dx = -s; dx <= s; dx += MOSAIC_COARSE_STEP) {
+	double v = imgalgo_calc_single_xcorr(search, zero_mean_patch, table_single, table_squared,
+					     sum_over_zero_mean_patch, s + dx, s + dy);
+	if(isfinite(v) && v > best) { best = v; best_dx = dx; best_dy = dy; }
+      }
+
+    bool improved = true;
+    while(improved) {
+      improved = false;
+      int cx = best_dx, cy = best_dy;
+      for(dy = cy - 1; dy <= cy + 1; dy++)
+	for(dx = cx - 1; dx <= cx + 1; dx++) {
+	  if(dx < -s || dx > s || dy < -s || dy > s || (dx == cx && dy == cy)) continue;
+	  double v = imgalgo_calc_single_xcorr(search, zero_mean_patch, table_single, table_squared,
+					       sum_over_zero_mean_patch, s + dx, s + dy);
+	  if(isfinite(v) && v > best) { best = v; best_dx = dx; best_dy = dy; improved = true; }
+	}
+    }
+
+    pair->dx = tb->x - ta->x + best_dx;
+    pair->dy = tb->y - ta->y + best_dy;
+    pair->corr = best;
+    debug(TM, "tiles %d/%d: shift %d/%d corr %f", pair->a, pair->b, best_dx, best_dy, best);
+  }
+
+ finish:
+  if(patch != NULL) gr_image_destroy(patch);
+  if(search != NULL) gr_image_destroy(search);
+  if(zero_mean_patch != NULL) mm_destroy(zero_mean_patch);
+  if(table_single != NULL) mm_destroy(table_single);
+  if(table_squared != NULL) mm_destroy(table_squared);
+
+  if(RET_IS_OK(ret))
+    report_progress(&params->mutex, &params->jobs_done, params->num_jobs,
+		    params->progress_func, params->progress_arg);
+  return ret;
+}
+
+/**
+ * Calculate tile positions, that fit the pairwise measurements best in the least
+ * squares sense. The nominal positions are used as a weak prior, so tiles without
+ * reliable measurements stay where they are. The system is solved with Gauss-Seidel
+ * iterations.
+ */
+static ret_t solve_positions(mosaic_t * mosaic, mosaic_pair_t * pairs, unsigned int num_pairs) {
+  unsigned int n = mosaic->num_tiles;
+  unsigned int i, j, iter;
+  ret_t ret = RET_OK;
+
+  double * pos_x = (double *)malloc(n * sizeof(double));
+  double * pos_y = (double *)malloc(n * sizeof(double));
+  unsigned int * adj_start = (unsigned int *)calloc(n + 1, sizeof(unsigned int));
+  unsigned int * adj = (unsigned int *)malloc(2 * num_pairs * sizeof(unsigned int) + 1);
+
+  if(pos_x == NULL || pos_y == NULL || adj_start == NULL || adj == NULL) {
+    ret = RET_MALLOC_FAILED;
+    goto finish;
+  }
+
+  // adjacency lists of pair indices per tile
+  for(j = 0; j < num_pairs; j++) {
+    if(pairs[j].corr < MOSAIC_MIN_CORRELATION) continue;
+    adj_start[pairs[j].a + 1]++;
+    adj_start[pairs[j].b + 1]++;
+  }
+  for(i = 0; i < n; i++) adj_start[i + 1] += adj_start[i];
+  {
+    unsigned int * fill = (unsigned int *)malloc(n * sizeof(unsigned int));
+    if(fill == NULL) { ret = RET_MALLOC_FAILED; goto finish; }
+    memcpy(fill, adj_start, n * sizeof(unsigned int));
+    for(j = 0; j < num_pairs; j++) {
+      if(pairs[j].corr < MOSAIC_MIN_CORRELATION) continue;
+      adj[fill[pairs[j].a]++] = j;
+      adj[fill[pairs[j].b]++] = j;
+    }
+    free(fill);
+  }
+
+  for(i = 0; i < n; i++) {
+    pos_x[i] = mosaic->tiles[i].x;
+    pos_y[i] = mosaic->tiles[i].y;
+  }
+
+  for(iter = 0; iter < MOSAIC_SOLVER_MAX_ITERATIONS; iter++) {
+    double max_delta = 0;
+
+    for(i = 0; i < n; i++) {
+      if(adj_start[i] == adj_start[i + 1]) continue;
+
+      double sum_w = MOSAIC_PRIOR_WEIGHT;
+      double sum_x = MOSAIC_PRIOR_WEIGHT * mosaic->tiles[i].x;
+      double sum_y = MOSAIC_PRIOR_WEIGHT * mosaic->tiles[i].y;
+
+      for(j = adj_start[i]; j < adj_start[i + 1]; j++) {
+	const mosaic_pair_t * pair = &pairs[adj[j]];
+	double w = pair->corr;
+	if(pair->b == i) {
+	  sum_x += w * (pos_x[pair->a] + pair->dx);
+	  sum_y += w * (pos_y[pair->a] + pair->dy);
+	}
+	else {
+	  sum_x += w * (pos_x[pair->b] - pair->dx);
+	  sum_y += w * (pos_y[pair->b] - pair->dy);
+	}
+	sum_w += w;
+      }
+
+      double new_x = sum_x / sum_w, new_y = sum_y / sum_w;
+      max_delta = MAX(max_delta, MAX(fabs(new_x - pos_x[i]), fabs(new_y - pos_y[i])));
+      pos_x[i] = new_x;
+      pos_y[i] = new_y;
+    }
+
+    if(max_delta < MOSAIC_SOLVER_EPSILON) break;
+  }
+  debug(TM, "position solver finished after %d iterations", iter);
+
+  for(i = 0; i < n; i++) {
+    mosaic->tiles[i].x = lrint(pos_x[i]);
+    mosaic->tiles[i].y = lrint(pos_y[i]);
+  }
+
+ finish:
+  if(pos_x != NULL) free(pos_x);
+  if(pos_y != NULL) free(pos_y);
+  if(adj_start != NULL) free(adj_start);
+  if(adj != NULL) free(adj);
+  return ret;
+}
+
+/**
+ * Refine the nominal tile positions. For each pair of overlapping tiles the
+ * displacement is measured with the normalized cross correlation. Then the
+ * positions are adjusted to fit all measurements. Each tile is decoded once,
+ * only the overlapping parts are kept for the measurements.
+ * @param max_shift maximum deviation of a tile from its nominal position
+ */
+ret_t mosaic_refine_offsets(mosaic_t * mosaic, unsigned int max_shift,
+			    gr_progress_func_t progress_func, void * progress_arg) {
+  unsigned int i, j, capacity = 0;
+  int ox0, oy0, ox1, oy1;
+  ret_t ret;
+
+  assert(mosaic != NULL);
+  if(mosaic == NULL) return RET_INV_PTR;
+
+  refine_params_t params;
+  memset(&params, 0, sizeof(refine_params_t));
+  params.mosaic = mosaic;
+  params.max_shift = max_shift;
+  params.progress_func = progress_func;
+  params.progress_arg = progress_arg;
+
+  for(i = 0; i < mosaic->num_tiles; i++)
+    for(j = i + 1; j < mosaic->num_tiles; j++) {
+      if(!get_overlap(&mosaic->tiles[i], &mosaic->tiles[j], &ox0, &oy0, &ox1, &oy1) ||
+	 ox1 - ox0 < (int)(2 * max_shift + MOSAIC_MIN_OVERLAP) ||
+	 oy1 - oy0 < (int)(2 * max_shift + MOSAIC_MIN_OVERLAP)) continue;
+
+      if(params.num_pairs == capacity) {
+	capacity = capacity == 0 ? 64 : capacity << 1;
+	mosaic_pair_t * pairs = (mosaic_pair_t *)realloc(params.pairs, capacity * sizeof(mosaic_pair_t));
+	if(pairs == NULL) {
+	  free(params.pairs);
+	  return RET_MALLOC_FAILED;
+	}
+	params.pairs = pairs;
+      }
+
+      // the patch is taken from the center of the overlap
+      mosaic_pair_t * pair = &params.pairs[params.num_pairs++];
+      memset(pair, 0, sizeof(mosaic_pair_t));
+      pair->a = i;
+      pair->b = j;
+      pair->pw = MIN(ox1 - ox0 - 2 * (int)max_shift, MOSAIC_MAX_PATCH);
+      pair->ph = MIN(oy1 - oy0 - 2 * (int)max_shift, MOSAIC_MAX_PATCH);
+      pair->px = ox0 + (ox1 - ox0 - (int)pair->pw) / 2;
+      pair->py = oy0 + (oy1 - oy0 - (int)pair->ph) / 2;
+    }
+
+  debug(TM, "refining offsets for %d tile pairs", params.num_pairs);
+  if(params.num_pairs == 0) return RET_OK;
+
+  // lists of pairs per tile
+  params.tile_pairs_start = (unsigned int *)calloc(mosaic->num_tiles + 1, sizeof(unsigned int));
+  params.tile_pairs = (unsigned int *)malloc(2 * params.num_pairs * sizeof(unsigned int));
+  unsigned int * fill = (unsigned int *)malloc(mosaic->num_tiles * sizeof(unsigned int));
+
+  if(params.tile_pairs_start == NULL || params.tile_pairs == NULL || fill == NULL) ret = RET_MALLOC_FAILED;
+  else {
+    for(j = 0; j < params.num_pairs; j++) {
+      params.tile_pairs_start[params.pairs[j].a + 1]++;
+      params.tile_pairs_start[params.pairs[j].b + 1]++;
+    }
+    for(i = 0; i < mosaic->num_tiles; i++) params.tile_pairs_start[i + 1] += params.tile_pairs_start[i];
+    memcpy(fill, params.tile_pairs_start, mosaic->num_tiles * sizeof(unsigned int));
+    for(j = 0; j < params.num_pairs; j++) {
+      params.tile_pairs[fill[params.pairs[j].a]++] = j;
+      params.tile_pairs[fill[params.pairs[j].b]++] = j;
+    }
+
+    params.num_jobs = mosaic->num_tiles + params.num_pairs;
+    pthread_mutex_init(&params.mutex, NULL);
+    if(RET_IS_OK(ret = par_run(mosaic->num_tiles, &extract_tile_regions, &params)))
+      ret = par_run(params.num_pairs, &measure_pair, &params);
+    pthread_mutex_destroy(&params.mutex);
+  }
+
+  if(RET_IS_OK(ret)) ret = solve_positions(mosaic, params.pairs, params.num_pairs);
+
+  // regions are left over, if the extraction failed
+  for(j = 0; j < params.num_pairs; j++) {
+    if(params.pairs[j].patch != NULL) gr_image_destroy(params.pairs[j].patch);
+    if(params.pairs[j].search != NULL) gr_image_destroy(params.pairs[j].search);
+  }
+
+  if(fill != NULL) free(fill);
+  if(params.tile_pairs_start != NULL) free(params.tile_pairs_start);
+  if(params.tile_pairs != NULL) free(params.tile_pairs);
+  free(params.pairs);
+  return ret;
+}
+
+/**
+ * Feathering weight of a tile at a position. It is the distance to the nearest
+ * tile border plus one, or 0 outside the tile.
+ */
+static inline int feather_weight(const mosaic_tile_t * tile, int x, int y) {
+  int dx = MIN(x - tile->x, tile->x + (int)tile->width - 1 - x);
+  int dy = MIN(y - tile->y, tile->y + (int)tile->height - 1 - y);
+  if(dx < 0 || dy < 0) return 0;
+  return MIN(dx, dy) + 1;
+}
+
+static int compare_tile_order(const void * a, const void * b) {
+  const tile_order_t * ta = (const tile_order_t *)a, * tb = (const tile_order_t *)b;
+  if(ta->y != tb->y) return ta->y < tb->y ? -1 : 1;
+  return ta->tile < tb->tile ? -1 : (ta->tile > tb->tile ? 1 : 0);
+}
+
+static ret_t load_band_tile(unsigned int job, void * arg) {
+  blend_params_t * params = (blend_params_t *)arg;
+  unsigned int i = params->to_load[job];
+  params->tile_images[i] = load_tile(&params->mosaic->tiles[i], IMAGE_TYPE_RGBA);
+  return params->tile_images[i] != NULL ? RET_OK : RET_ERR;
+}
+
+/**
+ * Blend rows of the current band. The contributions of all tiles covering a pixel
+ * are summed up with their feathering weights and the pixel is rounded once.
+ */
+static ret_t blend_rows(unsigned int job, void * arg) {
+  blend_params_t * params = (blend_params_t *)arg;
+  image_t * dst_img = params->img;
+  unsigned int i, width = dst_img->width;
+  int x, y;
+  int min_y = params->band_min_y + job * MOSAIC_BLEND_ROWS;
+  int max_y = MIN(min_y + MOSAIC_BLEND_ROWS, params->band_max_y);
+
+  // sums of the weighted channels and of the weights
+  uint32_t * sums = (uint32_t *)malloc(4 * width * sizeof(uint32_t));
+  if(sums == NULL) return RET_MALLOC_FAILED;
+
+  for(y = min_y; y < max_y; y++) {
+    memset(sums, 0, 4 * width * sizeof(uint32_t));
+
+    for(i = 0; i < params->num_active; i++) {
+      const mosaic_tile_t * tile = &params->mosaic->tiles[params->active[i]];
+      if(y < tile->y || y >= tile->y + (int)tile->height) continue;
+
+      int min_x = MAX(tile->x, 0), max_x = MIN(tile->x + (int)tile->width, (int)width);
+      const uint32_t * src = (const uint32_t *)mm_get_ptr(params->tile_images[params->active[i]]->map, 
+							  min_x - tile->x, y - tile->y);
+      uint32_t * sum = sums + 4 * min_x;
+
+      for(x = min_x; x < max_x; x++, src++, sum += 4) {
+	uint32_t w = feather_weight(tile, x, y);
+	sum[0] += w * MASK_R(*src);
+	sum[1] += w * MASK_G(*src);
+	sum[2] += w * MASK_B(*src);
+	sum[3] += w;
+      }
+    }
+
+    uint32_t * dst = (uint32_t *)mm_get_ptr(dst_img->map, 0, y);
+    const uint32_t * sum = sums;
+    for(x = 0; x < (int)width; x++, dst++, sum += 4)
+      if(sum[3] > 0) {
+	uint32_t half = sum[3] >> 1;
+	*dst = MERGE_CHANNELS(((sum[0] + half) / sum[3]), ((sum[1] + half) / sum[3]), 
+			      ((sum[2] + half) / sum[3]), 0xffU);
+      }
+  }
+
+  free(sums);
+  return RET_OK;
+}
+
+/**
+ * Stitch the tiles of a mosaic into an image. The image is cleared first. The image
+ * is blended in bands of rows from top to bottom. Each tile is decoded once, when the
+ * first band reaches it, and released after the last band, so only the tiles, that 
+ * intersect the current band, are held in memory. Parts of tiles outside the image 
+ * are clipped.
+ */
+ret_t mosaic_import(image_t * img, mosaic_t * mosaic,
+		    gr_progress_func_t progress_func, void * progress_arg) {
+  unsigned int i, n, next_tile = 0;
+  int cur_y = 0;
+  ret_t ret;
+
+  assert(img != NULL);
+  assert(mosaic != NULL);
+  if(img == NULL || mosaic == NULL) return RET_INV_PTR;
+  if(img->image_type != IMAGE_TYPE_RGBA) {
+    debug(TM, "mosaic import is only implemented for RGBA images");
+    return RET_ERR;
+  }
+
+  if(RET_IS_NOT_OK(ret = gr_map_clear(img))) return ret;
+  if(mosaic->num_tiles == 0) return RET_OK;
+
+  blend_params_t params;
+  memset(&params, 0, sizeof(blend_params_t));
+  params.img = img;
+  params.mosaic = mosaic;
+  params.tile_images = (image_t **)calloc(mosaic->num_tiles, sizeof(image_t *));
+  params.active = (unsigned int *)malloc(mosaic->num_tiles * sizeof(unsigned int));
+  params.to_load = (unsigned int *)malloc(mosaic->num_tiles * sizeof(unsigned int));
+  tile_order_t * order = (tile_order_t *)malloc(mosaic->num_tiles * sizeof(tile_order_t));
+
+  if(params.tile_images == NULL || params.active == NULL || params.to_load == NULL || order == NULL) {
+    ret = RET_MALLOC_FAILED;
+    goto finish;
+  }
+
+  for(i = 0; i < mosaic->num_tiles; i++) {
+    order[i].y = mosaic->tiles[i].y;
+    order[i].tile = i;
+  }
+  qsort(order, mosaic->num_tiles, sizeof(tile_order_t), &compare_tile_order);
+
+  while(cur_y < (int)img->height) {
+
+    // release tiles, that end above the band
+    for(i = 0, n = 0; i < params.num_active; i++) {
+      const mosaic_tile_t * tile = &mosaic->tiles[params.active[i]];
+      if(tile->y + (int)tile->height > cur_y) params.active[n++] = params.active[i];
+      else {
+	gr_image_destroy(params.tile_images[params.active[i]]);
+	params.tile_images[params.active[i]] = NULL;
+      }
+    }
+    params.num_active = n;
+
+    // decode tiles, that start within the band
+    for(n = 0; next_tile < mosaic->num_tiles && order[next_tile].y <= cur_y; next_tile++) {
+      const mosaic_tile_t * tile = &mosaic->tiles[order[next_tile].tile];
+      if(tile->y + (int)tile->height > cur_y &&
+	 tile->x < (int)img->width && tile->x + (int)tile->width > 0) {
+	params.to_load[n++] = order[next_tile].tile;
+	params.active[params.num_active++] = order[next_tile].tile;
+      }
+    }
+    if(RET_IS_NOT_OK(ret = par_run(n, &load_band_tile, &params))) goto finish;
+
+    // the band ends, where the set of tiles changes
+    int max_y = img->height;
+    if(next_tile < mosaic->num_tiles) max_y = MIN(max_y, order[next_tile].y);
+    for(i = 0; i < params.num_active; i++) {
+      const mosaic_tile_t * tile = &mosaic->tiles[params.active[i]];
+      max_y = MIN(max_y, tile->y + (int)tile->height);
+    }
+
+    params.band_min_y = cur_y;
+    params.band_max_y = max_y;
+    if(RET_IS_NOT_OK(ret = par_run((max_y - cur_y + MOSAIC_BLEND_ROWS - 1) / MOSAIC_BLEND_ROWS, 
+				   &blend_rows, &params))) goto finish;
+
+    cur_y = max_y;
+    if(progress_func != NULL) (*progress_func)((double)cur_y / (double)img->height, progress_arg);
+  }
+
+ finish:
+  if(params.tile_images != NULL) {
+    for(i = 0; i < mosaic->num_tiles; i++)
+      if(params.tile_images[i] != NULL) gr_image_destroy(params.tile_images[i]);
+    free(params.tile_images);
+  }
+  if(params.active != NULL) free(params.active);
+  if(params.to_load != NULL) free(params.to_load);
+  if(order != NULL) free(order);
+  return ret;
+}
@@ -0,0 +1,63 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __MOSAIC_H__
+#define __MOSAIC_H__
+
+#include "globals.h"
+#include "graphics.h"
+
+/**
+ * A mosaic is a set of overlapping image tiles, that are stitched into a single
+ * background image. A tile list is a text file with one tile per line:
+ *
+ *   <filename> <x> <y>
+ *
+ * x and y are the nominal position of the upper left corner of the tile in the
+ * layer. Filenames may contain spaces. Relative filenames are relative to the
+ * directory of the tile list. Empty lines and lines starting with '#' are ignored.
+ */
+
+typedef struct {
+  char * filename;
+  int x, y; // position in the layer, updated by mosaic_refine_offsets()
+  unsigned int width, height;
+} mosaic_tile_t;
+
+/* Default for the maximum deviation from the nominal tile positions in pixel. */
+#define MOSAIC_DEFAULT_MAX_SHIFT 32
+
+typedef struct {
+  unsigned int num_tiles;
+  mosaic_tile_t * tiles;
+} mosaic_t;
+
+mosaic_t * mosaic_load_tile_list(const char * const filename);
+ret_t mosaic_destroy(mosaic_t * mosaic);
+
+ret_t mosaic_refine_offsets(mosaic_t * mosaic, unsigned int max_shift,
+			    gr_progress_func_t progress_func, void * progress_arg);
+
+ret_t mosaic_import(image_t * img, mosaic_t * mosaic,
+		    gr_progress_func_t progress_func, void * progress_arg);
+
+#endif
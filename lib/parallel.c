@@ -0,0 +1,195 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "parallel.h"
+
+/* Number of worker threads. 0 means: not determined yet. */
+static unsigned int num_threads = 0;
+
+/* Set in threads, that work on a job queue. Nested calls of par_run() run serially. */
+static __thread int is_worker = 0;
+
+typedef struct par_job_queue {
+  par_func_t func;
+  void * arg;
+  unsigned int num_jobs;
+
+  unsigned int next_job;
+  unsigned int max_workers;  // number of pool threads, that may work on the queue
+  unsigned int workers;      // number of pool threads, that run a job of the queue
+  unsigned int running;      // number of jobs in progress
+  ret_t ret;
+
+  struct par_job_queue * next;
+} par_job_queue_t;
+
+/*
+ * The worker threads are started on demand and wait for job queues. Several
+ * threads may call par_run() at the same time, so there is a list of queues.
+ */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done_cond = PTHREAD_COND_INITIALIZER;
+static par_job_queue_t * pool_queues = NULL;
+static unsigned int pool_size = 0;
+
+/**
+ * Get the number of worker threads par_run() uses. The number defaults to the
+ * number of online CPUs and can be overridden with the environment variable
+ * DEGATE_THREADS.
+ */
+unsigned int par_get_num_threads() {
+  if(num_threads == 0) {
+    char * env = getenv("DEGATE_THREADS");
+    long n = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = n > 0 ? (unsigned int)n : 1;
+  }
+  return num_threads;
+}
+
+/**
+ * Set the number of worker threads. A value of 0 resets it to the default.
+ * Pool threads, that are not needed anymore, stay idle.
+ */
+void par_set_num_threads(unsigned int n) {
+  num_threads = n;
+}
+
+static inline int par_queue_has_jobs(const par_job_queue_t * queue) {
+  return queue->next_job < queue->num_jobs && RET_IS_OK(queue->ret);
+}
+
+/**
+ * Run a job of a queue. The caller must hold the pool mutex. It is released 
+ * while the job runs.
+ */
+static void par_run_job(par_job_queue_t * queue) {
+  unsigned int job = queue->next_job++;
+  queue->running++;
+  pthread_mutex_unlock(&pool_mutex);
+
+  ret_t ret = (*queue->func)(job, queue->arg);
+
+  pthread_mutex_lock(&pool_mutex);
+  if(RET_IS_NOT_OK(ret) && RET_IS_OK(queue->ret)) queue->ret = ret;
+  if(--queue->running == 0 && !par_queue_has_jobs(queue)) pthread_cond_broadcast(&pool_done_cond);
+}
+
+static void * par_worker(void * ptr) {
+  is_worker = 1;
+
+  pthread_mutex_lock(&pool_mutex);
+  while(1) {
+    par_job_queue_t * queue;
+    for(queue = pool_queues; queue != NULL; queue = queue->next)
+      if(par_queue_has_jobs(queue) && queue->workers < queue->max_workers) break;
+
+    if(queue == NULL) {
+      pthread_cond_wait(&pool_work_cond, &pool_mutex);
+      continue;
+    }
+
+    queue->workers++;
+    par_run_job(queue);
+    queue->workers--;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return NULL;
+}
+
+/**
+ * Start pool threads, until there are at least n of them. The caller must hold
+ * the pool mutex.
+ */
+static void par_grow_pool(unsigned int n) {
+  pthread_t thread;
+  while(pool_size < n) {
+    if(pthread_create(&thread, NULL, par_worker, NULL) != 0) {
+      debug(TM, "pthread_create() failed. Running with %d pool threads.", pool_size);
+      return;
+    }
+    pthread_detach(thread);
+    pool_size++;
+  }
+}
+
+/**
+ * Run num_jobs jobs on a pool of worker threads and wait until all jobs are done.
+ * Jobs are handed out in ascending order. If a job fails, no further jobs are
+ * started and the first error code is returned. If par_run() is called from within
+ * a job, the jobs run in the calling thread.
+ * @param num_jobs number of jobs
+ * @param func the job function
+ * @param arg argument for the job function
+ * @returns RET_OK if all jobs succeeded
+ */
+ret_t par_run(unsigned int num_jobs, par_func_t func, void * arg) {
+  assert(func != NULL);
+  if(func == NULL) return RET_INV_PTR;
+  if(num_jobs == 0) return RET_OK;
+
+  par_job_queue_t queue;
+  queue.func = func;
+  queue.arg = arg;
+  queue.num_jobs = num_jobs;
+  queue.next_job = 0;
+  queue.max_workers = (is_worker ? 1 : MIN(par_get_num_threads(), num_jobs)) - 1;
+  queue.workers = 0;
+  queue.running = 0;
+  queue.ret = RET_OK;
+  queue.next = NULL;
+
+  int was_worker = is_worker;
+  is_worker = 1;
+
+  pthread_mutex_lock(&pool_mutex);
+
+  if(queue.max_workers > 0) {
+    par_grow_pool(queue.max_workers);
+
+    par_job_queue_t ** last = &pool_queues;
+    while(*last != NULL) last = &(*last)->next;
+    *last = &queue;
+    pthread_cond_broadcast(&pool_work_cond);
+  }
+
+  // the calling thread works on the queue, too
+  while(par_queue_has_jobs(&queue)) par_run_job(&queue);
+  while(queue.running > 0) pthread_cond_wait(&pool_done_cond, &pool_mutex);
+
+  if(queue.max_workers > 0) {
+    par_job_queue_t ** q = &pool_queues;
+    while(*q != &queue) q = &(*q)->next;
+    *q = queue.next;
+  }
+
+  pthread_mutex_unlock(&pool_mutex);
+
+  is_worker = was_worker;
+  return queue.ret;
+}
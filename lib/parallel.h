@@ -0,0 +1,41 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include "globals.h"
+
+/**
+ * A job function. It is called once for each job number in [0, num_jobs).
+ * @param job the job number
+ * @param arg the argument that was passed to par_run()
+ * @returns RET_OK on success. Any other value stops the remaining jobs.
+ */
+typedef ret_t (*par_func_t)(unsigned int job, void * arg);
+
+unsigned int par_get_num_threads();
+void par_set_num_threads(unsigned int num_threads);
+
+ret_t par_run(unsigned int num_jobs, par_func_t func, void * arg);
+
+#endif
@@ -38,6 +38,8 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #define TEMPLATES_DAT "templates.dat"
 #define TEMPLATE_PLACEMENT_DAT "template_placements.dat"
 #define PROJECT_FILE "project.prj"
+#define BG_LAYER_FILE "bg_layer_%02d.dat"
+#define BG_LAYER_RESAMPLED_FILE "bg_layer_%02d.dat.new"
 
 project_t * project_create(const char * const project_dir, 
 			   unsigned int width, unsigned int height, int num_layers) {
@@ -93,6 +95,11 @@ project_t * project_create(const char * const project_dir,
     return NULL;
   }
 
+  if((ptr->filter_cache = filter_cache_create(ptr->scaling_manager)) == NULL) {
+    project_destroy(ptr);
+    return NULL;
+  }
+
   if((ptr->alignment_marker_set = amset_create(num_layers)) == NULL) {
     project_destroy(ptr);
     return NULL;
@@ -161,6 +168,9 @@ ret_t project_destroy(project_t * project) {
   if(project->alignment_marker_set != NULL)
     if(RET_IS_NOT_OK(ret = amset_destroy(project->alignment_marker_set))) return ret;
   
+  if(project->filter_cache != NULL) 
+    if(RET_IS_NOT_OK(ret = filter_cache_destroy(project->filter_cache))) return ret;
+
   if(project->scaling_manager != NULL) 
     if(RET_IS_NOT_OK(ret = scalmgr_destroy(project->scaling_manager))) return ret;
 
@@ -191,18 +201,143 @@ ret_t project_map_background_memfiles(project_t * const project) {
   
   for(i = 0; i < project->num_layers; i++) {
     char bg_mapping_filename[PATH_MAX];
-    snprintf(bg_mapping_filename, sizeof(bg_mapping_filename), "bg_layer_%02d.dat", i);
+    snprintf(bg_mapping_filename, sizeof(bg_mapping_filename), BG_LAYER_FILE, i);
     if(RET_IS_NOT_OK(ret = gr_map_file(project->bg_images[i],  
 				       project->project_dir, bg_mapping_filename))) {
       puts("mapping failed");
       return ret;
     }
+    // the viewer reads small areas at random positions
+    mm_advise(project->bg_images[i]->map, MM_ACCESS_RANDOM);
 #ifdef MAP_FILES_ON_DEMAND
     if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(project->bg_images[i]))) return ret;
 #endif
   }
   return RET_OK;
 }
+/**
+ * Resample the background image of a layer into a new data file. The current
+ * background image is only read, so it might be rendered while the resampling
+ * is in progress. Use project_commit_resampled_layer() to replace the background 
+ * image with the resampled one. 
+ * @see gr_resample_affine()
+ */
+ret_t project_resample_layer(project_t * const project, int layer,
+			     double scaling_x, double scaling_y, 
+			     double shift_x, double shift_y,
+			     GR_INTERPOLATION interpolation) {
+  ret_t ret;
+  image_t * src, * dst;
+  char filename[PATH_MAX];
+
+  assert(project != NULL);
+  assert(project->bg_images != NULL);
+  if(project == NULL || project->bg_images == NULL) return RET_INV_PTR;
+  assert(layer >= 0 && layer < project->num_layers);
+  if(layer < 0 || layer >= project->num_layers) return RET_ERR;
+
+  src = project->bg_images[layer];
+  if((dst = gr_create_image(src->width, src->height, src->image_type)) == NULL) 
+    return RET_MALLOC_FAILED;
+
+  snprintf(filename, sizeof(filename), BG_LAYER_RESAMPLED_FILE, layer);
+  if(RET_IS_NOT_OK(ret = gr_map_file(dst, project->project_dir, filename))) {
+    gr_image_destroy(dst);
+    return ret;
+  }
+
+#ifdef MAP_FILES_ON_DEMAND
+  if(RET_IS_NOT_OK(ret = gr_reactivate_mapping(src))) {
+    gr_destroy_and_unlink(dst);
+    return ret;
+  }
+#endif
+
+  // stream through the old data file, pages that were read are dropped early
+  MM_ACCESS_PATTERN prev_pattern = mm_get_access_pattern(src->map);
+  mm_advise(src->map, MM_ACCESS_SEQUENTIAL);
+  mm_advise(dst->map, MM_ACCESS_SEQUENTIAL);
+  ret = gr_resample_affine(src, dst, scaling_x, scaling_y, shift_x, shift_y, interpolation);
+  mm_advise(src->map, prev_pattern);
+
+#ifdef MAP_FILES_ON_DEMAND
+  gr_deactivate_mapping(src);
+#endif
+
+  if(RET_IS_NOT_OK(ret)) {
+    gr_destroy_and_unlink(dst);
+    return ret;
+  }
+
+  // writes the data back to disk
+  return gr_image_destroy(dst);
+}
+
+/**
+ * Replace the background image of a layer with the data file, that was written
+ * by project_resample_layer(). The data file is renamed over the old one, so the
+ * old background image stays intact until the new one is complete. The scaled
+ * images of the layer are invalidated and recalculated on demand.
+ */
+ret_t project_commit_resampled_layer(project_t * const project, int layer) {
+  ret_t ret;
+  char old_filename[PATH_MAX], new_filename[PATH_MAX], bg_mapping_filename[PATH_MAX];
+  image_t * img;
+
+  assert(project != NULL);
+  assert(project->bg_images != NULL);
+  assert(project->project_dir != NULL);
+  if(project == NULL || project->bg_images == NULL || project->project_dir == NULL) 
+    return RET_INV_PTR;
+  assert(layer >= 0 && layer < project->num_layers);
+  if(layer < 0 || layer >= project->num_layers) return RET_ERR;
+
+  img = project->bg_images[layer];
+  snprintf(bg_mapping_filename, sizeof(bg_mapping_filename), BG_LAYER_FILE, layer);
+  snprintf(old_filename, sizeof(old_filename), "%s/" BG_LAYER_FILE, project->project_dir, layer);
+  snprintf(new_filename, sizeof(new_filename), "%s/" BG_LAYER_RESAMPLED_FILE, 
+	   project->project_dir, layer);
+
+  // the prefetch thread of the scaling manager might read the background image
+  if(project->scaling_manager != NULL) pthread_mutex_lock(&project->scaling_manager->tile_mutex);
+
+  if(rename(new_filename, old_filename) == -1) {
+    perror("can't replace background image");
+    ret = RET_ERR;
+  }
+  else if(RET_IS_OK(ret = gr_map_file(img, project->project_dir, bg_mapping_filename))) {
+    mm_advise(img->map, MM_ACCESS_RANDOM);
+#ifdef MAP_FILES_ON_DEMAND
+    ret = gr_deactivate_mapping(img);
+#endif
+  }
+
+  if(project->scaling_manager != NULL) pthread_mutex_unlock(&project->scaling_manager->tile_mutex);
+
+  if(RET_IS_OK(ret) && project->scaling_manager != NULL && img->width > 0 && img->height > 0)
+    ret = scalmgr_invalidate_region(project->scaling_manager, layer, 
+				    0, 0, img->width - 1, img->height - 1);
+  return ret;
+}
+
+/**
+ * Get the image of a layer, that object matching should work on. If a filter 
+ * pipeline is set, this is the filtered greyscale layer, else the background 
+ * image. The filtered layer is calculated for the inclusive region.
+ * @return NULL on error
+ */
+image_t * project_get_matching_image(project_t * const project, int layer,
+				     unsigned int min_x, unsigned int min_y,
+				     unsigned int max_x, unsigned int max_y) {
+  assert(project != NULL);
+  if(project == NULL || layer < 0 || layer >= project->num_layers) return NULL;
+
+  if(project->filter_cache->pipeline.num_stages == 0) return project->bg_images[layer];
+
+  if(RET_IS_NOT_OK(filter_cache_ensure_region(project->filter_cache, layer, 
+					      min_x, min_y, max_x, max_y))) return NULL;
+  return filter_cache_get_image(project->filter_cache, layer);
+}
 
 #define TEMPLATE_DAT_HEADER "# foo"
 #define TEMPLATE_PLACEMENT_DAT_HEADER "# bar"
@@ -333,6 +468,14 @@ project_t * project_load(const char * const project_dir) {
   PROJECT_READ_STRING("project_description", project->project_description);
   PROJECT_READ_STRING("project_file_version", project->project_file_version);
 
+  // filter pipeline for matching
+  if((setting = config_lookup(&cfg, "filter_pipeline")) != NULL) {
+    filter_pipeline_t pipeline;
+    if(RET_IS_NOT_OK(filter_pipeline_parse(&pipeline, config_setting_get_string(setting))) ||
+       RET_IS_NOT_OK(filter_cache_set_pipeline(project->filter_cache, &pipeline)))
+      printf("can't parse filter pipeline - ignoring it\n");
+  }
+
   // grid
   long grid_mode = UNDEFINED_GRID_MODE;
   PROJECT_READ_INT_WO_CHECK("grid.mode", grid_mode);
@@ -544,6 +687,14 @@ ret_t project_save(const project_t * const project) {
   PROJECT_STORE_STRING(cfg.root, "project_description", project->project_description);
   PROJECT_STORE_STRING(cfg.root, "project_file_version", project->project_file_version);
 
+  char filter_pipeline[256];
+  if(RET_IS_NOT_OK(filter_pipeline_format(&project->filter_cache->pipeline, 
+					  filter_pipeline, sizeof(filter_pipeline)))) {
+    config_destroy(&cfg);
+    return RET_ERR;
+  }
+  PROJECT_STORE_STRING(cfg.root, "filter_pipeline", filter_pipeline);
+
   // store grid
   if((group = config_setting_add(cfg.root, "grid", CONFIG_TYPE_GROUP)) == NULL) {
     config_destroy(&cfg);
@@ -29,6 +29,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include "grid.h"
 #include "scaling_manager.h"
 #include "port_color_manager.h"
+#include "filter.h"
 
 struct project {
 
@@ -42,6 +43,7 @@ struct project {
   image_t ** bg_images;
   scaling_manager_t * scaling_manager;
   port_color_manager_t * port_color_manager;
+  filter_cache_t * filter_cache; // filtered background images for matching
 
   logic_model_t * lmodel;
   
@@ -66,6 +68,16 @@ project_t * project_load(const char * const project_dir /*, render_params_t * co
 
 ret_t project_map_background_memfiles(project_t * const project);
 
+ret_t project_resample_layer(project_t * const project, int layer,
+			     double scaling_x, double scaling_y, 
+			     double shift_x, double shift_y,
+			     GR_INTERPOLATION interpolation);
+ret_t project_commit_resampled_layer(project_t * const project, int layer);
+
+image_t * project_get_matching_image(project_t * const project, int layer,
+				     unsigned int min_x, unsigned int min_y,
+				     unsigned int max_x, unsigned int max_y);
+
 ret_t project_save(const project_t * const project);
 
 ret_t project_cleanup(const char * const project_dir);
@@ -0,0 +1,425 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "registration.h"
+#include "fft.h"
+
+/* Maximum number of pyramid levels. */
+#define REG_MAX_LEVELS 32
+
+/* Ratio between two scaling candidates, that are tested on the coarsest level. */
+#define REG_SCALING_STEP 1.01
+
+/**
+ * Image pyramid of a layer. The first levels are the zoom levels of the scaling 
+ * manager. If the coarsest zoom level does not fit into a correlation window,
+ * further levels are downsampled into scratch memory.
+ */
+typedef struct {
+  scaling_manager_t * sm;
+  unsigned int layer;
+  unsigned int num_levels;
+  unsigned int num_sm_levels; // number of levels, that belong to the scaling manager
+  image_t * images[REG_MAX_LEVELS];
+} reg_pyramid_t;
+
+static void reg_pyramid_destroy(reg_pyramid_t * pyr) {
+  unsigned int i;
+  for(i = pyr->num_sm_levels; i < pyr->num_levels; i++) gr_image_destroy(pyr->images[i]);
+  pyr->num_levels = pyr->num_sm_levels;
+}
+
+/**
+ * Make sure, that a region of a pyramid level is calculated. The region is 
+ * clipped to the image.
+ */
+static ret_t reg_pyramid_prepare(reg_pyramid_t * pyr, unsigned int level,
+				 double min_x, double min_y, double max_x, double max_y) {
+  image_t * img = pyr->images[level];
+  if(level == 0 || level >= pyr->num_sm_levels) return RET_OK;
+  if(max_x < 0 || max_y < 0 || min_x >= img->width || min_y >= img->height) return RET_OK;
+
+  return scalmgr_ensure_region(pyr->sm, pyr->layer, scalmgr_get_level(pyr->sm, pyr->layer, level)->zoom,
+			       min_x < 0 ? 0 : (unsigned int)min_x, 
+			       min_y < 0 ? 0 : (unsigned int)min_y,
+			       MIN((unsigned int)max_x, img->width - 1), 
+			       MIN((unsigned int)max_y, img->height - 1));
+}
+
+static ret_t reg_pyramid_init(reg_pyramid_t * pyr, scaling_manager_t * sm, unsigned int layer) {
+  ret_t ret;
+  unsigned int i, num_sm_levels = scalmgr_get_num_levels(sm);
+
+  memset(pyr, 0, sizeof(reg_pyramid_t));
+  pyr->sm = sm;
+  pyr->layer = layer;
+
+  for(i = 0; i < num_sm_levels && i < REG_MAX_LEVELS; i++) {
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, i);
+    image_t * img = i == 0 ? sm->bg_images[layer] : (l != NULL ? l->image : NULL);
+    if(img == NULL) break;
+    if(img->map->mem == NULL) {
+      debug(TM, "zoom level %d of layer %d is not mapped", i, layer);
+      return RET_ERR;
+    }
+    pyr->images[i] = img;
+  }
+  if(i == 0) return RET_ERR;
+  pyr->num_levels = pyr->num_sm_levels = i;
+
+  image_t * coarsest = pyr->images[i - 1];
+  if(coarsest->width == 0 || coarsest->height == 0) return RET_ERR;
+  if(RET_IS_NOT_OK(ret = reg_pyramid_prepare(pyr, i - 1, 0, 0, coarsest->width - 1, 
+					     coarsest->height - 1))) return ret;
+
+  while(MAX(coarsest->width, coarsest->height) > REG_WINDOW_SIZE &&
+	coarsest->width >= 2 && coarsest->height >= 2 && pyr->num_levels < REG_MAX_LEVELS) {
+
+    image_t * img = gr_create_image(coarsest->width / 2, coarsest->height / 2, coarsest->image_type);
+    if(img == NULL) {
+      reg_pyramid_destroy(pyr);
+      return RET_MALLOC_FAILED;
+    }
+    if(RET_IS_NOT_OK(ret = gr_map_scratch(img, sm->project_dir)) ||
+       RET_IS_NOT_OK(ret = gr_downsample(coarsest, img))) {
+      gr_image_destroy(img);
+      reg_pyramid_destroy(pyr);
+      return ret;
+    }
+    pyr->images[pyr->num_levels++] = coarsest = img;
+  }
+  return RET_OK;
+}
+
+/**
+ * Sample a window with bilinear interpolation and prepare it for a phase correlation.
+ * The window position k corresponds to the image position center + (k - size/2) / scaling.
+ * Samples outside the image are replaced by the mean of the samples inside.
+ */
+static ret_t reg_sample_window(image_t * img, double center_x, double center_y,
+			       double scaling_x, double scaling_y, unsigned int size, double * dst) {
+  unsigned int x, y, num_valid = 0;
+  double sum = 0;
+
+  for(y = 0; y < size; y++) {
+    double src_y = center_y + ((double)y - size / 2) / scaling_y;
+    for(x = 0; x < size; x++) {
+      double src_x = center_x + ((double)x - size / 2) / scaling_x;
+      double * v = &dst[y * size + x];
+
+      if(src_x < 0 || src_y < 0 || src_x > img->width - 1 || src_y > img->height - 1) {
+	*v = NAN;
+	continue;
+      }
+
+      unsigned int x0 = (unsigned int)src_x, y0 = (unsigned int)src_y;
+      unsigned int x1 = MIN(x0 + 1, img->width - 1), y1 = MIN(y0 + 1, img->height - 1);
+      double wx = src_x - x0, wy = src_y - y0;
+
+      *v = (1 - wy) * ((1 - wx) * gr_get_greyscale_pixval(img, x0, y0) + 
+		       wx * gr_get_greyscale_pixval(img, x1, y0)) +
+	wy * ((1 - wx) * gr_get_greyscale_pixval(img, x0, y1) + 
+	      wx * gr_get_greyscale_pixval(img, x1, y1));
+      sum += *v;
+      num_valid++;
+    }
+  }
+
+  if(num_valid == 0) return RET_ERR;
+
+  for(x = 0; x < size * size; x++) 
+    if(isnan(dst[x])) dst[x] = sum / num_valid;
+
+  fft_apply_window(dst, size);
+  return RET_OK;
+}
+
+/**
+ * Search the scaling and translation on the coarsest pyramid level. The
+ * windows are centered on both images and the scaling with the highest
+ * correlation peak is taken.
+ */
+static ret_t reg_coarse_search(image_t * lower, image_t * upper, double * a, double * b,
+			       reg_match_t * match) {
+  ret_t ret;
+  int i, steps = (int)ceil(log(REG_MAX_SCALING) / log(REG_SCALING_STEP));
+  double best_peak = -1;
+  double center_lx = lower->width / 2.0, center_ly = lower->height / 2.0;
+  double center_ux = upper->width / 2.0, center_uy = upper->height / 2.0;
+
+  if(RET_IS_NOT_OK(ret = reg_sample_window(lower, center_lx, center_ly, 1, 1, 
+					   REG_WINDOW_SIZE, a))) return ret;
+
+  for(i = -steps; i <= steps; i++) {
+    double scaling = pow(REG_SCALING_STEP, i), shift_x, shift_y, peak;
+
+    if(RET_IS_NOT_OK(ret = reg_sample_window(upper, center_ux, center_uy, scaling, scaling,
+					     REG_WINDOW_SIZE, b)) ||
+       RET_IS_NOT_OK(ret = fft_phase_correlation(a, b, REG_WINDOW_SIZE, 
+						 &shift_x, &shift_y, &peak))) return ret;
+
+    // the center of the upper window corresponds to (center_l - shift) in the lower layer
+    if(peak > best_peak) {
+      best_peak = peak;
+      match->scaling_x = match->scaling_y = scaling;
+      match->shift_x = center_lx - shift_x - scaling * center_ux;
+      match->shift_y = center_ly - shift_y - scaling * center_uy;
+    }
+  }
+
+  match->confidence = best_peak;
+  return RET_OK;
+}
+
+/**
+ * Refine the scaling and translation on a pyramid level. Two windows in the 
+ * overlapping area of both layers are correlated. The scaling and translation are
+ * calculated from the two corresponding points. If a correlation fails, the 
+ * previous estimation is kept.
+ * @param peak the lower correlation peak of both windows is stored here.
+ */
+static ret_t reg_refine(reg_pyramid_t * lower, reg_pyramid_t * upper, unsigned int level,
+			double * a, double * b, reg_match_t * match, double * peak) {
+  ret_t ret;
+  unsigned int j;
+  image_t * l_img = lower->images[level], * u_img = upper->images[level];
+  double lower_x[2], lower_y[2], upper_x[2], upper_y[2];
+
+  // overlapping area in coordinates of the lower layer
+  double min_x = MAX(0, match->shift_x);
+  double min_y = MAX(0, match->shift_y);
+  double max_x = MIN(l_img->width - 1, match->shift_x + match->scaling_x * (u_img->width - 1));
+  double max_y = MIN(l_img->height - 1, match->shift_y + match->scaling_y * (u_img->height - 1));
+  if(max_x - min_x < 2 || max_y - min_y < 2) {
+    debug(TM, "layers %d and %d do not overlap", lower->layer, upper->layer);
+    return RET_ERR;
+  }
+
+  *peak = 1;
+  for(j = 0; j < 2; j++) {
+    double px = floor(min_x + (max_x - min_x) * (1 + 2 * j) / 4);
+    double py = floor(min_y + (max_y - min_y) * (1 + 2 * j) / 4);
+    double ux = (px - match->shift_x) / match->scaling_x;
+    double uy = (py - match->shift_y) / match->scaling_y;
+    double rx = REG_WINDOW_SIZE / (2 * match->scaling_x) + 2;
+    double ry = REG_WINDOW_SIZE / (2 * match->scaling_y) + 2;
+    double shift_x, shift_y, p;
+
+    if(RET_IS_NOT_OK(ret = reg_pyramid_prepare(lower, level, px - REG_WINDOW_SIZE / 2, 
+					       py - REG_WINDOW_SIZE / 2, 
+					       px + REG_WINDOW_SIZE / 2, 
+					       py + REG_WINDOW_SIZE / 2)) ||
+       RET_IS_NOT_OK(ret = reg_pyramid_prepare(upper, level, ux - rx, uy - ry, ux + rx, uy + ry)) ||
+       RET_IS_NOT_OK(ret = reg_sample_window(l_img, px, py, 1, 1, REG_WINDOW_SIZE, a)) ||
+       RET_IS_NOT_OK(ret = reg_sample_window(u_img, ux, uy, match->scaling_x, match->scaling_y,
+					     REG_WINDOW_SIZE, b)) ||
+       RET_IS_NOT_OK(ret = fft_phase_correlation(a, b, REG_WINDOW_SIZE, &shift_x, &shift_y, &p)))
+      return ret;
+
+    lower_x[j] = px - shift_x;
+    lower_y[j] = py - shift_y;
+    upper_x[j] = ux;
+    upper_y[j] = uy;
+    *peak = MIN(*peak, p);
+  }
+
+  if(*peak >= REG_MIN_CONFIDENCE && 
+     fabs(upper_x[1] - upper_x[0]) >= 1 && fabs(upper_y[1] - upper_y[0]) >= 1) {
+    match->scaling_x = (lower_x[1] - lower_x[0]) / (upper_x[1] - upper_x[0]);
+    match->scaling_y = (lower_y[1] - lower_y[0]) / (upper_y[1] - upper_y[0]);
+    match->shift_x = lower_x[0] - match->scaling_x * upper_x[0];
+    match->shift_y = lower_y[0] - match->scaling_y * upper_y[0];
+  }
+
+  for(j = 0; j < 2; j++) {
+    match->upper_x[j] = upper_x[j];
+    match->upper_y[j] = upper_y[j];
+    match->lower_x[j] = match->scaling_x * upper_x[j] + match->shift_x;
+    match->lower_y[j] = match->scaling_y * upper_y[j] + match->shift_y;
+  }
+  return RET_OK;
+}
+
+/**
+ * Estimate the scaling and translation between two layers. The estimation starts
+ * with a search over scalings on the coarsest pyramid level and is refined on
+ * each finer level.
+ * @param match the result. The confidence is the lowest correlation peak of the
+ *   coarse search and of the background image level. Callers should reject matches
+ *   with a confidence below REG_MIN_CONFIDENCE.
+ */
+ret_t reg_match_layers(scaling_manager_t * sm, unsigned int lower_layer, unsigned int upper_layer,
+		       reg_match_t * match) {
+  ret_t ret;
+  reg_pyramid_t lower, upper;
+  double * a, * b;
+
+  assert(sm != NULL);
+  assert(match != NULL);
+  if(sm == NULL || match == NULL || sm->bg_images == NULL) return RET_INV_PTR;
+  if(lower_layer >= sm->num_layers || upper_layer >= sm->num_layers) return RET_ERR;
+
+  a = (double *)malloc(REG_WINDOW_SIZE * REG_WINDOW_SIZE * sizeof(double));
+  b = (double *)malloc(REG_WINDOW_SIZE * REG_WINDOW_SIZE * sizeof(double));
+  if(a == NULL || b == NULL) {
+    if(a != NULL) free(a);
+    if(b != NULL) free(b);
+    return RET_MALLOC_FAILED;
+  }
+
+  if(RET_IS_NOT_OK(ret = reg_pyramid_init(&lower, sm, lower_layer))) {
+    free(a);
+    free(b);
+    return ret;
+  }
+  if(RET_IS_NOT_OK(ret = reg_pyramid_init(&upper, sm, upper_layer))) {
+    reg_pyramid_destroy(&lower);
+    free(a);
+    free(b);
+    return ret;
+  }
+
+  memset(match, 0, sizeof(reg_match_t));
+  unsigned int level = MIN(lower.num_levels, upper.num_levels) - 1;
+
+  if(RET_IS_OK(ret = reg_coarse_search(lower.images[level], upper.images[level], a, b, match))) {
+    double coarse_confidence = match->confidence, peak = 0;
+
+    debug(TM, "layer %d -> %d: coarse estimation on level %d: s=%f dx=%f dy=%f peak=%f", 
+	  upper_layer, lower_layer, level, match->scaling_x, match->shift_x, match->shift_y,
+	  coarse_confidence);
+
+    for(;;) {
+      if(RET_IS_NOT_OK(ret = reg_refine(&lower, &upper, level, a, b, match, &peak))) break;
+      if(level == 0) break;
+
+      /* coordinates on the next finer level, a pixel x on this level covers the
+	 pixels 2x and 2x + 1 on the finer level */
+      level--;
+      match->shift_x = 2 * match->shift_x + 0.5 * (1 - match->scaling_x);
+      match->shift_y = 2 * match->shift_y + 0.5 * (1 - match->scaling_y);
+    }
+
+    match->confidence = MIN(coarse_confidence, peak);
+    debug(TM, "layer %d -> %d: sx=%f sy=%f dx=%f dy=%f confidence=%f", upper_layer, lower_layer,
+	  match->scaling_x, match->scaling_y, match->shift_x, match->shift_y, match->confidence);
+  }
+
+  reg_pyramid_destroy(&lower);
+  reg_pyramid_destroy(&upper);
+  free(a);
+  free(b);
+  return ret;
+}
+
+static ret_t reg_set_marker(alignment_marker_set_t * set, unsigned int layer, MARKER_TYPE marker_type,
+			    double x, double y) {
+  unsigned int ux = x < 0 ? 0 : lrint(x), uy = y < 0 ? 0 : lrint(y);
+  if(amset_get_marker(set, layer, marker_type) != NULL)
+    return amset_replace_marker(set, layer, marker_type, ux, uy);
+  else
+    return amset_add_marker(set, layer, marker_type, ux, uy);
+}
+
+/**
+ * Register all pairs of adjacent layers. Fails, if a pair can't be registered.
+ * The scaling manager is thread safe, so this may run while layers are rendered.
+ * @param matches array of num_layers - 1 results, the layers i and i + 1 for each i
+ */
+ret_t reg_match_all_layers(scaling_manager_t * sm, unsigned int num_layers, reg_match_t * matches) {
+  ret_t ret = RET_OK;
+  unsigned int i;
+
+  assert(sm != NULL);
+  assert(matches != NULL);
+  if(sm == NULL || matches == NULL) return RET_INV_PTR;
+  if(num_layers < 2 || num_layers > sm->num_layers) return RET_ERR;
+
+  for(i = 0; i < num_layers - 1 && RET_IS_OK(ret); i++)
+    if(RET_IS_OK(ret = reg_match_layers(sm, i, i + 1, &matches[i])) &&
+       matches[i].confidence < REG_MIN_CONFIDENCE) {
+      debug(TM, "can't register layer %d with layer %d", i + 1, i);
+      ret = RET_ERR;
+    }
+
+  return ret;
+}
+
+/**
+ * Place the alignment markers at the corresponding positions, that were found by
+ * reg_match_all_layers(). The layers can then be aligned with amset_calc_transformation()
+ * as if the markers were placed manually.
+ */
+ret_t reg_place_alignment_markers(alignment_marker_set_t * set, unsigned int num_layers,
+				  const reg_match_t * matches) {
+  ret_t ret = RET_OK;
+  unsigned int i;
+
+  assert(set != NULL);
+  assert(matches != NULL);
+  if(set == NULL || matches == NULL) return RET_INV_PTR;
+  if(num_layers < 2 || num_layers > (unsigned int)set->num_layers) return RET_ERR;
+
+  for(i = 0; i < num_layers - 1 && RET_IS_OK(ret); i++) {
+    const reg_match_t * m = &matches[i];
+    if(RET_IS_NOT_OK(ret = reg_set_marker(set, i, MARKER_TYPE_M1_UP, m->lower_x[0], m->lower_y[0])) ||
+       RET_IS_NOT_OK(ret = reg_set_marker(set, i, MARKER_TYPE_M2_UP, m->lower_x[1], m->lower_y[1])) ||
+       RET_IS_NOT_OK(ret = reg_set_marker(set, i + 1, MARKER_TYPE_M1_DOWN, m->upper_x[0], m->upper_y[0])) ||
+       RET_IS_NOT_OK(ret = reg_set_marker(set, i + 1, MARKER_TYPE_M2_DOWN, m->upper_x[1], m->upper_y[1])))
+      break;
+  }
+
+  return ret;
+}
+
+/**
+ * Register all pairs of adjacent layers and place the alignment markers at 
+ * corresponding positions. The markers are only changed, if all pairs could be
+ * registered.
+ */
+ret_t reg_fill_alignment_markers(scaling_manager_t * sm, alignment_marker_set_t * set) {
+  ret_t ret;
+  unsigned int num_layers;
+  reg_match_t * matches;
+
+  assert(sm != NULL);
+  assert(set != NULL);
+  if(sm == NULL || set == NULL) return RET_INV_PTR;
+
+  num_layers = MIN((unsigned int)set->num_layers, sm->num_layers);
+  if(num_layers < 2) return RET_ERR;
+
+  if((matches = (reg_match_t *)malloc((num_layers - 1) * sizeof(reg_match_t))) == NULL) 
+    return RET_MALLOC_FAILED;
+
+  if(RET_IS_OK(ret = reg_match_all_layers(sm, num_layers, matches)))
+    ret = reg_place_alignment_markers(set, num_layers, matches);
+
+  free(matches);
+  return ret;
+}
@@ -0,0 +1,71 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __REGISTRATION_H__
+#define __REGISTRATION_H__
+
+#include "globals.h"
+#include "graphics.h"
+#include "scaling_manager.h"
+#include "alignment_marker.h"
+
+/**
+ * Automatic registration of adjacent layers. The scaling and translation between
+ * two layers is estimated with phase correlations on the zoom levels of the
+ * scaling manager, from the coarsest level to the background image.
+ */
+
+/** Edge length of the windows, that are correlated. Must be a power of two. */
+#define REG_WINDOW_SIZE 256
+
+/** Scalings between two layers are searched in the range [1/REG_MAX_SCALING, REG_MAX_SCALING]. */
+#define REG_MAX_SCALING 1.25
+
+/** Matches with a lower correlation peak are considered as failed. */
+#define REG_MIN_CONFIDENCE 0.03
+
+/**
+ * The result of a registration. The position (x, y) in the upper layer corresponds
+ * to (scaling_x * x + shift_x, scaling_y * y + shift_y) in the lower layer.
+ */
+typedef struct {
+  double scaling_x, scaling_y;
+  double shift_x, shift_y;
+
+  // two corresponding points in both layers, e.g. for alignment markers
+  double lower_x[2], lower_y[2];
+  double upper_x[2], upper_y[2];
+
+  double confidence; // the lowest correlation peak
+} reg_match_t;
+
+ret_t reg_match_layers(scaling_manager_t * sm, unsigned int lower_layer, unsigned int upper_layer,
+		       reg_match_t * match);
+
+ret_t reg_match_all_layers(scaling_manager_t * sm, unsigned int num_layers, reg_match_t * matches);
+
+ret_t reg_place_alignment_markers(alignment_marker_set_t * set, unsigned int num_layers,
+				  const reg_match_t * matches);
+
+ret_t reg_fill_alignment_markers(scaling_manager_t * sm, alignment_marker_set_t * set);
+
+#endif
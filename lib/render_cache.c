@@ -0,0 +1,469 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "render_cache.h"
+#include "image_view.h"
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+static inline uint32_t hash_data(uint32_t h, const void * data, size_t len) {
+  const uint8_t * ptr = (const uint8_t *)data;
+  size_t i;
+  for(i = 0; i < len; i++) h = (h ^ ptr[i]) * FNV_PRIME;
+  return h;
+}
+
+#define HASH_VAR(h, var) h = hash_data(h, &(var), sizeof(var))
+
+/**
+ * Hash everything from the render params, that changes the rendered image. Objects
+ * from the logic model are not hashed. They report their changes on their own.
+ */
+static uint32_t hash_render_params(const render_params_t * rp) {
+  uint32_t h = FNV_OFFSET_BASIS;
+  int i;
+
+  HASH_VAR(h, rp->bg_images);
+  HASH_VAR(h, rp->lmodel);
+  HASH_VAR(h, rp->grid);
+  HASH_VAR(h, rp->alignment_marker_set);
+  HASH_VAR(h, rp->scaling_manager);
+  HASH_VAR(h, rp->similarity_cache);
+  HASH_VAR(h, rp->lod_cache);
+  HASH_VAR(h, rp->sprite_cache);
+
+  HASH_VAR(h, rp->gate_pin_color);
+  HASH_VAR(h, rp->gate_area_color);
+  HASH_VAR(h, rp->wire_color);
+  HASH_VAR(h, rp->il_up_color);
+  HASH_VAR(h, rp->il_down_color);
+  HASH_VAR(h, rp->grid_color);
+  HASH_VAR(h, rp->marker_color_m1_up);
+  HASH_VAR(h, rp->marker_color_m1_down);
+  HASH_VAR(h, rp->marker_color_m2_up);
+  HASH_VAR(h, rp->marker_color_m2_down);
+  HASH_VAR(h, rp->alignment_marker_size);
+  HASH_VAR(h, rp->distance_to_color);
+
+  const grid_t * grid = rp->grid;
+  if(grid != NULL) {
+    HASH_VAR(h, grid->grid_mode);
+    HASH_VAR(h, grid->offset_x);
+    HASH_VAR(h, grid->offset_y);
+    HASH_VAR(h, grid->dist_x);
+    HASH_VAR(h, grid->dist_y);
+    HASH_VAR(h, grid->horizontal_lines_enabled);
+    HASH_VAR(h, grid->vertical_lines_enabled);
+    HASH_VAR(h, grid->uhg_enabled);
+    HASH_VAR(h, grid->uvg_enabled);
+    if(grid->uhg_offsets != NULL) 
+      h = hash_data(h, grid->uhg_offsets, grid->num_uhg_entries * sizeof(unsigned int));
+    if(grid->uvg_offsets != NULL) 
+      h = hash_data(h, grid->uvg_offsets, grid->num_uvg_entries * sizeof(unsigned int));
+  }
+
+  const alignment_marker_set_t * amset = rp->alignment_marker_set;
+  if(amset != NULL && amset->markers != NULL) {
+    for(i = 0; i < amset->max_markers; i++) {
+      const alignment_marker_t * m = amset->markers[i];
+      if(m != NULL) {
+	HASH_VAR(h, m->x);
+	HASH_VAR(h, m->y);
+	HASH_VAR(h, m->layer);
+	HASH_VAR(h, m->marker_type);
+      }
+    }
+  }
+
+  return h;
+}
+
+static uint32_t get_enabled_mask(const renderer_t * renderer) {
+  uint32_t mask = 0;
+  int i;
+  for(i = 0; i < renderer->num; i++)
+    if(renderer->rendering_enabled[i]) mask |= 1U << i;
+  return mask;
+}
+
+static unsigned long get_bg_version(const render_params_t * rp, unsigned int layer) {
+  scaling_manager_t * sm = rp->scaling_manager;
+  return sm != NULL && layer < sm->num_layers ? scalmgr_get_layer_version(sm, layer) : 0;
+}
+
+
+/**
+ * Create a render cache.
+ * @param num_tiles The number of tiles, the cache can hold. It should be larger
+ *   than the number of tiles of a view, because tiles of a view can't be evicted
+ *   while the view is rendered.
+ * @see rcache_get_num_tiles_for_view()
+ */
+rcache_t * rcache_create(renderer_t * renderer, render_params_t * render_params, unsigned int num_tiles) {
+  assert(renderer != NULL);
+  assert(render_params != NULL);
+  assert(num_tiles > 0);
+  if(renderer == NULL || render_params == NULL || num_tiles == 0) return NULL;
+
+  rcache_t * rc = (rcache_t *)malloc(sizeof(rcache_t));
+  if(rc == NULL) return NULL;
+  memset(rc, 0, sizeof(rcache_t));
+
+  // tile images are allocated, when they are used the first time
+  if((rc->tiles = (rcache_tile_t *)calloc(num_tiles, sizeof(rcache_tile_t))) == NULL) {
+    free(rc);
+    return NULL;
+  }
+
+  rc->renderer = renderer;
+  rc->render_params = render_params;
+  rc->num_tiles = num_tiles;
+  rc->params_hash = hash_render_params(render_params);
+  pthread_mutex_init(&rc->mutex, NULL);
+  return rc;
+}
+
+static ret_t rcache_destroy_tiles(rcache_t * rc) {
+  unsigned int i;
+  ret_t ret;
+  for(i = 0; i < rc->num_tiles; i++)
+    if(rc->tiles[i].img != NULL && RET_IS_NOT_OK(ret = gr_image_destroy(rc->tiles[i].img))) return ret;
+
+  free(rc->tiles);
+  rc->tiles = NULL;
+  rc->num_tiles = 0;
+  return RET_OK;
+}
+
+ret_t rcache_destroy(rcache_t * rc) {
+  ret_t ret;
+  assert(rc != NULL);
+  if(rc == NULL) return RET_INV_PTR;
+
+  if(RET_IS_NOT_OK(ret = rcache_destroy_tiles(rc))) return ret;
+  pthread_mutex_destroy(&rc->mutex);
+  free(rc);
+  return RET_OK;
+}
+
+/**
+ * Drop all tiles and change the number of tiles, the cache can hold. The cache
+ * itself stays, so it can be invalidated from other threads at any time. It must
+ * not be used for rendering, while the size is changed.
+ */
+ret_t rcache_set_num_tiles(rcache_t * rc, unsigned int num_tiles) {
+  ret_t ret;
+  assert(rc != NULL);
+  assert(num_tiles > 0);
+  if(rc == NULL) return RET_INV_PTR;
+  if(num_tiles == 0) return RET_ERR;
+
+  pthread_mutex_lock(&rc->mutex);
+  if(RET_IS_OK(ret = rcache_destroy_tiles(rc))) {
+    if((rc->tiles = (rcache_tile_t *)calloc(num_tiles, sizeof(rcache_tile_t))) == NULL) 
+      ret = RET_MALLOC_FAILED;
+    else rc->num_tiles = num_tiles;
+  }
+  pthread_mutex_unlock(&rc->mutex);
+  return ret;
+}
+
+/**
+ * Get a cache size in tiles, that keeps the tiles of about three views of
+ * width x height screen pixels.
+ */
+unsigned int rcache_get_num_tiles_for_view(unsigned int width, unsigned int height) {
+  return 3 * (width / RCACHE_TILE_SIZE + 2) * (height / RCACHE_TILE_SIZE + 2);
+}
+
+/**
+ * Mark a tile as invalid. A tile, that is rendered right now, is not marked 
+ * as valid, when it is complete. The caller must hold the mutex.
+ */
+static inline void rcache_invalidate_tile(rcache_tile_t * tile) {
+  tile->valid = 0;
+  if(tile->in_use) tile->invalidated = 1;
+}
+
+static void rcache_invalidate_tiles(rcache_t * rc) {
+  unsigned int i;
+  for(i = 0; i < rc->num_tiles; i++) rcache_invalidate_tile(&rc->tiles[i]);
+}
+
+static void rcache_invalidate_tiles_in_region(rcache_t * rc, 
+					      unsigned int min_x, unsigned int min_y, 
+					      unsigned int max_x, unsigned int max_y) {
+  unsigned int i;
+  for(i = 0; i < rc->num_tiles; i++) {
+    rcache_tile_t * tile = &rc->tiles[i];
+    if(tile->valid || tile->in_use) {
+      double tile_size_x = RCACHE_TILE_SIZE * tile->scaling_x;
+      double tile_size_y = RCACHE_TILE_SIZE * tile->scaling_y;
+      double margin_x = RENDERER_OVERDRAW_SCREEN * tile->scaling_x + RENDERER_OVERDRAW_REAL;
+      double margin_y = RENDERER_OVERDRAW_SCREEN * tile->scaling_y + RENDERER_OVERDRAW_REAL;
+
+      if(tile->tile_x * tile_size_x <= max_x + margin_x && 
+	 (tile->tile_x + 1) * tile_size_x >= min_x - margin_x &&
+	 tile->tile_y * tile_size_y <= max_y + margin_y && 
+	 (tile->tile_y + 1) * tile_size_y >= min_y - margin_y) 
+	rcache_invalidate_tile(tile);
+    }
+  }
+}
+
+void rcache_invalidate_all(rcache_t * rc) {
+  assert(rc != NULL);
+  if(rc == NULL) return;
+
+  pthread_mutex_lock(&rc->mutex);
+  rcache_invalidate_tiles(rc);
+  pthread_mutex_unlock(&rc->mutex);
+}
+
+/**
+ * Invalidate all tiles, that show parts of a region. The region is given in real 
+ * coordinates. Objects within the region may be drawn beyond it, so tiles within 
+ * the overdraw margin are invalidated, too.
+ */
+void rcache_invalidate_region(rcache_t * rc, 
+			      unsigned int min_x, unsigned int min_y, 
+			      unsigned int max_x, unsigned int max_y) {
+  assert(rc != NULL);
+  if(rc == NULL) return;
+
+  pthread_mutex_lock(&rc->mutex);
+  rcache_invalidate_tiles_in_region(rc, min_x, min_y, max_x, max_y);
+  pthread_mutex_unlock(&rc->mutex);
+}
+
+/**
+ * Invalidate the tiles, that show an object from the logic model.
+ * If obj_ptr is NULL, all tiles are invalidated.
+ */
+void rcache_invalidate_object(rcache_t * rc, LM_OBJECT_TYPE object_type, void * obj_ptr) {
+  assert(rc != NULL);
+  if(rc == NULL) return;
+
+  lmodel_gate_t * gate;
+  lmodel_wire_t * wire;
+  lmodel_via_t * via;
+  unsigned int radius;
+
+  pthread_mutex_lock(&rc->mutex);
+
+  switch(obj_ptr != NULL ? object_type : LM_TYPE_UNDEF) {
+  case LM_TYPE_GATE:
+    gate = (lmodel_gate_t *)obj_ptr;
+    rcache_invalidate_tiles_in_region(rc, gate->min_x, gate->min_y, gate->max_x, gate->max_y);
+    break;
+  case LM_TYPE_GATE_PORT:
+    gate = ((lmodel_gate_port_t *)obj_ptr)->gate;
+    if(gate != NULL) rcache_invalidate_tiles_in_region(rc, gate->min_x, gate->min_y, gate->max_x, gate->max_y);
+    else rcache_invalidate_tiles(rc);
+    break;
+  case LM_TYPE_WIRE:
+    wire = (lmodel_wire_t *)obj_ptr;
+    radius = wire->diameter >> 1;
+    rcache_invalidate_tiles_in_region(rc, 
+				      MIN(wire->from_x, wire->to_x) > radius ? MIN(wire->from_x, wire->to_x) - radius : 0,
+				      MIN(wire->from_y, wire->to_y) > radius ? MIN(wire->from_y, wire->to_y) - radius : 0,
+				      MAX(wire->from_x, wire->to_x) + radius,
+				      MAX(wire->from_y, wire->to_y) + radius);
+    break;
+  case LM_TYPE_VIA:
+    via = (lmodel_via_t *)obj_ptr;
+    radius = via->diameter << 1; // radius of highlighted vias
+    rcache_invalidate_tiles_in_region(rc, 
+				      via->x > radius ? via->x - radius : 0,
+				      via->y > radius ? via->y - radius : 0,
+				      via->x + radius, via->y + radius);
+    break;
+  default:
+    rcache_invalidate_tiles(rc);
+  }
+
+  pthread_mutex_unlock(&rc->mutex);
+}
+
+static rcache_tile_t * rcache_lookup(rcache_t * rc, unsigned int layer, double scaling_x, double scaling_y,
+				     long tile_x, long tile_y, uint32_t enabled_mask, unsigned long bg_version) {
+  unsigned int i;
+  for(i = 0; i < rc->num_tiles; i++) {
+    rcache_tile_t * tile = &rc->tiles[i];
+    if(tile->valid && 
+       tile->tile_x == tile_x && tile->tile_y == tile_y &&
+       tile->layer == layer &&
+       tile->scaling_x == scaling_x && tile->scaling_y == scaling_y &&
+       tile->enabled_mask == enabled_mask &&
+       tile->bg_version == bg_version) return tile;
+  }
+  return NULL;
+}
+
+/**
+ * Get a tile, that can be reused. Invalid tiles are preferred, else the least
+ * recently used tile is taken. Tiles of the current view are never returned.
+ * The caller must hold the mutex.
+ */
+static rcache_tile_t * rcache_get_free_tile(rcache_t * rc) {
+  unsigned int i;
+  rcache_tile_t * lru = NULL;
+
+  for(i = 0; i < rc->num_tiles; i++) {
+    rcache_tile_t * tile = &rc->tiles[i];
+    if(!tile->valid) return tile;
+    if(tile->last_used != rc->clock && (lru == NULL || tile->last_used < lru->last_used)) lru = tile;
+  }
+  return lru;
+}
+
+/**
+ * Render a region like render_region() does, but take unchanged tiles from
+ * the cache. The region is given in real coordinates.
+ * @return Returns RET_CANCEL, if rendering was cancelled, see renderer_set_cancel_flag().
+ */
+ret_t rcache_render_region(rcache_t * rc, image_t * dst_img, unsigned int layer,
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y) {
+  long tile_x, tile_y, y;
+
+  assert(rc != NULL);
+  assert(dst_img != NULL);
+  assert(dst_img->image_type == IMAGE_TYPE_RGBA);
+  if(rc == NULL || dst_img == NULL) return RET_INV_PTR;
+  if(dst_img->image_type != IMAGE_TYPE_RGBA) return RET_ERR;
+
+  double scaling_x = (max_x - min_x) / (double)dst_img->width;
+  double scaling_y = (max_y - min_y) / (double)dst_img->height;
+
+  if(scaling_x <= 0 || scaling_y <= 0) {
+    render_region(rc->renderer, dst_img, layer, min_x, min_y, max_x, max_y);
+    return RET_OK;
+  }
+
+  // screen position of the view on a canvas, that starts at real (0, 0)
+  long origin_x = lrint(min_x / scaling_x);
+  long origin_y = lrint(min_y / scaling_y);
+
+  long tile_min_x = origin_x / RCACHE_TILE_SIZE;
+  long tile_min_y = origin_y / RCACHE_TILE_SIZE;
+  long tile_max_x = (origin_x + dst_img->width - 1) / RCACHE_TILE_SIZE;
+  long tile_max_y = (origin_y + dst_img->height - 1) / RCACHE_TILE_SIZE;
+
+  if((unsigned long)((tile_max_x - tile_min_x + 1) * (tile_max_y - tile_min_y + 1)) > rc->num_tiles) {
+    // the view doesn't fit into the cache
+    render_region(rc->renderer, dst_img, layer, min_x, min_y, max_x, max_y);
+    return RET_OK;
+  }
+
+  uint32_t params_hash = hash_render_params(rc->render_params);
+  pthread_mutex_lock(&rc->mutex);
+  if(params_hash != rc->params_hash) {
+    rcache_invalidate_tiles(rc);
+    rc->params_hash = params_hash;
+  }
+  pthread_mutex_unlock(&rc->mutex);
+
+  uint32_t enabled_mask = get_enabled_mask(rc->renderer);
+  unsigned long bg_version = get_bg_version(rc->render_params, layer);
+
+  rc->clock++;
+  rgba_view_t dst(dst_img);
+
+  for(tile_y = tile_min_y; tile_y <= tile_max_y; tile_y++) {
+    for(tile_x = tile_min_x; tile_x <= tile_max_x; tile_x++) {
+
+      pthread_mutex_lock(&rc->mutex);
+      rcache_tile_t * tile = rcache_lookup(rc, layer, scaling_x, scaling_y, tile_x, tile_y, 
+					   enabled_mask, bg_version);
+      renderer_add_cache_stats(rc->renderer, tile != NULL, tile == NULL);
+
+      if(tile == NULL) {
+	if((tile = rcache_get_free_tile(rc)) == NULL) {
+	  pthread_mutex_unlock(&rc->mutex);
+	  return RET_ERR;
+	}
+
+	// the tile is rendered without the mutex, invalidations are recorded meanwhile
+	tile->valid = 0;
+	tile->in_use = 1;
+	tile->invalidated = 0;
+	tile->layer = layer;
+	tile->scaling_x = scaling_x;
+	tile->scaling_y = scaling_y;
+	tile->tile_x = tile_x;
+	tile->tile_y = tile_y;
+	tile->enabled_mask = enabled_mask;
+	tile->bg_version = bg_version;
+	tile->last_used = rc->clock;
+	pthread_mutex_unlock(&rc->mutex);
+
+	if(tile->img == NULL && 
+	   (tile->img = gr_create_memory_image(RCACHE_TILE_SIZE, RCACHE_TILE_SIZE, IMAGE_TYPE_RGBA)) == NULL) {
+	  pthread_mutex_lock(&rc->mutex);
+	  tile->in_use = 0;
+	  pthread_mutex_unlock(&rc->mutex);
+	  return RET_MALLOC_FAILED;
+	}
+
+	// render_region() expects, that the first render function paints the whole buffer
+	gr_map_clear(tile->img);
+	render_region(rc->renderer, tile->img, layer, 
+		      tile_x * RCACHE_TILE_SIZE * scaling_x, tile_y * RCACHE_TILE_SIZE * scaling_y,
+		      (tile_x + 1) * RCACHE_TILE_SIZE * scaling_x, (tile_y + 1) * RCACHE_TILE_SIZE * scaling_y);
+
+	// a cancelled tile is incomplete
+	int cancelled = renderer_is_cancelled(rc->renderer);
+	pthread_mutex_lock(&rc->mutex);
+	tile->valid = !cancelled && !tile->invalidated;
+	tile->in_use = 0;
+	pthread_mutex_unlock(&rc->mutex);
+	if(cancelled) return RET_CANCEL;
+      }
+      else {
+	tile->last_used = rc->clock;
+	pthread_mutex_unlock(&rc->mutex);
+      }
+
+      // copy the visible part of the tile
+      long from_x = MAX(tile_x * RCACHE_TILE_SIZE, origin_x);
+      long from_y = MAX(tile_y * RCACHE_TILE_SIZE, origin_y);
+      long to_x = MIN((tile_x + 1) * RCACHE_TILE_SIZE, origin_x + (long)dst_img->width);
+      long to_y = MIN((tile_y + 1) * RCACHE_TILE_SIZE, origin_y + (long)dst_img->height);
+
+      rgba_view_t src(tile->img);
+      for(y = from_y; y < to_y; y++)
+	imgview_convert_row<IMAGE_TYPE_RGBA, IMAGE_TYPE_RGBA>(dst.ptr(from_x - origin_x, y - origin_y),
+							       src.ptr(from_x - tile_x * RCACHE_TILE_SIZE, 
+								       y - tile_y * RCACHE_TILE_SIZE),
+							       to_x - from_x);
+    }
+  }
+
+  return RET_OK;
+}
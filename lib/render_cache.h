@@ -0,0 +1,91 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __RENDER_CACHE_H__
+#define __RENDER_CACHE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "renderer.h"
+#include "logic_model.h"
+
+/**
+ * Cache for rendered screen tiles. The rendered view is split into tiles of
+ * RCACHE_TILE_SIZE x RCACHE_TILE_SIZE screen pixels, that are aligned to a grid
+ * starting at real coordinate (0, 0). Tiles are keyed by layer, scaling, tile
+ * position and the set of enabled render functions. If the view is moved, only
+ * newly exposed tiles are rendered.
+ *
+ * Changes to the logic model invalidate the tiles around the changed objects.
+ * The cache drops all tiles, if the render params or the background image change.
+ * Tiles may be invalidated from any thread, while a view is rendered.
+ */
+
+#define RCACHE_TILE_SIZE 256
+
+typedef struct {
+  image_t * img;
+  int valid;
+  int in_use;               // the tile is rendered right now
+  int invalidated;          // the tile was invalidated, while it was rendered
+
+  unsigned int layer;
+  double scaling_x, scaling_y;
+  long tile_x, tile_y;      // position in units of tiles
+  uint32_t enabled_mask;    // one bit per enabled render function
+  unsigned long bg_version; // version of the background, the tile was rendered from
+
+  unsigned long last_used;
+} rcache_tile_t;
+
+typedef struct render_cache {
+  renderer_t * renderer;
+  render_params_t * render_params;
+
+  unsigned int num_tiles;
+  rcache_tile_t * tiles;
+
+  unsigned long clock;       // incremented for each rendered view
+  uint32_t params_hash;      // hash of the render params, the tiles were rendered with
+
+  pthread_mutex_t mutex;     // protects the tile table and the tile states
+} rcache_t;
+
+rcache_t * rcache_create(renderer_t * renderer, render_params_t * render_params, unsigned int num_tiles);
+ret_t rcache_destroy(rcache_t * rc);
+ret_t rcache_set_num_tiles(rcache_t * rc, unsigned int num_tiles);
+
+ret_t rcache_render_region(rcache_t * rc, image_t * dst_img, unsigned int layer,
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y);
+
+void rcache_invalidate_all(rcache_t * rc);
+void rcache_invalidate_region(rcache_t * rc, 
+			      unsigned int min_x, unsigned int min_y, 
+			      unsigned int max_x, unsigned int max_y);
+void rcache_invalidate_object(rcache_t * rc, LM_OBJECT_TYPE object_type, void * obj_ptr);
+
+unsigned int rcache_get_num_tiles_for_view(unsigned int width, unsigned int height);
+
+#endif
@@ -0,0 +1,586 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <wand/magick-wand.h>
+
+#include "globals.h"
+#include "render_export.h"
+#include "parallel.h"
+#include "image_view.h"
+
+/** Write a buffer completely. */
+static ret_t rexport_write(int fd, const void * data, size_t size) {
+  const uint8_t * ptr = (const uint8_t *)data;
+  while(size > 0) {
+    ssize_t written = write(fd, ptr, size);
+    if(written <= 0) return RET_ERR;
+    ptr += written;
+    size -= written;
+  }
+  return RET_OK;
+}
+
+/** Convert width RGBA pixels into RGB triples. */
+static void rexport_convert_row(uint8_t * dst, const uint32_t * src, unsigned int width) {
+  unsigned int x;
+  for(x = 0; x < width; x++) {
+    uint32_t pix = src[x];
+    *dst++ = MASK_R(pix);
+    *dst++ = MASK_G(pix);
+    *dst++ = MASK_B(pix);
+  }
+}
+
+static inline void put_le16(uint8_t * p, uint16_t v) {
+  p[0] = v; p[1] = v >> 8;
+}
+
+static inline void put_le64(uint8_t * p, uint64_t v) {
+  unsigned int i;
+  for(i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+/**
+ * Guess the export format from the file name extension. Unknown extensions are
+ * written as PPM.
+ */
+REXPORT_FORMAT rexport_get_format_by_filename(const char * const filename) {
+  assert(filename != NULL);
+  const char * ext = filename != NULL ? strrchr(filename, '.') : NULL;
+  if(ext == NULL) return REXPORT_FORMAT_PPM;
+  if(!strcasecmp(ext, ".tif") || !strcasecmp(ext, ".tiff")) return REXPORT_FORMAT_TIFF;
+  if(!strcasecmp(ext, ".dzi")) return REXPORT_FORMAT_DZI;
+  return REXPORT_FORMAT_PPM;
+}
+
+/*
+ * TIFF
+ *
+ * Tiles are written in row major order directly after the header, so their
+ * offsets are known in advance. The only IFD follows the tiles.
+ */
+
+#define TIFF_HEADER_SIZE 16
+#define TIFF_NUM_ENTRIES 11
+#define TIFF_TYPE_SHORT 3
+#define TIFF_TYPE_LONG 4
+#define TIFF_TYPE_LONG8 16
+
+static unsigned int rexport_tiles_x(const rexport_writer_t * w) {
+  return (w->width + REXPORT_TILE_SIZE - 1) / REXPORT_TILE_SIZE;
+}
+
+static unsigned int rexport_tiles_y(const rexport_writer_t * w) {
+  return (w->height + REXPORT_TILE_SIZE - 1) / REXPORT_TILE_SIZE;
+}
+
+static size_t rexport_tiff_tile_bytes() {
+  return REXPORT_TILE_SIZE * REXPORT_TILE_SIZE * 3;
+}
+
+static uint64_t rexport_tiff_ifd_offset(const rexport_writer_t * w) {
+  return TIFF_HEADER_SIZE + (uint64_t)rexport_tiles_x(w) * rexport_tiles_y(w) * rexport_tiff_tile_bytes();
+}
+
+static ret_t rexport_tiff_write_header(rexport_writer_t * w) {
+  uint8_t header[TIFF_HEADER_SIZE];
+  header[0] = header[1] = 'I'; // little endian
+  put_le16(header + 2, 43);    // BigTIFF
+  put_le16(header + 4, 8);     // size of offsets
+  put_le16(header + 6, 0);
+  put_le64(header + 8, rexport_tiff_ifd_offset(w));
+  return rexport_write(w->fd, header, sizeof(header));
+}
+
+/** Write a row of tiles. Tiles at the border are padded with black. */
+static ret_t rexport_tiff_write_tiles(rexport_writer_t * w, image_t * img, unsigned int num_rows) {
+  ret_t ret;
+  unsigned int tx, y;
+  rgba_view_t src(img);
+
+  for(tx = 0; tx < rexport_tiles_x(w); tx++) {
+    unsigned int min_x = tx * REXPORT_TILE_SIZE;
+    unsigned int width = MIN(REXPORT_TILE_SIZE, w->width - min_x);
+
+    memset(w->buffer, 0, rexport_tiff_tile_bytes());
+    for(y = 0; y < num_rows; y++)
+      rexport_convert_row(w->buffer + y * REXPORT_TILE_SIZE * 3, src.ptr(min_x, y), width);
+
+    if(RET_IS_NOT_OK(ret = rexport_write(w->fd, w->buffer, rexport_tiff_tile_bytes()))) return ret;
+  }
+  return RET_OK;
+}
+
+static void rexport_tiff_entry(uint8_t * p, uint16_t tag, uint16_t type, uint64_t count, uint64_t value) {
+  put_le16(p, tag);
+  put_le16(p + 2, type);
+  put_le64(p + 4, count);
+  put_le64(p + 12, value);
+}
+
+static ret_t rexport_tiff_write_ifd(rexport_writer_t * w) {
+  ret_t ret;
+  uint64_t i, num_tiles = (uint64_t)rexport_tiles_x(w) * rexport_tiles_y(w);
+  uint64_t ifd_offset = rexport_tiff_ifd_offset(w);
+  size_t ifd_size = 8 + TIFF_NUM_ENTRIES * 20 + 8;
+  uint64_t offsets_offset = ifd_offset + ifd_size;
+  uint64_t counts_offset = offsets_offset + num_tiles * 8;
+
+  uint8_t ifd[8 + TIFF_NUM_ENTRIES * 20 + 8];
+  uint8_t * e = ifd + 8;
+  memset(ifd, 0, sizeof(ifd));
+  put_le64(ifd, TIFF_NUM_ENTRIES);
+
+  // values, that fit into eight bytes, are stored in the entry
+  uint64_t bits_per_sample = 8 | (8 << 16) | ((uint64_t)8 << 32);
+  rexport_tiff_entry(e, 256, TIFF_TYPE_LONG, 1, w->width); e += 20;    // ImageWidth
+  rexport_tiff_entry(e, 257, TIFF_TYPE_LONG, 1, w->height); e += 20;   // ImageLength
+  rexport_tiff_entry(e, 258, TIFF_TYPE_SHORT, 3, bits_per_sample); e += 20; // BitsPerSample
+  rexport_tiff_entry(e, 259, TIFF_TYPE_SHORT, 1, 1); e += 20;          // Compression: none
+  rexport_tiff_entry(e, 262, TIFF_TYPE_SHORT, 1, 2); e += 20;          // Photometric: RGB
+  rexport_tiff_entry(e, 277, TIFF_TYPE_SHORT, 1, 3); e += 20;          // SamplesPerPixel
+  rexport_tiff_entry(e, 284, TIFF_TYPE_SHORT, 1, 1); e += 20;          // PlanarConfiguration
+  rexport_tiff_entry(e, 322, TIFF_TYPE_LONG, 1, REXPORT_TILE_SIZE); e += 20; // TileWidth
+  rexport_tiff_entry(e, 323, TIFF_TYPE_LONG, 1, REXPORT_TILE_SIZE); e += 20; // TileLength
+  rexport_tiff_entry(e, 324, TIFF_TYPE_LONG8, num_tiles,                // TileOffsets
+		     num_tiles == 1 ? TIFF_HEADER_SIZE : offsets_offset); e += 20;
+  rexport_tiff_entry(e, 325, TIFF_TYPE_LONG8, num_tiles,                // TileByteCounts
+		     num_tiles == 1 ? rexport_tiff_tile_bytes() : counts_offset);
+
+  if(RET_IS_NOT_OK(ret = rexport_write(w->fd, ifd, sizeof(ifd)))) return ret;
+  if(num_tiles == 1) return RET_OK;
+
+  // the arrays are written in chunks of REXPORT_TILE_SIZE entries
+  uint8_t chunk[REXPORT_TILE_SIZE * 8];
+  unsigned int pass;
+  for(pass = 0; pass < 2; pass++) {
+    for(i = 0; i < num_tiles; i += REXPORT_TILE_SIZE) {
+      uint64_t j, n = MIN((uint64_t)REXPORT_TILE_SIZE, num_tiles - i);
+      for(j = 0; j < n; j++)
+	put_le64(chunk + 8 * j, pass == 0 ? 
+		 TIFF_HEADER_SIZE + (i + j) * rexport_tiff_tile_bytes() : rexport_tiff_tile_bytes());
+      if(RET_IS_NOT_OK(ret = rexport_write(w->fd, chunk, n * 8))) return ret;
+    }
+  }
+  return RET_OK;
+}
+
+/*
+ * DZI
+ *
+ * Level n of a Deep Zoom pyramid has a size of ceil(size / 2^(num_levels - 1 - n)).
+ * Each level collects a band of rows. If the band is complete, its tiles are
+ * written and the band is downsampled into the next lower level.
+ */
+
+static char * rexport_dzi_tile_dir(const char * const filename) {
+  size_t len = strlen(filename);
+  const char * ext = strrchr(filename, '.');
+  if(ext != NULL && !strcasecmp(ext, ".dzi")) len = ext - filename;
+
+  char * dir = (char *)malloc(len + strlen("_files") + 1);
+  if(dir == NULL) return NULL;
+  memcpy(dir, filename, len);
+  strcpy(dir + len, "_files");
+  return dir;
+}
+
+static ret_t rexport_dzi_create_levels(rexport_writer_t * w) {
+  unsigned int level, n = 0;
+  char path[PATH_MAX];
+
+  while((1U << n) < MAX(w->width, w->height)) n++;
+  w->num_levels = n + 1;
+
+  if((w->levels = (rexport_level_t *)malloc(w->num_levels * sizeof(rexport_level_t))) == NULL)
+    return RET_MALLOC_FAILED;
+  memset(w->levels, 0, w->num_levels * sizeof(rexport_level_t));
+
+  if(mkdir(w->tile_dir, 0700) != 0 && errno != EEXIST) return RET_INV_PATH;
+
+  for(level = 0; level < w->num_levels; level++) {
+    rexport_level_t * l = &w->levels[level];
+    unsigned int shift = w->num_levels - 1 - level;
+    l->width = (unsigned int)(((uint64_t)w->width + (1ULL << shift) - 1) >> shift);
+    l->height = (unsigned int)(((uint64_t)w->height + (1ULL << shift) - 1) >> shift);
+
+    snprintf(path, sizeof(path), "%s/%d", w->tile_dir, level);
+    if(mkdir(path, 0700) != 0 && errno != EEXIST) return RET_INV_PATH;
+
+    // the full resolution level is fed directly
+    if(level < w->num_levels - 1 &&
+       (l->band = gr_create_memory_image(l->width, REXPORT_TILE_SIZE, IMAGE_TYPE_RGBA)) == NULL)
+      return RET_MALLOC_FAILED;
+  }
+  return RET_OK;
+}
+
+static ret_t rexport_dzi_write_tile(rexport_writer_t * w, unsigned int level, unsigned int col, 
+				    unsigned int row, unsigned int width, unsigned int height) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%d/%d_%d.%s", w->tile_dir, level, col, row, w->tile_format);
+
+  if(!strcmp(w->tile_format, "ppm")) {
+    char header[64];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd == -1) return RET_INV_PATH;
+    snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    ret_t ret = rexport_write(fd, header, strlen(header));
+    if(RET_IS_OK(ret)) ret = rexport_write(fd, w->buffer, (size_t)width * height * 3);
+    close(fd);
+    return ret;
+  }
+  else {
+    MagickWand * magick_wand = NewMagickWand();
+    MagickBooleanType status = MagickConstituteImage(magick_wand, width, height, "RGB", 
+						     CharPixel, w->buffer);
+    if(status != MagickFalse) status = MagickWriteImage(magick_wand, path);
+    DestroyMagickWand(magick_wand);
+    return status == MagickFalse ? RET_ERR : RET_OK;
+  }
+}
+
+/** 2x2 box filter. At odd borders the last row or column is repeated. */
+static void rexport_downsample_rows(image_t * dst_img, unsigned int dst_y, 
+				    image_t * src_img, unsigned int num_rows) {
+  unsigned int x, y;
+  rgba_view_t dst(dst_img);
+  rgba_view_t src(src_img);
+
+  for(y = 0; 2 * y < num_rows; y++) {
+    const uint32_t * row0 = src.row(2 * y);
+    const uint32_t * row1 = src.row(MIN(2 * y + 1, num_rows - 1));
+    uint32_t * dst_row = dst.row(dst_y + y);
+
+    for(x = 0; x < dst.width; x++) {
+      unsigned int x0 = 2 * x, x1 = MIN(2 * x + 1, src.width - 1);
+      uint32_t a = row0[x0], b = row0[x1], c = row1[x0], d = row1[x1];
+      dst_row[x] = MERGE_CHANNELS(((MASK_R(a) + MASK_R(b) + MASK_R(c) + MASK_R(d) + 2) >> 2),
+				  ((MASK_G(a) + MASK_G(b) + MASK_G(c) + MASK_G(d) + 2) >> 2),
+				  ((MASK_B(a) + MASK_B(b) + MASK_B(c) + MASK_B(d) + 2) >> 2),
+				  0xffU);
+    }
+  }
+}
+
+static ret_t rexport_dzi_add_band(rexport_writer_t * w, unsigned int level, 
+				  image_t * img, unsigned int num_rows) {
+  ret_t ret;
+  unsigned int col, y;
+  rexport_level_t * l = &w->levels[level];
+  rgba_view_t src(img);
+
+  for(col = 0; col * REXPORT_TILE_SIZE < l->width; col++) {
+    unsigned int min_x = col * REXPORT_TILE_SIZE;
+    unsigned int width = MIN(REXPORT_TILE_SIZE, l->width - min_x);
+
+    for(y = 0; y < num_rows; y++)
+      rexport_convert_row(w->buffer + y * width * 3, src.ptr(min_x, y), width);
+
+    if(RET_IS_NOT_OK(ret = rexport_dzi_write_tile(w, level, col, l->tile_row, width, num_rows)))
+      return ret;
+  }
+  l->tile_row++;
+
+  if(level == 0) return RET_OK;
+
+  rexport_level_t * parent = &w->levels[level - 1];
+  rexport_downsample_rows(parent->band, parent->num_rows, img, num_rows);
+  parent->num_rows += (num_rows + 1) / 2;
+
+  if(parent->num_rows == REXPORT_TILE_SIZE || l->tile_row * REXPORT_TILE_SIZE >= l->height) {
+    unsigned int rows = parent->num_rows;
+    parent->num_rows = 0;
+    return rexport_dzi_add_band(w, level - 1, parent->band, rows);
+  }
+  return RET_OK;
+}
+
+static ret_t rexport_dzi_write_descriptor(rexport_writer_t * w) {
+  FILE * f = fopen(w->dzi_file, "w");
+  if(f == NULL) return RET_INV_PATH;
+
+  fprintf(f, 
+	  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"%s\" Overlap=\"0\" TileSize=\"%d\">\n"
+	  "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+	  "</Image>\n", w->tile_format, REXPORT_TILE_SIZE, w->width, w->height);
+
+  return fclose(f) == 0 ? RET_OK : RET_ERR;
+}
+
+/*
+ * Writer
+ */
+
+/**
+ * Create a streaming writer for an image of the given size. The PPM and TIFF
+ * header is written immediately. For DZI the file name is the name of the 
+ * descriptor. The tiles are stored in a directory next to it, whose name ends
+ * with "_files".
+ */
+rexport_writer_t * rexport_writer_create(REXPORT_FORMAT format, const char * const filename,
+					 unsigned int width, unsigned int height) {
+  rexport_writer_t * w;
+
+  assert(filename != NULL);
+  if(filename == NULL || width == 0 || height == 0) return NULL;
+
+  if((w = (rexport_writer_t *)malloc(sizeof(rexport_writer_t))) == NULL) return NULL;
+  memset(w, 0, sizeof(rexport_writer_t));
+  w->format = format;
+  w->width = width;
+  w->height = height;
+  w->fd = -1;
+
+  size_t buffer_size = format == REXPORT_FORMAT_PPM ? 
+    (size_t)width * 3 : REXPORT_TILE_SIZE * REXPORT_TILE_SIZE * 3;
+  if((w->buffer = (uint8_t *)malloc(buffer_size)) == NULL) {
+    rexport_writer_destroy(w);
+    return NULL;
+  }
+
+  if(format == REXPORT_FORMAT_DZI) {
+    w->tile_format = REXPORT_DZI_TILE_FORMAT;
+    if((w->dzi_file = strdup(filename)) == NULL ||
+       (w->tile_dir = rexport_dzi_tile_dir(filename)) == NULL ||
+       RET_IS_NOT_OK(rexport_dzi_create_levels(w))) {
+      rexport_writer_destroy(w);
+      return NULL;
+    }
+    MagickWandGenesis();
+    return w;
+  }
+
+  if((w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+    rexport_writer_destroy(w);
+    return NULL;
+  }
+
+  ret_t ret;
+  if(format == REXPORT_FORMAT_TIFF) 
+    ret = rexport_tiff_write_header(w);
+  else {
+    char header[64];
+    snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    ret = rexport_write(w->fd, header, strlen(header));
+  }
+
+  if(RET_IS_NOT_OK(ret)) {
+    rexport_writer_destroy(w);
+    return NULL;
+  }
+  return w;
+}
+
+/**
+ * Append rows to the image. For tiled formats, all calls except the last one 
+ * must pass REXPORT_BAND_HEIGHT rows.
+ * @param img An RGBA image with the width of the exported image.
+ */
+ret_t rexport_writer_add_rows(rexport_writer_t * w, image_t * img, unsigned int num_rows) {
+  ret_t ret;
+  unsigned int y;
+
+  assert(w != NULL);
+  assert(img != NULL);
+  if(w == NULL || img == NULL) return RET_INV_PTR;
+
+  assert(img->image_type == IMAGE_TYPE_RGBA && img->width == w->width && num_rows <= img->height);
+  if(img->image_type != IMAGE_TYPE_RGBA || img->width != w->width || num_rows > img->height ||
+     w->rows_written + num_rows > w->height) return RET_ERR;
+
+  if(w->format != REXPORT_FORMAT_PPM && num_rows != REXPORT_BAND_HEIGHT && 
+     w->rows_written + num_rows != w->height) return RET_ERR;
+
+  switch(w->format) {
+  case REXPORT_FORMAT_PPM: {
+    rgba_view_t src(img);
+    for(y = 0; y < num_rows; y++) {
+      rexport_convert_row(w->buffer, src.row(y), w->width);
+      if(RET_IS_NOT_OK(ret = rexport_write(w->fd, w->buffer, (size_t)w->width * 3))) return ret;
+    }
+    break;
+  }
+  case REXPORT_FORMAT_TIFF:
+    if(RET_IS_NOT_OK(ret = rexport_tiff_write_tiles(w, img, num_rows))) return ret;
+    break;
+  case REXPORT_FORMAT_DZI:
+    if(RET_IS_NOT_OK(ret = rexport_dzi_add_band(w, w->num_levels - 1, img, num_rows))) return ret;
+    break;
+  }
+
+  w->rows_written += num_rows;
+  return RET_OK;
+}
+
+/**
+ * Complete the file after the last row, e.g. write the TIFF directory.
+ */
+ret_t rexport_writer_finish(rexport_writer_t * w) {
+  assert(w != NULL);
+  if(w == NULL) return RET_INV_PTR;
+  if(w->rows_written != w->height) return RET_ERR;
+
+  switch(w->format) {
+  case REXPORT_FORMAT_TIFF: return rexport_tiff_write_ifd(w);
+  case REXPORT_FORMAT_DZI: return rexport_dzi_write_descriptor(w);
+  default: return RET_OK;
+  }
+}
+
+ret_t rexport_writer_destroy(rexport_writer_t * w) {
+  unsigned int level;
+  ret_t ret = RET_OK;
+
+  assert(w != NULL);
+  if(w == NULL) return RET_INV_PTR;
+
+  if(w->fd != -1 && close(w->fd) != 0) ret = RET_ERR;
+  if(w->levels != NULL) {
+    for(level = 0; level < w->num_levels; level++)
+      if(w->levels[level].band != NULL) gr_image_destroy(w->levels[level].band);
+    free(w->levels);
+  }
+  if(w->buffer != NULL) free(w->buffer);
+  if(w->dzi_file != NULL) free(w->dzi_file);
+  if(w->tile_dir != NULL) free(w->tile_dir);
+
+  memset(w, 0, sizeof(rexport_writer_t));
+  free(w);
+  return ret;
+}
+
+/*
+ * Rendering
+ */
+
+typedef struct {
+  renderer_t * renderer;
+  unsigned int layer;
+  unsigned int min_x, min_y, max_x, height;
+  unsigned int first_band;
+  image_t ** bands;
+} rexport_band_params_t;
+
+static ret_t rexport_render_band(unsigned int job, void * arg) {
+  rexport_band_params_t * params = (rexport_band_params_t *)arg;
+  image_t * img = params->bands[job];
+  unsigned int min_y = (params->first_band + job) * REXPORT_BAND_HEIGHT;
+  unsigned int rows = MIN(REXPORT_BAND_HEIGHT, params->height - min_y);
+
+  // the last band is rendered into the upper rows of the band image
+  memory_map_t band_map = *img->map;
+  band_map.height = rows;
+  band_map.storage_type = MAP_STORAGE_TYPE_UNDEF;
+  band_map.filename = NULL;
+  band_map.fd = -1;
+
+  image_t band_img = *img;
+  band_img.height = rows;
+  band_img.map = &band_map;
+
+  // render_region() expects, that the first render function paints the whole buffer
+  memset(band_map.mem, 0, (size_t)img->width * rows * sizeof(uint32_t));
+  render_region(params->renderer, &band_img, params->layer, 
+		params->min_x, params->min_y + min_y, params->max_x, params->min_y + min_y + rows);
+  return RET_OK;
+}
+
+/**
+ * Render a region at a scaling of 1:1 into a file. As many bands are rendered in
+ * parallel as there are threads. Then they are written in order. The export is
+ * not cancelled by the cancel flag of the renderer. The renderer must not be used
+ * by other threads meanwhile.
+ */
+ret_t rexport_render_to_file(renderer_t * const renderer, unsigned int layer,
+			     unsigned int min_x, unsigned int min_y, 
+			     unsigned int max_x, unsigned int max_y,
+			     REXPORT_FORMAT format, const char * const filename,
+			     gr_progress_func_t progress_func, void * progress_arg) {
+  ret_t ret = RET_OK;
+  unsigned int i, band;
+
+  assert(renderer != NULL);
+  assert(filename != NULL);
+  if(renderer == NULL || filename == NULL) return RET_INV_PTR;
+  if(max_x <= min_x || max_y <= min_y) return RET_ERR;
+
+  unsigned int width = max_x - min_x, height = max_y - min_y;
+  unsigned int num_bands = (height + REXPORT_BAND_HEIGHT - 1) / REXPORT_BAND_HEIGHT;
+  unsigned int num_parallel = MIN(MAX(par_get_num_threads(), 1), num_bands);
+
+  rexport_writer_t * writer = rexport_writer_create(format, filename, width, height);
+  if(writer == NULL) return RET_ERR;
+
+  image_t ** bands = (image_t **)malloc(num_parallel * sizeof(image_t *));
+  if(bands == NULL) {
+    rexport_writer_destroy(writer);
+    return RET_MALLOC_FAILED;
+  }
+  memset(bands, 0, num_parallel * sizeof(image_t *));
+
+  for(i = 0; i < num_parallel && RET_IS_OK(ret); i++)
+    if((bands[i] = gr_create_memory_image(width, REXPORT_BAND_HEIGHT, IMAGE_TYPE_RGBA)) == NULL)
+      ret = RET_MALLOC_FAILED;
+
+  rexport_band_params_t params = { renderer, layer, min_x, min_y, max_x, height, 0, bands };
+
+  // damage of the logic model cancels the frames of the render thread, not the export
+  volatile int * cancel = renderer_get_cancel_flag(renderer);
+  renderer_set_cancel_flag(renderer, NULL);
+
+  for(band = 0; band < num_bands && RET_IS_OK(ret); band += num_parallel) {
+    unsigned int n = MIN(num_parallel, num_bands - band);
+    params.first_band = band;
+
+    if(RET_IS_OK(ret = par_run(n, &rexport_render_band, &params))) {
+      for(i = 0; i < n && RET_IS_OK(ret); i++)
+	ret = rexport_writer_add_rows(writer, bands[i], 
+				      MIN(REXPORT_BAND_HEIGHT, height - (band + i) * REXPORT_BAND_HEIGHT));
+    }
+
+    if(progress_func != NULL) (*progress_func)((double)(band + n) / (double)num_bands, progress_arg);
+  }
+
+  renderer_set_cancel_flag(renderer, cancel);
+
+  if(RET_IS_OK(ret)) ret = rexport_writer_finish(writer);
+
+  for(i = 0; i < num_parallel; i++)
+    if(bands[i] != NULL) gr_image_destroy(bands[i]);
+  free(bands);
+
+  ret_t ret2 = rexport_writer_destroy(writer);
+  return RET_IS_OK(ret) ? ret2 : ret;
+}
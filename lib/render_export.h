@@ -0,0 +1,90 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#ifndef __RENDER_EXPORT_H__
+#define __RENDER_EXPORT_H__
+
+#include <stdio.h>
+#include "globals.h"
+#include "graphics.h"
+#include "renderer.h"
+
+/**
+ * Export of large regions at a scaling of 1:1. The region is rendered in bands 
+ * of REXPORT_BAND_HEIGHT rows, several bands in parallel, and the bands are 
+ * streamed to a writer in order. Memory is bounded by a few bands, no matter 
+ * how large the region is.
+ *
+ * Supported formats are binary PPM, tiled BigTIFF with uncompressed RGB tiles and
+ * a Deep Zoom (DZI) pyramid of PNG tiles for web viewers.
+ */
+
+#define REXPORT_TILE_SIZE 256
+#define REXPORT_BAND_HEIGHT REXPORT_TILE_SIZE
+#define REXPORT_DZI_TILE_FORMAT "png"
+
+enum REXPORT_FORMAT {
+  REXPORT_FORMAT_PPM = 0,
+  REXPORT_FORMAT_TIFF = 1,
+  REXPORT_FORMAT_DZI = 2
+};
+
+/** Level of a tile pyramid. Rows are collected, until a row of tiles is complete. */
+typedef struct {
+  unsigned int width, height;
+  image_t * band;          // REXPORT_TILE_SIZE rows
+  unsigned int num_rows;   // rows in the band
+  unsigned int tile_row;   // next row of tiles to write
+} rexport_level_t;
+
+typedef struct {
+  REXPORT_FORMAT format;
+  unsigned int width, height;
+  unsigned int rows_written;
+
+  int fd;            // PPM and TIFF
+  uint8_t * buffer;  // a row of pixels or a tile in RGB
+
+  // DZI
+  char * dzi_file;
+  char * tile_dir;
+  const char * tile_format;  // file extension of the tiles, "ppm" tiles are written directly
+  unsigned int num_levels;
+  rexport_level_t * levels; // level num_levels - 1 has full resolution
+} rexport_writer_t;
+
+REXPORT_FORMAT rexport_get_format_by_filename(const char * const filename);
+
+rexport_writer_t * rexport_writer_create(REXPORT_FORMAT format, const char * const filename,
+					 unsigned int width, unsigned int height);
+ret_t rexport_writer_add_rows(rexport_writer_t * writer, image_t * img, unsigned int num_rows);
+ret_t rexport_writer_finish(rexport_writer_t * writer);
+ret_t rexport_writer_destroy(rexport_writer_t * writer);
+
+ret_t rexport_render_to_file(renderer_t * const renderer, unsigned int layer,
+			     unsigned int min_x, unsigned int min_y, 
+			     unsigned int max_x, unsigned int max_y,
+			     REXPORT_FORMAT format, const char * const filename,
+			     gr_progress_func_t progress_func, void * progress_arg);
+
+#endif
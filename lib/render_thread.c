@@ -0,0 +1,333 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "render_thread.h"
+#include "image_view.h"
+
+static void * rthread_run(void * arg);
+
+/**
+ * Create and start a render thread.
+ * @param frame_func Called on the render thread for each finished frame. May be NULL.
+ */
+rthread_t * rthread_create(renderer_t * renderer, rthread_frame_func_t frame_func, void * arg) {
+  rthread_t * rt;
+
+  assert(renderer != NULL);
+  if(renderer == NULL) return NULL;
+
+  if((rt = (rthread_t *)malloc(sizeof(rthread_t))) == NULL) return NULL;
+  memset(rt, 0, sizeof(rthread_t));
+
+  rt->renderer = renderer;
+  rt->frame_func = frame_func;
+  rt->frame_arg = arg;
+  rt->running = 1;
+
+  pthread_mutex_init(&rt->mutex, NULL);
+  pthread_cond_init(&rt->cond, NULL);
+
+  renderer_set_cancel_flag(renderer, &rt->cancel);
+
+  if(pthread_create(&rt->thread, NULL, &rthread_run, rt) != 0) {
+    renderer_set_cancel_flag(renderer, NULL);
+    pthread_cond_destroy(&rt->cond);
+    pthread_mutex_destroy(&rt->mutex);
+    free(rt);
+    return NULL;
+  }
+
+  return rt;
+}
+
+/**
+ * Stop the render thread and free its buffers. The renderer and the render
+ * cache are not destroyed.
+ */
+ret_t rthread_destroy(rthread_t * rt) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  rt->running = 0;
+  rt->cancel = 1;
+  pthread_cond_broadcast(&rt->cond);
+  pthread_mutex_unlock(&rt->mutex);
+
+  pthread_join(rt->thread, NULL);
+
+  renderer_set_cancel_flag(rt->renderer, NULL);
+  pthread_cond_destroy(&rt->cond);
+  pthread_mutex_destroy(&rt->mutex);
+
+  if(rt->frame != NULL) gr_image_destroy(rt->frame);
+  if(rt->preview != NULL) gr_image_destroy(rt->preview);
+  if(rt->finished != NULL) gr_image_destroy(rt->finished);
+
+  memset(rt, 0, sizeof(rthread_t));
+  free(rt);
+  return RET_OK;
+}
+
+/** Cancel the frame in progress and wait for the thread. The caller must hold the mutex. */
+static void rthread_wait_idle(rthread_t * rt) {
+  rt->cancel = 1;
+  while(rt->busy) pthread_cond_wait(&rt->cond, &rt->mutex);
+  rt->cancel = 0;
+}
+
+/**
+ * Prevent the thread from rendering, e.g. while the logic model is modified. The 
+ * frame in progress is cancelled. Calls may be nested and may come from any thread.
+ */
+ret_t rthread_lock(rthread_t * rt) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  rt->locks++;
+  rthread_wait_idle(rt);
+  pthread_mutex_unlock(&rt->mutex);
+  return RET_OK;
+}
+
+/**
+ * Allow rendering again. A pending request is rendered after the last unlock.
+ */
+ret_t rthread_unlock(rthread_t * rt) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  assert(rt->locks > 0);
+  if(rt->locks > 0 && --rt->locks == 0) pthread_cond_broadcast(&rt->cond);
+  pthread_mutex_unlock(&rt->mutex);
+  return RET_OK;
+}
+
+/**
+ * Cancel the frame in progress and drop a pending request. The function returns, 
+ * when the thread is idle. The next frame is rendered after the next request.
+ */
+ret_t rthread_cancel(rthread_t * rt) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  rt->started_id = rt->request_id;
+  rthread_wait_idle(rt);
+  pthread_mutex_unlock(&rt->mutex);
+  return RET_OK;
+}
+
+/**
+ * Set the render cache, that is used for full resolution frames. Pass NULL, 
+ * before the cache is destroyed.
+ */
+ret_t rthread_set_render_cache(rthread_t * rt, rcache_t * rc) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  rthread_wait_idle(rt);
+  rt->render_cache = rc;
+  pthread_mutex_unlock(&rt->mutex);
+  return RET_OK;
+}
+
+/**
+ * Request rendering of a view. A frame in progress for an older request is cancelled.
+ */
+ret_t rthread_request_view(rthread_t * rt, unsigned int layer, 
+			   unsigned int width, unsigned int height,
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y) {
+  assert(rt != NULL);
+  if(rt == NULL) return RET_INV_PTR;
+  if(width == 0 || height == 0 || max_x <= min_x || max_y <= min_y) return RET_ERR;
+
+  pthread_mutex_lock(&rt->mutex);
+  rt->request.layer = layer;
+  rt->request.width = width;
+  rt->request.height = height;
+  rt->request.min_x = min_x;
+  rt->request.min_y = min_y;
+  rt->request.max_x = max_x;
+  rt->request.max_y = max_y;
+  rt->request_id++;
+  rt->cancel = 1;
+  pthread_cond_broadcast(&rt->cond);
+  pthread_mutex_unlock(&rt->mutex);
+  return RET_OK;
+}
+
+/**
+ * Copy the last finished frame. Only frames of the latest request are returned.
+ * @param is_preview Set to 1, if the frame is a preview. May be NULL.
+ * @return Returns RET_ERR, if there is no frame for the latest request or if the
+ *   size of the destination image differs.
+ */
+ret_t rthread_get_frame(rthread_t * rt, image_t * dst_img, int * is_preview) {
+  ret_t ret = RET_ERR;
+  assert(rt != NULL);
+  assert(dst_img != NULL);
+  if(rt == NULL || dst_img == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&rt->mutex);
+  if(rt->finished != NULL && rt->finished_id == rt->request_id && 
+     rt->finished->width == dst_img->width && rt->finished->height == dst_img->height) {
+    ret = gr_clone_image_data(dst_img, rt->finished);
+    if(is_preview != NULL) *is_preview = rt->finished_is_preview;
+  }
+  pthread_mutex_unlock(&rt->mutex);
+  return ret;
+}
+
+/** (Re)create a buffer, if the size changed. */
+static ret_t rthread_ensure_buffer(image_t ** img, unsigned int width, unsigned int height) {
+  if(*img != NULL && (*img)->width == width && (*img)->height == height) return RET_OK;
+  if(*img != NULL) gr_image_destroy(*img);
+  if((*img = gr_create_memory_image(width, height, IMAGE_TYPE_RGBA)) == NULL) return RET_MALLOC_FAILED;
+  return RET_OK;
+}
+
+/** Scale the preview up to the frame size by repeating pixels. */
+static void rthread_scale_up(image_t * dst_img, image_t * src_img) {
+  unsigned int x, y, last_src_y = UINT_MAX;
+  rgba_view_t dst(dst_img);
+  rgba_view_t src(src_img);
+
+  for(y = 0; y < dst.height; y++) {
+    unsigned int src_y = (unsigned long)y * src.height / dst.height;
+    uint32_t * dst_row = dst.row(y);
+
+    if(src_y == last_src_y)
+      memcpy(dst_row, dst.row(y - 1), dst.width * sizeof(uint32_t));
+    else {
+      const uint32_t * src_row = src.row(src_y);
+      for(x = 0; x < dst.width; x++) dst_row[x] = src_row[(unsigned long)x * src.width / dst.width];
+    }
+    last_src_y = src_y;
+  }
+}
+
+/**
+ * Make the frame buffer the finished frame, if the request is still the latest
+ * one, and inform the caller.
+ */
+static void rthread_publish(rthread_t * rt, unsigned long id, int is_preview) {
+  int published = 0;
+
+  pthread_mutex_lock(&rt->mutex);
+  if(id == rt->request_id && !rt->cancel &&
+     RET_IS_OK(rthread_ensure_buffer(&rt->finished, rt->frame->width, rt->frame->height))) {
+    gr_clone_image_data(rt->finished, rt->frame);
+    rt->finished_id = id;
+    rt->finished_is_preview = is_preview;
+    published = 1;
+  }
+  pthread_mutex_unlock(&rt->mutex);
+
+  if(published && rt->frame_func != NULL) (*rt->frame_func)(rt->frame_arg);
+}
+
+/**
+ * Render a view into the frame buffer. If the scaling changed, a preview is
+ * rendered first.
+ */
+static ret_t rthread_render_frame(rthread_t * rt, const rthread_view_t * view, unsigned long id) {
+  ret_t ret;
+  double scaling = (double)(view->max_x - view->min_x) / (double)view->width;
+
+  if(RET_IS_NOT_OK(ret = rthread_ensure_buffer(&rt->frame, view->width, view->height))) return ret;
+
+  // the preview is part of the frame, cancelled frames are not counted
+  renderer_begin_frame(rt->renderer);
+
+  if(scaling != rt->last_scaling &&
+     view->width >= RTHREAD_PREVIEW_FACTOR && view->height >= RTHREAD_PREVIEW_FACTOR) {
+
+    if(RET_IS_NOT_OK(ret = rthread_ensure_buffer(&rt->preview, 
+						 view->width / RTHREAD_PREVIEW_FACTOR,
+						 view->height / RTHREAD_PREVIEW_FACTOR))) return ret;
+
+    // render_region() expects, that the first render function paints the whole buffer
+    gr_map_clear(rt->preview);
+    render_region(rt->renderer, rt->preview, view->layer, 
+		  view->min_x, view->min_y, view->max_x, view->max_y);
+    if(renderer_is_cancelled(rt->renderer)) return RET_CANCEL;
+
+    rthread_scale_up(rt->frame, rt->preview);
+    rthread_publish(rt, id, 1);
+  }
+
+  if(rt->render_cache == NULL || 
+     (ret = rcache_render_region(rt->render_cache, rt->frame, view->layer, 
+				 view->min_x, view->min_y, view->max_x, view->max_y)) != RET_OK) {
+    if(ret == RET_CANCEL) return ret;
+    gr_map_clear(rt->frame);
+    render_region(rt->renderer, rt->frame, view->layer, 
+		  view->min_x, view->min_y, view->max_x, view->max_y);
+  }
+  if(renderer_is_cancelled(rt->renderer)) return RET_CANCEL;
+
+  renderer_end_frame(rt->renderer);
+  rt->last_scaling = scaling;
+  rthread_publish(rt, id, 0);
+  return RET_OK;
+}
+
+static void * rthread_run(void * arg) {
+  rthread_t * rt = (rthread_t *)arg;
+
+  pthread_mutex_lock(&rt->mutex);
+  while(rt->running) {
+
+    if(rt->started_id == rt->request_id || rt->locks > 0) {
+      pthread_cond_wait(&rt->cond, &rt->mutex);
+      continue;
+    }
+
+    rthread_view_t view = rt->request;
+    unsigned long id = rt->request_id;
+    rt->started_id = id;
+    rt->cancel = 0;
+    rt->busy = 1;
+    pthread_mutex_unlock(&rt->mutex);
+
+    ret_t ret = rthread_render_frame(rt, &view, id);
+    if(RET_IS_NOT_OK(ret) && ret != RET_CANCEL) debug(TM, "rendering a frame failed");
+
+    pthread_mutex_lock(&rt->mutex);
+    rt->busy = 0;
+    pthread_cond_broadcast(&rt->cond);
+  }
+  pthread_mutex_unlock(&rt->mutex);
+  return NULL;
+}
@@ -0,0 +1,104 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#ifndef __RENDER_THREAD_H__
+#define __RENDER_THREAD_H__
+
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "renderer.h"
+#include "render_cache.h"
+
+/**
+ * Background thread for rendering views. A view is requested with
+ * rthread_request_view() and rendered asynchronously. If the scaling changed
+ * since the last frame, a preview with 1/RTHREAD_PREVIEW_FACTOR of the resolution
+ * is rendered first, which takes the background from a higher zoom level of
+ * the scaling manager. Then the view is rendered with full resolution.
+ *
+ * Each finished frame is reported by a callback on the render thread. The
+ * callback should only notify the GUI thread, which copies the frame with
+ * rthread_get_frame(). A newer request cancels the frame in progress.
+ *
+ * Threads, that modify the logic model or the background images, must call
+ * rthread_lock() before and rthread_unlock() afterwards. No frame is rendered
+ * in between.
+ */
+
+#define RTHREAD_PREVIEW_FACTOR 4
+
+typedef void (*rthread_frame_func_t)(void * arg);
+
+typedef struct {
+  unsigned int layer;
+  unsigned int width, height;             // screen size
+  unsigned int min_x, min_y, max_x, max_y; // real coordinates
+} rthread_view_t;
+
+typedef struct render_thread {
+  renderer_t * renderer;
+  rcache_t * render_cache; // may be NULL
+
+  pthread_t thread;
+  pthread_mutex_t mutex;   // protects everything below
+  pthread_cond_t cond;
+
+  int running;             // cleared to stop the thread
+  int busy;                // a frame is rendered
+  unsigned int locks;      // number of rthread_lock() calls without rthread_unlock()
+  volatile int cancel;     // polled by the renderer
+
+  rthread_view_t request;
+  unsigned long request_id;  // incremented for each request
+  unsigned long started_id;  // the last request, the thread has taken
+
+  image_t * frame;         // buffers of the render thread
+  image_t * preview;
+  double last_scaling;     // scaling of the last full frame
+
+  image_t * finished;      // the last finished frame
+  unsigned long finished_id;
+  int finished_is_preview;
+
+  rthread_frame_func_t frame_func;
+  void * frame_arg;
+} rthread_t;
+
+rthread_t * rthread_create(renderer_t * renderer, rthread_frame_func_t frame_func, void * arg);
+ret_t rthread_destroy(rthread_t * rt);
+
+ret_t rthread_set_render_cache(rthread_t * rt, rcache_t * rc);
+
+ret_t rthread_request_view(rthread_t * rt, unsigned int layer, 
+			   unsigned int width, unsigned int height,
+			   unsigned int min_x, unsigned int min_y, 
+			   unsigned int max_x, unsigned int max_y);
+ret_t rthread_cancel(rthread_t * rt);
+
+ret_t rthread_get_frame(rthread_t * rt, image_t * dst_img, int * is_preview);
+
+ret_t rthread_lock(rthread_t * rt);
+ret_t rthread_unlock(rthread_t * rt);
+
+#endif
@@ -26,72 +26,79 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
-#include <ft2build.h>
-#include <ctype.h>
+#include <limits.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "graphics.h"
+#include "image_view.h"
+#include "blend.h"
 #include "renderer.h"
 #include "globals.h"
 #include "img_algorithms.h"
 #include "logic_model.h"
 #include "alignment_marker.h"
 #include "quadtree.h"
+#include "parallel.h"
+#include "render_export.h"
+#include "sprite_cache.h"
 //#include "font.h"
 
 // #define FONTFILE "/usr/share/fonts/truetype/freefont/FreeSans.ttf"
 #define FONT_SIZE 9
 
-#ifdef DEBUG
-//#define RENDERER_MEASURE_TIME
-#endif
-
 typedef struct {
-  renderer_t * const renderer;
+  renderer_state_t * const state;
   render_params_t * const render_params;
   image_t * dst_img;
   LM_OBJECT_TYPE object_type;
-  unsigned int min_x;  // real
-  unsigned int min_y;
-  unsigned int max_x;
-  unsigned int max_y;
+  double min_x;  // real
+  double min_y;
+  double max_x;
+  double max_y;
 } qtree_callback_params_t;
 
-ret_t recalc_steps(renderer_t * renderer,
-		   unsigned int map_min_x, unsigned int map_min_y, 
-		   unsigned int map_max_x, unsigned int map_max_y,
+/**
+ * Calculate the source coordinates for each screen column and row. The origin is
+ * the fractional source position of the upper left screen pixel.
+ */
+ret_t recalc_steps(renderer_state_t * state,
+		   double origin_x, double origin_y,
 		   double scaling_x, double scaling_y,
 		   unsigned int dst_width, unsigned int dst_height) {
 
-  if(renderer->last_screen_width != dst_width ||
-     renderer->last_screen_height != dst_height ||
-     renderer->last_map_width != map_max_x - map_min_x ||
-     renderer->last_map_height != map_max_y - map_min_y ||
-     renderer->last_rel_scaling_x != scaling_x ||
-     renderer->last_rel_scaling_y != scaling_y ) {
+  if(state->last_screen_width != dst_width ||
+     state->last_screen_height != dst_height ||
+     state->last_origin_x != origin_x ||
+     state->last_origin_y != origin_y ||
+     state->last_rel_scaling_x != scaling_x ||
+     state->last_rel_scaling_y != scaling_y ) {
 
     unsigned int i;
 
-    renderer->last_screen_width =  dst_width;
-    renderer->last_screen_height =  dst_height;
-    renderer->last_map_width = map_max_x - map_min_x;
-    renderer->last_map_height = map_max_y - map_min_y;
-    renderer->last_rel_scaling_x = scaling_x;
-    renderer->last_rel_scaling_y = scaling_y;
+    state->last_screen_width =  dst_width;
+    state->last_screen_height =  dst_height;
+    state->last_origin_x = origin_x;
+    state->last_origin_y = origin_y;
+    state->last_rel_scaling_x = scaling_x;
+    state->last_rel_scaling_y = scaling_y;
     
-    if(renderer->x_steps) free(renderer->x_steps);
-    if(renderer->y_steps) free(renderer->y_steps);
+    if(state->x_steps) free(state->x_steps);
+    if(state->y_steps) free(state->y_steps);
 
-    if((renderer->x_steps = (unsigned int *) malloc(dst_width * sizeof(unsigned int))) == NULL)
+    if((state->x_steps = (unsigned int *) malloc(dst_width * sizeof(unsigned int))) == NULL)
       return RET_MALLOC_FAILED;
 
-    if((renderer->y_steps = (unsigned int *) malloc(dst_height * sizeof(unsigned int))) == NULL) {
-      free(renderer->x_steps);
+    if((state->y_steps = (unsigned int *) malloc(dst_height * sizeof(unsigned int))) == NULL) {
+      free(state->x_steps);
       return RET_MALLOC_FAILED;
     }
 
-    for(i = 0; i < dst_width; i++) renderer->x_steps[i] = (unsigned int)(i * scaling_x);
-    for(i = 0; i < dst_height; i++) renderer->y_steps[i] = (unsigned int)(i * scaling_y);
+    for(i = 0; i < dst_width; i++) state->x_steps[i] = (unsigned int)(origin_x + i * scaling_x);
+    for(i = 0; i < dst_height; i++) state->y_steps[i] = (unsigned int)(origin_y + i * scaling_y);
 
   }
 
@@ -99,23 +106,200 @@ ret_t recalc_steps(renderer_t * renderer,
 }
 
 
+/**
+ * Choose how rows of a source image are copied to the screen. The x-steps must
+ * have been calculated with recalc_steps(). Screen pixels beyond the source
+ * image are not part of the spans and must be cleared by the caller.
+ */
+static ret_t renderer_calc_spans(renderer_state_t * state, unsigned int src_width, 
+				 unsigned int dst_width, double scaling_x) {
+  unsigned int i, width = 0;
+  const unsigned int * steps = state->x_steps;
+
+  // the steps are ascending
+  while(width < dst_width && steps[width] < src_width) width++;
+  state->blit_width = width;
+
+  unsigned int stride = width > 1 ? steps[1] - steps[0] : 1;
+  for(i = 1; i < width && stride > 0; i++) 
+    if(steps[i] != steps[0] + i * stride) stride = 0;
+
+  if(stride == 1) state->blit_mode = RENDERER_BLIT_COPY;
+  else if(stride > 1) {
+    state->blit_mode = RENDERER_BLIT_STRIDE;
+    state->blit_stride = stride;
+  }
+  else if(scaling_x < 1) {
+    state->blit_mode = RENDERER_BLIT_REPLICATE;
+
+    if(state->runs_size < width) {
+      if(state->runs) free(state->runs);
+      state->runs_size = 0;
+      if((state->runs = (renderer_run_t *)malloc(width * sizeof(renderer_run_t))) == NULL) 
+	return RET_MALLOC_FAILED;
+      state->runs_size = width;
+    }
+
+    state->num_runs = 0;
+    for(i = 0; i < width; i++) {
+      if(i > 0 && steps[i] == steps[i - 1]) state->runs[state->num_runs - 1].length++;
+      else {
+	state->runs[state->num_runs].src_x = steps[i];
+	state->runs[state->num_runs].length = 1;
+	state->num_runs++;
+      }
+    }
+  }
+  else state->blit_mode = RENDERER_BLIT_GATHER;
+
+  return RET_OK;
+}
+
+static inline void fill_span(uint32_t * dst, uint32_t pix, unsigned int length) {
+#ifdef __SSE2__
+  const __m128i v = _mm_set1_epi32(pix);
+  for(; length >= 4; length -= 4, dst += 4) _mm_storeu_si128((__m128i *)dst, v);
+#endif
+  while(length--) *dst++ = pix;
+}
+
+/**
+ * Copy every stride-th pixel of the source row.
+ */
+static void blit_stride_row(uint32_t * dst, const uint32_t * src, unsigned int width, 
+			    unsigned int stride) {
+  unsigned int x = 0;
+
+#ifdef __SSE2__
+  if(stride == 2) {
+    // take the even pixels of 8 source pixels, the last odd pixel may be beyond the row
+    for(; x + 5 <= width; x += 4) {
+      __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 2 * x)));
+      __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 2 * x + 4)));
+      _mm_storeu_si128((__m128i *)(dst + x), _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+    }
+  }
+#endif
+
+  for(; x + 4 <= width; x += 4) {
+    const uint32_t * s = src + x * stride;
+    dst[x] = s[0];
+    dst[x + 1] = s[stride];
+    dst[x + 2] = s[2 * stride];
+    dst[x + 3] = s[3 * stride];
+  }
+  for(; x < width; x++) dst[x] = src[x * stride];
+}
+
+/**
+ * Copy a source row to a screen row according to the spans calculated with
+ * renderer_calc_spans(). The rest of the screen row is cleared.
+ */
+static void blit_row(const renderer_state_t * state, uint32_t * dst, const uint32_t * src,
+		     unsigned int dst_width) {
+  unsigned int i, width = state->blit_width;
+
+  if(width > 0) {
+    switch(state->blit_mode) {
+    case RENDERER_BLIT_COPY:
+      memcpy(dst, src + state->x_steps[0], width * sizeof(uint32_t));
+      break;
+    case RENDERER_BLIT_STRIDE:
+      blit_stride_row(dst, src + state->x_steps[0], width, state->blit_stride);
+      break;
+    case RENDERER_BLIT_REPLICATE: {
+      uint32_t * d = dst;
+      for(i = 0; i < state->num_runs; i++) {
+	fill_span(d, src[state->runs[i].src_x], state->runs[i].length);
+	d += state->runs[i].length;
+      }
+      break;
+    }
+    default:
+      for(i = 0; i < width; i++) dst[i] = src[state->x_steps[i]];
+    }
+  }
+
+  if(width < dst_width) memset(dst + width, 0, (dst_width - width) * sizeof(uint32_t));
+}
+
+
+/**
+ * Create a scratch state for rendering. Each state has its own label cache.
+ */
+static renderer_state_t * renderer_state_create(const gcache_atlas_t * atlas) {
+  renderer_state_t * state = (renderer_state_t *)malloc(sizeof(renderer_state_t));
+  if(!state) return NULL;
+
+  memset(state, 0, sizeof(renderer_state_t));
+
+  if((state->labels = gcache_labels_create(atlas, RENDERER_NUM_LABELS)) == NULL) {
+    free(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+static void renderer_state_destroy(renderer_state_t * state) {
+  if(state) {
+    gcache_labels_destroy(state->labels);
+    if(state->x_steps) free(state->x_steps);
+    if(state->y_steps) free(state->y_steps);
+    if(state->runs) free(state->runs);
+    free(state);
+  }
+}
+
+/**
+ * Take an unused scratch state from the renderer. If there is none, a new
+ * state is created.
+ */
+static renderer_state_t * renderer_get_state(renderer_t * const renderer) {
+  pthread_mutex_lock(&renderer->state_mutex);
+  renderer_state_t * state = renderer->free_states;
+  if(state != NULL) renderer->free_states = state->next;
+  pthread_mutex_unlock(&renderer->state_mutex);
+
+  return state != NULL ? state : renderer_state_create(renderer->atlas);
+}
+
+/**
+ * Return a scratch state to the renderer, so that it can be reused.
+ */
+static void renderer_put_state(renderer_t * const renderer, renderer_state_t * state) {
+  pthread_mutex_lock(&renderer->state_mutex);
+  state->next = renderer->free_states;
+  renderer->free_states = state;
+  pthread_mutex_unlock(&renderer->state_mutex);
+}
+
+/** Monotonic wall clock time in ms. */
+static double renderer_time_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
 renderer_t * renderer_create() {
   renderer_t * rend = (renderer_t *)malloc(sizeof(renderer_t));
   if(!rend) return NULL;
 	
   memset(rend, 0, sizeof(renderer_t));
+  rend->parallel = 1;
 
   char font_file[PATH_MAX];
   snprintf(font_file, PATH_MAX, "%s/FreeSans.ttf", getenv("DEGATE_HOME"));
 
-  if(FT_Init_FreeType(&rend->library) ||
-     FT_New_Face(rend->library, font_file, 0, &rend->face) ||
-     FT_Set_Pixel_Sizes( rend->face, 0, FONT_SIZE)) {
+  if((rend->atlas = gcache_atlas_create(font_file, FONT_SIZE)) == NULL) {
     debug(TM, "Initializing font renderer failed");
     free(rend);
     return NULL;
   }
-  rend->slot = rend->face->glyph;
+
+  pthread_mutex_init(&rend->state_mutex, NULL);
+  pthread_mutex_init(&rend->stats_mutex, NULL);
+  rend->frame_start = renderer_time_ms();
 
   return rend;
 }
@@ -124,10 +308,136 @@ void renderer_destroy(renderer_t * const renderer) {
   if(renderer) {
     int i;
     for(i = 0; i < renderer->num; i++) if(renderer->names[i]) free(renderer->names[i]);
+
+    while(renderer->free_states != NULL) {
+      renderer_state_t * state = renderer->free_states;
+      renderer->free_states = state->next;
+      renderer_state_destroy(state);
+    }
+
+    pthread_mutex_destroy(&renderer->state_mutex);
+    pthread_mutex_destroy(&renderer->stats_mutex);
+    gcache_atlas_destroy(renderer->atlas);
     free(renderer);
   }
 }
 
+/**
+ * Enable or disable rendering of horizontal bands in parallel. Parallel
+ * rendering is enabled by default. The number of threads is taken from
+ * par_get_num_threads().
+ */
+void renderer_set_parallel(renderer_t * const renderer, int parallel) {
+  if(renderer) renderer->parallel = parallel;
+}
+
+/**
+ * Set a flag, that is polled while rendering. If the flag becomes non-zero, the
+ * remaining render functions are skipped and the rendered image is incomplete.
+ * Pass NULL to render uncancellable.
+ */
+void renderer_set_cancel_flag(renderer_t * const renderer, volatile int * cancel) {
+  if(renderer) renderer->cancel = cancel;
+}
+
+volatile int * renderer_get_cancel_flag(renderer_t * const renderer) {
+  return renderer ? renderer->cancel : NULL;
+}
+
+int renderer_is_cancelled(renderer_t * const renderer) {
+  return renderer != NULL && renderer->cancel != NULL && *renderer->cancel != 0;
+}
+
+/**
+ * Start a frame. A frame may consist of several calls to render_region(), e.g.
+ * for a preview and the tiles of the render cache. Regions, that are rendered 
+ * outside of a frame, e.g. exports, are not counted.
+ */
+void renderer_begin_frame(renderer_t * const renderer) {
+  if(renderer) {
+    pthread_mutex_lock(&renderer->stats_mutex);
+    memset(&renderer->stats, 0, sizeof(renderer_stats_t));
+    renderer->frame_start = renderer_time_ms();
+    renderer->in_frame = 1;
+    pthread_mutex_unlock(&renderer->stats_mutex);
+  }
+}
+
+/**
+ * Complete a frame. Its statistics become available by renderer_get_stats().
+ * Cancelled frames should not be completed.
+ */
+void renderer_end_frame(renderer_t * const renderer) {
+  if(renderer) {
+    pthread_mutex_lock(&renderer->stats_mutex);
+    double now = renderer_time_ms();
+    renderer->stats.frame_time = now - renderer->frame_start;
+    renderer->frame_times[renderer->num_frames % RENDERER_STATS_NUM_FRAMES] = renderer->stats.frame_time;
+    renderer->num_frames++;
+    renderer->last_stats = renderer->stats;
+    memset(&renderer->stats, 0, sizeof(renderer_stats_t));
+    renderer->frame_start = now;
+    renderer->in_frame = 0;
+    pthread_mutex_unlock(&renderer->stats_mutex);
+  }
+}
+
+/**
+ * Count tiles, that were taken from the render cache or rendered.
+ */
+void renderer_add_cache_stats(renderer_t * const renderer, unsigned long hits, unsigned long misses) {
+  if(renderer) {
+    pthread_mutex_lock(&renderer->stats_mutex);
+    if(renderer->in_frame) {
+      renderer->stats.cache_hits += hits;
+      renderer->stats.cache_misses += misses;
+    }
+    pthread_mutex_unlock(&renderer->stats_mutex);
+  }
+}
+
+static int compare_doubles(const void * a, const void * b) {
+  double d = *(const double *)a - *(const double *)b;
+  return d < 0 ? -1 : (d > 0 ? 1 : 0);
+}
+
+/**
+ * Get the statistics of the last completed frame and the median and 99th
+ * percentile of the last RENDERER_STATS_NUM_FRAMES frame times.
+ */
+ret_t renderer_get_stats(renderer_t * const renderer, renderer_stats_t * stats) {
+  double times[RENDERER_STATS_NUM_FRAMES];
+
+  assert(renderer != NULL);
+  assert(stats != NULL);
+  if(renderer == NULL || stats == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&renderer->stats_mutex);
+  *stats = renderer->last_stats;
+  stats->num_frames = MIN(renderer->num_frames, (unsigned long)RENDERER_STATS_NUM_FRAMES);
+  memcpy(times, renderer->frame_times, stats->num_frames * sizeof(double));
+  pthread_mutex_unlock(&renderer->stats_mutex);
+
+  if(stats->num_frames > 0) {
+    qsort(times, stats->num_frames, sizeof(double), &compare_doubles);
+    stats->frame_time_p50 = times[(stats->num_frames - 1) * 50 / 100];
+    stats->frame_time_p99 = times[(stats->num_frames - 1) * 99 / 100];
+  }
+  return RET_OK;
+}
+
+void renderer_reset_stats(renderer_t * const renderer) {
+  if(renderer) {
+    pthread_mutex_lock(&renderer->stats_mutex);
+    memset(&renderer->stats, 0, sizeof(renderer_stats_t));
+    memset(&renderer->last_stats, 0, sizeof(renderer_stats_t));
+    renderer->num_frames = 0;
+    renderer->frame_start = renderer_time_ms();
+    renderer->in_frame = 0;
+    pthread_mutex_unlock(&renderer->stats_mutex);
+  }
+}
+
 
 static inline uint32_t highlight_color(uint32_t col) {
   uint8_t r = MASK_R(col);
@@ -147,15 +457,6 @@ static inline uint32_t highlight_color_by_state(uint32_t col, int state) {
   return col;
 }
 
-static inline uint32_t alpha_blend(uint32_t bg_col, uint32_t new_col) {
-  uint8_t alpha = MASK_A(new_col);
-  uint8_t r = ((0xff-alpha) * MASK_R(bg_col) + alpha * MASK_R(new_col)) >> 8;
-  uint8_t g = ((0xff-alpha) * MASK_G(bg_col) + alpha * MASK_G(new_col)) >> 8;
-  uint8_t b = ((0xff-alpha) * MASK_B(bg_col) + alpha * MASK_B(new_col)) >> 8;
-
-  return MERGE_CHANNELS(r, g, b, 0xff);
-}
-
 void renderer_add_layer(renderer_t * const renderer, render_func_t function_ptr, 
 			void * data_ptr, int enabled, const char * const name) {
   if(renderer) {
@@ -196,33 +497,121 @@ int renderer_render_func_enabled(renderer_t * const renderer, int slot_pos) {
   return (renderer && slot_pos < renderer->num) ? renderer->rendering_enabled[slot_pos] : 0;
 }
 
-void render_region(RENDERER_REGION_FUNC_PARAMS) {
+/**
+ * Run all enabled render functions for a region. The cost of each function is
+ * added to the statistics of the frame, if a frame was begun.
+ */
+static void render_layers(renderer_t * const renderer, renderer_state_t * const state,
+			  image_t * dst_img, unsigned int layer,
+			  double min_x, double min_y, double max_x, double max_y) {
   int i;
-  if(!renderer) return;
-
-#ifdef RENDERER_MEASURE_TIME
-  clock_t start, finish;
-  start = clock();
-#endif
+  renderer_func_stats_t func_stats[MAX_RENDERER_LAYER];
+  memset(func_stats, 0, sizeof(func_stats));
 
   if(renderer->rendering_enabled[0] == 0) {
     // if first render func is not enabled, memset the buffer
     gr_map_clear(dst_img);
   }
-  for(i = 0; i < renderer->num; i++) {
+  for(i = 0; i < renderer->num && !renderer_is_cancelled(renderer); i++) {
     
     if(renderer->rendering_enabled[i]) {
 
-      if(!RET_IS_OK((*(renderer->funcs[i]))(renderer, dst_img, layer, min_x, min_y, max_x, max_y,
+      double start = renderer_time_ms();
+      state->objects_visited = state->objects_drawn = 0;
+
+      if(!RET_IS_OK((*(renderer->funcs[i]))(state, dst_img, layer, min_x, min_y, max_x, max_y,
 					(render_params_t *)renderer->data_ptr[i])))
 	debug(TM, "rendering failed: %s\n", renderer->names[i]);
+
+      func_stats[i].time = renderer_time_ms() - start;
+      func_stats[i].objects_visited = state->objects_visited;
+      func_stats[i].objects_drawn = state->objects_drawn;
     }
   }
 
-#ifdef RENDERER_MEASURE_TIME
-  finish = clock();
-  debug(TM, "rendering time: %f ms", 1000*(double(finish - start)/CLOCKS_PER_SEC));
-#endif
+  pthread_mutex_lock(&renderer->stats_mutex);
+  for(i = 0; i < renderer->num && renderer->in_frame; i++) {
+    renderer->stats.funcs[i].time += func_stats[i].time;
+    renderer->stats.funcs[i].objects_visited += func_stats[i].objects_visited;
+    renderer->stats.funcs[i].objects_drawn += func_stats[i].objects_drawn;
+  }
+  pthread_mutex_unlock(&renderer->stats_mutex);
+}
+
+typedef struct {
+  renderer_t * renderer;
+  image_t * dst_img;
+  unsigned int layer;
+  double min_x, min_y, max_x, max_y;
+  unsigned int band_height;
+} render_band_params_t;
+
+static ret_t render_band(unsigned int band, void * arg) {
+  render_band_params_t * params = (render_band_params_t *)arg;
+  image_t * dst_img = params->dst_img;
+
+  unsigned int from_y = band * params->band_height;
+  unsigned int to_y = MIN(from_y + params->band_height, dst_img->height);
+  double scaling_y = (params->max_y - params->min_y) / (double)dst_img->height;
+
+  // The band image is a view on the rows of the destination image. It does not own 
+  // the memory and must not be destroyed.
+  memory_map_t band_map = *dst_img->map;
+  band_map.height = to_y - from_y;
+  band_map.storage_type = MAP_STORAGE_TYPE_UNDEF;
+  band_map.mem = (uint8_t *)mm_get_ptr(dst_img->map, 0, from_y);
+  band_map.filename = NULL;
+  band_map.fd = -1;
+
+  image_t band_img = *dst_img;
+  band_img.height = to_y - from_y;
+  band_img.map = &band_map;
+
+  renderer_state_t * state = renderer_get_state(params->renderer);
+  if(state == NULL) return RET_MALLOC_FAILED;
+
+  render_layers(params->renderer, state, &band_img, params->layer,
+		params->min_x, params->min_y + from_y * scaling_y,
+		params->max_x, to_y == dst_img->height ? params->max_y : params->min_y + to_y * scaling_y);
+
+  renderer_put_state(params->renderer, state);
+  return RET_OK;
+}
+
+/**
+ * Render a region with all enabled render functions. In parallel mode the 
+ * destination image is split into horizontal bands, that are rendered with
+ * the full layer stack on the worker threads.
+ */
+void render_region(RENDERER_REGION_FUNC_PARAMS) {
+  if(!renderer || !dst_img || dst_img->height == 0) return;
+
+  // use more bands than threads, because bands differ in complexity
+  unsigned int num_bands = renderer->parallel ? 
+    MIN(2 * par_get_num_threads(), dst_img->height / RENDERER_MIN_BAND_HEIGHT) : 1;
+  if(num_bands < 1) num_bands = 1;
+
+  render_band_params_t params;
+  params.renderer = renderer;
+  params.dst_img = dst_img;
+  params.layer = layer;
+  params.min_x = min_x;
+  params.min_y = min_y;
+  params.max_x = max_x;
+  params.max_y = max_y;
+  params.band_height = (dst_img->height + num_bands - 1) / num_bands;
+  num_bands = (dst_img->height + params.band_height - 1) / params.band_height;
+
+  if(num_bands == 1) {
+    renderer_state_t * state = renderer_get_state(renderer);
+    if(state == NULL) debug(TM, "can't create render state");
+    else {
+      render_layers(renderer, state, dst_img, layer, min_x, min_y, max_x, max_y);
+      renderer_put_state(renderer, state);
+    }
+  }
+  else if(RET_IS_NOT_OK(par_run(num_bands, &render_band, &params)))
+    debug(TM, "rendering bands failed");
 }
 
 void renderer_initialize_params(render_params_t * rend) {
@@ -243,12 +632,16 @@ void renderer_initialize_params(render_params_t * rend) {
   rend->marker_color_m2_down = 0x7f20a020;
   rend->alignment_marker_size = 10;
 
+  rend->distance_to_color = 0xff52a25c;
+  rend->similarity_cache = NULL;
+  rend->lod_cache = NULL;
+  rend->sprite_cache = NULL;
+
   /*
   rend->threshold_col_separation = 110;
   rend->pin_diameter = 4;
   rend->match_horizontal_wires = TRUE;
   rend->match_vertical_wires = TRUE;	
-  rend->distance_to_color = 0xff52a25c;
   */
 
   if(rend->grid != NULL) {
@@ -270,7 +663,7 @@ ret_t render_background_old(RENDERER_FUNC_PARAMS) {
   unsigned int bg_width = bg_img->width;
   unsigned int bg_height = bg_img->height;
 
-  if(!RET_IS_OK(ret = recalc_steps(renderer, min_x, min_y, max_x, max_y,
+  if(!RET_IS_OK(ret = recalc_steps(state, min_x, min_y, max_x, max_y,
 				   dst_img->width, dst_img->height)))
     return ret;
 		
@@ -282,7 +675,7 @@ ret_t render_background_old(RENDERER_FUNC_PARAMS) {
   for(dst_y = 0; dst_y < _dst_height; dst_y++) {
     for(dst_x = 0; dst_x < _dst_width; dst_x++) {
       gr_copy_pixel_rgba(dst_img, dst_x, dst_y,
-			 bg_img, renderer->x_steps[dst_x] + min_x, renderer->y_steps[dst_y] + min_y);
+			 bg_img, state->x_steps[dst_x] + min_x, state->y_steps[dst_y] + min_y);
     }
   }
 
@@ -298,7 +691,7 @@ ret_t render_background(RENDERER_FUNC_PARAMS) {
   double scaling_y = (max_y - min_y) / (double)dst_img->height;
   image_t * bg_img = NULL;
   double bg_pre_scaling = 0;
-  unsigned int dst_x, dst_y;
+  unsigned int dst_y;
 
   //gr_map_clear(dst_img);
   //debug(TM, "scaling is %f", scaling_x);
@@ -318,26 +711,37 @@ ret_t render_background(RENDERER_FUNC_PARAMS) {
   //unsigned int bg_width = bg_img->width;
   //unsigned int bg_height = bg_img->height;
   
-  unsigned int bg_min_x = min_x / bg_pre_scaling;
-  unsigned int bg_min_y = min_y / bg_pre_scaling;
+  double bg_min_x = min_x / bg_pre_scaling;
+  double bg_min_y = min_y / bg_pre_scaling;
+
+  if(RET_IS_NOT_OK(ret = scalmgr_ensure_region(data_ptr->scaling_manager, layer, 
+					       lrint(bg_pre_scaling), bg_min_x, bg_min_y,
+					       max_x / bg_pre_scaling, max_y / bg_pre_scaling)))
+    return ret;
 
-  if(!RET_IS_OK(ret = recalc_steps(renderer, min_x, min_y, max_x, max_y,
+  if(!RET_IS_OK(ret = recalc_steps(state, bg_min_x, bg_min_y,
 				   scaling_x, scaling_y,
 				   dst_img->width, dst_img->height)))
     return ret;
 
-  unsigned int src_x, src_y;
-  for(dst_y = 0; dst_y < dst_img->height; dst_y++) {
-    src_y = bg_min_y + renderer->y_steps[dst_y];
+  rgba_view_t dst(dst_img);
+  rgba_view_t src(bg_img);
 
-    for(dst_x = 0; dst_x < dst_img->width; dst_x++) {
-      src_x = bg_min_x + renderer->x_steps[dst_x];
+  if(RET_IS_NOT_OK(ret = renderer_calc_spans(state, src.width, dst.width, scaling_x)))
+    return ret;
 
-      if(src_x < bg_img->width && src_y < bg_img->height)
-	gr_copy_pixel_rgba(dst_img, dst_x, dst_y, bg_img, src_x, src_y);
-      else
-	gr_set_pixval(dst_img, dst_x, dst_y, 0);
-    }
+  unsigned int src_y;
+  for(dst_y = 0; dst_y < dst.height; dst_y++) {
+    src_y = state->y_steps[dst_y];
+    uint32_t * dst_row = dst.row(dst_y);
+
+    if(src_y >= src.height)
+      memset(dst_row, 0, dst.width * sizeof(uint32_t));
+    else if(dst_y > 0 && src_y == state->y_steps[dst_y - 1])
+      // zoomed in: repeat the row above
+      memcpy(dst_row, dst.row(dst_y - 1), dst.width * sizeof(uint32_t));
+    else
+      blit_row(state, dst_row, src.row(src_y), dst.width);
   }
 
  
@@ -352,147 +756,211 @@ ret_t render_to_grayscale(RENDERER_FUNC_PARAMS) {
 }
 
 
-/*
+/**
+ * Render the hue distance of the background image to the reference color. The
+ * distance is taken from the similarity cache, so it is only calculated once for
+ * a reference color.
+ */
 ret_t render_color_similarity(RENDERER_FUNC_PARAMS) {
-  return imgalgo_to_color_similarity(dst_img, data_ptr->distance_to_color);
-}
-*/
+  ret_t ret;
 
-// screen coords
-ret_t draw_rectangle(image_t * dst_img, unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y, 
-		     color_t fill_color, color_t frame_color, unsigned int frame_size) {
-  unsigned int x, y,
-    x_a = min_x + frame_size, 
-    x_b = max_x > frame_size ? max_x - frame_size : 0,
-    y_a = min_y + frame_size,
-    y_b = max_y > frame_size ? max_y - frame_size : 0;
+  double scaling_x = (max_x - min_x) / (double)dst_img->width;
+  double scaling_y = (max_y - min_y) / (double)dst_img->height;
+  double bg_pre_scaling = 0;
+  unsigned int dst_x, dst_y;
+  simcache_t * sc = data_ptr->similarity_cache;
+
+  if(sc == NULL) return imgalgo_to_color_similarity(dst_img, data_ptr->distance_to_color);
 
-  if(max_x >= dst_img->width || max_y >= dst_img->height) {
-    debug(TM, "rectangle is out of image area");
+  if(scalmgr_get_image(data_ptr->scaling_manager, layer, scaling_x, &bg_pre_scaling) == NULL) 
     return RET_ERR;
-  }
 
-  
-  for(y = min_y; y < max_y; y++) {
-
-      for(x = min_x; x < max_x; x++) {
-	uint32_t pix = gr_get_pixval(dst_img, x, y);
-	color_t col = 
-	  (x < x_a || 
-	   x >= x_b || 
-	   y < y_a || 
-	   y >= y_b) ? frame_color : fill_color;
-	gr_set_pixval(dst_img, x, y, alpha_blend(pix, col));
-      }
+  scaling_x /= bg_pre_scaling;
+  scaling_y /= bg_pre_scaling;
+
+  unsigned int zoom = lrint(bg_pre_scaling);
+  double sim_min_x = min_x / bg_pre_scaling;
+  double sim_min_y = min_y / bg_pre_scaling;
+
+  if(RET_IS_NOT_OK(ret = simcache_set_color(sc, data_ptr->distance_to_color)) ||
+     RET_IS_NOT_OK(ret = simcache_ensure_region(sc, layer, zoom, sim_min_x, sim_min_y,
+						max_x / bg_pre_scaling, max_y / bg_pre_scaling)))
+    return ret;
+
+  if(!RET_IS_OK(ret = recalc_steps(state, sim_min_x, sim_min_y,
+				   scaling_x, scaling_y,
+				   dst_img->width, dst_img->height)))
+    return ret;
+
+  image_t * sim_img = simcache_get_image(sc, layer, zoom);
+  if(sim_img == NULL) return RET_ERR;
+
+  rgba_view_t dst(dst_img);
+  gs_view_t src(sim_img);
+
+  unsigned int src_x, src_y;
+  for(dst_y = 0; dst_y < dst.height; dst_y++) {
+    src_y = state->y_steps[dst_y];
+    uint32_t * dst_row = dst.row(dst_y);
+
+    if(src_y >= src.height) {
+      memset(dst_row, 0, dst.width * sizeof(uint32_t));
+      continue;
     }
+
+    const uint8_t * src_row = src.row(src_y);
+    for(dst_x = 0; dst_x < dst.width; dst_x++) {
+      src_x = state->x_steps[dst_x];
+      uint32_t v = src_x < src.width ? src_row[src_x] : 0;
+      dst_row[dst_x] = MERGE_CHANNELS(v, v, v, 0xffU);
+    }
+  }
+
+  simcache_release_image(sc, sim_img);
   return RET_OK;
 }
 
-ret_t draw_circle(image_t * dst_img, unsigned int x, unsigned int y, unsigned int diameter, 
-		  uint32_t color) {
+/**
+ * Convert a real coordinate into a screen coordinate. Screen coordinates may be
+ * negative or beyond the image size for objects, that are only partially visible.
+ */
+static inline int screen_coord(double real, double min, double scaling) {
+  return (int)floor((real - min) / scaling);
+}
 
-  unsigned int _x, _y;
-  unsigned int radius = diameter >> 1;
-  unsigned int radius2 = radius << 1;
+/**
+ * An object, that spans several bands or tiles, is only counted in the one, that
+ * contains its upper left corner.
+ */
+static inline int count_object(double corner_x, double corner_y, 
+			       double min_x, double min_y, double max_x, double max_y) {
+  return corner_x >= min_x && corner_x < max_x && corner_y >= min_y && corner_y < max_y;
+}
 
-  unsigned int x_min = x > radius ? x - radius : 0;
-  unsigned int x_max = x + radius < dst_img->width ? x + radius : dst_img->width;
-  unsigned int y_min = y > radius ? y - radius : 0;
-  unsigned int y_max = y + radius < dst_img->height ? y + radius : dst_img->height;
+// screen coords, the rectangle is clipped to the image
+ret_t draw_rectangle(image_t * dst_img, int min_x, int min_y, int max_x, int max_y, 
+		     color_t fill_color, color_t frame_color, unsigned int frame_size) {
+  int y,
+    x_a = MIN(min_x + (int)frame_size, max_x), 
+    x_b = MAX(max_x - (int)frame_size, x_a),
+    y_a = min_y + frame_size,
+    y_b = max_y - frame_size;
 
-  for(_y = y_min; _y < y_max; _y++) {
-    unsigned int dy2 = (_y > y ? _y - y : y - _y);
-    dy2 = dy2 * dy2;
+  int from_x = MAX(min_x, 0), to_x = MIN(max_x, (int)dst_img->width);
+  int from_y = MAX(min_y, 0), to_y = MIN(max_y, (int)dst_img->height);
+  if(from_x >= to_x) return RET_OK;
 
-    for(_x = x_min; _x < x_max; _x++) {
-      unsigned int dx = (_x > x ? _x - x : x - _x);
+  rgba_view_t dst(dst_img);
 
-      if(dx * dx + dy2 <= radius2) {
-	uint32_t pix = gr_get_pixval(dst_img, _x, _y);
-	gr_set_pixval(dst_img, _x, _y, alpha_blend(pix, color));
-      }
+  // each row consists of a left frame, the filling and a right frame span
+  int fill_from = MIN(MAX(x_a, from_x), to_x), fill_to = MAX(MIN(x_b, to_x), fill_from);
+
+  for(y = from_y; y < to_y; y++) {
+    uint32_t * row = dst.row(y);
+
+    if(y < y_a || y >= y_b) blend_span(row + from_x, frame_color, to_x - from_x);
+    else {
+      blend_span(row + from_x, frame_color, fill_from - from_x);
+      blend_span(row + fill_from, fill_color, fill_to - fill_from);
+      blend_span(row + fill_to, frame_color, to_x - fill_to);
     }
   }
   return RET_OK;
 }
 
+// screen coords, the circle is clipped to the image
+ret_t draw_circle(image_t * dst_img, int x, int y, unsigned int diameter, 
+		  uint32_t color) {
+
+  // the circle covers the area of the former aliased circle: dx^2 + dy^2 <= 2 * radius
+  rgba_view_t dst(dst_img);
+  blend_circle(dst, x, y, sqrt((double)((diameter >> 1) << 1)), color);
+  return RET_OK;
+}
+
 
+static inline void blend_pixel(image_t * dst_img, long long x, long long y, uint32_t color) {
+  if(x >= 0 && y >= 0 && x < (long long)dst_img->width && y < (long long)dst_img->height) {
+    uint32_t * pix = (uint32_t *)dst_img->map->mem + y * dst_img->width + x;
+    *pix = blend_alpha(*pix, color);
+  }
+}
+
+/**
+ * Draw a line with the bresenham algorithm. The end points are screen coordinates
+ * and may be outside of the image. Only the steps within the image are iterated.
+ * The error term for the first visible step is calculated directly, so the line is
+ * rasterized the same way, no matter how the screen is split into regions.
+ */
 ret_t draw_line(image_t * dst_img, 
-		unsigned int min_x, unsigned int min_y,
-		unsigned int max_x, unsigned int max_y,
+		int min_x, int min_y,
+		int max_x, int max_y,
 		unsigned int wire_diameter, uint32_t color) {
 
-  // bresenham-copy'n'paste from wikipedia
+  long long dx, dy, es, el, err, t, t_min, t_max, k, i;
+  long long fast, slow, fast_size;
+  int inc_fast, inc_slow;
+  int half = (int)(wire_diameter >> 1);
+  bool x_is_fast;
 
-  int x, y, t, dx, dy, incx, incy, pdx, pdy, ddx, ddy, es, el, err, i;
-  //unsigned int visible_x = 0, visible_y = 0;
-  uint32_t pix;
-  /* Entfernung in beiden Dimensionen berechnen */
-  dx = max_x - min_x;
-  dy = max_y - min_y;
-  
-  /* Vorzeichen des Inkrements bestimmen */
-  incx = SIGNUM(dx);
-  incy = SIGNUM(dy);
-  if(dx<0) dx = -dx;
-  if(dy<0) dy = -dy;
-  
-  /* feststellen, welche Entfernung größer ist */
-  if (dx>dy) {
-    /* x ist schnelle Richtung */
-    pdx=incx; pdy=0;    /* pd. ist Parallelschritt */
-    ddx=incx; ddy=incy; /* dd. ist Diagonalschritt */
-    es =dy;   el =dx;   /* Fehlerschritte schnell, langsam */
-  } 
+  dx = (long long)max_x - min_x;
+  dy = (long long)max_y - min_y;
+
+  // the first pixel is drawn without thickness
+  blend_pixel(dst_img, min_x, min_y, color);
+
+  x_is_fast = llabs(dx) > llabs(dy);
+  if(x_is_fast) {
+    fast = min_x; slow = min_y;
+    inc_fast = SIGNUM(dx); inc_slow = SIGNUM(dy);
+    el = llabs(dx); es = llabs(dy);
+    fast_size = dst_img->width;
+  }
   else {
-    /* y ist schnelle Richtung */
-    pdx=0;    pdy=incy; /* pd. ist Parallelschritt */
-    ddx=incx; ddy=incy; /* dd. ist Diagonalschritt */
-    es =dx;   el =dy;   /* Fehlerschritte schnell, langsam */
+    fast = min_y; slow = min_x;
+    inc_fast = SIGNUM(dy); inc_slow = SIGNUM(dx);
+    el = llabs(dy); es = llabs(dx);
+    fast_size = dst_img->height;
   }
-  
-  /* Initialisierungen vor Schleifenbeginn */
-  x = min_x;
-  y = min_y;
-  err = el/2;
-  
-  if(x>0 && y>0 && x < (int)dst_img->width && y < (int)dst_img->height) {
-    pix = gr_get_pixval(dst_img, x, y);
-    gr_set_pixval(dst_img, x, y, alpha_blend(pix, color));
+
+  if(el == 0) return RET_OK;
+
+  // steps t in 1..el, whose coordinate in fast direction is within the image
+  if(inc_fast > 0) {
+    t_min = MAX(1, -fast);
+    t_max = MIN(el, fast_size - 1 - fast);
   }
+  else {
+    t_min = MAX(1, fast - (fast_size - 1));
+    t_max = MIN(el, fast);
+  }
+  if(t_min > t_max) return RET_OK;
+
+  // state after t_min - 1 steps: err = el/2 - t * es + k * el with 0 <= err < el
+  t = t_min - 1;
+  err = el / 2 - t * es;
+  k = err < 0 ? (-err + el - 1) / el : 0;
+  err += k * el;
+  fast += t * inc_fast;
+  slow += k * inc_slow;
+
+  for(t = t_min; t <= t_max; t++) {
 
-  /* Pixel berechnen */
-  for(t=0; t<el; ++t) {/* t zaehlt die Pixel, el ist auch Anzahl */
-    
-    /* Aktualisierung Fehlerterm */
     err -= es; 
-    if(err<0) {
-      /* Fehlerterm wieder positiv (>=0) machen */
+    if(err < 0) {
       err += el;
-      /* Schritt in langsame Richtung, Diagonalschritt */
-      x += ddx;
-      y += ddy;
+      slow += inc_slow;
     } 
-    else {
-      /* Schritt in schnelle Richtung, Parallelschritt */
-      x += pdx;
-      y += pdy;
-    }
-    
-    if (dx>dy) {
-      // x schnell
-      for(i = y - (int)(wire_diameter >> 1); i < y + (int)(wire_diameter >> 1); i++)
-	if(x>0 && i>0 && x < (int)dst_img->width && i < (int)dst_img->height) {
-	  pix = gr_get_pixval(dst_img, x, i);
-	  gr_set_pixval(dst_img, x, i, alpha_blend(pix, color));
-	}
+    fast += inc_fast;
+
+    if(x_is_fast) {
+      for(i = slow - half; i < slow + half; i++) blend_pixel(dst_img, fast, i, color);
     }
     else {
-      for(i = x - (int)(wire_diameter >> 1); i < x + (int)(wire_diameter >> 1); i++)
-	if(i>0 && y>0 && i < (int)dst_img->width && y < (int)dst_img->height) {
-	  pix = gr_get_pixval(dst_img, i, y);
-	  gr_set_pixval(dst_img, i, y, alpha_blend(pix, color));
-	}
+      // the thickness of steep lines is a horizontal span
+      long long from = MAX(slow - half, 0), to = MIN(slow + half, (long long)dst_img->width);
+      if(from < to) blend_span((uint32_t *)dst_img->map->mem + fast * dst_img->width + from, 
+			       color, to - from);
     }
   }
 
@@ -500,57 +968,29 @@ ret_t draw_line(image_t * dst_img,
 }
 
 			  
-ret_t draw_string(renderer_t * renderer, render_params_t * render_params, image_t * dst_img,
-		  const char * const text, unsigned int x, unsigned int y) {
-
-  unsigned int i, _x, _y, x_offs = 0;
-
-  for(i = 0; i < strlen(text); i++) {
+// screen coords, the text is clipped to the image
+ret_t draw_string(renderer_state_t * state, render_params_t * render_params, image_t * dst_img,
+		  const char * const text, int x, int y) {
 
-    int glyph_index = FT_Get_Char_Index(renderer->face, islower(text[i]) ? toupper(text[i]) : text[i]);
-    if(FT_Load_Glyph(renderer->face, glyph_index, FT_LOAD_DEFAULT)) return RET_ERR;
-    if(FT_Render_Glyph(renderer->face->glyph, FT_RENDER_MODE_NORMAL)) return RET_ERR;
+  if(x >= (int)dst_img->width || y >= (int)dst_img->height || y + 2 * FONT_SIZE < 0) return RET_OK;
 
-    for (_x=0; _x < (unsigned)renderer->slot->bitmap.width; _x++) {
-      for (_y=0; _y < (unsigned)renderer->slot->bitmap.rows; _y++) {
+  const gcache_label_t * label = gcache_get_label(state->labels, text);
+  if(label == NULL) return RET_ERR;
 
-	unsigned int __x = x + _x + x_offs;
-	unsigned int __y = y + _y;
-
-	int byte_index = (_x + _y* renderer->slot->bitmap.pitch);
-
-	if(__x < dst_img->width && __y < dst_img->height) {
-	  unsigned char f = (renderer->slot->bitmap.buffer[byte_index]);
-	  if(f) {
-	    uint32_t col = MERGE_CHANNELS(255, 255, 255, f);
-	    uint32_t pix = gr_get_pixval(dst_img, __x, __y);
-	    gr_set_pixval(dst_img, __x, __y, alpha_blend(pix, col));
-	  }
-
-	}
-      }
-    }
-    x_offs += renderer->slot->bitmap.width + 2;
-  }
+  gcache_draw_label(dst_img, label, x, y, MERGE_CHANNELS(255, 255, 255, 0));
   return RET_OK;
 }
 
 			
-ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_t * dst_img, lmodel_gate_t * gate,
-		  unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
-
-
-  if(gate->max_x < min_x || gate->min_x > max_x ||
-     gate->max_y < min_y || gate->min_y > max_y) return RET_OK;
-
+/**
+ * Draw the frame, the filling, the template name and the ports of a gate. The upper left
+ * corner of the gate is at the screen position (x, y). Ports are positioned relative
+ * to this corner, so that a gate body looks the same wherever it is drawn.
+ */
+static ret_t draw_gate_body(renderer_state_t * state, render_params_t * render_params, image_t * dst_img,
+			    lmodel_gate_t * gate, int x, int y, int width, int height,
+			    double scaling_x, double scaling_y) {
   ret_t ret;
-  double scaling_x = (max_x - min_x) / (double)dst_img->width;
-  double scaling_y = (max_y - min_y) / (double)dst_img->height;
-
-  unsigned int screen_min_x = gate->min_x > min_x ? (unsigned int)((gate->min_x - min_x) / scaling_x) : 0;
-  unsigned int screen_min_y = gate->min_y > min_y ? (unsigned int)((gate->min_y - min_y) / scaling_y) : 0;
-  unsigned int screen_max_x = gate->max_x < max_x ? (unsigned int)((gate->max_x - min_x) / scaling_x) : dst_img->width - 1;
-  unsigned int screen_max_y = gate->max_y < max_y ? (unsigned int)((gate->max_y - min_y) / scaling_y) : dst_img->height - 1;
 
   // render filled rectangle
   color_t fill_col = gate->gate_template != NULL ? gate->gate_template->fill_color : 0;
@@ -558,26 +998,23 @@ ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_
   if(fill_col == 0) fill_col = render_params->gate_area_color;
   if(frame_col == 0) frame_col = fill_col;
 
-  draw_rectangle(dst_img, screen_min_x, screen_min_y, screen_max_x, screen_max_y, 
+  draw_rectangle(dst_img, x, y, x + width, y + height,
 		 highlight_color_by_state(fill_col, gate->is_selected), 
 		 highlight_color_by_state(frame_col, gate->is_selected),
 		 MIN(MAX(lrint(2.5 / scaling_x), 1), 3)
 		 );
 
-  if(gate->name && screen_max_x - screen_min_x > strlen(gate->name) * FONT_SIZE) {
-    draw_string(renderer, render_params, dst_img,
-		gate->name, screen_min_x + 5, screen_min_y + 2*5 + FONT_SIZE);
-  }
+  if(width < RENDERER_LOD_MIN_GATE_SIZE || height < RENDERER_LOD_MIN_GATE_SIZE) return RET_OK;
 
-  // render names for type and instance
+  // render name of the type and the ports
   if(gate->gate_template && gate->gate_template->short_name &&
-     (screen_max_x - screen_min_x > strlen(gate->gate_template->short_name) * FONT_SIZE)) {
+     (width > (int)(strlen(gate->gate_template->short_name) * FONT_SIZE))) {
 
-    draw_string(renderer, render_params, dst_img,
-		gate->gate_template->short_name, screen_min_x + 5, screen_min_y + 5 );
+    draw_string(state, render_params, dst_img,
+		gate->gate_template->short_name, x + 5, y + 5 );
       
-    unsigned int width  = gate->gate_template->master_image_max_x - gate->gate_template->master_image_min_x;
-    unsigned int height = gate->gate_template->master_image_max_y - gate->gate_template->master_image_min_y;
+    unsigned int tmpl_width  = gate->gate_template->master_image_max_x - gate->gate_template->master_image_min_x;
+    unsigned int tmpl_height = gate->gate_template->master_image_max_y - gate->gate_template->master_image_min_y;
 
     lmodel_gate_port_t * ports = gate->ports;
 
@@ -586,8 +1023,8 @@ ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_
 
       if(tmpl_port && tmpl_port->relative_x_coord != 0 && tmpl_port->relative_y_coord != 0) {
 	unsigned int 
-	  x = tmpl_port->relative_x_coord, 
-	  y = tmpl_port->relative_y_coord;
+	  port_x = tmpl_port->relative_x_coord, 
+	  port_y = tmpl_port->relative_y_coord;
 	
 	switch(gate->template_orientation) {
 	case LM_TEMPLATE_ORIENTATION_UNDEFINED:
@@ -595,26 +1032,20 @@ ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_
 	case LM_TEMPLATE_ORIENTATION_NORMAL:
 	  break;
 	case LM_TEMPLATE_ORIENTATION_FLIPPED_UP_DOWN:
-	  y = height - y;
+	  port_y = tmpl_height - port_y;
 	  break;
 	case LM_TEMPLATE_ORIENTATION_FLIPPED_LEFT_RIGHT:
-	  x = width - x;
+	  port_x = tmpl_width - port_x;
 	  break;
 	case LM_TEMPLATE_ORIENTATION_FLIPPED_BOTH:
-	  x = width - x;
-	  y = height - y;
+	  port_x = tmpl_width - port_x;
+	  port_y = tmpl_height - port_y;
 	  break;
 	}
 	
-	x += gate->min_x;
-	y += gate->min_y;
-	
-	if(gate->template_orientation != LM_TEMPLATE_ORIENTATION_UNDEFINED && 
-	   x >= min_x && x < max_x && y >= min_y && y < max_y) {
-	  x -= min_x;
-	  y -= min_y;
-	  x = (double)x / scaling_x;
-	  y = (double)y / scaling_y;
+	if(gate->template_orientation != LM_TEMPLATE_ORIENTATION_UNDEFINED) {
+	  int screen_x = x + (int)floor((double)port_x / scaling_x);
+	  int screen_y = y + (int)floor((double)port_y / scaling_y);
 	  
 	  unsigned int port_size = (double)tmpl_port->diameter / scaling_x;
 
@@ -622,14 +1053,15 @@ ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_
 	  port_color = highlight_color_by_state(port_color, ports->is_selected);
 
 	  if(RET_IS_NOT_OK(ret = draw_circle(dst_img, 
-					     x, 
-					     y, 
+					     screen_x, 
+					     screen_y, 
 					     ports->is_selected ? (port_size << 2) : port_size + 1,
 					     port_color)))
 	    return ret;
 	  
-	  if(tmpl_port->port_name && x + strlen(tmpl_port->port_name) * FONT_SIZE < screen_max_x) {
-	    draw_string(renderer, render_params, dst_img, tmpl_port->port_name, x + 5, y + 5 );
+	  if(tmpl_port->port_name && 
+	     screen_x + (int)(strlen(tmpl_port->port_name) * FONT_SIZE) < x + width) {
+	    draw_string(state, render_params, dst_img, tmpl_port->port_name, screen_x + 5, screen_y + 5 );
 	  }
 	}
       }
@@ -640,6 +1072,146 @@ ret_t render_gate(renderer_t * renderer, render_params_t * render_params, image_
   return RET_OK;
 }
 
+/**
+ * Render the body of a gate into a sprite. The body is drawn onto a black and onto a
+ * white image. The difference between both is the translucency of a pixel, the
+ * drawing on black is the premultiplied color.
+ */
+static image_t * render_gate_sprite(renderer_state_t * state, render_params_t * render_params,
+				    lmodel_gate_t * gate, int margin, int width, int height,
+				    double scaling_x, double scaling_y) {
+
+  unsigned int sprite_width = width + 2 * margin, sprite_height = height + 2 * margin;
+  image_t * black = gr_create_memory_image(sprite_width, sprite_height, IMAGE_TYPE_RGBA);
+  image_t * white = gr_create_memory_image(sprite_width, sprite_height, IMAGE_TYPE_RGBA);
+  size_t i, num_pixels = (size_t)sprite_width * sprite_height;
+
+  if(black == NULL || white == NULL) {
+    if(black != NULL) gr_image_destroy(black);
+    if(white != NULL) gr_image_destroy(white);
+    return NULL;
+  }
+
+  memset(black->map->mem, 0, num_pixels * sizeof(uint32_t));
+  memset(white->map->mem, 0xff, num_pixels * sizeof(uint32_t));
+
+  if(RET_IS_NOT_OK(draw_gate_body(state, render_params, black, gate, margin, margin, width, height,
+				  scaling_x, scaling_y)) ||
+     RET_IS_NOT_OK(draw_gate_body(state, render_params, white, gate, margin, margin, width, height,
+				  scaling_x, scaling_y))) {
+    gr_image_destroy(black);
+    gr_image_destroy(white);
+    return NULL;
+  }
+
+  uint32_t * b = (uint32_t *)black->map->mem;
+  const uint32_t * w = (const uint32_t *)white->map->mem;
+
+  for(i = 0; i < num_pixels; i++) {
+    // the background weight is the same for all channels
+    int bg_weight = ((MASK_G(w[i]) - (int)MASK_G(b[i])) * 256 + 127) / 255;
+    unsigned int alpha = MIN(256 - MAX(bg_weight, 0), 255);
+    b[i] = alpha == 0 ? 0 : MERGE_CHANNELS(MASK_R(b[i]), MASK_G(b[i]), MASK_B(b[i]), alpha);
+  }
+
+  gr_image_destroy(white);
+  return black;
+}
+
+/**
+ * Stamp the body of a gate from the sprite cache. Gates with selected ports or ports,
+ * that do not match the ports of the template, are not cached.
+ * @return Returns true, if the gate body was drawn.
+ */
+static bool render_gate_from_sprite(renderer_state_t * state, render_params_t * render_params, 
+				    image_t * dst_img, lmodel_gate_t * gate,
+				    int x, int y, int width, int height,
+				    double scaling_x, double scaling_y) {
+
+  lmodel_gate_template_t * tmpl = gate->gate_template;
+  if(render_params->sprite_cache == NULL || tmpl == NULL ||
+     width < RENDERER_LOD_MIN_GATE_SIZE || height < RENDERER_LOD_MIN_GATE_SIZE ||
+     (size_t)width * height > RENDERER_SPRITE_MAX_PIXELS) return false;
+
+  lmodel_gate_port_t * port;
+  lmodel_gate_template_port_t * tmpl_port;
+  unsigned int num_ports = 0, num_tmpl_ports = 0, max_port_size = 0;
+
+  for(port = gate->ports; port != NULL; port = port->next) {
+    if(port->is_selected || port->tmpl_port == NULL) return false;
+    num_ports++;
+  }
+  for(tmpl_port = tmpl->ports; tmpl_port != NULL; tmpl_port = tmpl_port->next) {
+    max_port_size = MAX(max_port_size, (unsigned int)((double)tmpl_port->diameter / scaling_x));
+    num_tmpl_ports++;
+  }
+  if(num_ports != num_tmpl_ports) return false;
+
+  spcache_key_t key;
+  memset(&key, 0, sizeof(spcache_key_t));
+  key.tmpl = tmpl;
+  key.orientation = gate->template_orientation;
+  key.select_state = gate->is_selected;
+  key.width = width;
+  key.height = height;
+  key.scaling_x = scaling_x;
+  key.scaling_y = scaling_y;
+  key.gate_area_color = render_params->gate_area_color;
+  key.port_color = render_params->il_down_color;
+
+  unsigned long version;
+  spcache_sprite_t * sprite = spcache_get(render_params->sprite_cache, &key, &version);
+
+  if(sprite == NULL) {
+    // port circles and names may exceed the gate
+    int margin = RENDERER_SPRITE_MARGIN + (int)ceil(sqrt((double)max_port_size + 1));
+    image_t * img = render_gate_sprite(state, render_params, gate, margin, width, height,
+				       scaling_x, scaling_y);
+    if(img == NULL) return false;
+    if((sprite = spcache_insert(render_params->sprite_cache, &key, version, img, margin, margin)) == NULL)
+      return false;
+  }
+
+  spcache_blit(dst_img, sprite, x, y);
+  spcache_release(render_params->sprite_cache, sprite);
+  return true;
+}
+
+ret_t render_gate(renderer_state_t * state, render_params_t * render_params, image_t * dst_img, lmodel_gate_t * gate,
+		  double min_x, double min_y, double max_x, double max_y) {
+
+  // ports of selected gates are drawn beyond the gate's bounding box
+  if(gate->max_x + RENDERER_OVERDRAW_REAL < min_x || gate->min_x > max_x + RENDERER_OVERDRAW_REAL ||
+     gate->max_y + RENDERER_OVERDRAW_REAL < min_y || gate->min_y > max_y + RENDERER_OVERDRAW_REAL) return RET_OK;
+
+  if(count_object(gate->min_x, gate->min_y, min_x, min_y, max_x, max_y)) state->objects_drawn++;
+  ret_t ret;
+  double scaling_x = (max_x - min_x) / (double)dst_img->width;
+  double scaling_y = (max_y - min_y) / (double)dst_img->height;
+
+  int screen_min_x = screen_coord(gate->min_x, min_x, scaling_x);
+  int screen_min_y = screen_coord(gate->min_y, min_y, scaling_y);
+  int screen_max_x = screen_coord(gate->max_x, min_x, scaling_x);
+  int screen_max_y = screen_coord(gate->max_y, min_y, scaling_y);
+  int width = screen_max_x - screen_min_x, height = screen_max_y - screen_min_y;
+
+  if(!render_gate_from_sprite(state, render_params, dst_img, gate, screen_min_x, screen_min_y, 
+			      width, height, scaling_x, scaling_y) &&
+     RET_IS_NOT_OK(ret = draw_gate_body(state, render_params, dst_img, gate, screen_min_x, screen_min_y,
+					width, height, scaling_x, scaling_y)))
+    return ret;
+
+  if(width < RENDERER_LOD_MIN_GATE_SIZE || height < RENDERER_LOD_MIN_GATE_SIZE) return RET_OK;
+
+  // render the name of the instance
+  if(gate->name && width > (int)(strlen(gate->name) * FONT_SIZE)) {
+    draw_string(state, render_params, dst_img,
+		gate->name, screen_min_x + 5, screen_min_y + 2*5 + FONT_SIZE);
+  }
+
+  return RET_OK;
+}
+
 
 bool liang_barsky_clip_test( double nDenom, double nNumerator, double * io_rTE, double * io_rTL ) {
   double t;
@@ -709,69 +1281,72 @@ bool liang_barsky_clipping( double from_x,
 }
 
 
-ret_t render_wire(renderer_t * renderer, render_params_t * render_params, image_t * dst_img, lmodel_wire_t * wire,
-		  unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+ret_t render_wire(renderer_state_t * state, render_params_t * render_params, image_t * dst_img, lmodel_wire_t * wire,
+		  double min_x, double min_y, double max_x, double max_y) {
+
+  double scaling_x = (max_x - min_x) / (double)dst_img->width;
+  double scaling_y = (max_y - min_y) / (double)dst_img->height;
+
+  double dia = (double)wire->diameter / scaling_x;
+  if(dia <= 1) return RET_OK;
 
-  double clipped_from_x = (double)wire->from_x - (double)min_x;
-  double clipped_from_y = (double)wire->from_y - (double)min_y;
-  double clipped_to_x = (double)wire->to_x -  (double)min_x;
-  double clipped_to_y = (double)wire->to_y - (double)min_y;
+  double clipped_from_x = (double)wire->from_x - min_x;
+  double clipped_from_y = (double)wire->from_y - min_y;
+  double clipped_to_x = (double)wire->to_x - min_x;
+  double clipped_to_y = (double)wire->to_y - min_y;
 
+  // check, if the wire touches the region enlarged by the wire's radius
+  double margin_x = wire->diameter / 2.0 + scaling_x;
+  double margin_y = wire->diameter / 2.0 + scaling_y;
 
   if(liang_barsky_clipping(clipped_from_x, 
 			   clipped_from_y,
 			   clipped_to_x,
 			   clipped_to_y,
-			   0, 0, max_x - min_x, max_y - min_y,
+			   -margin_x, -margin_y, max_x - min_x + margin_x, max_y - min_y + margin_y,
 			   &clipped_from_x, 
 			   &clipped_from_y,
 			   &clipped_to_x,
 			   &clipped_to_y)) {
 
-    double scaling_x = (max_x - min_x) / (double)dst_img->width;
-    double scaling_y = (max_y - min_y) / (double)dst_img->height;
-
-    double dia = (double)wire->diameter / scaling_x;
-    if(dia > 1) {
-      clipped_from_x /= scaling_x;
-      clipped_from_y /= scaling_y;
-      clipped_to_x /= scaling_x;
-      clipped_to_y /= scaling_y;
-
-      draw_line(dst_img, 
-		clipped_from_x,
-		clipped_from_y,
-		clipped_to_x,
-		clipped_to_y,
-		dia,  highlight_color_by_state(render_params->wire_color, wire->is_selected));
-     
-      if(wire->is_selected && wire->name && 
-	 wire->from_x > min_x && wire->from_x < max_x &&
-	 wire->from_y > min_y && wire->from_y < max_y ) {
-
-	draw_string(renderer, render_params, dst_img,
-		    wire->name, clipped_from_x + 5, clipped_from_y + 5 );
-      }
-    }
+    if(count_object(MIN(wire->from_x, wire->to_x), MIN(wire->from_y, wire->to_y),
+		    min_x, min_y, max_x, max_y)) state->objects_drawn++;
+
+    // draw_line() clips by itself, the end points must not be moved
+    draw_line(dst_img, 
+	      screen_coord(wire->from_x, min_x, scaling_x),
+	      screen_coord(wire->from_y, min_y, scaling_y),
+	      screen_coord(wire->to_x, min_x, scaling_x),
+	      screen_coord(wire->to_y, min_y, scaling_y),
+	      dia,  highlight_color_by_state(render_params->wire_color, wire->is_selected));
+  }
 
+  if(wire->is_selected && wire->name) {
+    draw_string(state, render_params, dst_img, wire->name, 
+		screen_coord(wire->from_x, min_x, scaling_x) + 5, 
+		screen_coord(wire->from_y, min_y, scaling_y) + 5);
   }
 
   return RET_OK;
 }
 
-ret_t render_via(renderer_t * renderer, render_params_t * render_params, image_t * dst_img, lmodel_via_t * via,
-		 unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+ret_t render_via(renderer_state_t * state, render_params_t * render_params, image_t * dst_img, lmodel_via_t * via,
+		 double min_x, double min_y, double max_x, double max_y) {
 
-  if(via->x > min_x && via->x < max_x &&
-     via->y > min_y && via->y < max_y) {
+  // highlighted vias are drawn with a radius of twice the diameter
+  if(via->x + 2 * via->diameter >= min_x && via->x < max_x + 2 * via->diameter &&
+     via->y + 2 * via->diameter >= min_y && via->y < max_y + 2 * via->diameter) {
 
     double scaling_x = (max_x - min_x) / (double)dst_img->width;
     double diameter_on_screen = (double)(via->diameter) / scaling_x;
 
     if(diameter_on_screen > 1) {
+      if(count_object(via->x - via->diameter / 2.0, via->y - via->diameter / 2.0,
+		      min_x, min_y, max_x, max_y)) state->objects_drawn++;
+
       double scaling_y = (max_y - min_y) / (double)dst_img->height;
-      unsigned int screen_x = via->x > min_x ? (unsigned int)((via->x - min_x) / scaling_x) : 0;
-      unsigned int screen_y = via->y > min_y ? (unsigned int)((via->y - min_y) / scaling_y) : 0;
+      int screen_x = screen_coord(via->x, min_x, scaling_x);
+      int screen_y = screen_coord(via->y, min_y, scaling_y);
       
       unsigned int via_size = (double)via->diameter / scaling_x;
 
@@ -795,25 +1370,34 @@ ret_t cb_render_object(quadtree_t * qtree, qtree_callback_params_t * data_ptr) {
   ret_t ret;
 
   while(object != NULL) {
+
     switch(object->object_type) {
     case LM_TYPE_GATE:
       if(data_ptr->object_type == LM_TYPE_GATE) { // are we interested in rendering this?
 	lmodel_gate_t * gate = (lmodel_gate_t *) (object->object);
-	if(RET_IS_NOT_OK(ret = render_gate(data_ptr->renderer, data_ptr->render_params, data_ptr->dst_img, gate,
+	if(count_object(gate->min_x, gate->min_y, data_ptr->min_x, data_ptr->min_y, 
+			data_ptr->max_x, data_ptr->max_y)) data_ptr->state->objects_visited++;
+	if(RET_IS_NOT_OK(ret = render_gate(data_ptr->state, data_ptr->render_params, data_ptr->dst_img, gate,
 					   data_ptr->min_x, data_ptr->min_y, data_ptr->max_x, data_ptr->max_y))) return ret;
       }
       break;
     case LM_TYPE_WIRE:
       if(data_ptr->object_type == LM_TYPE_WIRE) { // are we interested in rendering this?
 	lmodel_wire_t * wire = (lmodel_wire_t *) (object->object);
-	if(RET_IS_NOT_OK(ret = render_wire(data_ptr->renderer, data_ptr->render_params, data_ptr->dst_img, wire,
+	if(count_object(MIN(wire->from_x, wire->to_x), MIN(wire->from_y, wire->to_y), 
+			data_ptr->min_x, data_ptr->min_y, data_ptr->max_x, data_ptr->max_y))
+	  data_ptr->state->objects_visited++;
+	if(RET_IS_NOT_OK(ret = render_wire(data_ptr->state, data_ptr->render_params, data_ptr->dst_img, wire,
 					   data_ptr->min_x, data_ptr->min_y, data_ptr->max_x, data_ptr->max_y))) return ret;
       }
       break;
     case LM_TYPE_VIA:
       if(data_ptr->object_type == LM_TYPE_VIA) { // are we interested in rendering this?
 	lmodel_via_t * via = (lmodel_via_t *) (object->object);
-	if(RET_IS_NOT_OK(ret = render_via(data_ptr->renderer, data_ptr->render_params, data_ptr->dst_img, via,
+	if(count_object(via->x - via->diameter / 2.0, via->y - via->diameter / 2.0, 
+			data_ptr->min_x, data_ptr->min_y, data_ptr->max_x, data_ptr->max_y))
+	  data_ptr->state->objects_visited++;
+	if(RET_IS_NOT_OK(ret = render_via(data_ptr->state, data_ptr->render_params, data_ptr->dst_img, via,
 					  data_ptr->min_x, data_ptr->min_y, data_ptr->max_x, data_ptr->max_y))) return ret;
       }
       break;
@@ -828,6 +1412,94 @@ ret_t cb_render_object(quadtree_t * qtree, qtree_callback_params_t * data_ptr) {
 }
 
 
+static inline uint32_t lod_blend(uint32_t bg_col, uint32_t pix) {
+  unsigned int inv_alpha = 0xff - MASK_A(pix);
+  return MERGE_CHANNELS((((inv_alpha * MASK_R(bg_col)) >> 8) + MASK_R(pix)),
+			(((inv_alpha * MASK_G(bg_col)) >> 8) + MASK_G(pix)),
+			(((inv_alpha * MASK_B(bg_col)) >> 8) + MASK_B(pix)), 0xffU);
+}
+
+/**
+ * Draw the coarse raster of a layer instead of the objects, if a screen pixel covers
+ * at least one cell of the raster. The level, whose cells match the scaling best, is
+ * chosen. Selected objects are not part of the raster. They are drawn over it.
+ * @return Returns true, if the raster was drawn. Otherwise the objects must be drawn.
+ */
+static bool render_lod_raster(renderer_state_t * state, render_params_t * render_params, 
+			      image_t * dst_img, unsigned int layer, LODCACHE_CLASS cls,
+			      double min_x, double min_y, double max_x, double max_y) {
+
+  if(render_params->lod_cache == NULL || min_x < 0 || min_y < 0) return false;
+
+  double scaling_x = (max_x - min_x) / (double)dst_img->width;
+  double scaling_y = (max_y - min_y) / (double)dst_img->height;
+  double scaling = MIN(scaling_x, scaling_y);
+  unsigned int cell_size = lodcache_get_cell_size(render_params->lmodel);
+  unsigned int level = 0, x, y, i;
+
+  if(cell_size == 0 || scaling < cell_size) return false;
+  while(level + 1 < LODCACHE_NUM_LEVELS && (double)(cell_size << (level + 1)) <= scaling) level++;
+  cell_size <<= level;
+
+  lodcache_colors_t colors = { render_params->gate_area_color, render_params->wire_color,
+			       render_params->il_up_color, render_params->il_down_color };
+  lodcache_raster_t * raster = lodcache_get_raster(render_params->lod_cache, render_params->lmodel, 
+						   layer, cls, &colors);
+  if(raster == NULL) return false;
+
+  // sample the cell under the center of each screen pixel
+  if(RET_IS_NOT_OK(recalc_steps(state, 
+				(min_x + 0.5 * scaling_x) / cell_size, (min_y + 0.5 * scaling_y) / cell_size,
+				scaling_x / cell_size, scaling_y / cell_size,
+				dst_img->width, dst_img->height))) {
+    lodcache_release(render_params->lod_cache, raster);
+    return false;
+  }
+
+  rgba_view_t src(raster->levels[level]);
+  rgba_view_t dst(dst_img);
+
+  for(y = 0; y < dst.height && state->y_steps[y] < src.height; y++) {
+    const uint32_t * src_row = src.row(state->y_steps[y]);
+    uint32_t * dst_row = dst.row(y);
+
+    for(x = 0; x < dst.width && state->x_steps[x] < src.width; x++) {
+      uint32_t pix = src_row[state->x_steps[x]];
+      if(MASK_A(pix) != 0) dst_row[x] = lod_blend(dst_row[x], pix);
+    }
+  }
+
+  for(i = 0; i < raster->num_selected; i++) {
+    void * obj_ptr = raster->selected[i];
+    if(cls == LODCACHE_CLASS_GATES)
+      render_gate(state, render_params, dst_img, (lmodel_gate_t *)obj_ptr, min_x, min_y, max_x, max_y);
+    else if(cls == LODCACHE_CLASS_WIRES)
+      render_wire(state, render_params, dst_img, (lmodel_wire_t *)obj_ptr, min_x, min_y, max_x, max_y);
+    else
+      render_via(state, render_params, dst_img, (lmodel_via_t *)obj_ptr, min_x, min_y, max_x, max_y);
+  }
+
+  lodcache_release(render_params->lod_cache, raster);
+  return true;
+}
+
+/**
+ * Get the region of the quadtree, that has to be searched for objects. It is the
+ * rendered region enlarged by the overdraw margin.
+ */
+static void get_search_region(image_t * dst_img, double min_x, double min_y, double max_x, double max_y,
+			      unsigned int * s_min_x, unsigned int * s_min_y, 
+			      unsigned int * s_max_x, unsigned int * s_max_y) {
+
+  double margin_x = RENDERER_OVERDRAW_SCREEN * (max_x - min_x) / (double)dst_img->width + RENDERER_OVERDRAW_REAL;
+  double margin_y = RENDERER_OVERDRAW_SCREEN * (max_y - min_y) / (double)dst_img->height + RENDERER_OVERDRAW_REAL;
+
+  *s_min_x = min_x > margin_x ? (unsigned int)floor(min_x - margin_x) : 0;
+  *s_min_y = min_y > margin_y ? (unsigned int)floor(min_y - margin_y) : 0;
+  *s_max_x = (unsigned int)ceil(max_x + margin_x);
+  *s_max_y = (unsigned int)ceil(max_y + margin_y);
+}
+
 ret_t render_gates(RENDERER_FUNC_PARAMS) {
   int l = -1;
 
@@ -839,11 +1511,15 @@ ret_t render_gates(RENDERER_FUNC_PARAMS) {
     l = lmodel_get_layer_num_by_type(data_ptr->lmodel, LM_LAYER_TYPE_LOGIC);
   }
 
-  if(l != -1) {
-    qtree_callback_params_t params = {renderer, data_ptr, dst_img, LM_TYPE_GATE, min_x, min_y, max_x, max_y};
+  if(l != -1 && 
+     !render_lod_raster(state, data_ptr, dst_img, l, LODCACHE_CLASS_GATES, min_x, min_y, max_x, max_y)) {
+    unsigned int s_min_x, s_min_y, s_max_x, s_max_y;
+    qtree_callback_params_t params = {state, data_ptr, dst_img, LM_TYPE_GATE, min_x, min_y, max_x, max_y};
     quadtree_traverse_func_t cb_func = (quadtree_traverse_func_t) &cb_render_object;
+    get_search_region(dst_img, min_x, min_y, max_x, max_y, &s_min_x, &s_min_y, &s_max_x, &s_max_y);
     //quadtree_traverse_downto_bbox(data_ptr->lmodel->root[l], min_x, min_y,max_x, max_y, cb_func, &params);
-    quadtree_traverse_complete_within_region(data_ptr->lmodel->root[l], min_x, min_y,max_x, max_y, cb_func, &params);
+    quadtree_traverse_complete_within_region(data_ptr->lmodel->root[l], s_min_x, s_min_y, s_max_x, s_max_y, 
+					     cb_func, &params);
   }
   return RET_OK;
 }
@@ -851,49 +1527,50 @@ ret_t render_gates(RENDERER_FUNC_PARAMS) {
 
 ret_t render_wires(RENDERER_FUNC_PARAMS) {
 
-  qtree_callback_params_t params = {renderer, data_ptr, dst_img, LM_TYPE_WIRE, min_x, min_y, max_x, max_y};
+  if(render_lod_raster(state, data_ptr, dst_img, layer, LODCACHE_CLASS_WIRES, min_x, min_y, max_x, max_y))
+    return RET_OK;
+
+  unsigned int s_min_x, s_min_y, s_max_x, s_max_y;
+  qtree_callback_params_t params = {state, data_ptr, dst_img, LM_TYPE_WIRE, min_x, min_y, max_x, max_y};
   quadtree_traverse_func_t cb_func = (quadtree_traverse_func_t) &cb_render_object;
-  quadtree_traverse_complete_within_region(data_ptr->lmodel->root[layer], min_x, min_y,max_x, max_y, cb_func, &params);
+  get_search_region(dst_img, min_x, min_y, max_x, max_y, &s_min_x, &s_min_y, &s_max_x, &s_max_y);
+  quadtree_traverse_complete_within_region(data_ptr->lmodel->root[layer], s_min_x, s_min_y, s_max_x, s_max_y, 
+					   cb_func, &params);
 
   return RET_OK;
 }
 
 ret_t render_vias(RENDERER_FUNC_PARAMS) {
 
-  qtree_callback_params_t params = {renderer, data_ptr, dst_img, LM_TYPE_VIA, min_x, min_y, max_x, max_y};
+  if(render_lod_raster(state, data_ptr, dst_img, layer, LODCACHE_CLASS_VIAS, min_x, min_y, max_x, max_y))
+    return RET_OK;
+
+  unsigned int s_min_x, s_min_y, s_max_x, s_max_y;
+  qtree_callback_params_t params = {state, data_ptr, dst_img, LM_TYPE_VIA, min_x, min_y, max_x, max_y};
   quadtree_traverse_func_t cb_func = (quadtree_traverse_func_t) &cb_render_object;
-  quadtree_traverse_complete_within_region(data_ptr->lmodel->root[layer], min_x, min_y,max_x, max_y, cb_func, &params);
+  get_search_region(dst_img, min_x, min_y, max_x, max_y, &s_min_x, &s_min_y, &s_max_x, &s_max_y);
+  quadtree_traverse_complete_within_region(data_ptr->lmodel->root[layer], s_min_x, s_min_y, s_max_x, s_max_y, 
+					   cb_func, &params);
 
   return RET_OK;
 }
 
-void renderer_draw_marker(image_t * dst_img, 
-			  unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y,
-			  unsigned int screen_x, unsigned int screen_y,
+void renderer_draw_marker(image_t * dst_img, int screen_x, int screen_y,
 			  uint32_t marker_color, unsigned int marker_size) {
 
-  unsigned int y, x;
-  unsigned int marker_radius = marker_size >> 1;
+  int marker_radius = marker_size >> 1;
+  rgba_view_t dst(dst_img);
 
-  for(y = screen_y > marker_radius ? screen_y - marker_radius : 0 ; 
-      y < MIN(screen_y + marker_radius, dst_img->height); y++) {
+  blend_rect(dst, screen_x - marker_radius, screen_y - marker_radius, 
+	     screen_x + marker_radius, screen_y + marker_radius, marker_color);
 
-      for(x = screen_x > marker_radius ? screen_x - marker_radius : 0 ; 
-	  x < MIN(screen_x + marker_radius, dst_img->width); x++) {
-	uint32_t pix = gr_get_pixval(dst_img, x, y);
-	gr_set_pixval(dst_img, x, y, alpha_blend(pix, marker_color));
-      }
-    }
-  
 }
 
 #define RENDER_ALIGNMENT_MARKER(m_type, m_var, m_col, alignment_marker_size) \
   alignment_marker * m_var = amset_get_marker(data_ptr->alignment_marker_set, layer, m_type); \
-  if(m_var && \
-     m_var->x > min_x && m_var->x < max_x && \
-     m_var->y > min_y && m_var->y < max_y) \
-    renderer_draw_marker(dst_img, min_x, min_y, max_x, max_y, \
-			 (m_var->x - min_x) / scaling_x, (m_var->y - min_y) / scaling_y, \
+  if(m_var) \
+    renderer_draw_marker(dst_img, \
+			 screen_coord(m_var->x, min_x, scaling_x), screen_coord(m_var->y, min_y, scaling_y), \
 			 m_col, alignment_marker_size);
 
 ret_t render_alignment_markers(RENDERER_FUNC_PARAMS) {
@@ -922,33 +1599,23 @@ ret_t render_regular_grid(RENDERER_FUNC_PARAMS) {
 
   if(grid->dist_x < 1 || grid->dist_y < 1) return RET_OK;
 
-  unsigned int screen_offs_x;
-  unsigned int screen_offs_y;
+  // first grid lines within the region
+  double n_x = grid->offset_x >= min_x ? 0 : ceil((min_x - grid->offset_x) / grid->dist_x);
+  double n_y = grid->offset_y >= min_y ? 0 : ceil((min_y - grid->offset_y) / grid->dist_y);
 
-  if(grid->offset_y >= min_y)
-    screen_offs_y = (unsigned int) ((grid->offset_y - min_y)/ scaling_y);
-  else {
-    int n = (int)((min_y - grid->offset_y) / grid->dist_y);
-    screen_offs_y = (unsigned int) ((grid->dist_y - (min_y - grid->offset_y - n * grid->dist_y))/ scaling_y);
-  }
-
-  if(grid->offset_x >= min_x)
-    screen_offs_x = (unsigned int) ((grid->offset_x - min_x)/ scaling_x);
-  else {
-    int n = (int)((min_x - grid->offset_x) / grid->dist_x);
-    screen_offs_x = (unsigned int) ((grid->dist_x - (min_x - grid->offset_x - n * grid->dist_x))/ scaling_x);
-  }
+  double screen_offs_x = (grid->offset_x + n_x * grid->dist_x - min_x) / scaling_x;
+  double screen_offs_y = (grid->offset_y + n_y * grid->dist_y - min_y) / scaling_y;
 
   if(grid->vertical_lines_enabled && scaling_x > 0 && grid->dist_x / scaling_x >= 2) {
-    for(dbl_dst_x = screen_offs_x; dbl_dst_x < dst_img->width - 1; dbl_dst_x += (grid->dist_x / scaling_x)) {
-      dst_x =  lrint(dbl_dst_x);
+    for(dbl_dst_x = screen_offs_x; dbl_dst_x < dst_img->width; dbl_dst_x += (grid->dist_x / scaling_x)) {
+      dst_x = (unsigned int)dbl_dst_x;
       vline(dst_img, dst_x, 0, data_ptr->grid_color);
     }
   }
   
   if(grid->horizontal_lines_enabled && scaling_y > 0 && grid->dist_y / scaling_y >= 2) {
-    for(dbl_dst_y = screen_offs_y; dbl_dst_y < dst_img->height - 1; dbl_dst_y += (grid->dist_y / scaling_y)) {
-      dst_y =  lrint(dbl_dst_y);
+    for(dbl_dst_y = screen_offs_y; dbl_dst_y < dst_img->height; dbl_dst_y += (grid->dist_y / scaling_y)) {
+      dst_y = (unsigned int)dbl_dst_y;
       hline(dst_img, 0, dst_y, data_ptr->grid_color);
     }
   }
@@ -968,7 +1635,7 @@ ret_t render_unregular_grid(RENDERER_FUNC_PARAMS) {
   if(grid->uhg_enabled == 1) {
     for(i = 0; i < grid->num_uhg_entries; i++) {
       unsigned int offset = grid->uhg_offsets[i];
-      if(offset >= min_y && offset <= max_y) {
+      if(offset >= min_y && offset < max_y) {
 	unsigned int dst_y = (double)(offset - min_y) / scaling_y;
 	hline(dst_img, 0, dst_y, data_ptr->grid_color);
       }
@@ -979,7 +1646,7 @@ ret_t render_unregular_grid(RENDERER_FUNC_PARAMS) {
   if(grid->uvg_enabled == 1) {
     for(i = 0; i < grid->num_uvg_entries; i++) {
       unsigned int offset = grid->uvg_offsets[i];
-      if(offset >= min_x && offset <= max_x) {
+      if(offset >= min_x && offset < max_x) {
 	unsigned int dst_x = (double)(offset - min_x) / scaling_x;
 	vline(dst_img, dst_x, 0, data_ptr->grid_color);
       }
@@ -993,10 +1660,10 @@ ret_t render_grid(RENDERER_FUNC_PARAMS) {
   if(data_ptr->grid != NULL) {
     switch(data_ptr->grid->grid_mode) {
     case USE_REGULAR_GRID:
-      return render_regular_grid(renderer, dst_img, layer, min_x, min_y, max_x, max_y, data_ptr); 
+      return render_regular_grid(state, dst_img, layer, min_x, min_y, max_x, max_y, data_ptr); 
       break;
     case USE_UNREGULAR_GRID:
-      return render_unregular_grid(renderer, dst_img, layer, min_x, min_y, max_x, max_y, data_ptr);
+      return render_unregular_grid(state, dst_img, layer, min_x, min_y, max_x, max_y, data_ptr);
       break;
     default:
       return RET_ERR;
@@ -1006,70 +1673,35 @@ ret_t render_grid(RENDERER_FUNC_PARAMS) {
 }
 
 void vline(image_t * img, unsigned int x, unsigned int y, uint32_t col) {
-  unsigned int _y;
-  for(_y = y; _y < img->height; _y++) {
-    uint32_t pix = gr_get_pixval(img, x, _y);
-    gr_set_pixval(img, x, _y, alpha_blend(pix, col));
-  }
+  if(x >= img->width || y >= img->height) return;
+  rgba_view_t dst(img);
+  blend_column(dst.ptr(x, y), dst.width, col, dst.height - y);
 }
 
 void hline(image_t * img, unsigned int x, unsigned int y, uint32_t col) {
-  unsigned int _x;
-  for(_x = x; _x < img->width; _x++) {
-    uint32_t pix = gr_get_pixval(img, _x, y);
-    gr_set_pixval(img, _x, y, alpha_blend(pix, col));
-  }	
+  if(x >= img->width || y >= img->height) return;
+  rgba_view_t dst(img);
+  blend_span(dst.ptr(x, y), col, dst.width - x);
 }
 
 /*
  */
+/**
+ * Write an RGBA image as binary PPM.
+ */
 ret_t renderer_write_image(image_t * img, const char * const filename) {
+  ret_t ret;
 
-#define PIXELS_IN_BUFFER 1000
-
-  int fd;
-  uint8_t tmp[3*PIXELS_IN_BUFFER];
-  char tmp2[100];
-  unsigned int x, y, i = 1;
-  uint8_t * ptr_dst = tmp;
-
-  fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
-  if(fd == -1) return RET_ERR;
-
-  snprintf(tmp2, sizeof(tmp2), "P6\n%d %d\n255\n", img->width, img->height);
-  if(write(fd, tmp2, strlen(tmp2)) != (ssize_t)strlen(tmp2)) {
-    close(fd);
-    return RET_ERR;
-  }
-
-  ptr_dst = tmp;
-
-  for(y = 0; y < img->height; y++)
-    for(x = 0; x < img->width; x++, i++) {
-
-      uint32_t pix = gr_get_pixval(img, x, y);
+  assert(img != NULL);
+  assert(filename != NULL);
+  if(img == NULL || filename == NULL) return RET_INV_PTR;
 
-      *ptr_dst++ = MASK_R(pix);
-      *ptr_dst++ = MASK_G(pix);
-      *ptr_dst++ = MASK_B(pix);
+  rexport_writer_t * writer = rexport_writer_create(REXPORT_FORMAT_PPM, filename, img->width, img->height);
+  if(writer == NULL) return RET_ERR;
 
-      if(i % PIXELS_IN_BUFFER == 0) {
-	if(write(fd, tmp, sizeof(tmp)) != sizeof(tmp)) {
-	  close(fd);
-	  return RET_ERR;
-	}
-	ptr_dst = tmp;
-      }
-    }
+  if(RET_IS_OK(ret = rexport_writer_add_rows(writer, img, img->height)))
+    ret = rexport_writer_finish(writer);
 
-  if(img->width * img->height % PIXELS_IN_BUFFER > 0) {
-    ssize_t s = 3*((img->width * img->height) % PIXELS_IN_BUFFER);
-    if(write(fd, tmp, s) != s) { 
-      close(fd);
-      return RET_ERR;
-    }
-  }
-  
-  close(fd);
-  return RET_OK;
+  ret_t ret2 = rexport_writer_destroy(writer);
+  return RET_IS_OK(ret) ? ret2 : ret;
 }
@@ -22,8 +22,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #ifndef __RENDERER_H__
 #define __RENDERER_H__
 
-#include <ft2build.h>
-#include FT_FREETYPE_H
+#include <pthread.h>
 
 #include "globals.h"
 #include "logic_model.h"
@@ -31,10 +30,15 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include "grid.h"
 #include "alignment_marker.h"
 #include "scaling_manager.h"
+#include "similarity_cache.h"
+#include "glyph_cache.h"
+#include "lod_cache.h"
+#include "sprite_cache.h"
 
 // Todo: should rendering params and renderer data structures be merged?
 
 typedef struct renderer renderer_t;
+typedef struct renderer_state renderer_state_t;
 
 // rendering params
 struct render_params {
@@ -59,58 +63,183 @@ struct render_params {
 
   unsigned int alignment_marker_size;
 
+  // reference color for the color similarity view
+  uint32_t distance_to_color;
+  simcache_t * similarity_cache;
+
+  // coarse rasters of the logic model for zoomed out views, may be NULL
+  lodcache_t * lod_cache;
+
+  // pre-rendered gates, may be NULL
+  spcache_t * sprite_cache;
+
   // for image algorithms
   /*  unsigned int threshold_col_separation;
   unsigned int pin_diameter;
   int match_horizontal_wires;
-  int match_vertical_wires;
-
-  uint32_t distance_to_color; */
+  int match_vertical_wires; */
 };
 
 typedef struct render_params render_params_t;
 
 
+/**
+ * The region is given in real coordinates. The coordinates may be fractional, so that
+ * a view can be rendered in pieces (e.g. tiles), that exactly line up.
+ */
 #define RENDERER_REGION_FUNC_PARAMS \
   renderer_t * const renderer,	    \
   image_t * dst_img,		    \
   unsigned int layer, \
-  unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y
+  double min_x, double min_y, double max_x, double max_y
 
+/**
+ * Render functions get the scratch state of the thread, that renders the
+ * region, instead of the renderer.
+ */
 #define RENDERER_FUNC_PARAMS \
-  RENDERER_REGION_FUNC_PARAMS, render_params_t * data_ptr
+  renderer_state_t * const state,   \
+  image_t * dst_img,		    \
+  unsigned int layer, \
+  double min_x, double min_y, double max_x, double max_y, \
+  render_params_t * data_ptr
 
-typedef int (*render_func_t)(renderer_t * const renderer,
+typedef int (*render_func_t)(renderer_state_t * const state,
 			     image_t *, 
 			     unsigned int, // layer
-			     unsigned int, // min_x
-			     unsigned int, // max_y
-			     unsigned int, // max_x
-			     unsigned int, // max_y
+			     double, // min_x
+			     double, // max_y
+			     double, // max_x
+			     double, // max_y
 			     render_params_t *);
 
 #define MAX_RENDERER_LAYER 30
 
-struct renderer {
-  render_func_t funcs[MAX_RENDERER_LAYER];
-  void * data_ptr[MAX_RENDERER_LAYER];
-  int rendering_enabled[MAX_RENDERER_LAYER];
-  char * names[MAX_RENDERER_LAYER];
+/**
+ * Objects may be drawn beyond their bounding boxes, e.g. labels or highlighted
+ * vias and ports. These are the maximum distances in screen pixels and in real
+ * pixels, objects are drawn beyond their bounding boxes. Objects within this margin
+ * around a region are rendered, too.
+ */
+#define RENDERER_OVERDRAW_SCREEN 128
+#define RENDERER_OVERDRAW_REAL 64
+
+/**
+ * Minimal height of a band in screen pixels. render_region() splits the destination
+ * image into horizontal bands, that are rendered in parallel.
+ */
+#define RENDERER_MIN_BAND_HEIGHT 32
+
+enum RENDERER_BLIT_MODE {
+  RENDERER_BLIT_COPY = 0,      // source pixels are contiguous
+  RENDERER_BLIT_STRIDE = 1,    // integer zoom out: every n-th source pixel
+  RENDERER_BLIT_REPLICATE = 2, // zoom in: source pixels are repeated
+  RENDERER_BLIT_GATHER = 3     // anything else
+};
+
+/** A source pixel, that is repeated on the screen. */
+typedef struct {
+  unsigned int src_x;
+  unsigned int length;
+} renderer_run_t;
+
+/**
+ * Gates, that are smaller on the screen than this number of pixels, are drawn
+ * without names and ports.
+ */
+#define RENDERER_LOD_MIN_GATE_SIZE 16
+
+/**
+ * Gates, that are larger on the screen than this number of pixels, are drawn
+ * directly instead of being stamped from the sprite cache. Sprites have a margin
+ * of screen pixels around the gate for port names.
+ */
+#define RENDERER_SPRITE_MAX_PIXELS (512 * 512)
+#define RENDERER_SPRITE_MARGIN 32
+
+/** Number of frames, the frame time percentiles are computed from. */
+#define RENDERER_STATS_NUM_FRAMES 128
+
+/** 
+ * Cost of a render function, summed over all bands and regions of a frame. Objects
+ * are counted in the band or tile, that contains their upper left corner. Objects,
+ * that span several bands or tiles, are counted once, objects, that start outside
+ * of the rendered area, are not counted.
+ */
+typedef struct {
+  double time;                    // ms, summed over all threads
+  unsigned long objects_visited;  // objects of the quadtree, that were looked at
+  unsigned long objects_drawn;    // objects, that were within the region
+} renderer_func_stats_t;
+
+/** Statistics of the last frame, see renderer_get_stats(). */
+typedef struct {
+  renderer_func_stats_t funcs[MAX_RENDERER_LAYER]; // indexed like the render functions
+  unsigned long cache_hits, cache_misses;          // tiles of the render cache
+  double frame_time;                               // ms, wall clock
+  double frame_time_p50, frame_time_p99;           // ms, over the last frames
+  unsigned int num_frames;                         // number of frames in the percentiles
+} renderer_stats_t;
 
-  // for font rendering
-  FT_Library library;
-  FT_Face face;
-  FT_GlyphSlot slot;
+/** Number of label slots in the label cache of each renderer state. */
+#define RENDERER_NUM_LABELS 1024
+
+/**
+ * Scratch state for rendering a region. Label caches and the step arrays must
+ * not be shared between threads, so each thread that renders a band takes its
+ * own state from the renderer.
+ */
+struct renderer_state {
+
+  // laid out strings for font rendering
+  gcache_labels_t * labels;
 
   // x/y-positions are only stored to check, if we have to recalculate the step-arrays
   unsigned int last_screen_width, last_screen_height;
-  unsigned int last_map_width, last_map_height;
+  double last_origin_x, last_origin_y;
   double last_rel_scaling_x, last_rel_scaling_y;
 
   unsigned int * x_steps, * y_steps;
-  
+
+  // how a row of the background image is copied, see renderer_calc_spans()
+  RENDERER_BLIT_MODE blit_mode;
+  unsigned int blit_width;  // number of screen pixels, that are within the source image
+  unsigned int blit_stride; // source pixels per screen pixel for RENDERER_BLIT_STRIDE
+  renderer_run_t * runs;    // runs of repeated source pixels for RENDERER_BLIT_REPLICATE
+  unsigned int num_runs, runs_size;
+
+  // counted by the object render functions
+  unsigned long objects_visited, objects_drawn;
+
+  renderer_state_t * next; // next unused state
+};
+
+struct renderer {
+  render_func_t funcs[MAX_RENDERER_LAYER];
+  void * data_ptr[MAX_RENDERER_LAYER];
+  int rendering_enabled[MAX_RENDERER_LAYER];
+  char * names[MAX_RENDERER_LAYER];
 
   int num; // number of rendering layers
+
+  int parallel; // render bands in parallel
+
+  volatile int * cancel; // if set and non-zero, rendering is aborted
+
+  gcache_atlas_t * atlas; // glyphs for font rendering
+
+  // unused scratch states
+  pthread_mutex_t state_mutex;
+  renderer_state_t * free_states;
+
+  // statistics
+  pthread_mutex_t stats_mutex;
+  renderer_stats_t stats;       // frame in progress
+  renderer_stats_t last_stats;  // last completed frame
+  int in_frame;                 // regions are only counted between begin and end of a frame
+  double frame_start;
+  double frame_times[RENDERER_STATS_NUM_FRAMES]; // ring buffer
+  unsigned long num_frames;
 };
 
 renderer_t * renderer_create();
@@ -119,6 +248,17 @@ void renderer_add_layer(renderer_t * const renderer, render_func_t function_ptr,
 			int enabled, const char * const name);
 void renderer_remove_last_layer(renderer_t * const renderer);
 
+void renderer_set_parallel(renderer_t * const renderer, int parallel);
+void renderer_set_cancel_flag(renderer_t * const renderer, volatile int * cancel);
+volatile int * renderer_get_cancel_flag(renderer_t * const renderer);
+int renderer_is_cancelled(renderer_t * const renderer);
+
+void renderer_begin_frame(renderer_t * const renderer);
+void renderer_end_frame(renderer_t * const renderer);
+void renderer_add_cache_stats(renderer_t * const renderer, unsigned long hits, unsigned long misses);
+ret_t renderer_get_stats(renderer_t * const renderer, renderer_stats_t * stats);
+void renderer_reset_stats(renderer_t * const renderer);
+
 void renderer_toggle_render_func(renderer_t * const renderer, int slot_pos);
 int renderer_get_num_render_func(renderer_t * const renderer);
 char * renderer_get_name_render_func(renderer_t * const renderer, int slot_pos);
@@ -0,0 +1,319 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "residency_manager.h"
+
+#ifdef __APPLE__
+typedef char mincore_vec_t;
+#else
+typedef unsigned char mincore_vec_t;
+#endif
+
+typedef struct {
+  memory_map_t * map;
+  unsigned long last_access; // value of the access clock
+} resmgr_entry_t;
+
+/* Protects the entries and the access clock. It is only held for short times, because
+   maps are touched while rendering. */
+static pthread_mutex_t resmgr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Held while the residency of maps is checked. Maps are not unregistered meanwhile,
+   so they stay mapped. Lock order: check_mutex, then resmgr_mutex. */
+static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static resmgr_entry_t * entries = NULL;
+static unsigned int num_entries = 0, max_entries = 0;
+
+static unsigned long access_clock = 0;
+static unsigned long access_clock_at_last_check = 0;
+
+static int check_thread_started = 0;
+
+/* Budget in bytes. 0 means: no limit. -1 means: not determined yet. */
+static size_t budget = (size_t)-1;
+
+/**
+ * Set the budget for resident data of file backed maps in bytes. 0 disables the
+ * budget. The default is taken from the environment variable DEGATE_MEMORY_BUDGET,
+ * that specifies the budget in MB.
+ */
+void resmgr_set_budget(size_t bytes) {
+  pthread_mutex_lock(&resmgr_mutex);
+  budget = bytes;
+  pthread_mutex_unlock(&resmgr_mutex);
+}
+
+static size_t resmgr_get_budget_locked() {
+  if(budget == (size_t)-1) {
+    char * env = getenv("DEGATE_MEMORY_BUDGET");
+    budget = env != NULL ? (size_t)atol(env) << 20 : 0;
+  }
+  return budget;
+}
+
+/**
+ * Get the budget for resident data in bytes.
+ */
+size_t resmgr_get_budget() {
+  pthread_mutex_lock(&resmgr_mutex);
+  size_t b = resmgr_get_budget_locked();
+  pthread_mutex_unlock(&resmgr_mutex);
+  return b;
+}
+
+static int resmgr_find(memory_map_t * map) {
+  unsigned int i;
+  for(i = 0; i < num_entries; i++)
+    if(entries[i].map == map) return i;
+  return -1;
+}
+
+/**
+ * Check the budget periodically. The thread runs as long as the process.
+ */
+static void * resmgr_check_thread(void * arg) {
+  while(1) {
+    sleep(RESMGR_CHECK_INTERVAL);
+    resmgr_enforce_budget();
+  }
+  return NULL;
+}
+
+/**
+ * Register a file backed map. Registering a map twice has no effect. The first
+ * registration starts the thread, that checks the budget.
+ */
+ret_t resmgr_register(memory_map_t * map) {
+  assert(map != NULL);
+  if(map == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&resmgr_mutex);
+
+  if(resmgr_find(map) == -1) {
+    if(num_entries == max_entries) {
+      unsigned int n = max_entries == 0 ? 32 : 2 * max_entries;
+      resmgr_entry_t * e = (resmgr_entry_t *)realloc(entries, n * sizeof(resmgr_entry_t));
+      if(e == NULL) {
+	pthread_mutex_unlock(&resmgr_mutex);
+	return RET_MALLOC_FAILED;
+      }
+      entries = e;
+      max_entries = n;
+    }
+    entries[num_entries].map = map;
+    entries[num_entries].last_access = ++access_clock;
+    num_entries++;
+  }
+
+  if(!check_thread_started) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, &resmgr_check_thread, NULL) == 0) check_thread_started = 1;
+    else debug(TM, "can't start the residency check thread");
+    pthread_attr_destroy(&attr);
+  }
+
+  pthread_mutex_unlock(&resmgr_mutex);
+  return RET_OK;
+}
+
+/**
+ * Remove a map from the residency manager. This must happen before the map is
+ * unmapped. A running check of the budget is finished first.
+ */
+ret_t resmgr_unregister(memory_map_t * map) {
+  assert(map != NULL);
+  if(map == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&check_mutex);
+  pthread_mutex_lock(&resmgr_mutex);
+  int i = resmgr_find(map);
+  if(i != -1) entries[i] = entries[--num_entries];
+  pthread_mutex_unlock(&resmgr_mutex);
+  pthread_mutex_unlock(&check_mutex);
+  return RET_OK;
+}
+
+static int resmgr_cmp_last_access(const void * a, const void * b) {
+  unsigned long la = ((const resmgr_entry_t *)a)->last_access;
+  unsigned long lb = ((const resmgr_entry_t *)b)->last_access;
+  return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+/**
+ * Count the bytes of a map, that are resident in RAM.
+ */
+static size_t resmgr_get_resident_size_of_map(memory_map_t * map) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t num_pages = (map->filesize + page_size - 1) / page_size;
+  size_t i, resident = 0;
+
+  if(map->mem == NULL || num_pages == 0) return 0;
+
+  mincore_vec_t * vec = (mincore_vec_t *)malloc(num_pages);
+  if(vec == NULL) return map->filesize;
+
+  if(mincore(map->mem, map->filesize, vec) == -1) {
+    free(vec);
+    return map->filesize;
+  }
+
+  for(i = 0; i < num_pages; i++)
+    if(vec[i] & 1) resident += page_size;
+
+  free(vec);
+  return resident;
+}
+
+/**
+ * Write back the data of a map and release its pages.
+ */
+static ret_t resmgr_evict(memory_map_t * map) {
+  ret_t ret = RET_OK;
+
+  if(msync(map->mem, map->filesize, MS_SYNC) == -1) {
+    debug(TM, "msync() failed");
+    return RET_ERR;
+  }
+
+  if(madvise(map->mem, map->filesize, MADV_DONTNEED) == -1) {
+    debug(TM, "madvise() failed");
+    ret = RET_ERR;
+  }
+
+#ifdef POSIX_FADV_DONTNEED
+  // drop the pages from the page cache, too
+  posix_fadvise(map->fd, 0, map->filesize, POSIX_FADV_DONTNEED);
+#endif
+  return ret;
+}
+
+/**
+ * Copy the entries, so that maps can be checked without holding the lock, that
+ * resmgr_touch() needs. The caller must hold check_mutex and free the copy.
+ */
+static resmgr_entry_t * resmgr_copy_entries(unsigned int * num, size_t * b) {
+  pthread_mutex_lock(&resmgr_mutex);
+  *b = resmgr_get_budget_locked();
+  *num = num_entries;
+  resmgr_entry_t * copy = (resmgr_entry_t *)malloc((num_entries + 1) * sizeof(resmgr_entry_t));
+  if(copy != NULL) memcpy(copy, entries, num_entries * sizeof(resmgr_entry_t));
+  pthread_mutex_unlock(&resmgr_mutex);
+  return copy;
+}
+
+static size_t resmgr_get_resident_size_of_entries(const resmgr_entry_t * e, unsigned int num) {
+  unsigned int i;
+  size_t resident = 0;
+  for(i = 0; i < num; i++) resident += resmgr_get_resident_size_of_map(e[i].map);
+  return resident;
+}
+
+/**
+ * Get the number of bytes of all registered maps, that are resident in RAM.
+ */
+size_t resmgr_get_resident_size() {
+  unsigned int num;
+  size_t b, resident = 0;
+
+  pthread_mutex_lock(&check_mutex);
+  resmgr_entry_t * copy = resmgr_copy_entries(&num, &b);
+  if(copy != NULL) {
+    resident = resmgr_get_resident_size_of_entries(copy, num);
+    free(copy);
+  }
+  pthread_mutex_unlock(&check_mutex);
+  return resident;
+}
+
+/**
+ * Check the resident size of all registered maps and evict the least recently
+ * used maps, until the resident size is within the budget. This is done 
+ * periodically in the background, too.
+ */
+ret_t resmgr_enforce_budget() {
+  ret_t ret = RET_OK;
+  unsigned int i, num;
+  size_t b;
+
+  pthread_mutex_lock(&check_mutex);
+
+  resmgr_entry_t * copy = resmgr_copy_entries(&num, &b);
+  if(copy == NULL) {
+    pthread_mutex_unlock(&check_mutex);
+    return RET_MALLOC_FAILED;
+  }
+
+  pthread_mutex_lock(&resmgr_mutex);
+  unsigned long clock_at_last_check = access_clock_at_last_check;
+  access_clock_at_last_check = access_clock;
+  pthread_mutex_unlock(&resmgr_mutex);
+
+  if(b > 0 && num > 0) {
+
+    size_t resident = resmgr_get_resident_size_of_entries(copy, num);
+
+    if(resident > b) {
+      qsort(copy, num, sizeof(resmgr_entry_t), &resmgr_cmp_last_access);
+
+      // maps, that were accessed since the last check, are in use and are not evicted
+      for(i = 0; i < num && resident > b && copy[i].last_access <= clock_at_last_check; i++) {
+
+	size_t size = resmgr_get_resident_size_of_map(copy[i].map);
+	if(size == 0) continue;
+
+	debug(TM, "evicting %s (%ld KB)", copy[i].map->filename, size >> 10);
+	if(RET_IS_NOT_OK(resmgr_evict(copy[i].map))) ret = RET_ERR;
+	resident -= size;
+      }
+    }
+  }
+
+  free(copy);
+  pthread_mutex_unlock(&check_mutex);
+  return ret;
+}
+
+/**
+ * Record an access to a map. The budget is checked in the background, so this
+ * is cheap enough to be called while rendering.
+ */
+void resmgr_touch(memory_map_t * map) {
+  assert(map != NULL);
+  if(map == NULL) return;
+
+  pthread_mutex_lock(&resmgr_mutex);
+  int i = resmgr_find(map);
+  if(i != -1) entries[i].last_access = ++access_clock;
+  pthread_mutex_unlock(&resmgr_mutex);
+}
@@ -0,0 +1,53 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __RESIDENCY_MANAGER_H__
+#define __RESIDENCY_MANAGER_H__
+
+#include <stddef.h>
+#include "globals.h"
+#include "memory_map.h"
+
+/**
+ * The residency manager keeps track of file backed memory maps and limits the
+ * amount of their data, that is resident in RAM. If the resident data exceeds the
+ * budget, the least recently used maps are written back and their pages are
+ * released with madvise(MADV_DONTNEED). The mapping itself is kept, so pointers
+ * into the map stay valid and pages are read back from file on the next access.
+ * The budget is checked by a background thread.
+ */
+
+/** Time in seconds between two checks of the budget. */
+#define RESMGR_CHECK_INTERVAL 2
+
+void resmgr_set_budget(size_t bytes);
+size_t resmgr_get_budget();
+
+ret_t resmgr_register(memory_map_t * map);
+ret_t resmgr_unregister(memory_map_t * map);
+
+void resmgr_touch(memory_map_t * map);
+
+size_t resmgr_get_resident_size();
+ret_t resmgr_enforce_budget();
+
+#endif
@@ -19,6 +19,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
                                                                                 
 */
 
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,8 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 
 #include "scaling_manager.h"
+#include "parallel.h"
+#include "residency_manager.h"
 
 /**
  * The scaling manager maintains a set of precalculated scaled images. The
@@ -39,6 +42,15 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
  * mechanical disc, seeking to noncached blocks increases io load. The precalulated
  * scaled images can also be used by template matching to increase performance.
  *
+ * Scaled images are calculated lazily. Each zoom level is divided into tiles of
+ * SCALMGR_TILE_SIZE x SCALMGR_TILE_SIZE pixels. A tile is calculated from the
+ * previous zoom level with a 2x2 box filter, when it is requested the first time
+ * via scalmgr_ensure_region(). The information, which tiles are valid, is stored
+ * in a file scaled_layer_<layer>.<zoom>.valid with one byte per tile next to the
+ * image data.
+ *
+ * The zoom levels are kept in a dense table, indexed by layer and level. Level l
+ * is scaled down by 2^l. Level 0 describes the background image itself.
  */
 
 /**
@@ -59,23 +71,69 @@ scaling_manager_t * scalmgr_create(int num_layers, image_t ** bg_images,
   }
   memset(ptr, 0, sizeof(scaling_manager_t));
 
+  if((ptr->layer_versions = (unsigned long *)calloc(num_layers, sizeof(unsigned long))) == NULL) {
+    free(ptr);
+    return NULL;
+  }
+
   ptr->num_layers = num_layers;
   ptr->bg_images = bg_images;
   ptr->project_dir = strdup(project_dir);
+  pthread_mutex_init(&ptr->tile_mutex, NULL);
+  pthread_mutex_init(&ptr->prefetch_mutex, NULL);
+  pthread_cond_init(&ptr->prefetch_cond, NULL);
 
   return ptr;
 }
 
+ret_t scalmgr_destroy_scalings(scaling_manager_t * sm);
+
+/**
+ * Stop the prefetch thread and wait for a prefetch, that is running. Requests, that
+ * were not started yet, are dropped. The next call of scalmgr_prefetch_region() 
+ * restarts the thread. Level images must not be freed or replaced, while the thread 
+ * is running.
+ */
+static void scalmgr_stop_prefetching(scaling_manager_t * sm) {
+  pthread_mutex_lock(&sm->prefetch_mutex);
+  int running = sm->prefetch_thread_running;
+  if(running) {
+    sm->prefetch_quit = 1;
+    pthread_cond_signal(&sm->prefetch_cond);
+  }
+  pthread_mutex_unlock(&sm->prefetch_mutex);
+
+  if(running) {
+    pthread_join(sm->prefetch_thread, NULL);
+
+    pthread_mutex_lock(&sm->prefetch_mutex);
+    sm->prefetch_thread_running = 0;
+    sm->prefetch_quit = 0;
+    sm->prefetch_pending = 0;
+    pthread_mutex_unlock(&sm->prefetch_mutex);
+  }
+}
+
 /**
  * The function destroyes a scling manager object. It does not destroy the 
  * original background images. But it destroys images, that were handled by the
  * scaling manager.
  */
 ret_t scalmgr_destroy(scaling_manager_t * sm) {
+  ret_t ret;
   assert(sm != NULL);
   if(sm == NULL) return RET_INV_PTR;
 
+  scalmgr_stop_prefetching(sm);
+
+  if(RET_IS_NOT_OK(ret = scalmgr_destroy_scalings(sm))) return ret;
+  if(sm->levels != NULL) free(sm->levels);
+  if(sm->layer_versions != NULL) free(sm->layer_versions);
+
   if(sm->project_dir != NULL) free(sm->project_dir);
+  pthread_mutex_destroy(&sm->tile_mutex);
+  pthread_mutex_destroy(&sm->prefetch_mutex);
+  pthread_cond_destroy(&sm->prefetch_cond);
 
   memset(sm, 0, sizeof(scaling_manager_t));
   free(sm);
@@ -95,10 +153,81 @@ unsigned int get_nearest_power_of_two(unsigned int value) {
   }
 }
 
+/**
+ * Get the level number for a zoom out factor, that is a power of two.
+ */
+static unsigned int scalmgr_zoom_to_level(unsigned int zoom) {
+  unsigned int level = 0;
+  while(zoom > 1) {
+    zoom >>= 1;
+    level++;
+  }
+  return level;
+}
+
+/**
+ * Get the number of levels per layer including level 0, the background image.
+ */
+unsigned int scalmgr_get_num_levels(scaling_manager_t * sm) {
+  assert(sm != NULL);
+  return sm != NULL ? sm->num_levels : 0;
+}
+
+/**
+ * Get the table entry for a layer and level. The entry describes the zoom level
+ * even if the image is not loaded.
+ * @return NULL if there is no such level
+ */
+scalmgr_level_t * scalmgr_get_level(scaling_manager_t * sm, unsigned int layer, unsigned int level) {
+  assert(sm != NULL);
+  if(sm == NULL || sm->levels == NULL) return NULL;
+  if(layer >= sm->num_layers || level >= sm->num_levels) return NULL;
+  return &sm->levels[layer * sm->num_levels + level];
+}
+
+/**
+ * Update the residency state of a table entry from its image mapping.
+ */
+static void scalmgr_update_level_state(scalmgr_level_t * l) {
+  if(l->image == NULL) {
+    l->storage_type = MAP_STORAGE_TYPE_UNDEF;
+    l->residency = SCALMGR_LEVEL_NOT_LOADED;
+  }
+  else {
+    l->storage_type = l->image->map->storage_type;
+    l->residency = l->image->map->mem != NULL ? SCALMGR_LEVEL_RESIDENT : SCALMGR_LEVEL_UNMAPPED;
+  }
+}
+
+/**
+ * Get the table entry for a layer and zoom out factor and record the access.
+ */
+static scalmgr_level_t * scalmgr_touch_level(scaling_manager_t * sm, unsigned int layer, 
+					     unsigned int zoom) {
+  scalmgr_level_t * l = scalmgr_get_level(sm, layer, scalmgr_zoom_to_level(zoom));
+  if(l != NULL) {
+    l->last_access = __sync_add_and_fetch(&sm->access_clock, 1);
+    scalmgr_update_level_state(l);
+    if(l->residency == SCALMGR_LEVEL_RESIDENT) resmgr_touch(l->image->map);
+  }
+  return l;
+}
+
+
+/**
+ * Get the zoom out factor of the level, that is used for a scaling.
+ */
+static unsigned int scalmgr_get_zoom_for_scaling(scaling_manager_t * sm, double scaling) {
+  if(scaling <= 1 || sm->zoom_out_factor < 2) return 1;
+
+  unsigned int factor = get_nearest_power_of_two(lrint(scaling));
+  return factor > sm->zoom_out_factor ? sm->zoom_out_factor : factor;
+}
 
 /**
  * Get a pointer to an image, that is scaled up or scaled down by a factor near to 
- * a given scaling factor.
+ * a given scaling factor. The image data is calculated lazily. Use 
+ * scalmgr_ensure_region() to make sure, that a region of the image is valid.
  */
 image_t * scalmgr_get_image(scaling_manager_t * sm, unsigned int layer, double scaling, 
 			    double * scaling_found) {
@@ -107,196 +236,138 @@ image_t * scalmgr_get_image(scaling_manager_t * sm, unsigned int layer, double s
   assert(layer < sm->num_layers);
   if(sm == NULL || scaling_found == NULL || layer >= sm->num_layers) return NULL;
   
-  unsigned int factor;
-  
-  if(scaling > 1 && sm->zoom_out_images != NULL){
-    image_list_t * ptr = sm->zoom_out_images;
-
-    factor = get_nearest_power_of_two(lrint(scaling));
-    if(factor > sm->zoom_out_factor) factor = sm->zoom_out_factor;
+  if(scaling > 1 && sm->zoom_out_factor >= 2) {
 
-    while(ptr != NULL) {
-      if(ptr->layer == layer && ptr->zoom == factor) {
-	*scaling_found = factor;
-	return ptr->image;
-      }
-      ptr = ptr->next;
+    unsigned int factor = scalmgr_get_zoom_for_scaling(sm, scaling);
+    scalmgr_level_t * l = scalmgr_touch_level(sm, layer, factor);
+    if(l != NULL && l->image != NULL) {
+      *scaling_found = factor;
+      return l->image;
     }
   }
 
   //debug(TM, "return normal image");
   assert(sm->bg_images[layer] != NULL);
+  scalmgr_touch_level(sm, layer, 1);
   *scaling_found = 1;
   return sm->bg_images[layer];
 }
 
-image_list_t * scalmgr_create_list(unsigned int layer, unsigned int zoom, image_t * image) {
-  image_list_t * ptr = NULL;
-  if((ptr = (image_list_t *)malloc(sizeof(image_list_t))) == NULL) return NULL;
-
-  memset(ptr, 0, sizeof(image_list_t));
-
-  ptr->layer = layer;
-  ptr->zoom = zoom;
-  ptr->image = image;
-  return ptr;
-}
-
-ret_t scalmgr_destroy_image_list(image_list_t * list) {
-  assert(list != NULL);
-  if(list == NULL) return RET_INV_PTR;
-  ret_t ret;
-  image_list_t * ptr = list, * ptr_next = NULL;
-  while(ptr != NULL) {
-
-    if(RET_IS_NOT_OK(ret = gr_image_destroy(ptr->image))) return ret;
-    ptr_next = ptr->next;
-    memset(ptr, 0, sizeof(image_list_t));
-    free(ptr);
-    ptr = ptr->next;
-  }
-  return RET_OK;
-}
-
+/**
+ * Destroy the scaled images of all layers. The level table itself is kept.
+ * Background prefetching is stopped first.
+ */
 ret_t scalmgr_destroy_scalings(scaling_manager_t * sm) {
   ret_t ret;
+  unsigned int i;
   assert(sm != NULL);
   if(sm == NULL) return RET_INV_PTR;
+  if(sm->levels == NULL) return RET_OK;
 
-  
-  if(sm->zoom_out_factor >= 2) {
-    if(sm->zoom_out_images != NULL && 
-       RET_IS_NOT_OK(ret = scalmgr_destroy_image_list(sm->zoom_out_images))) return ret;
-    sm->zoom_out_images = NULL;
-  }
+  scalmgr_stop_prefetching(sm);
 
-  return RET_OK;
-}
+  for(i = 0; i < sm->num_layers * sm->num_levels; i++) {
+    scalmgr_level_t * l = &sm->levels[i];
+    if(l->zoom < 2) continue;
 
-image_list_t * scalmgr_get_list_elem(image_list_t * img_list, 
-				     unsigned int zoom_factor, unsigned int layer) {
-  image_list_t * ptr = img_list;
-
-  while(ptr != NULL) {
-    if(ptr->zoom == zoom_factor && ptr->layer == layer) return ptr;
-    ptr = ptr->next;
+    if(l->image != NULL && RET_IS_NOT_OK(ret = gr_image_destroy(l->image))) return ret;
+    if(l->valid_tiles != NULL && RET_IS_NOT_OK(ret = mm_destroy(l->valid_tiles))) return ret;
+    l->image = NULL;
+    l->valid_tiles = NULL;
+    scalmgr_update_level_state(l);
   }
-  return NULL;
+
+  return RET_OK;
 }
 
 
-image_t * scalmgr_create_scaled_image(scaling_manager_t * sm,
-				      image_t * master_img, unsigned int width, unsigned int height,
-				      unsigned int layer, unsigned int zoom_i) {
+/**
+ * Map the image data and the tile valid map of a zoom level from the project 
+ * directory. If there is image data from a version without valid maps, all tiles
+ * are treated as valid.
+ */
+static ret_t scalmgr_create_level(scaling_manager_t * sm, scalmgr_level_t * l) {
   image_t * img = NULL;
+  memory_map_t * valid_tiles = NULL;
   char filename[PATH_MAX];
   char fq_filename[PATH_MAX];
   struct stat stat_buf;
+  ret_t ret;
 
   debug(TM, "\tcreate image");
-  if((img = gr_create_image(width, height, IMAGE_TYPE_RGBA)) == NULL) {
-    return NULL;
+  if((img = gr_create_image(l->width, l->height, IMAGE_TYPE_RGBA)) == NULL) {
+    return RET_MALLOC_FAILED;
   }
     
-  snprintf(filename, sizeof(filename), "scaled_layer_%02d.%d.dat", layer, zoom_i);
+  snprintf(filename, sizeof(filename), "scaled_layer_%02d.%d.dat", l->layer, l->zoom);
   snprintf(fq_filename, sizeof(fq_filename), "%s/%s", sm->project_dir, filename);
-  int file_exists = stat(fq_filename, &stat_buf);
+  int image_exists = stat(fq_filename, &stat_buf) == 0;
     
   // map file
   debug(TM, "\tmap image from file %s", filename);
-  if(!RET_IS_OK(gr_map_file(img, sm->project_dir, filename))) {
+  if(RET_IS_NOT_OK(ret = gr_map_file(img, sm->project_dir, filename))) {
     debug(TM, "mapping failed: %s", filename);
-    return NULL;
+    gr_image_destroy(img);
+    return ret;
   }
-    
-  // scale
-  if(file_exists == -1) { // does not exists
-    debug(TM, "\tfile does not exists - scaling image");
-      
-    if(RET_IS_NOT_OK(gr_scale_image(master_img, img))) {
-      debug(TM, "scaling failed: %s", filename);
-      return NULL;
-    }
+
+  snprintf(filename, sizeof(filename), "scaled_layer_%02d.%d.valid", l->layer, l->zoom);
+  snprintf(fq_filename, sizeof(fq_filename), "%s/%s", sm->project_dir, filename);
+  int valid_map_exists = stat(fq_filename, &stat_buf) == 0;
+
+  if((valid_tiles = mm_create((l->width + SCALMGR_TILE_SIZE - 1) / SCALMGR_TILE_SIZE,
+			      (l->height + SCALMGR_TILE_SIZE - 1) / SCALMGR_TILE_SIZE, 1)) == NULL ||
+     RET_IS_NOT_OK(ret = mm_map_file(valid_tiles, sm->project_dir, filename))) {
+    debug(TM, "mapping failed: %s", filename);
+    if(valid_tiles != NULL) mm_destroy(valid_tiles);
+    gr_image_destroy(img);
+    return RET_ERR;
   }
-  
-  return img;
+
+  if(image_exists && !valid_map_exists) 
+    memset(valid_tiles->mem, 1, valid_tiles->width * valid_tiles->height);
+
+  mm_advise(img->map, MM_ACCESS_RANDOM);
+
+  l->image = img;
+  l->valid_tiles = valid_tiles;
+  scalmgr_update_level_state(l);
+  return RET_OK;
 }
 
-ret_t scalmgr_load_scalings_for_layer(scaling_manager_t * sm, unsigned int max_factor, 
-				      unsigned int layer) {
+static ret_t scalmgr_load_scalings_for_layer(scaling_manager_t * sm, unsigned int layer) {
 
-  unsigned int zoom_i;
+  unsigned int level;
   ret_t ret;
 
-  debug(TM, "load scaled images for layer %d - maxzoom = %d", layer, max_factor);
+  debug(TM, "load scaled images for layer %d - maxzoom = %d", layer, sm->zoom_out_factor);
   assert(sm != NULL);
   if(sm == NULL) return RET_INV_PTR;
 
-  if(max_factor < 2) return RET_OK;
-  
-  unsigned int width = sm->bg_images[0]->width;
-  unsigned int height = sm->bg_images[0]->height;
-
-#ifdef MAP_FILES_ON_DEMAND
-  if(RET_IS_NOT_OK(ret = gr_reactivate_mapping(sm->bg_images[layer]))) {
-    debug(TM, "gr_reactivate_mapping() failed");
-    return ret;
-  }
-#endif
-
-  image_t * img_last = sm->bg_images[layer];
+  for(level = 1; level < sm->num_levels; level++) {
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
 
-  for(zoom_i = 2; zoom_i <= max_factor; zoom_i*= 2) {
-    image_t * img = NULL;
-
-    debug(TM, "\tzoom = %d", zoom_i);
-    
-    width /= 2;
-    height /= 2;
+    debug(TM, "\tzoom = %d", l->zoom);
+    if(l->image != NULL) continue;
     
-    img = scalmgr_create_scaled_image(sm, img_last, width, height, layer, zoom_i);
-    assert(img != NULL);
-    if(img == NULL) {
-      scalmgr_destroy_scalings(sm);
-      return RET_ERR;
-    }
+    if(RET_IS_NOT_OK(ret = scalmgr_create_level(sm, l))) return ret;
 
 #ifdef MAP_FILES_ON_DEMAND
-    if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(img_last))) {
+    if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(l->image))) {
       debug(TM, "deactivate mapping");
-      scalmgr_destroy_scalings(sm);
       return ret;
     }
+    scalmgr_update_level_state(l);
 #endif
-
-    img_last = img;
-
-    image_list_t * list_elem = scalmgr_create_list(layer, zoom_i, img);
-    assert(list_elem != NULL);
-    if(list_elem == NULL) {
-      scalmgr_destroy_scalings(sm);
-      return RET_ERR;
-    }
-    
-    // add to list
-    list_elem->next = sm->zoom_out_images;
-    sm->zoom_out_images = list_elem;
   }
 
-#ifdef MAP_FILES_ON_DEMAND
-  if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(img_last))) {
-    debug(TM, "deactivate mapping");
-    scalmgr_destroy_scalings(sm);
-    return ret;
-  }
-  if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(sm->bg_images[layer]))) return ret;
-#endif
-  
-
   return RET_OK;
   
 }
 
+/**
+ * Map the scaled images for all layers. Image data is not calculated here.
+ */
 ret_t scalmgr_load_scalings(scaling_manager_t * sm) {
   ret_t ret;
   unsigned int layer;
@@ -304,136 +375,357 @@ ret_t scalmgr_load_scalings(scaling_manager_t * sm) {
   if(sm == NULL) return RET_INV_PTR;
 
   debug(TM, "Load scaled images.");
+  scalmgr_stop_prefetching(sm);
 
   for(layer = 0; layer < sm->num_layers; layer++) {
 
-    if(RET_IS_NOT_OK(ret = scalmgr_load_scalings_for_layer(sm, sm->zoom_out_factor, layer)))
+    if(RET_IS_NOT_OK(ret = scalmgr_load_scalings_for_layer(sm, layer))) {
+      scalmgr_destroy_scalings(sm);
       return ret;
+    }
   }
 
   debug(TM, "Loading images done.");
   return RET_OK;
 }
-			    
+			  
 
 ret_t scalmgr_map_files_for_layer(scaling_manager_t * sm, unsigned int layer) {
-  image_list_t * ptr = NULL;
+  unsigned int level;
   ret_t ret;
-  ptr = sm->zoom_out_images;
-  while(ptr != NULL) {
-    if(ptr->layer == layer) {
+  for(level = 1; level < sm->num_levels; level++) {
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+    if(l->image != NULL) {
 #ifdef MAP_FILES_ON_DEMAND
-      if(RET_IS_NOT_OK(ret = gr_reactivate_mapping(ptr->image))) return ret;
+      if(RET_IS_NOT_OK(ret = gr_reactivate_mapping(l->image))) return ret;
 #endif
+      scalmgr_update_level_state(l);
     }
-    ptr = ptr->next;
   }
 
   return RET_OK;
 }
 
 ret_t scalmgr_unmap_files_for_layer(scaling_manager_t * sm, unsigned int layer) {
-  image_list_t * ptr = NULL;
+  unsigned int level;
   ret_t ret;
-  ptr = sm->zoom_out_images;
-  while(ptr != NULL) {
-    if(ptr->layer == layer) {
+  for(level = 1; level < sm->num_levels; level++) {
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+    if(l->image != NULL) {
 #ifdef MAP_FILES_ON_DEMAND
-      if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(ptr->image))) return ret;
+      if(RET_IS_NOT_OK(ret = gr_deactivate_mapping(l->image))) return ret;
 #endif
+      scalmgr_update_level_state(l);
     }
-    ptr = ptr->next;
   }
 
   return RET_OK;
 }
 
 
+typedef struct {
+  image_t * src;
+  image_t * dst;
+  unsigned int * tiles; // tile numbers
+} scalmgr_tile_job_t;
+
+static ret_t scalmgr_calc_tile(unsigned int job, void * arg) {
+  scalmgr_tile_job_t * params = (scalmgr_tile_job_t *)arg;
+  unsigned int tiles_x = (params->dst->width + SCALMGR_TILE_SIZE - 1) / SCALMGR_TILE_SIZE;
+  unsigned int min_x = (params->tiles[job] % tiles_x) * SCALMGR_TILE_SIZE;
+  unsigned int min_y = (params->tiles[job] / tiles_x) * SCALMGR_TILE_SIZE;
+
+  return gr_downsample_region(params->src, params->dst, min_x, min_y,
+			      MIN(min_x + SCALMGR_TILE_SIZE, params->dst->width) - 1,
+			      MIN(min_y + SCALMGR_TILE_SIZE, params->dst->height) - 1);
+}
+
 /**
- * Recreate scaled images.
+ * Calculate all invalid tiles of a zoom level within a region. The region of the
+ * previous zoom level is calculated first. The caller must hold the tile mutex.
  */
-ret_t scalmgr_recreate_scalings(scaling_manager_t * sm) {
+static ret_t scalmgr_calc_region(scaling_manager_t * sm, unsigned int layer, unsigned int level,
+				 unsigned int min_x, unsigned int min_y, 
+				 unsigned int max_x, unsigned int max_y) {
   ret_t ret;
-  unsigned int layer;
-  assert(sm != NULL);
-  if(sm == NULL) return RET_INV_PTR;
+  unsigned int tx, ty, num_tiles = 0;
 
-  // destroy current scaled images
-  //if(RET_IS_NOT_OK(ret = scalmgr_destroy_scalings(sm))) return ret;
+  if(level == 0) return RET_OK;
 
-  for(layer = 0; layer < sm->num_layers; layer++) {
-    debug(TM, "recreate scalings for layer %d", layer);
-    if(RET_IS_NOT_OK(ret = scalmgr_recreate_scalings_for_layer(sm, layer))) return ret;
+  scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+  if(l == NULL || l->image == NULL) {
+    debug(TM, "there is no zoom level %d for layer %d", level, layer);
+    return RET_ERR;
   }
 
-  return RET_OK;
-}
+  image_t * img = l->image;
+  memory_map_t * valid_tiles = l->valid_tiles;
+
+  if(img->width == 0 || img->height == 0) return RET_OK;
+  if(max_x >= img->width) max_x = img->width - 1;
+  if(max_y >= img->height) max_y = img->height - 1;
+  if(min_x > max_x || min_y > max_y) return RET_OK;
+
+  // collect the invalid tiles
+  unsigned int tile_min_x = min_x / SCALMGR_TILE_SIZE, tile_max_x = max_x / SCALMGR_TILE_SIZE;
+  unsigned int tile_min_y = min_y / SCALMGR_TILE_SIZE, tile_max_y = max_y / SCALMGR_TILE_SIZE;
+  unsigned int inv_min_x = UINT_MAX, inv_min_y = UINT_MAX, inv_max_x = 0, inv_max_y = 0;
+  unsigned int * tiles = NULL;
+
+  for(ty = tile_min_y; ty <= tile_max_y; ty++)
+    for(tx = tile_min_x; tx <= tile_max_x; tx++)
+      if(*(uint8_t *)mm_get_ptr(valid_tiles, tx, ty) == 0) {
+	if(tiles == NULL &&
+	   (tiles = (unsigned int *)malloc((tile_max_x - tile_min_x + 1) * 
+					   (tile_max_y - tile_min_y + 1) * 
+					   sizeof(unsigned int))) == NULL) return RET_MALLOC_FAILED;
+
+	tiles[num_tiles++] = ty * valid_tiles->width + tx;
+	inv_min_x = MIN(inv_min_x, tx);
+	inv_min_y = MIN(inv_min_y, ty);
+	inv_max_x = MAX(inv_max_x, tx);
+	inv_max_y = MAX(inv_max_y, ty);
+      }
+
+  if(num_tiles == 0) return RET_OK;
+
+  // the previous zoom level must be valid for the area of the invalid tiles
+  if(RET_IS_NOT_OK(ret = scalmgr_calc_region(sm, layer, level - 1,
+					     2 * inv_min_x * SCALMGR_TILE_SIZE,
+					     2 * inv_min_y * SCALMGR_TILE_SIZE,
+					     2 * (inv_max_x + 1) * SCALMGR_TILE_SIZE - 1,
+					     2 * (inv_max_y + 1) * SCALMGR_TILE_SIZE - 1))) {
+    free(tiles);
+    return ret;
+  }
+
+  image_t * src = level == 1 ? sm->bg_images[layer] : scalmgr_get_level(sm, layer, level - 1)->image;
+
+  // the tiles are calculated row by row, so both images are read front to back
+  MM_ACCESS_PATTERN prev_src = mm_get_access_pattern(src->map);
+  MM_ACCESS_PATTERN prev_dst = mm_get_access_pattern(img->map);
+  mm_advise(src->map, MM_ACCESS_SEQUENTIAL);
+  mm_advise(img->map, MM_ACCESS_SEQUENTIAL);
 
+  scalmgr_tile_job_t params = { src, img, tiles };
+  ret = par_run(num_tiles, &scalmgr_calc_tile, &params);
+
+  mm_advise(src->map, prev_src);
+  mm_advise(img->map, prev_dst);
+
+  if(RET_IS_OK(ret)) {
+    unsigned int i;
+    for(i = 0; i < num_tiles; i++) valid_tiles->mem[tiles[i]] = 1;
+  }
+
+  free(tiles);
+  return ret;
+}
 
 /**
- * Recreate scaled images for a layer.
+ * Make sure, that a region of a scaled image is calculated. Tiles, that are not
+ * valid, are calculated from the previous zoom level.
+ * @param zoom the zoom out factor as returned from scalmgr_get_image()
+ * @param min_x, min_y, max_x, max_y the region in coordinates of the scaled image. 
+ *   The upper bounds are inclusive and are clipped to the image size.
  */
-ret_t scalmgr_recreate_scalings_for_layer(scaling_manager_t * sm, unsigned int layer) {
-
-  unsigned int zoom_i;
+ret_t scalmgr_ensure_region(scaling_manager_t * sm, unsigned int layer, unsigned int zoom,
+			    unsigned int min_x, unsigned int min_y, 
+			    unsigned int max_x, unsigned int max_y) {
+  ret_t ret;
   assert(sm != NULL);
-  assert(sm->bg_images[0] != NULL);
-  if(sm == NULL || sm->bg_images[0] == NULL) return RET_INV_PTR;
+  assert(layer < sm->num_layers);
+  if(sm == NULL) return RET_INV_PTR;
+  if(layer >= sm->num_layers) return RET_ERR;
 
+  pthread_mutex_lock(&sm->tile_mutex);
+  ret = scalmgr_calc_region(sm, layer, scalmgr_zoom_to_level(zoom), min_x, min_y, max_x, max_y);
+  pthread_mutex_unlock(&sm->tile_mutex);
+  return ret;
+}
 
-  image_t * last_img = sm->bg_images[layer];
+static void * scalmgr_prefetch_thread(void * arg) {
+  scaling_manager_t * sm = (scaling_manager_t *)arg;
 
-  for(zoom_i = 2; zoom_i <= sm->zoom_out_factor; zoom_i*= 2) {
+  pthread_mutex_lock(&sm->prefetch_mutex);
+  while(!sm->prefetch_quit) {
 
-    debug(TM, "recreate scalings for layer %d, zoom-out %d", layer, zoom_i);
-    image_list_t * ptr = scalmgr_get_list_elem(sm->zoom_out_images, zoom_i, layer);
-    if(ptr != NULL) {
-      assert(ptr->image != NULL);
+    if(!sm->prefetch_pending) {
+      pthread_cond_wait(&sm->prefetch_cond, &sm->prefetch_mutex);
+      continue;
+    }
 
-      unsigned int w = ptr->image->width;
-      unsigned int h = ptr->image->height;
-      gr_destroy_and_unlink(ptr->image);
+    unsigned int layer = sm->prefetch_layer, zoom = sm->prefetch_zoom;
+    unsigned int min_x = sm->prefetch_min_x, min_y = sm->prefetch_min_y;
+    unsigned int max_x = sm->prefetch_max_x, max_y = sm->prefetch_max_y;
+    sm->prefetch_pending = 0;
+    pthread_mutex_unlock(&sm->prefetch_mutex);
 
-      ptr->image = scalmgr_create_scaled_image(sm, last_img, w, h, layer, zoom_i);
-      if(ptr->image == NULL) {
-	scalmgr_destroy_scalings(sm);
-	return RET_ERR;
-      }
+    // the level image is used under the tile lock, see also scalmgr_stop_prefetching()
+    pthread_mutex_lock(&sm->tile_mutex);
+    unsigned int level = scalmgr_zoom_to_level(zoom);
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+    if(l != NULL && l->image != NULL) {
+
+      // for zoomed out levels the source tiles are read while calculating
+      if(RET_IS_NOT_OK(scalmgr_calc_region(sm, layer, level, min_x, min_y, max_x, max_y)))
+	debug(TM, "prefetching region failed");
 
-      last_img = ptr->image;
+      mm_advise_willneed(l->image->map, min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
     }
-    else {
+    pthread_mutex_unlock(&sm->tile_mutex);
+
+    pthread_mutex_lock(&sm->prefetch_mutex);
+  }
+  pthread_mutex_unlock(&sm->prefetch_mutex);
+  return NULL;
+}
 
-      image_t * img = scalmgr_create_scaled_image(sm, last_img, 
-						  last_img->width / 2, last_img->height / 2, 
-						  layer, zoom_i);
+/**
+ * Prefetch a region of a layer in the background. The zoom level is chosen in the
+ * same way as in scalmgr_get_image(). Missing tiles of the level are calculated and
+ * the kernel is asked to read the image data. A new request replaces a request,
+ * that was not started yet.
+ * @param scaling the scaling as it would be passed to scalmgr_get_image()
+ * @param min_x, min_y, max_x, max_y the region in background image coordinates
+ */
+ret_t scalmgr_prefetch_region(scaling_manager_t * sm, unsigned int layer, double scaling,
+			      unsigned int min_x, unsigned int min_y, 
+			      unsigned int max_x, unsigned int max_y) {
+  assert(sm != NULL);
+  if(sm == NULL) return RET_INV_PTR;
+  if(layer >= sm->num_layers || min_x > max_x || min_y > max_y) return RET_ERR;
 
-      assert(img != NULL);
-      if(img == NULL) return RET_ERR;
+#ifdef MAP_FILES_ON_DEMAND
+  // mappings are switched by the GUI thread, so they can't be read in the background
+  return RET_OK;
+#endif
 
-      image_list_t * list_elem = scalmgr_create_list(layer, zoom_i, img);
-      assert(list_elem != NULL);
-      if(list_elem == NULL) {
-	scalmgr_destroy_scalings(sm);
-	return RET_ERR;
-      }
+  unsigned int zoom = scalmgr_get_zoom_for_scaling(sm, scaling);
 
-      list_elem->next = sm->zoom_out_images;
-      sm->zoom_out_images = list_elem;
+  pthread_mutex_lock(&sm->prefetch_mutex);
 
-      last_img = list_elem->image;
+  if(!sm->prefetch_thread_running) {
+    if(pthread_create(&sm->prefetch_thread, NULL, scalmgr_prefetch_thread, sm) != 0) {
+      pthread_mutex_unlock(&sm->prefetch_mutex);
+      debug(TM, "can't start prefetch thread");
+      return RET_ERR;
     }
+    sm->prefetch_thread_running = 1;
+  }
+
+  sm->prefetch_layer = layer;
+  sm->prefetch_zoom = zoom;
+  sm->prefetch_min_x = min_x / zoom;
+  sm->prefetch_min_y = min_y / zoom;
+  sm->prefetch_max_x = max_x / zoom;
+  sm->prefetch_max_y = max_y / zoom;
+  sm->prefetch_pending = 1;
+  pthread_cond_signal(&sm->prefetch_cond);
 
+  pthread_mutex_unlock(&sm->prefetch_mutex);
+  return RET_OK;
+}
+
+/**
+ * Mark the tiles of all zoom levels, that cover a region of the background image,
+ * as invalid. They are recalculated, when they are requested the next time.
+ * @param min_x, min_y, max_x, max_y the region in background image coordinates.
+ *   The upper bounds are inclusive.
+ */
+ret_t scalmgr_invalidate_region(scaling_manager_t * sm, unsigned int layer,
+				unsigned int min_x, unsigned int min_y, 
+				unsigned int max_x, unsigned int max_y) {
+  unsigned int level, tx, ty;
+  assert(sm != NULL);
+  assert(layer < sm->num_layers);
+  if(sm == NULL) return RET_INV_PTR;
+  if(layer >= sm->num_layers) return RET_ERR;
+  if(min_x > max_x || min_y > max_y) return RET_OK;
+
+  pthread_mutex_lock(&sm->tile_mutex);
+  __sync_add_and_fetch(&sm->layer_versions[layer], 1);
+
+  for(level = 1; level < sm->num_levels; level++) {
+    scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+    if(l->valid_tiles == NULL) continue;
+
+    memory_map_t * valid_tiles = l->valid_tiles;
+    unsigned int tile_size = l->zoom * SCALMGR_TILE_SIZE;
+    unsigned int tile_max_x = MIN(max_x / tile_size, valid_tiles->width - 1);
+    unsigned int tile_max_y = MIN(max_y / tile_size, valid_tiles->height - 1);
+
+    for(ty = min_y / tile_size; ty <= tile_max_y; ty++)
+      for(tx = min_x / tile_size; tx <= tile_max_x; tx++)
+	*(uint8_t *)mm_get_ptr(valid_tiles, tx, ty) = 0;
   }
 
+  pthread_mutex_unlock(&sm->tile_mutex);
+  return RET_OK;
+}
+
+/**
+ * Get the version of the background image of a layer. The version changes, whenever
+ * a region of the layer is invalidated. Caches of derived data can compare the 
+ * version to find out, if they are outdated.
+ */
+unsigned long scalmgr_get_layer_version(scaling_manager_t * sm, unsigned int layer) {
+  assert(sm != NULL);
+  assert(layer < sm->num_layers);
+  if(sm == NULL || layer >= sm->num_layers) return 0;
+  return __sync_add_and_fetch(&sm->layer_versions[layer], 0);
+}
+
+
+/**
+ * Recreate scaled images. The scaled images are marked as invalid and are 
+ * recalculated on demand.
+ */
+ret_t scalmgr_recreate_scalings(scaling_manager_t * sm) {
+  ret_t ret;
+  unsigned int layer;
+  assert(sm != NULL);
+  if(sm == NULL) return RET_INV_PTR;
+
+  for(layer = 0; layer < sm->num_layers; layer++) {
+    debug(TM, "recreate scalings for layer %d", layer);
+    if(RET_IS_NOT_OK(ret = scalmgr_recreate_scalings_for_layer(sm, layer))) return ret;
+  }
 
   return RET_OK;
 }
 
+
+/**
+ * Recreate scaled images for a layer. Missing zoom levels are created and
+ * all tiles are marked as invalid.
+ */
+ret_t scalmgr_recreate_scalings_for_layer(scaling_manager_t * sm, unsigned int layer) {
+  ret_t ret;
+  assert(sm != NULL);
+  assert(sm->bg_images[0] != NULL);
+  if(sm == NULL || sm->bg_images[0] == NULL) return RET_INV_PTR;
+
+  // missing level images are created
+  scalmgr_stop_prefetching(sm);
+
+  if(RET_IS_NOT_OK(ret = scalmgr_load_scalings_for_layer(sm, layer))) {
+    scalmgr_destroy_scalings(sm);
+    return ret;
+  }
+
+  return scalmgr_invalidate_region(sm, layer, 0, 0, 
+				   sm->bg_images[layer]->width - 1, 
+				   sm->bg_images[layer]->height - 1);
+}
+
 /** 
- * Define the scalings.
+ * Define the scalings. The level table is set up for zoom out factors up to
+ * zoom_out_factor. Scaled images, that were loaded before, are destroyed.
  */
 ret_t scalmgr_set_scalings(scaling_manager_t * sm, unsigned int zoom_out_factor) {
+  ret_t ret;
+  unsigned int layer, level;
 
   assert(sm != NULL);
   assert(sm->bg_images[0] != NULL);
@@ -442,9 +734,37 @@ ret_t scalmgr_set_scalings(scaling_manager_t * sm, unsigned int zoom_out_factor)
   if(sm == NULL || sm->bg_images[0] == NULL) return RET_INV_PTR;
   if(zoom_out_factor == 0) return RET_ERR;
 
-  sm->zoom_out_factor = zoom_out_factor;
+  if(RET_IS_NOT_OK(ret = scalmgr_destroy_scalings(sm))) return ret;
+
+  unsigned int num_levels = scalmgr_zoom_to_level(zoom_out_factor) + 1;
+  scalmgr_level_t * levels = 
+    (scalmgr_level_t *)malloc(sm->num_layers * num_levels * sizeof(scalmgr_level_t));
+  if(levels == NULL) return RET_MALLOC_FAILED;
+  memset(levels, 0, sm->num_layers * num_levels * sizeof(scalmgr_level_t));
+
+  if(sm->levels != NULL) free(sm->levels);
+  sm->levels = levels;
+  sm->num_levels = num_levels;
+  sm->zoom_out_factor = 1 << (num_levels - 1);
+
+  for(layer = 0; layer < sm->num_layers; layer++) {
+    unsigned int width = sm->bg_images[0]->width;
+    unsigned int height = sm->bg_images[0]->height;
+
+    for(level = 0; level < num_levels; level++) {
+      scalmgr_level_t * l = scalmgr_get_level(sm, layer, level);
+      l->layer = layer;
+      l->zoom = 1 << level;
+      l->width = width;
+      l->height = height;
+      if(level == 0) l->image = sm->bg_images[layer];
+      scalmgr_update_level_state(l);
+
+      width /= 2;
+      height /= 2;
+    }
+  }
 
-  //return scalmgr_recreate_scalings(sm);
   return RET_OK;
 }
 
@@ -24,23 +24,60 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 
 #include "graphics.h"
 #include <math.h>
+#include <pthread.h>
 
-typedef struct image_list image_list_t;
+/** Edge length of the tiles, that are calculated on demand. */
+#define SCALMGR_TILE_SIZE 128
 
-struct image_list {
-  unsigned int layer;
-  unsigned int zoom;
-  image_t * image;
-  image_list_t * next;
+enum SCALMGR_RESIDENCY {
+  SCALMGR_LEVEL_NOT_LOADED = 0, // there is no image for this level
+  SCALMGR_LEVEL_UNMAPPED = 1,   // the image exists, but is not mapped into memory
+  SCALMGR_LEVEL_RESIDENT = 2,   // the image data is mapped into memory
 };
 
+/**
+ * Table entry for a zoom level of a layer.
+ */
+typedef struct scalmgr_level {
+  unsigned int layer;
+  unsigned int zoom;           // zoom out factor, 2^level
+  unsigned int width, height;
+
+  MAP_STORAGE_TYPE storage_type;
+  SCALMGR_RESIDENCY residency;
+  unsigned long last_access;   // value of the access clock on the last access
+
+  image_t * image;             // for level 0 this is the background image
+  memory_map_t * valid_tiles;  // one byte per tile, 0 if the tile must be calculated
+} scalmgr_level_t;
+
 typedef struct scaling_manager {
   unsigned int zoom_out_factor;
 
   unsigned int num_layers;
   char * project_dir;
   image_t ** bg_images;
-  image_list_t * zoom_out_images;
+
+  // dense table with num_layers * num_levels entries, indexed by [layer][level]
+  unsigned int num_levels;
+  scalmgr_level_t * levels;
+  unsigned long access_clock;
+
+  // per layer counter, that is incremented, when the background image changes
+  unsigned long * layer_versions;
+
+  // serializes the calculation of tiles
+  pthread_mutex_t tile_mutex;
+
+  // background prefetching, see scalmgr_prefetch_region()
+  pthread_t prefetch_thread;
+  pthread_mutex_t prefetch_mutex;
+  pthread_cond_t prefetch_cond;
+  int prefetch_thread_running;
+  int prefetch_pending;
+  int prefetch_quit;
+  unsigned int prefetch_layer, prefetch_zoom;
+  unsigned int prefetch_min_x, prefetch_min_y, prefetch_max_x, prefetch_max_y;
 } scaling_manager_t;
 
 scaling_manager_t * scalmgr_create(int num_layers, image_t ** bg_images,
@@ -57,9 +94,23 @@ ret_t scalmgr_unmap_files_for_layer(scaling_manager_t * sm, unsigned int layer);
 
 unsigned int scalmgr_get_max_zoom_out_factor(scaling_manager_t * sm);
 
+unsigned int scalmgr_get_num_levels(scaling_manager_t * sm);
+scalmgr_level_t * scalmgr_get_level(scaling_manager_t * sm, unsigned int layer, unsigned int level);
+
 ret_t scalmgr_recreate_scalings(scaling_manager_t * sm);
 ret_t scalmgr_recreate_scalings_for_layer(scaling_manager_t * sm, unsigned int layer);
 
 ret_t scalmgr_load_scalings(scaling_manager_t * sm);
 
+ret_t scalmgr_ensure_region(scaling_manager_t * sm, unsigned int layer, unsigned int zoom,
+			    unsigned int min_x, unsigned int min_y, 
+			    unsigned int max_x, unsigned int max_y);
+ret_t scalmgr_prefetch_region(scaling_manager_t * sm, unsigned int layer, double scaling,
+			      unsigned int min_x, unsigned int min_y, 
+			      unsigned int max_x, unsigned int max_y);
+ret_t scalmgr_invalidate_region(scaling_manager_t * sm, unsigned int layer,
+				unsigned int min_x, unsigned int min_y, 
+				unsigned int max_x, unsigned int max_y);
+unsigned long scalmgr_get_layer_version(scaling_manager_t * sm, unsigned int layer);
+
 #endif
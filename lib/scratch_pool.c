@@ -0,0 +1,182 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "scratch_pool.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+typedef struct scratch_buffer scratch_buffer_t;
+
+struct scratch_buffer {
+  void * mem;
+  size_t size;
+  scratch_buffer_t * next;
+};
+
+static pthread_mutex_t scratch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static scratch_buffer_t * free_buffers = NULL;
+static size_t cached_size = 0; // size of all buffers in free_buffers
+static size_t used_size = 0;   // size of all buffers, that are handed out
+
+/* Budget in bytes. -1 means: not determined yet. */
+static size_t budget = (size_t)-1;
+
+/**
+ * Set the maximum amount of scratch memory, that may be handed out at a time.
+ * The default is taken from the environment variable DEGATE_SCRATCH_BUDGET in MB.
+ * If it is not set, half of the physical memory is used.
+ */
+void scratch_set_budget(size_t bytes) {
+  pthread_mutex_lock(&scratch_mutex);
+  budget = bytes;
+  pthread_mutex_unlock(&scratch_mutex);
+}
+
+static size_t scratch_get_budget_locked() {
+  if(budget == (size_t)-1) {
+    char * env = getenv("DEGATE_SCRATCH_BUDGET");
+    if(env != NULL) 
+      budget = (size_t)atol(env) << 20;
+    else
+      budget = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE) / 2;
+  }
+  return budget;
+}
+
+/**
+ * Get the scratch memory budget in bytes.
+ */
+size_t scratch_get_budget() {
+  pthread_mutex_lock(&scratch_mutex);
+  size_t b = scratch_get_budget_locked();
+  pthread_mutex_unlock(&scratch_mutex);
+  return b;
+}
+
+/**
+ * Get a zero filled buffer of at least size bytes.
+ * @param alloc_size the real size of the buffer is stored here. It must be passed
+ *   to scratch_free().
+ * @returns NULL, if the budget would be exceeded or if there is no memory
+ */
+void * scratch_alloc(size_t size, size_t * alloc_size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  scratch_buffer_t * ptr, ** best = NULL, ** pptr;
+  void * mem = NULL;
+
+  assert(alloc_size != NULL);
+  if(alloc_size == NULL) return NULL;
+
+  size = (size + page_size - 1) & ~(page_size - 1);
+  if(size == 0) size = page_size;
+
+  pthread_mutex_lock(&scratch_mutex);
+
+  if(used_size + size > scratch_get_budget_locked()) {
+    pthread_mutex_unlock(&scratch_mutex);
+    return NULL;
+  }
+
+  // use the smallest cached buffer, that is large enough and does not waste half of it
+  for(pptr = &free_buffers; *pptr != NULL; pptr = &(*pptr)->next)
+    if((*pptr)->size >= size && (*pptr)->size / 2 < size &&
+       (best == NULL || (*pptr)->size < (*best)->size)) best = pptr;
+
+  if(best != NULL) {
+    ptr = *best;
+    *best = ptr->next;
+    cached_size -= ptr->size;
+    mem = ptr->mem;
+    size = ptr->size;
+    free(ptr);
+#ifndef __linux__
+    // madvise(MADV_DONTNEED) does not clear anonymous pages on all systems
+    memset(mem, 0, size);
+#endif
+  }
+  else {
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) mem = NULL;
+  }
+
+  if(mem != NULL) {
+    used_size += size;
+    *alloc_size = size;
+  }
+
+  pthread_mutex_unlock(&scratch_mutex);
+  return mem;
+}
+
+/**
+ * Give a buffer back to the pool. The pages are released, so the buffer reads as 
+ * zero, when it is handed out again.
+ */
+void scratch_free(void * mem, size_t alloc_size) {
+  scratch_buffer_t * ptr;
+
+  assert(mem != NULL);
+  if(mem == NULL) return;
+
+  // on Linux private anonymous pages are dropped and read as zero on the next access
+  madvise(mem, alloc_size, MADV_DONTNEED);
+
+  pthread_mutex_lock(&scratch_mutex);
+  used_size -= alloc_size;
+
+  if(cached_size + alloc_size <= SCRATCH_POOL_MAX_CACHED &&
+     (ptr = (scratch_buffer_t *)malloc(sizeof(scratch_buffer_t))) != NULL) {
+    ptr->mem = mem;
+    ptr->size = alloc_size;
+    ptr->next = free_buffers;
+    free_buffers = ptr;
+    cached_size += alloc_size;
+  }
+  else munmap(mem, alloc_size);
+
+  pthread_mutex_unlock(&scratch_mutex);
+}
+
+/**
+ * Unmap all buffers, that are cached in the pool.
+ */
+void scratch_trim() {
+  pthread_mutex_lock(&scratch_mutex);
+  while(free_buffers != NULL) {
+    scratch_buffer_t * ptr = free_buffers;
+    free_buffers = ptr->next;
+    munmap(ptr->mem, ptr->size);
+    free(ptr);
+  }
+  cached_size = 0;
+  pthread_mutex_unlock(&scratch_mutex);
+}
@@ -0,0 +1,45 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __SCRATCH_POOL_H__
+#define __SCRATCH_POOL_H__
+
+#include <stddef.h>
+#include "globals.h"
+
+/**
+ * The scratch pool hands out anonymous memory for intermediate data, that never
+ * has to be stored. Released buffers are kept in the pool and are handed out
+ * again. Memory from the pool reads as zero.
+ */
+
+/** Released buffers up to this total size are kept in the pool. */
+#define SCRATCH_POOL_MAX_CACHED (256 * 1024 * 1024)
+
+void scratch_set_budget(size_t bytes);
+size_t scratch_get_budget();
+
+void * scratch_alloc(size_t size, size_t * alloc_size);
+void scratch_free(void * mem, size_t alloc_size);
+void scratch_trim();
+
+#endif
@@ -0,0 +1,327 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "similarity_cache.h"
+#include "img_algorithms.h"
+#include "parallel.h"
+#include "image_view.h"
+
+/**
+ * Create a similarity cache for the background images of a scaling manager.
+ */
+simcache_t * simcache_create(scaling_manager_t * sm) {
+  simcache_t * sc;
+  unsigned int layer;
+
+  assert(sm != NULL);
+  if(sm == NULL) return NULL;
+
+  if((sc = (simcache_t *)malloc(sizeof(simcache_t))) == NULL) return NULL;
+  memset(sc, 0, sizeof(simcache_t));
+
+  if((sc->layer_versions = (unsigned long *)malloc(sm->num_layers * sizeof(unsigned long))) == NULL) {
+    free(sc);
+    return NULL;
+  }
+
+  sc->sm = sm;
+  sc->num_layers = sm->num_layers;
+  for(layer = 0; layer < sc->num_layers; layer++)
+    sc->layer_versions[layer] = scalmgr_get_layer_version(sm, layer);
+
+  pthread_mutex_init(&sc->mutex, NULL);
+  return sc;
+}
+
+static void simcache_destroy_levels(simcache_t * sc) {
+  unsigned int i;
+  if(sc->levels == NULL) return;
+
+  for(i = 0; i < sc->num_layers * sc->num_levels; i++) {
+    if(sc->levels[i].image != NULL) gr_image_destroy(sc->levels[i].image);
+    if(sc->levels[i].valid_tiles != NULL) mm_destroy(sc->levels[i].valid_tiles);
+  }
+  free(sc->levels);
+  sc->levels = NULL;
+  sc->num_levels = 0;
+}
+
+/**
+ * Destroy a similarity cache. The scaling manager is not destroyed.
+ */
+ret_t simcache_destroy(simcache_t * sc) {
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+
+  simcache_destroy_levels(sc);
+  free(sc->layer_versions);
+  pthread_mutex_destroy(&sc->mutex);
+
+  memset(sc, 0, sizeof(simcache_t));
+  free(sc);
+  return RET_OK;
+}
+
+static void simcache_invalidate_layer(simcache_t * sc, unsigned int layer) {
+  unsigned int level;
+  for(level = 0; level < sc->num_levels; level++) {
+    simcache_level_t * l = &sc->levels[layer * sc->num_levels + level];
+    if(l->valid_tiles != NULL) mm_clear(l->valid_tiles);
+  }
+}
+
+/**
+ * Mark all tiles of all layers as invalid.
+ */
+ret_t simcache_invalidate(simcache_t * sc) {
+  unsigned int layer;
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&sc->mutex);
+  for(layer = 0; layer < sc->num_layers; layer++) simcache_invalidate_layer(sc, layer);
+  pthread_mutex_unlock(&sc->mutex);
+  return RET_OK;
+}
+
+/**
+ * Set the reference color. The cache is only invalidated, if the hue of the
+ * color differs from the current reference hue.
+ */
+ret_t simcache_set_color(simcache_t * sc, uint32_t color) {
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+
+  uint8_t hue = rgb_to_h(MASK_R(color), MASK_G(color), MASK_B(color));
+
+  // tiles are calculated for the reference hue with the mutex held
+  pthread_mutex_lock(&sc->mutex);
+  if(hue != sc->ref_hue) {
+    unsigned int layer;
+    sc->ref_hue = hue;
+    for(layer = 0; layer < sc->num_layers; layer++) simcache_invalidate_layer(sc, layer);
+  }
+  pthread_mutex_unlock(&sc->mutex);
+  return RET_OK;
+}
+
+static unsigned int simcache_zoom_to_level(unsigned int zoom) {
+  unsigned int level = 0;
+  while(zoom > 1) {
+    zoom >>= 1;
+    level++;
+  }
+  return level;
+}
+
+/**
+ * Get the table entry for a layer and zoom level. The table follows the zoom 
+ * levels of the scaling manager. The image is created on first use. The caller 
+ * must hold the mutex.
+ */
+static simcache_level_t * simcache_get_level(simcache_t * sc, unsigned int layer, unsigned int zoom) {
+  unsigned int level = simcache_zoom_to_level(zoom);
+  unsigned int num_levels = MAX(scalmgr_get_num_levels(sc->sm), 1);
+
+  if(layer >= sc->num_layers || level >= num_levels) return NULL;
+
+  if(sc->num_levels != num_levels) {
+    simcache_destroy_levels(sc);
+    size_t size = sc->num_layers * num_levels * sizeof(simcache_level_t);
+    if((sc->levels = (simcache_level_t *)malloc(size)) == NULL) return NULL;
+    memset(sc->levels, 0, size);
+    sc->num_levels = num_levels;
+  }
+
+  simcache_level_t * l = &sc->levels[layer * sc->num_levels + level];
+  if(l->image == NULL) {
+    image_t * bg = sc->sm->bg_images[layer];
+    scalmgr_level_t * sl = level > 0 ? scalmgr_get_level(sc->sm, layer, level) : NULL;
+    unsigned int width = sl != NULL ? sl->width : bg->width;
+    unsigned int height = sl != NULL ? sl->height : bg->height;
+
+    // the similarity image is never stored, scratch memory is sufficient
+    if((l->image = gr_create_image(width, height, IMAGE_TYPE_GS)) == NULL) return NULL;
+    if(RET_IS_NOT_OK(gr_map_scratch(l->image, sc->sm->project_dir)) ||
+       (l->valid_tiles = mm_create((width + SCALMGR_TILE_SIZE - 1) / SCALMGR_TILE_SIZE,
+				   (height + SCALMGR_TILE_SIZE - 1) / SCALMGR_TILE_SIZE, 1)) == NULL ||
+       RET_IS_NOT_OK(mm_alloc_memory(l->valid_tiles))) {
+      gr_image_destroy(l->image);
+      l->image = NULL;
+      if(l->valid_tiles != NULL) mm_destroy(l->valid_tiles);
+      l->valid_tiles = NULL;
+      return NULL;
+    }
+  }
+  return l;
+}
+
+typedef struct {
+  image_t * src;
+  image_t * dst;
+  unsigned int * tiles;
+  unsigned int tiles_x;
+  uint8_t ref_hue;
+} simcache_tile_job_t;
+
+static ret_t simcache_calc_tile(unsigned int job, void * arg) {
+  simcache_tile_job_t * params = (simcache_tile_job_t *)arg;
+  unsigned int min_x = (params->tiles[job] % params->tiles_x) * SCALMGR_TILE_SIZE;
+  unsigned int min_y = (params->tiles[job] / params->tiles_x) * SCALMGR_TILE_SIZE;
+  unsigned int width = MIN(min_x + SCALMGR_TILE_SIZE, params->dst->width) - min_x;
+  unsigned int max_y = MIN(min_y + SCALMGR_TILE_SIZE, params->dst->height);
+  unsigned int y;
+
+  rgba_view_t src(params->src);
+  gs_view_t dst(params->dst);
+  for(y = min_y; y < max_y; y++)
+    imgalgo_color_similarity_row(src.ptr(min_x, y), dst.ptr(min_x, y), width, params->ref_hue);
+  return RET_OK;
+}
+
+/**
+ * Make sure, that a region of a similarity image is calculated. The background
+ * image region is calculated by the scaling manager first.
+ * @param zoom the zoom out factor as returned from scalmgr_get_image()
+ * @param min_x, min_y, max_x, max_y the region in coordinates of the scaled image. 
+ *   The upper bounds are inclusive and are clipped to the image size.
+ */
+ret_t simcache_ensure_region(simcache_t * sc, unsigned int layer, unsigned int zoom,
+			     unsigned int min_x, unsigned int min_y, 
+			     unsigned int max_x, unsigned int max_y) {
+  ret_t ret = RET_OK;
+  unsigned int tx, ty, num_tiles = 0;
+  unsigned int * tiles = NULL;
+
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+  if(layer >= sc->num_layers) return RET_ERR;
+
+  pthread_mutex_lock(&sc->mutex);
+
+  simcache_level_t * l = simcache_get_level(sc, layer, zoom);
+  if(l == NULL) {
+    pthread_mutex_unlock(&sc->mutex);
+    return RET_ERR;
+  }
+
+  // the background image has changed since the tiles were calculated
+  unsigned long version = scalmgr_get_layer_version(sc->sm, layer);
+  if(version != sc->layer_versions[layer]) {
+    simcache_invalidate_layer(sc, layer);
+    sc->layer_versions[layer] = version;
+  }
+
+  image_t * img = l->image;
+  memory_map_t * valid_tiles = l->valid_tiles;
+
+  if(max_x >= img->width) max_x = img->width - 1;
+  if(max_y >= img->height) max_y = img->height - 1;
+  if(img->width == 0 || img->height == 0 || min_x > max_x || min_y > max_y) {
+    pthread_mutex_unlock(&sc->mutex);
+    return RET_OK;
+  }
+
+  unsigned int tile_min_x = min_x / SCALMGR_TILE_SIZE, tile_max_x = max_x / SCALMGR_TILE_SIZE;
+  unsigned int tile_min_y = min_y / SCALMGR_TILE_SIZE, tile_max_y = max_y / SCALMGR_TILE_SIZE;
+  unsigned int inv_min_x = UINT_MAX, inv_min_y = UINT_MAX, inv_max_x = 0, inv_max_y = 0;
+
+  for(ty = tile_min_y; ty <= tile_max_y; ty++)
+    for(tx = tile_min_x; tx <= tile_max_x; tx++)
+      if(*(uint8_t *)mm_get_ptr(valid_tiles, tx, ty) == 0) {
+	if(tiles == NULL &&
+	   (tiles = (unsigned int *)malloc((tile_max_x - tile_min_x + 1) * 
+					   (tile_max_y - tile_min_y + 1) * 
+					   sizeof(unsigned int))) == NULL) {
+	  pthread_mutex_unlock(&sc->mutex);
+	  return RET_MALLOC_FAILED;
+	}
+
+	tiles[num_tiles++] = ty * valid_tiles->width + tx;
+	inv_min_x = MIN(inv_min_x, tx);
+	inv_min_y = MIN(inv_min_y, ty);
+	inv_max_x = MAX(inv_max_x, tx);
+	inv_max_y = MAX(inv_max_y, ty);
+      }
+
+  if(num_tiles > 0) {
+    unsigned int level = simcache_zoom_to_level(zoom);
+    image_t * src = level == 0 ? sc->sm->bg_images[layer] : scalmgr_get_level(sc->sm, layer, level)->image;
+
+    if(src == NULL || src->map->mem == NULL) {
+      debug(TM, "background image for zoom level %d of layer %d is not available", level, layer);
+      ret = RET_ERR;
+    }
+    else if(RET_IS_OK(ret = scalmgr_ensure_region(sc->sm, layer, zoom,
+						  inv_min_x * SCALMGR_TILE_SIZE, 
+						  inv_min_y * SCALMGR_TILE_SIZE,
+						  (inv_max_x + 1) * SCALMGR_TILE_SIZE - 1,
+						  (inv_max_y + 1) * SCALMGR_TILE_SIZE - 1))) {
+
+      simcache_tile_job_t params = { src, img, tiles, valid_tiles->width, sc->ref_hue };
+      if(RET_IS_OK(ret = par_run(num_tiles, &simcache_calc_tile, &params))) {
+	unsigned int i;
+	for(i = 0; i < num_tiles; i++) valid_tiles->mem[tiles[i]] = 1;
+      }
+    }
+    free(tiles);
+  }
+
+  pthread_mutex_unlock(&sc->mutex);
+  return ret;
+}
+
+/**
+ * Get the similarity image for a layer and zoom out factor. Use 
+ * simcache_ensure_region() to calculate the image data for a region. The cache
+ * stays locked, until the image is released with simcache_release_image(), so
+ * the image can't be destroyed or recalculated while it is read.
+ * @return NULL on error. The cache is not locked then.
+ */
+image_t * simcache_get_image(simcache_t * sc, unsigned int layer, unsigned int zoom) {
+  assert(sc != NULL);
+  if(sc == NULL) return NULL;
+
+  pthread_mutex_lock(&sc->mutex);
+  simcache_level_t * l = simcache_get_level(sc, layer, zoom);
+  if(l == NULL) {
+    pthread_mutex_unlock(&sc->mutex);
+    return NULL;
+  }
+  return l->image;
+}
+
+/**
+ * Release an image, that was returned by simcache_get_image().
+ */
+void simcache_release_image(simcache_t * sc, image_t * img) {
+  assert(sc != NULL);
+  assert(img != NULL);
+  if(sc == NULL || img == NULL) return;
+  pthread_mutex_unlock(&sc->mutex);
+}
@@ -0,0 +1,66 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#ifndef __SIMILARITY_CACHE_H__
+#define __SIMILARITY_CACHE_H__
+
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "scaling_manager.h"
+
+/**
+ * Cache for the hue distance of the background images to a reference color.
+ * There is a greyscale image for each layer and zoom level of the scaling manager.
+ * Tiles of SCALMGR_TILE_SIZE are calculated on demand. The cache is invalidated,
+ * if the reference hue changes or if the background image of a layer changes.
+ */
+
+typedef struct {
+  image_t * image;             // NULL, if the level was not requested yet
+  memory_map_t * valid_tiles;  // one byte per tile, 0 if the tile must be calculated
+} simcache_level_t;
+
+typedef struct similarity_cache {
+  scaling_manager_t * sm;
+  uint8_t ref_hue;
+
+  unsigned int num_layers, num_levels;
+  simcache_level_t * levels;      // indexed by [layer][level]
+  unsigned long * layer_versions; // background versions, the tiles were calculated for
+
+  pthread_mutex_t mutex;
+} simcache_t;
+
+simcache_t * simcache_create(scaling_manager_t * sm);
+ret_t simcache_destroy(simcache_t * sc);
+
+ret_t simcache_set_color(simcache_t * sc, uint32_t color);
+ret_t simcache_invalidate(simcache_t * sc);
+
+ret_t simcache_ensure_region(simcache_t * sc, unsigned int layer, unsigned int zoom,
+			     unsigned int min_x, unsigned int min_y, 
+			     unsigned int max_x, unsigned int max_y);
+image_t * simcache_get_image(simcache_t * sc, unsigned int layer, unsigned int zoom);
+void simcache_release_image(simcache_t * sc, image_t * img);
+
+#endif
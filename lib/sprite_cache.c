@@ -0,0 +1,274 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "globals.h"
+#include "sprite_cache.h"
+#include "image_view.h"
+#include "blend.h"
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+static uint32_t hash_data(uint32_t h, const void * data, size_t len) {
+  const uint8_t * p = (const uint8_t *)data;
+  while(len--) h = (h ^ *p++) * FNV_PRIME;
+  return h;
+}
+
+#define HASH_VAR(h, var) h = hash_data(h, &(var), sizeof(var))
+
+static unsigned int spcache_hash(const spcache_key_t * key) {
+  uint32_t h = FNV_OFFSET_BASIS;
+  HASH_VAR(h, key->tmpl);
+  HASH_VAR(h, key->orientation);
+  HASH_VAR(h, key->select_state);
+  HASH_VAR(h, key->width);
+  HASH_VAR(h, key->height);
+  HASH_VAR(h, key->scaling_x);
+  HASH_VAR(h, key->scaling_y);
+  return h % SPCACHE_NUM_BUCKETS;
+}
+
+static bool spcache_key_equal(const spcache_key_t * a, const spcache_key_t * b) {
+  return a->tmpl == b->tmpl && a->orientation == b->orientation && a->select_state == b->select_state &&
+    a->width == b->width && a->height == b->height &&
+    a->scaling_x == b->scaling_x && a->scaling_y == b->scaling_y &&
+    a->gate_area_color == b->gate_area_color && a->port_color == b->port_color;
+}
+
+static size_t spcache_sprite_size(const spcache_sprite_t * sprite) {
+  return (size_t)sprite->img->width * sprite->img->height * sizeof(uint32_t);
+}
+
+static void spcache_free_sprite(spcache_sprite_t * sprite) {
+  gr_image_destroy(sprite->img);
+  free(sprite);
+}
+
+/**
+ * Create an empty sprite cache.
+ * @param max_size Size of all sprite images in bytes.
+ */
+spcache_t * spcache_create(size_t max_size) {
+  spcache_t * sc;
+  if((sc = (spcache_t *)malloc(sizeof(spcache_t))) == NULL) return NULL;
+  memset(sc, 0, sizeof(spcache_t));
+  sc->max_size = max_size;
+  sc->template_version = lmodel_get_template_version();
+  pthread_mutex_init(&sc->mutex, NULL);
+  return sc;
+}
+
+/** Remove a sprite from its bucket. It is freed, unless it is in use. */
+static void spcache_drop(spcache_t * sc, spcache_sprite_t ** link) {
+  spcache_sprite_t * sprite = *link;
+  *link = sprite->next;
+  sc->size -= spcache_sprite_size(sprite);
+
+  if(sprite->refs == 0) spcache_free_sprite(sprite);
+  else sprite->stale = 1;
+}
+
+static void spcache_drop_all(spcache_t * sc) {
+  unsigned int i;
+  for(i = 0; i < SPCACHE_NUM_BUCKETS; i++)
+    while(sc->buckets[i] != NULL) spcache_drop(sc, &sc->buckets[i]);
+}
+
+/**
+ * Destroy the cache. Sprites must not be in use.
+ */
+ret_t spcache_destroy(spcache_t * sc) {
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+
+  spcache_drop_all(sc);
+  pthread_mutex_destroy(&sc->mutex);
+  free(sc);
+  return RET_OK;
+}
+
+/**
+ * Drop all sprites, e.g. if the logic model is replaced.
+ */
+ret_t spcache_invalidate(spcache_t * sc) {
+  assert(sc != NULL);
+  if(sc == NULL) return RET_INV_PTR;
+
+  pthread_mutex_lock(&sc->mutex);
+  spcache_drop_all(sc);
+  pthread_mutex_unlock(&sc->mutex);
+  return RET_OK;
+}
+
+/**
+ * Look up a sprite. If a sprite is returned, it must be released with 
+ * spcache_release().
+ * @param version Is set to the template version, a new sprite has to be inserted with.
+ * @return Returns NULL, if there is no sprite for the key.
+ */
+spcache_sprite_t * spcache_get(spcache_t * sc, const spcache_key_t * key, unsigned long * version) {
+  spcache_sprite_t * sprite;
+
+  assert(sc != NULL);
+  assert(key != NULL);
+  assert(version != NULL);
+  if(sc == NULL || key == NULL || version == NULL) return NULL;
+
+  pthread_mutex_lock(&sc->mutex);
+
+  unsigned long template_version = lmodel_get_template_version();
+  if(template_version != sc->template_version) {
+    spcache_drop_all(sc);
+    sc->template_version = template_version;
+  }
+  *version = template_version;
+
+  for(sprite = sc->buckets[spcache_hash(key)]; sprite != NULL; sprite = sprite->next)
+    if(spcache_key_equal(&sprite->key, key)) {
+      sprite->refs++;
+      sprite->last_used = ++sc->clock;
+      break;
+    }
+
+  pthread_mutex_unlock(&sc->mutex);
+  return sprite;
+}
+
+/** Drop least recently used sprites, that are not in use, until the cache fits. */
+static void spcache_evict(spcache_t * sc) {
+  unsigned int i;
+
+  while(sc->size > sc->max_size) {
+    spcache_sprite_t ** lru = NULL, ** link;
+
+    for(i = 0; i < SPCACHE_NUM_BUCKETS; i++)
+      for(link = &sc->buckets[i]; *link != NULL; link = &(*link)->next)
+	if((*link)->refs == 0 && (lru == NULL || (*link)->last_used < (*lru)->last_used)) lru = link;
+
+    if(lru == NULL) return;
+    spcache_drop(sc, lru);
+  }
+}
+
+/**
+ * Insert a rendered sprite. The cache takes the ownership of the image. If 
+ * another thread inserted a sprite for the key in the meantime, that sprite is 
+ * returned instead. Sprites, that were rendered from an outdated template version,
+ * are returned, but not cached.
+ * @param version The version, spcache_get() returned, before the sprite was rendered.
+ * @return Returns the sprite, that must be released with spcache_release(), or NULL.
+ */
+spcache_sprite_t * spcache_insert(spcache_t * sc, const spcache_key_t * key, unsigned long version,
+				  image_t * img, int offset_x, int offset_y) {
+  spcache_sprite_t * sprite;
+
+  assert(sc != NULL);
+  assert(key != NULL);
+  assert(img != NULL);
+  if(sc == NULL || key == NULL || img == NULL) return NULL;
+
+  if((sprite = (spcache_sprite_t *)malloc(sizeof(spcache_sprite_t))) == NULL) {
+    gr_image_destroy(img);
+    return NULL;
+  }
+  memset(sprite, 0, sizeof(spcache_sprite_t));
+  sprite->key = *key;
+  sprite->img = img;
+  sprite->offset_x = offset_x;
+  sprite->offset_y = offset_y;
+  sprite->refs = 1;
+
+  pthread_mutex_lock(&sc->mutex);
+
+  if(version != sc->template_version || version != lmodel_get_template_version()) 
+    sprite->stale = 1;
+  else {
+    unsigned int bucket = spcache_hash(key);
+    spcache_sprite_t * existing;
+
+    for(existing = sc->buckets[bucket]; existing != NULL; existing = existing->next)
+      if(spcache_key_equal(&existing->key, key)) break;
+
+    if(existing != NULL) {
+      existing->refs++;
+      existing->last_used = ++sc->clock;
+      spcache_free_sprite(sprite);
+      sprite = existing;
+    }
+    else {
+      sprite->last_used = ++sc->clock;
+      sprite->next = sc->buckets[bucket];
+      sc->buckets[bucket] = sprite;
+      sc->size += spcache_sprite_size(sprite);
+      spcache_evict(sc);
+    }
+  }
+
+  pthread_mutex_unlock(&sc->mutex);
+  return sprite;
+}
+
+/**
+ * Release a sprite, that was returned by spcache_get() or spcache_insert().
+ */
+void spcache_release(spcache_t * sc, spcache_sprite_t * sprite) {
+  assert(sc != NULL);
+  assert(sprite != NULL);
+  if(sc == NULL || sprite == NULL) return;
+
+  pthread_mutex_lock(&sc->mutex);
+  assert(sprite->refs > 0);
+  if(--sprite->refs == 0 && sprite->stale) spcache_free_sprite(sprite);
+  pthread_mutex_unlock(&sc->mutex);
+}
+
+/**
+ * Stamp a sprite, so that the upper left corner of the gate is at the screen
+ * position (x, y). The sprite is clipped to the image.
+ */
+ret_t spcache_blit(image_t * dst_img, const spcache_sprite_t * sprite, int x, int y) {
+  int row;
+
+  assert(dst_img != NULL);
+  assert(sprite != NULL);
+  if(dst_img == NULL || sprite == NULL) return RET_INV_PTR;
+
+  rgba_view_t dst(dst_img);
+  rgba_view_t src(sprite->img);
+
+  int min_x = x - sprite->offset_x, min_y = y - sprite->offset_y;
+  int from_x = MAX(min_x, 0), to_x = MIN(min_x + (int)src.width, (int)dst.width);
+  int from_y = MAX(min_y, 0), to_y = MIN(min_y + (int)src.height, (int)dst.height);
+  if(from_x >= to_x) return RET_OK;
+
+  for(row = from_y; row < to_y; row++)
+    blend_premultiplied_span(dst.ptr(from_x, row), src.ptr(from_x - min_x, row - min_y), to_x - from_x);
+
+  return RET_OK;
+}
@@ -0,0 +1,90 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#ifndef __SPRITE_CACHE_H__
+#define __SPRITE_CACHE_H__
+
+#include <pthread.h>
+#include "globals.h"
+#include "graphics.h"
+#include "logic_model.h"
+
+/**
+ * Cache for pre-rendered gates. All gates of a template look alike at a given
+ * scaling, if they have the same size, orientation and selection state. Their 
+ * frame, filling, template name and ports are rendered once into a sprite,
+ * that is stamped for each gate.
+ *
+ * Sprites are premultiplied, see blend_premultiplied(). All sprites are dropped,
+ * if a gate template changes (see lmodel_get_template_version()). If the cache
+ * exceeds its size, the least recently used sprites are dropped.
+ */
+
+#define SPCACHE_NUM_BUCKETS 256
+#define SPCACHE_DEFAULT_SIZE (32 * 1024 * 1024) // bytes of sprite images
+
+typedef struct {
+  const lmodel_gate_template_t * tmpl;
+  LM_TEMPLATE_ORIENTATION orientation;
+  int select_state;
+  unsigned int width, height;    // size of the gate in real pixels
+  double scaling_x, scaling_y;
+  color_t gate_area_color;       // default colours of the render params
+  color_t port_color;
+} spcache_key_t;
+
+typedef struct spcache_sprite spcache_sprite_t;
+
+struct spcache_sprite {
+  spcache_key_t key;
+  image_t * img;
+  int offset_x, offset_y;  // position of the upper left corner of the gate in the sprite
+
+  unsigned int refs;       // sprites are not freed, while they are in use
+  int stale;               // dropped from the cache, freed after the last release
+  unsigned long last_used;
+  spcache_sprite_t * next;
+};
+
+typedef struct sprite_cache {
+  spcache_sprite_t * buckets[SPCACHE_NUM_BUCKETS];
+  size_t size, max_size;
+  unsigned long clock;
+  unsigned long template_version; // version of the templates, the sprites were rendered from
+
+  pthread_mutex_t mutex;
+} spcache_t;
+
+spcache_t * spcache_create(size_t max_size);
+ret_t spcache_destroy(spcache_t * sc);
+ret_t spcache_invalidate(spcache_t * sc);
+
+spcache_sprite_t * spcache_get(spcache_t * sc, const spcache_key_t * key, unsigned long * version);
+spcache_sprite_t * spcache_insert(spcache_t * sc, const spcache_key_t * key, unsigned long version,
+				  image_t * img, int offset_x, int offset_y);
+void spcache_release(spcache_t * sc, spcache_sprite_t * sprite);
+
+ret_t spcache_blit(image_t * dst_img, const spcache_sprite_t * sprite, int x, int y);
+
+#endif
@@ -33,6 +33,7 @@ along with degate. If not, see <http://www.gnu.org/licenses/>.
 #include <time.h>
 #include "globals.h"
 #include "plugins.h"
+#include "img_algorithms.h"
 #include "gui/GateSelectWin.h"
 #include "gui/TemplateMatchingParamsWin.h"
 
@@ -133,16 +134,6 @@ ret_t imgalgo_run_template_matching(image_t * master, image_t * _template,
 				    LM_TEMPLATE_ORIENTATION orientation,
 				    template_matching_params_t * matching_params);
 
-double imgalgo_calc_single_xcorr(const image_t * const master, 
-				 memory_map_t * const zero_mean_template, 
-				 memory_map_t * const summation_table_single,
-				 memory_map_t * const summation_table_squared,
-				 double sum_over_zero_mean_template,
-				 unsigned int x, unsigned int y);
-
-double calc_mean_for_img_area(image_t * img, unsigned int min_x, unsigned int min_y, 
-			      unsigned int width, unsigned int height);
-
 
 
 /** 
@@ -177,50 +168,6 @@ plugin_func_descr_t plugin_func_descriptions[] = {
 };
 
 
-inline double mm_get_double(memory_map_t * table, unsigned int x, unsigned int y) {
-  return *(double *)mm_get_ptr(table, x, y);
-}
-
-inline void mm_set_double(memory_map_t * table, unsigned int x, unsigned int y, double v) {
-  *(double *)mm_get_ptr(table, x, y) = v;
-}
-
-
-ret_t precalc_summation_tables(image_t * master_img, 
-			       memory_map_t * summation_table_single, 
-			       memory_map_t * summation_table_squared) {
-
-
-  unsigned int x, y;
-
-  for(y = 0; y < master_img->height; y++)
-    for(x = 0; x < master_img->width; x++) {
-      mm_set_double(summation_table_single, x, y, 0);
-      mm_set_double(summation_table_squared, x, y, 0);
-    }
-
-  for(y = 0; y < master_img->height; y++)
-    for(x = 0; x < master_img->width; x++) {
-
-      double f = gr_get_greyscale_pixval(master_img, x, y);
-
-      double s_l = x > 0 ? mm_get_double(summation_table_single, x - 1, y) : 0;
-      double s_o = y > 0 ? mm_get_double(summation_table_single, x, y - 1) : 0;
-      double s_lo = x > 0 && y > 0 ? mm_get_double(summation_table_single, x - 1, y - 1) : 0;
-
-
-      double s2_l = x > 0 ? mm_get_double(summation_table_squared, x - 1, y) : 0;
-      double s2_o = y > 0 ? mm_get_double(summation_table_squared, x, y - 1) : 0;
-      double s2_lo = x > 0 && y > 0 ? mm_get_double(summation_table_squared, x - 1, y - 1) : 0;
-
-      double f1 = f + s_l + s_o - s_lo;
-      double f2 = f*f + s2_l + s2_o - s2_lo;
-
-      mm_set_double(summation_table_single, x, y, f1);
-      mm_set_double(summation_table_squared, x, y, f2);
-    }
-  return RET_OK;
-}
 
 /* These functions are called back from the main application within
    a thread. 
@@ -287,6 +234,12 @@ ret_t template_matching(plugin_params_t * pparams) {
   if(matching_params->max_x >= master_img->width) matching_params->max_x = master_img->width - 1;
   if(matching_params->max_y >= master_img->height) matching_params->max_y = master_img->height - 1;
 
+  if(RET_IS_NOT_OK(ret = scalmgr_ensure_region(pparams->project->scaling_manager, layer, 
+					       lrint(scale_down),
+					       matching_params->min_x, matching_params->min_y,
+					       matching_params->max_x, matching_params->max_y))) 
+    return ret;
+
   debug(TM, "matching on layer = %d", layer);
 
   /************************************************************************************
@@ -300,7 +253,7 @@ ret_t template_matching(plugin_params_t * pparams) {
 					 matching_params->max_y - matching_params->min_y, 
 					 IMAGE_TYPE_GS)) == NULL) { ret = RET_ERR; goto error; }
   
-  if(RET_IS_NOT_OK(ret = gr_map_temp_file(master_img_gs_sd, 
+  if(RET_IS_NOT_OK(ret = gr_map_scratch(master_img_gs_sd, 
 					  pparams->project->project_dir))) goto error;
   
   // implicit conversion to gs
@@ -313,7 +266,7 @@ ret_t template_matching(plugin_params_t * pparams) {
 				      pparams->max_y - pparams->min_y, 
 				      IMAGE_TYPE_GS)) == NULL) { ret = RET_ERR; goto error; }
   
-  if(RET_IS_NOT_OK(ret = gr_map_temp_file(master_img_gs, 
+  if(RET_IS_NOT_OK(ret = gr_map_scratch(master_img_gs, 
 					  pparams->project->project_dir))) goto error;
   
   // implicit conversion to gs
@@ -332,7 +285,7 @@ ret_t template_matching(plugin_params_t * pparams) {
 		matching_params->max_y - matching_params->min_y, 
 		sizeof(double))) == NULL) { ret = RET_ERR; goto error; }
   
-  if(RET_IS_NOT_OK(ret = mm_map_temp_file(matching_params->summation_table_single_sd, 
+  if(RET_IS_NOT_OK(ret = mm_map_scratch(matching_params->summation_table_single_sd, 
 					  pparams->project->project_dir))) goto error;
 
 
@@ -341,11 +294,11 @@ ret_t template_matching(plugin_params_t * pparams) {
 		matching_params->max_y - matching_params->min_y, 
 		sizeof(double))) == NULL) goto error;
 
-  if(RET_IS_NOT_OK(ret = mm_map_temp_file(matching_params->summation_table_squared_sd, 
+  if(RET_IS_NOT_OK(ret = mm_map_scratch(matching_params->summation_table_squared_sd, 
 					  pparams->project->project_dir))) goto error;
 
 
-  if(RET_IS_NOT_OK(ret = precalc_summation_tables(master_img_gs_sd, 
+  if(RET_IS_NOT_OK(ret = imgalgo_precalc_summation_tables(master_img_gs_sd, 
 						  matching_params->summation_table_single_sd, 
 						  matching_params->summation_table_squared_sd))) goto error;
 
@@ -356,7 +309,7 @@ ret_t template_matching(plugin_params_t * pparams) {
       mm_create(pparams->max_x - pparams->min_x, pparams->max_y - pparams->min_y, 
 		sizeof(double))) == NULL) { ret = RET_ERR; goto error; }
   
-  if(RET_IS_NOT_OK(ret = mm_map_temp_file(matching_params->summation_table_single, 
+  if(RET_IS_NOT_OK(ret = mm_map_scratch(matching_params->summation_table_single, 
 					  pparams->project->project_dir))) goto error;
 
 
@@ -364,10 +317,10 @@ ret_t template_matching(plugin_params_t * pparams) {
       mm_create(pparams->max_x - pparams->min_x, pparams->max_y - pparams->min_y, 
 		sizeof(double))) == NULL) goto error;
 
-  if(RET_IS_NOT_OK(ret = mm_map_temp_file(matching_params->summation_table_squared,
+  if(RET_IS_NOT_OK(ret = mm_map_scratch(matching_params->summation_table_squared,
 					  pparams->project->project_dir))) goto error;
 
-  if(RET_IS_NOT_OK(ret = precalc_summation_tables(master_img_gs, 
+  if(RET_IS_NOT_OK(ret = imgalgo_precalc_summation_tables(master_img_gs, 
 						  matching_params->summation_table_single,
 						  matching_params->summation_table_squared))) goto error;
 
@@ -392,6 +345,12 @@ ret_t template_matching(plugin_params_t * pparams) {
     unsigned int tmpl_pos_max_y = lrint((double)gate_template->master_image_max_y / (double)scale_down);
     if(tmpl_pos_max_x >= master_img->width) tmpl_pos_max_x = master_img->width - 1;
     if(tmpl_pos_max_y >= master_img->height) tmpl_pos_max_y = master_img->height - 1;
+
+    // the master region may lie outside of the search region
+    if(RET_IS_NOT_OK(ret = scalmgr_ensure_region(pparams->project->scaling_manager, layer, 
+						 lrint(scale_down),
+						 tmpl_pos_min_x, tmpl_pos_min_y,
+						 tmpl_pos_max_x, tmpl_pos_max_y))) goto error;
     
     if((_template_sd = gr_extract_image_as_gs(master_img_sd,
 					      tmpl_pos_min_x, tmpl_pos_min_y,
@@ -900,22 +859,6 @@ TEMPLATE_MATCHING_STATE get_next_pos(unsigned int * x, unsigned int * y,
 
 }
 
-double subtract_mean(image_t * img, memory_map_t * zero_mean_img) {
-  
-  double mean = calc_mean_for_img_area(img, 0, 0, img->width, img->height);
-  double sum_over_zero_mean_img = 0;
-  unsigned int x, y;
-
-  for(y = 0; y < img->height; y++) 
-    for(x = 0; x < img->width; x++) {
-      double tmp = (double)gr_get_greyscale_pixval(img, x, y) - mean;
-      mm_set_double( zero_mean_img, x, y, tmp);
-      sum_over_zero_mean_img += tmp * tmp;
-    }
-
-  return sum_over_zero_mean_img;
-}
-
 ret_t imgalgo_run_template_matching(image_t * master, image_t * _template,
 				    unsigned int min_x, unsigned int min_y,
 				    unsigned int max_x, unsigned int max_y,
@@ -956,8 +899,8 @@ ret_t imgalgo_run_template_matching(image_t * master, image_t * _template,
   }
   if(RET_IS_NOT_OK(ret = mm_alloc_memory(zero_mean_template_sd))) goto error;
 
-  sum_over_zero_mean_template = subtract_mean(_template, zero_mean_template);
-  sum_over_zero_mean_template_sd = subtract_mean(sd_template, zero_mean_template_sd);
+  sum_over_zero_mean_template = imgalgo_subtract_mean(_template, zero_mean_template);
+  sum_over_zero_mean_template_sd = imgalgo_subtract_mean(sd_template, zero_mean_template_sd);
 
 
   while( matching_params->stop_algorithm == 0 && 
@@ -1010,71 +953,3 @@ ret_t imgalgo_run_template_matching(image_t * master, image_t * _template,
   
   return ret;
 }
-
-double calc_mean_for_img_area(image_t * img, unsigned int min_x, unsigned int min_y, 
-			      unsigned int width, unsigned int height) {
-  double mean = 0;
-  unsigned int x,y;
-  assert(width > 0 && height > 0);
-  assert(min_x + width <= img->width);
-  assert(min_y + height <= img->height);
-
-  for(y = min_y; y < min_y + height; y++)
-    for(x = min_x; x < min_x + width; x++)
-      mean += gr_get_greyscale_pixval(img, x, y);
-
-  return mean / (width * height);
-}
-
-
-double imgalgo_calc_single_xcorr(const image_t * const master, 
-				 memory_map_t * const zero_mean_template, 
-				 memory_map_t * const summation_table_single,
-				 memory_map_t * const summation_table_squared,
-				 double sum_over_zero_mean_template,
-				 unsigned int local_x, unsigned int local_y) {
-
-  double template_size = zero_mean_template->width * zero_mean_template->height;
-
-  unsigned int 
-    x_plus_w = local_x + zero_mean_template->width -1,
-    y_plus_h = local_y + zero_mean_template->height -1,
-    lxm1 = local_x - 1,
-    lym1 = local_y - 1;
-  
-  // calulate denominator
-  double 
-    f1 = mm_get_double(summation_table_single, x_plus_w, y_plus_h),
-    f2 = mm_get_double(summation_table_squared, x_plus_w, y_plus_h);
-  
-  if(local_x > 0) {
-    f1 -= mm_get_double(summation_table_single, lxm1, y_plus_h);
-    f2 -= mm_get_double(summation_table_squared, lxm1, y_plus_h);
-  }
-  if(local_y > 0) {
-    f1 -= mm_get_double(summation_table_single, x_plus_w, lym1);
-    f2 -= mm_get_double(summation_table_squared, x_plus_w, lym1);
-  }
-  if(local_x > 0 && local_y > 0) {
-    f1 += mm_get_double(summation_table_single, lxm1, lym1);
-    f2 += mm_get_double(summation_table_squared, lxm1, lym1);
-  }
-  
-  double denominator = sqrt((f2 - f1*f1/template_size) * sum_over_zero_mean_template);
-  
-  // calculate nummerator
-  
-  unsigned int _x, _y;
-  double nummerator = 0;
-
-  for(_y = 0; _y < zero_mean_template->height; _y ++) {
-    for(_x = 0; _x < zero_mean_template->width; _x ++) {
-      double f_xy = gr_get_greyscale_pixval(master, _x + local_x, _y + local_y);
-      double t_xy = mm_get_double(zero_mean_template, _x, _y);
-      nummerator += f_xy * t_xy;
-      
-    }
-  }
-  
-  return nummerator/denominator;
-}
@@ -0,0 +1,111 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#ifndef __RENDER_FIXTURE_H__
+#define __RENDER_FIXTURE_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <logic_model.h>
+#include <globals.h>
+
+/**
+ * Fixture of the renderer tests: a logic model with a single logic layer and a
+ * renderer without render functions. Each test adds the render functions and the
+ * objects it checks. The definitions are not static, so the header must only be
+ * included by the single source file of a test.
+ */
+
+#define SIZE 2048
+
+logic_model_t * lmodel;
+render_params_t render_params;
+renderer_t * renderer;
+
+void fixture_setup(void) {
+  // the font is searched in $DEGATE_HOME
+  setenv("DEGATE_HOME", ".", 0);
+  assert((renderer = renderer_create()) != NULL);
+
+  assert((lmodel = lmodel_create(1, SIZE, SIZE)) != NULL);
+  assert(RET_IS_OK(lmodel_set_layer_type(lmodel, 0, LM_LAYER_TYPE_LOGIC)));
+
+  memset(&render_params, 0, sizeof(render_params_t));
+  renderer_initialize_params(&render_params);
+  render_params.lmodel = lmodel;
+
+  srand(42);
+}
+
+/**
+ * Add gates at random positions. If requested, a via is placed into each gate.
+ */
+void fixture_add_random_gates(unsigned int num, int with_vias) {
+  unsigned int i;
+  for(i = 0; i < num; i++) {
+    unsigned int x = 100 + rand() % (SIZE - 300), y = 100 + rand() % (SIZE - 300);
+    lmodel_gate_t * gate = lmodel_create_gate(lmodel, x, y, x + 20 + rand() % 80, y + 20 + rand() % 80, 
+					      NULL, strdup("GATE"), 0);
+    assert(gate != NULL);
+    assert(RET_IS_OK(lmodel_add_gate(lmodel, 0, gate)));
+
+    if(with_vias) {
+      lmodel_via_t * via = lmodel_create_via(lmodel, x + 10, y + 10, LM_VIA_UP, 4 + rand() % 8, NULL, 0);
+      assert(via != NULL);
+      assert(RET_IS_OK(lmodel_add_via(lmodel, 0, via)));
+    }
+  }
+}
+
+/**
+ * Add wires at random positions with a via at the end of each wire.
+ */
+void fixture_add_random_wires(unsigned int num) {
+  unsigned int i;
+  for(i = 0; i < num; i++) {
+    // objects must not reach the border of the logic model
+    unsigned int x = 100 + rand() % (SIZE - 200), y = 100 + rand() % (SIZE - 200);
+    int dx = rand() % 800 - 400, dy = rand() % 800 - 400;
+    unsigned int to_x = MIN(MAX((int)x + dx, 100), SIZE - 100);
+    unsigned int to_y = MIN(MAX((int)y + dy, 100), SIZE - 100);
+    lmodel_wire_t * wire = lmodel_create_wire(lmodel, x, y, to_x, to_y, 2 + rand() % 6, NULL, 0);
+    assert(wire != NULL);
+    assert(RET_IS_OK(lmodel_add_wire(lmodel, 0, wire)));
+
+    lmodel_via_t * via = lmodel_create_via(lmodel, to_x, to_y, LM_VIA_UP, 4 + rand() % 8, NULL, 0);
+    assert(via != NULL);
+    assert(RET_IS_OK(lmodel_add_via(lmodel, 0, via)));
+  }
+}
+
+int images_equal(image_t * a, image_t * b) {
+  return a->width == b->width && a->height == b->height &&
+    memcmp(a->map->mem, b->map->mem, a->width * a->height * BYTES_PER_PIXEL) == 0;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <graphics.h>
+#include <scaling_manager.h>
+#include <alignment_marker.h>
+#include <fft.h>
+#include <registration.h>
+#include <globals.h>
+
+#define DEBUG
+
+#define EPSILON 1.5
+#define CHECK_DIST_OK(a, b) (fabs((double)a - (double)b)  < EPSILON)
+
+/* fft_1d() followed by the inverse transformation returns the input */
+void test01(void) {
+  fft_complex_t data[64];
+  double orig[64];
+  int i;
+
+  for(i = 0; i < 64; i++) {
+    orig[i] = rand() % 256;
+    data[i].re = orig[i];
+    data[i].im = 0;
+  }
+
+  assert(fft_1d(data, 64, 0) == RET_OK);
+
+  // the first coefficient is the sum of all values
+  double sum = 0;
+  for(i = 0; i < 64; i++) sum += orig[i];
+  assert(fabs(data[0].re - sum) < 1e-6);
+
+  assert(fft_1d(data, 64, 1) == RET_OK);
+  for(i = 0; i < 64; i++) {
+    assert(fabs(data[i].re - orig[i]) < 1e-6);
+    assert(fabs(data[i].im) < 1e-6);
+  }
+}
+
+/* fill an image with smoothed noise, so that it has structures of different sizes */
+void fill_texture(image_t * img) {
+  unsigned int x, y, i;
+  for(y = 0; y < img->height; y++)
+    for(x = 0; x < img->width; x++)
+      gr_set_greyscale_pixval(img, x, y, rand() % 256);
+
+  for(i = 0; i < 2; i++)
+    for(y = 0; y + 1 < img->height; y++)
+      for(x = 0; x + 1 < img->width; x++)
+	gr_set_greyscale_pixval(img, x, y, 
+				(gr_get_greyscale_pixval(img, x, y) + 
+				 gr_get_greyscale_pixval(img, x + 1, y) +
+				 gr_get_greyscale_pixval(img, x, y + 1) +
+				 gr_get_greyscale_pixval(img, x + 1, y + 1)) / 4);
+}
+
+/* phase correlation finds the translation between two windows */
+void test02(void) {
+  const unsigned int size = 64;
+  double a[size * size], b[size * size];
+  double shift_x, shift_y, peak;
+  unsigned int x, y;
+
+  image_t * img = gr_create_memory_image(size + 20, size + 20, IMAGE_TYPE_GS);
+  assert(img != NULL);
+  fill_texture(img);
+
+  for(y = 0; y < size; y++)
+    for(x = 0; x < size; x++) {
+      a[y * size + x] = gr_get_greyscale_pixval(img, x + 10, y + 10);
+      b[y * size + x] = gr_get_greyscale_pixval(img, x + 10 - 7, y + 10 + 4);
+    }
+  fft_apply_window(a, size);
+  fft_apply_window(b, size);
+
+  assert(fft_phase_correlation(a, b, size, &shift_x, &shift_y, &peak) == RET_OK);
+  printf("shift_x=%f shift_y=%f peak=%f\n", shift_x, shift_y, peak);
+  assert(CHECK_DIST_OK(shift_x, 7));
+  assert(CHECK_DIST_OK(shift_y, -4));
+  assert(peak > REG_MIN_CONFIDENCE);
+
+  gr_image_destroy(img);
+}
+
+/* register a layer, that is a scaled and translated copy of another layer */
+void test03(void) {
+  const unsigned int width = 1500, height = 1200;
+  const double scaling = 1.08, shift_x = 37, shift_y = -21;
+  char project_dir[] = "/tmp/degate_reg_test.XXXXXX";
+  image_t * bg_images[2];
+  double scaling_x[2], scaling_y[2];
+  int sx[2], sy[2];
+  reg_match_t match;
+
+  assert(mkdtemp(project_dir) != NULL);
+
+  bg_images[0] = gr_create_memory_image(width, height, IMAGE_TYPE_RGBA);
+  bg_images[1] = gr_create_memory_image(width, height, IMAGE_TYPE_RGBA);
+  assert(bg_images[0] != NULL && bg_images[1] != NULL);
+  fill_texture(bg_images[0]);
+
+  // upper(u) = lower(scaling * u + shift)
+  assert(gr_resample_affine(bg_images[0], bg_images[1], 1 / scaling, 1 / scaling, 
+			    -shift_x / scaling, -shift_y / scaling, 
+			    GR_INTERPOLATION_BILINEAR) == RET_OK);
+
+  scaling_manager_t * sm = scalmgr_create(2, bg_images, project_dir);
+  assert(sm != NULL);
+  assert(scalmgr_set_scalings(sm, 4) == RET_OK);
+  assert(scalmgr_load_scalings(sm) == RET_OK);
+
+  assert(reg_match_layers(sm, 0, 1, &match) == RET_OK);
+  printf("sx=%f sy=%f dx=%f dy=%f confidence=%f\n", match.scaling_x, match.scaling_y,
+	 match.shift_x, match.shift_y, match.confidence);
+  assert(match.confidence > REG_MIN_CONFIDENCE);
+  assert(fabs(match.scaling_x - scaling) < 0.005);
+  assert(fabs(match.scaling_y - scaling) < 0.005);
+  assert(CHECK_DIST_OK(match.shift_x, shift_x));
+  assert(CHECK_DIST_OK(match.shift_y, shift_y));
+
+  // the markers give the same transformation
+  alignment_marker_set_t * amset = amset_create(2);
+  assert(amset != NULL);
+  assert(reg_fill_alignment_markers(sm, amset) == RET_OK);
+  assert(amset_complete(amset) == 1);
+  assert(amset_calc_transformation(amset, scaling_x, scaling_y, sx, sy) == RET_OK);
+  assert(fabs(scaling_x[1] / scaling_x[0] - scaling) < 0.01);
+  assert(fabs(scaling_y[1] / scaling_y[0] - scaling) < 0.01);
+
+  amset_destroy(amset);
+  scalmgr_destroy(sm);
+  gr_image_destroy(bg_images[0]);
+  gr_image_destroy(bg_images[1]);
+
+  char cmd[100];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", project_dir);
+  system(cmd);
+}
+
+int main(void) {
+  test01();
+  test02();
+  test03();
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <graphics.h>
+#include <ccl.h>
+#include <globals.h>
+
+#define DEBUG
+
+#define EPSILON 0.01
+#define CHECK_OK(a, b) (fabs((double)(a) - (double)(b)) < EPSILON)
+
+/* label an image with a simple flood fill for comparison */
+unsigned int flood_label(image_t * img, uint32_t * labels, int conn8) {
+  unsigned int w = img->width, h = img->height, num = 0, i;
+  unsigned int * stack = (unsigned int *)malloc(w * h * sizeof(unsigned int));
+  assert(stack != NULL);
+  memset(labels, 0, w * h * sizeof(uint32_t));
+
+  for(i = 0; i < w * h; i++) {
+    if(labels[i] || gr_get_greyscale_pixval(img, i % w, i / w) <= 127) continue;
+    unsigned int sp = 0;
+    labels[i] = ++num;
+    stack[sp++] = i;
+    while(sp > 0) {
+      unsigned int p = stack[--sp];
+      int x = p % w, y = p / w, dx, dy;
+      for(dy = -1; dy <= 1; dy++)
+	for(dx = -1; dx <= 1; dx++) {
+	  int nx = x + dx, ny = y + dy;
+	  if((dx == 0 && dy == 0) || (!conn8 && dx != 0 && dy != 0)) continue;
+	  if(nx < 0 || ny < 0 || nx >= (int)w || ny >= (int)h) continue;
+	  unsigned int n = ny * w + nx;
+	  if(labels[n] == 0 && gr_get_greyscale_pixval(img, nx, ny) > 127) {
+	    labels[n] = num;
+	    stack[sp++] = n;
+	  }
+	}
+    }
+  }
+  free(stack);
+  return num;
+}
+
+/* the labeling of random images matches a flood fill */
+void test01(void) {
+  const unsigned int w = 700, h = 600;
+  uint32_t * ref = (uint32_t *)malloc(w * h * sizeof(uint32_t));
+  uint32_t * map = (uint32_t *)malloc((w * h + 1) * sizeof(uint32_t));
+  unsigned int x, y, conn8;
+  ccl_result_t result;
+
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  assert(img != NULL && ref != NULL && map != NULL);
+
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++)
+      gr_set_greyscale_pixval(img, x, y, rand() % 100 < 45 ? 0xff : 0);
+
+  for(conn8 = 0; conn8 < 2; conn8++) {
+    unsigned int num = flood_label(img, ref, conn8);
+
+    assert(ccl_label_image(img, 0, 0, w, h, 127, 
+			   conn8 ? CCL_CONNECTIVITY_8 : CCL_CONNECTIVITY_4,
+			   NULL, &result) == RET_OK);
+    printf("%s: %u components\n", conn8 ? "8-connectivity" : "4-connectivity", result.num_components);
+    assert(result.num_components == num);
+
+    // both labelings describe the same partition
+    memset(map, 0, (w * h + 1) * sizeof(uint32_t));
+    for(y = 0; y < h; y++)
+      for(x = 0; x < w; x++) {
+	uint32_t l = ccl_get_label(&result, x, y);
+	assert((l == 0) == (ref[y * w + x] == 0));
+	if(l == 0) continue;
+	if(map[l] == 0) map[l] = ref[y * w + x];
+	assert(map[l] == ref[y * w + x]);
+
+	ccl_component_t * c = &result.components[l - 1];
+	assert(x >= c->min_x && x <= c->max_x && y >= c->min_y && y <= c->max_y);
+      }
+
+    ccl_destroy_result(&result);
+  }
+
+  gr_image_destroy(img);
+  free(ref);
+  free(map);
+}
+
+void draw_rect(image_t * img, unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+  unsigned int x, y;
+  for(y = min_y; y <= max_y; y++)
+    for(x = min_x; x <= max_x; x++)
+      gr_set_greyscale_pixval(img, x, y, 0xff);
+}
+
+/* shape of wire like components, that span several tiles */
+void test02(void) {
+  ccl_result_t result;
+  int i;
+
+  image_t * img = gr_create_memory_image(1000, 800, IMAGE_TYPE_RGBA);
+  assert(img != NULL);
+  assert(mm_clear(img->map) == RET_OK);
+
+  draw_rect(img, 100, 200, 699, 203);  // horizontal wire
+  draw_rect(img, 900, 10, 905, 709);   // vertical wire
+  for(i = 0; i < 300; i++)             // diagonal wire
+    draw_rect(img, 50 + i, 300 + i, 52 + i, 300 + i);
+  draw_rect(img, 500, 600, 507, 607);  // via
+
+  assert(ccl_label_image(img, 0, 0, 1000, 800, 127, CCL_CONNECTIVITY_4, NULL, &result) == RET_OK);
+  assert(result.num_components == 4);
+
+  ccl_component_t * c = &result.components[ccl_get_label(&result, 100, 200) - 1];
+  assert(c->area == 600 * 4);
+  assert(c->min_x == 100 && c->max_x == 699 && c->min_y == 200 && c->max_y == 203);
+  assert(CHECK_OK(c->orientation, 0));
+  assert(CHECK_OK(c->major_axis, 600) && CHECK_OK(c->minor_axis, 4));
+  assert(CHECK_OK(c->center_x, 399.5) && CHECK_OK(c->center_y, 201.5));
+
+  c = &result.components[ccl_get_label(&result, 900, 10) - 1];
+  assert(CHECK_OK(fabs(c->orientation), M_PI / 2));
+  assert(CHECK_OK(c->major_axis, 700) && CHECK_OK(c->minor_axis, 6));
+
+  c = &result.components[ccl_get_label(&result, 50, 300) - 1];
+  printf("diagonal: orientation=%f major=%f minor=%f\n", c->orientation, c->major_axis, c->minor_axis);
+  assert(fabs(c->orientation - M_PI / 4) < 0.01);
+  assert(c->major_axis > 420 && c->minor_axis < 4);
+
+  c = &result.components[ccl_get_label(&result, 503, 603) - 1];
+  assert(c->area == 64);
+  assert(CHECK_OK(c->major_axis, 8) && CHECK_OK(c->minor_axis, 8));
+
+  ccl_destroy_result(&result);
+
+  // a region, that does not start at the origin
+  assert(ccl_label_image(img, 400, 150, 2000, 2000, 127, CCL_CONNECTIVITY_4, NULL, &result) == RET_OK);
+  assert(result.num_components == 3);
+  c = &result.components[ccl_get_label(&result, 400, 200) - 1];
+  assert(c->min_x == 400 && c->max_x == 699 && c->area == 300 * 4);
+  ccl_destroy_result(&result);
+
+  gr_image_destroy(img);
+}
+
+int main(void) {
+  test01();
+  test02();
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <graphics.h>
+#include <scaling_manager.h>
+#include <filter.h>
+#include <globals.h>
+
+#define DEBUG
+
+void fill_noise(image_t * img) {
+  unsigned int x, y;
+  for(y = 0; y < img->height; y++)
+    for(x = 0; x < img->width; x++)
+      gr_set_greyscale_pixval(img, x, y, rand() % 256);
+}
+
+static inline int clip(int v, int max_v) {
+  return v < 0 ? 0 : (v > max_v ? max_v : v);
+}
+
+/* reference for a box blur with the same fixed point rounding */
+void box_blur_ref(image_t * img, uint8_t * out, int r) {
+  int w = img->width, h = img->height, n = 2 * r + 1, x, y, i;
+  uint8_t * tmp = (uint8_t *)malloc(w * h);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) {
+      unsigned int sum = 0;
+      for(i = -r; i <= r; i++) sum += gr_get_greyscale_pixval(img, clip(x + i, w - 1), y);
+      tmp[y * w + x] = ((sum + n / 2) * (65536 / n)) >> 16;
+    }
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) {
+      unsigned int sum = 0;
+      for(i = -r; i <= r; i++) sum += tmp[clip(y + i, h - 1) * w + x];
+      out[y * w + x] = ((sum + n / 2) * (65536 / n)) >> 16;
+    }
+  free(tmp);
+}
+
+/* minimum over a square window */
+void erode_ref(image_t * img, uint8_t * out, int r) {
+  int w = img->width, h = img->height, x, y, i, j;
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) {
+      uint8_t v = 255;
+      for(j = -r; j <= r; j++)
+	for(i = -r; i <= r; i++)
+	  v = MIN(v, gr_get_greyscale_pixval(img, clip(x + i, w - 1), clip(y + j, h - 1)));
+      out[y * w + x] = v;
+    }
+}
+
+/* tiled filtering gives the same result as filtering the whole image */
+void test01(void) {
+  const unsigned int w = 700, h = 530;
+  filter_pipeline_t pipeline;
+  uint8_t * ref = (uint8_t *)malloc(w * h);
+  unsigned int x, y;
+
+  image_t * src = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * dst = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  assert(src != NULL && dst != NULL && ref != NULL);
+  fill_noise(src);
+
+  filter_pipeline_init(&pipeline);
+  assert(filter_pipeline_add(&pipeline, FILTER_BOX_BLUR, 3) == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  box_blur_ref(src, ref, 3);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++)
+      assert(gr_get_greyscale_pixval(dst, x, y) == ref[y * w + x]);
+
+  filter_pipeline_init(&pipeline);
+  assert(filter_pipeline_add(&pipeline, FILTER_ERODE, 2) == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  erode_ref(src, ref, 2);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++)
+      assert(gr_get_greyscale_pixval(dst, x, y) == ref[y * w + x]);
+
+  // a pipeline with a large border: filtering a region gives the same pixels
+  assert(filter_pipeline_parse(&pipeline, "gauss:2,close:1,lcn:8") == RET_OK);
+  assert(pipeline.num_stages == 3);
+  assert(filter_pipeline_get_border(&pipeline) == 6 + 2 + 16);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++)
+      ref[y * w + x] = gr_get_greyscale_pixval(dst, x, y);
+
+  image_t * dst2 = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  assert(dst2 != NULL);
+  assert(filter_apply(&pipeline, dst2, src, 260, 250, 300, 270) == RET_OK);
+  for(y = 250; y < 512; y++)
+    for(x = 256; x < 512; x++)
+      assert(gr_get_greyscale_pixval(dst2, x, y) == ref[y * w + x]);
+
+  gr_image_destroy(dst2);
+  gr_image_destroy(src);
+  gr_image_destroy(dst);
+  free(ref);
+}
+
+/* properties of the filters */
+void test02(void) {
+  const unsigned int w = 300, h = 200;
+  filter_pipeline_t pipeline;
+  char str[100];
+  unsigned int x, y;
+
+  image_t * src = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  image_t * dst = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  assert(src != NULL && dst != NULL);
+
+  // blurring and normalizing a constant image
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) gr_set_greyscale_pixval(src, x, y, 77);
+
+  assert(filter_pipeline_parse(&pipeline, "gauss:3.5") == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) assert(gr_get_greyscale_pixval(dst, x, y) == 77);
+
+  assert(filter_pipeline_parse(&pipeline, "lcn:5") == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) assert(gr_get_greyscale_pixval(dst, x, y) == 128);
+
+  // opening removes small bright spots, closing fills small dark holes
+  gr_set_greyscale_pixval(src, 100, 100, 200);
+  gr_set_greyscale_pixval(src, 150, 100, 10);
+  assert(filter_pipeline_parse(&pipeline, "open:1") == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  assert(gr_get_greyscale_pixval(dst, 100, 100) == 77);
+  assert(gr_get_greyscale_pixval(dst, 150, 100) == 10);
+  assert(filter_pipeline_parse(&pipeline, "close:1") == RET_OK);
+  assert(filter_apply(&pipeline, dst, src, 0, 0, w, h) == RET_OK);
+  assert(gr_get_greyscale_pixval(dst, 100, 100) == 200);
+  assert(gr_get_greyscale_pixval(dst, 150, 100) == 77);
+
+  // the text format
+  assert(filter_pipeline_parse(&pipeline, "box:2, gauss:1.5,dilate:1") == RET_OK);
+  assert(filter_pipeline_format(&pipeline, str, sizeof(str)) == RET_OK);
+  assert(strcmp(str, "box:2,gauss:1.5,dilate:1") == 0);
+  assert(filter_pipeline_parse(&pipeline, "blur:2") != RET_OK);
+  assert(filter_pipeline_parse(&pipeline, "box:100") != RET_OK);
+  assert(pipeline.num_stages == 3);
+  assert(filter_pipeline_parse(&pipeline, "") == RET_OK);
+  assert(pipeline.num_stages == 0);
+
+  gr_image_destroy(src);
+  gr_image_destroy(dst);
+}
+
+/* the cache follows changes of the pipeline and of the background image */
+void test03(void) {
+  const unsigned int w = 600, h = 400;
+  char project_dir[] = "/tmp/degate_filter_test.XXXXXX";
+  filter_pipeline_t pipeline;
+  unsigned int x, y;
+
+  assert(mkdtemp(project_dir) != NULL);
+  image_t * bg = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_GS);
+  assert(bg != NULL && ref != NULL);
+  fill_noise(bg);
+
+  scaling_manager_t * sm = scalmgr_create(1, &bg, project_dir);
+  assert(sm != NULL);
+  filter_cache_t * fc = filter_cache_create(sm);
+  assert(fc != NULL);
+
+  assert(filter_pipeline_parse(&pipeline, "dilate:2") == RET_OK);
+  assert(filter_cache_set_pipeline(fc, &pipeline) == RET_OK);
+  assert(filter_cache_ensure_region(fc, 0, 0, 0, w - 1, h - 1) == RET_OK);
+  image_t * img = filter_cache_get_image(fc, 0);
+  assert(img != NULL);
+  assert(filter_apply(&pipeline, ref, bg, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(memcmp(img->map->mem, ref->map->mem, w * h) == 0);
+
+  // a new pipeline
+  assert(filter_pipeline_parse(&pipeline, "box:1") == RET_OK);
+  assert(filter_cache_set_pipeline(fc, &pipeline) == RET_OK);
+  assert(filter_cache_ensure_region(fc, 0, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(filter_apply(&pipeline, ref, bg, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(memcmp(img->map->mem, ref->map->mem, w * h) == 0);
+
+  // a changed background image
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++) gr_set_greyscale_pixval(bg, x, y, x ^ y);
+  assert(scalmgr_invalidate_region(sm, 0, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(filter_cache_ensure_region(fc, 0, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(filter_apply(&pipeline, ref, bg, 0, 0, w - 1, h - 1) == RET_OK);
+  assert(memcmp(img->map->mem, ref->map->mem, w * h) == 0);
+
+  filter_cache_destroy(fc);
+  scalmgr_destroy(sm);
+  gr_image_destroy(bg);
+  gr_image_destroy(ref);
+
+  char cmd[100];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", project_dir);
+  system(cmd);
+}
+
+int main(void) {
+  test01();
+  test02();
+  test03();
+  return 0;
+}
@@ -0,0 +1,341 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <render_cache.h>
+#include <logic_model.h>
+#include <parallel.h>
+#include <scaling_manager.h>
+#include <globals.h>
+
+#define DEBUG
+
+#include "render_fixture.h"
+
+void setup(void) {
+  fixture_setup();
+
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+  renderer_add_layer(renderer, (render_func_t) &render_wires, &render_params, 1, "Wires");
+  renderer_add_layer(renderer, (render_func_t) &render_vias, &render_params, 1, "Vias");
+
+  fixture_add_random_gates(40, 0);
+  fixture_add_random_wires(200);
+}
+
+/* a view, that is composed from tiles, equals a view, that is rendered at once */
+void test01(void) {
+  unsigned int i, w = 700, h = 500;
+  double scalings[] = {0.5, 1, 2, 4};
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(ref != NULL && img != NULL && rc != NULL);
+
+  for(i = 0; i < 4; i++) {
+    double s = scalings[i];
+    // views, that start at whole screen pixels, are composed without rounding
+    unsigned int min_x = lrint((200 + 37 * i) * s), min_y = lrint((600 - 51 * i) * s);
+    unsigned int max_x = min_x + lrint(w * s), max_y = min_y + lrint(h * s);
+
+    gr_map_clear(ref);
+    render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+    assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+    assert(images_equal(ref, img));
+
+    // move the view, the tiles are taken from the cache
+    min_x += lrint(100 * s); max_x += lrint(100 * s);
+    gr_map_clear(ref);
+    render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+    assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+    assert(images_equal(ref, img));
+  }
+
+  rcache_destroy(rc);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+void on_damage(void * arg, LM_OBJECT_TYPE object_type, void * obj_ptr) {
+  rcache_invalidate_object((rcache_t *) arg, object_type, obj_ptr);
+}
+
+/* changes of the logic model invalidate the tiles around the changed objects */
+void test02(void) {
+  unsigned int i, w = 600, h = 600, min_x = 512, min_y = 512;
+  unsigned int max_x = min_x + w, max_y = min_y + h;
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(ref != NULL && img != NULL && rc != NULL);
+
+  lmodel_set_damage_callback(&on_damage, rc);
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+
+  unsigned int num_valid = 0;
+  for(i = 0; i < rc->num_tiles; i++) if(rc->tiles[i].valid) num_valid++;
+  assert(num_valid == 9);
+
+  // a via in the center tile
+  lmodel_via_t * via = lmodel_create_via(lmodel, 900, 900, LM_VIA_DOWN, 10, NULL, 0);
+  assert(RET_IS_OK(lmodel_add_via(lmodel, 0, via)));
+
+  num_valid = 0;
+  for(i = 0; i < rc->num_tiles; i++) if(rc->tiles[i].valid) num_valid++;
+  assert(num_valid < 9);
+
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+  assert(images_equal(ref, img));
+
+  // selection
+  assert(RET_IS_OK(lmodel_set_select_state(LM_TYPE_VIA, via, SELECT_STATE_DIRECT)));
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+  assert(images_equal(ref, img));
+
+  assert(RET_IS_OK(lmodel_remove_object_by_ptr(lmodel, 0, via, LM_TYPE_VIA)));
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+  assert(images_equal(ref, img));
+
+  // render params and enabled render functions
+  render_params.wire_color = 0xff00ff00;
+  renderer_toggle_render_func(renderer, 0);
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+  assert(images_equal(ref, img));
+  renderer_toggle_render_func(renderer, 0);
+
+  lmodel_set_damage_callback(NULL, NULL);
+  rcache_destroy(rc);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* a view, that is rendered in parallel bands, equals a view, that is rendered at once */
+void test03(void) {
+  unsigned int i, w = 640, h = 479;
+  double scalings[] = {0.37, 1, 3.3};
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(ref != NULL && img != NULL);
+
+  par_set_num_threads(4);
+
+  for(i = 0; i < 3; i++) {
+    double s = scalings[i];
+    unsigned int min_x = 150 + 43 * i, min_y = 220 + 17 * i;
+    unsigned int max_x = min_x + lrint(w * s), max_y = min_y + lrint(h * s);
+
+    renderer_set_parallel(renderer, 0);
+    gr_map_clear(ref);
+    render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+
+    renderer_set_parallel(renderer, 1);
+    gr_map_clear(img);
+    render_region(renderer, img, 0, min_x, min_y, max_x, max_y);
+    assert(images_equal(ref, img));
+  }
+
+  par_set_num_threads(0);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* the background is blitted by spans for zoom in, zoom out and non integer scalings */
+void test04(void) {
+  unsigned int i, x, y, w = 320, h = 200;
+  const unsigned int bg_w = 1000, bg_h = 700;
+  double scalings[] = {0.25, 0.4, 1, 1.6, 2, 3};
+  char project_dir[] = "/tmp/degate_render_test.XXXXXX";
+
+  assert(mkdtemp(project_dir) != NULL);
+  image_t * bg = gr_create_memory_image(bg_w, bg_h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(bg != NULL && img != NULL);
+  for(y = 0; y < bg_h; y++)
+    for(x = 0; x < bg_w; x++) gr_set_pixval(bg, x, y, rand() | 0xff000000);
+
+  scaling_manager_t * sm = scalmgr_create(1, &bg, project_dir);
+  assert(sm != NULL);
+
+  render_params_t bg_params;
+  memset(&bg_params, 0, sizeof(render_params_t));
+  renderer_initialize_params(&bg_params);
+  bg_params.bg_images = &bg;
+  bg_params.scaling_manager = sm;
+
+  renderer_t * bg_renderer = renderer_create();
+  assert(bg_renderer != NULL);
+  renderer_add_layer(bg_renderer, (render_func_t) &render_background, &bg_params, 1, "Background");
+  renderer_set_parallel(bg_renderer, 0);
+
+  for(i = 0; i < 6; i++) {
+    double s = scalings[i];
+    // the view reaches beyond the right and lower border of the background image
+    unsigned int min_x = bg_w - lrint(w * s * 0.7), min_y = bg_h - lrint(h * s * 0.6);
+    unsigned int max_x = min_x + lrint(w * s), max_y = min_y + lrint(h * s);
+
+    render_region(bg_renderer, img, 0, min_x, min_y, max_x, max_y);
+
+    for(y = 0; y < h; y++)
+      for(x = 0; x < w; x++) {
+	unsigned int src_x = (unsigned int)(min_x + x * s), src_y = (unsigned int)(min_y + y * s);
+	uint32_t expected = src_x < bg_w && src_y < bg_h ? gr_get_pixval(bg, src_x, src_y) : 0;
+	assert(gr_get_pixval(img, x, y) == expected);
+      }
+  }
+
+  renderer_destroy(bg_renderer);
+  scalmgr_destroy(sm);
+  gr_image_destroy(bg);
+  gr_image_destroy(img);
+  rmdir(project_dir);
+}
+
+/* frame statistics count objects per render function and cached tiles */
+void test05(void) {
+  unsigned int i, w = 512, h = 512;
+  renderer_stats_t stats;
+  image_t * img = gr_create_memory_image(SIZE, SIZE, IMAGE_TYPE_RGBA);
+  image_t * view = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(img != NULL && view != NULL && rc != NULL);
+
+  renderer_reset_stats(renderer);
+  assert(RET_IS_OK(renderer_get_stats(renderer, &stats)));
+  assert(stats.num_frames == 0 && stats.frame_time == 0);
+
+  // regions outside of a frame, e.g. exports, are not counted
+  gr_map_clear(img);
+  render_region(renderer, img, 0, 0, 0, SIZE, SIZE);
+
+  // objects, that span several bands, are counted once
+  renderer_begin_frame(renderer);
+  gr_map_clear(img);
+  render_region(renderer, img, 0, 0, 0, SIZE, SIZE);
+  renderer_end_frame(renderer);
+
+  assert(RET_IS_OK(renderer_get_stats(renderer, &stats)));
+  assert(stats.num_frames == 1 && stats.frame_time > 0);
+  assert(stats.frame_time_p50 == stats.frame_time && stats.frame_time_p99 == stats.frame_time);
+  assert(stats.funcs[0].objects_visited == 40 && stats.funcs[0].objects_drawn == 40);
+  assert(stats.funcs[1].objects_visited == 200 && stats.funcs[1].objects_drawn == 200);
+  assert(stats.funcs[2].objects_visited == 200 && stats.funcs[2].objects_drawn == 200);
+  for(i = 0; i < 3; i++) assert(stats.funcs[i].time > 0);
+  assert(stats.cache_hits == 0 && stats.cache_misses == 0);
+
+  // the first view renders all tiles, the second one takes them from the cache
+  for(i = 0; i < 2; i++) {
+    renderer_begin_frame(renderer);
+    assert(RET_IS_OK(rcache_render_region(rc, view, 0, 0, 0, w, h)));
+    renderer_end_frame(renderer);
+
+    assert(RET_IS_OK(renderer_get_stats(renderer, &stats)));
+    assert(stats.num_frames == 2 + i);
+    assert(stats.cache_hits == (i == 0 ? 0 : 4) && stats.cache_misses == (i == 0 ? 4 : 0));
+    assert(i == 0 ? stats.funcs[0].objects_visited > 0 : stats.funcs[0].objects_visited == 0);
+    assert(stats.funcs[0].objects_drawn <= stats.funcs[0].objects_visited);
+  }
+  assert(stats.frame_time_p50 <= stats.frame_time_p99);
+
+  rcache_destroy(rc);
+  gr_image_destroy(img);
+  gr_image_destroy(view);
+}
+
+int invalidator_running;
+
+void * invalidator(void * arg) {
+  rcache_t * rc = (rcache_t *) arg;
+  unsigned int i = 0;
+  while(__sync_fetch_and_add(&invalidator_running, 0)) {
+    if(i++ % 2) rcache_invalidate_all(rc);
+    else rcache_invalidate_region(rc, 600, 600, 700, 700);
+    usleep(100);
+  }
+  return NULL;
+}
+
+/* tiles may be invalidated from other threads, while a view is rendered */
+void test06(void) {
+  unsigned int i, w = 600, h = 400, min_x = 300, min_y = 400;
+  unsigned int max_x = min_x + w, max_y = min_y + h;
+  pthread_t thread;
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, 1);
+  assert(ref != NULL && img != NULL && rc != NULL);
+
+  // the view doesn't fit into a single tile, until the cache is resized
+  assert(RET_IS_OK(rcache_set_num_tiles(rc, rcache_get_num_tiles_for_view(w, h))));
+  assert(rc->num_tiles == rcache_get_num_tiles_for_view(w, h));
+
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+
+  __sync_lock_test_and_set(&invalidator_running, 1);
+  assert(pthread_create(&thread, NULL, &invalidator, rc) == 0);
+  for(i = 0; i < 20; i++) {
+    assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+    assert(images_equal(ref, img));
+  }
+  __sync_lock_test_and_set(&invalidator_running, 0);
+  pthread_join(thread, NULL);
+
+  // no tile is marked as in use after rendering
+  for(i = 0; i < rc->num_tiles; i++) assert(!rc->tiles[i].in_use);
+
+  rcache_destroy(rc);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  test03();
+  test04();
+  test05();
+  test06();
+  return 0;
+}
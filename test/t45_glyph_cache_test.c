@@ -0,0 +1,140 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <graphics.h>
+#include <glyph_cache.h>
+#include <globals.h>
+
+#define DEBUG
+
+#define FONT_FILE "./FreeSans.ttf"
+#define FONT_SIZE 9
+
+void fill_noise(image_t * img) {
+  unsigned int x, y;
+  for(y = 0; y < img->height; y++)
+    for(x = 0; x < img->width; x++)
+      gr_set_pixval(img, x, y, rand() | 0xff000000);
+}
+
+/* draw a string glyph by glyph with FreeType */
+void draw_string_reference(FT_Face face, image_t * img, const char * text, int x, int y, uint32_t color) {
+  unsigned int i, _x, _y, x_offs = 0;
+
+  for(i = 0; i < strlen(text); i++) {
+    int glyph_index = FT_Get_Char_Index(face, islower(text[i]) ? toupper(text[i]) : text[i]);
+    assert(FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT) == 0);
+    assert(FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL) == 0);
+    FT_Bitmap * bitmap = &face->glyph->bitmap;
+
+    for(_y = 0; _y < (unsigned)bitmap->rows; _y++)
+      for(_x = 0; _x < (unsigned)bitmap->width; _x++) {
+	int __x = x + _x + x_offs, __y = y + _y;
+	uint8_t a = bitmap->buffer[_x + _y * bitmap->pitch];
+	if(a && __x >= 0 && __y >= 0 && __x < (int)img->width && __y < (int)img->height) {
+	  uint32_t pix = gr_get_pixval(img, __x, __y);
+	  gr_set_pixval(img, __x, __y, 
+			MERGE_CHANNELS(((0xff - a) * MASK_R(pix) + a * MASK_R(color)) >> 8,
+				       ((0xff - a) * MASK_G(pix) + a * MASK_G(color)) >> 8,
+				       ((0xff - a) * MASK_B(pix) + a * MASK_B(color)) >> 8, 0xffU));
+	}
+      }
+    x_offs += bitmap->width + 2;
+  }
+}
+
+/* labels from the atlas look like strings rendered with FreeType */
+void test01(void) {
+  const char * texts[] = {"NAND2", "dff_x1", "Q", "a b", "", "OAI211 CLK"};
+  int positions[][2] = {{10, 10}, {-7, 3}, {90, 45}, {3, -4}, {50, 20}, {-40, -2}};
+  unsigned int i;
+  FT_Library library;
+  FT_Face face;
+
+  assert(FT_Init_FreeType(&library) == 0);
+  assert(FT_New_Face(library, FONT_FILE, 0, &face) == 0);
+  assert(FT_Set_Pixel_Sizes(face, 0, FONT_SIZE) == 0);
+
+  gcache_atlas_t * atlas = gcache_atlas_create(FONT_FILE, FONT_SIZE);
+  gcache_labels_t * lc = gcache_labels_create(atlas, 16);
+  assert(atlas != NULL && lc != NULL);
+
+  image_t * ref = gr_create_memory_image(100, 50, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(100, 50, IMAGE_TYPE_RGBA);
+  assert(ref != NULL && img != NULL);
+
+  for(i = 0; i < 6; i++) {
+    uint32_t color = i % 2 ? MERGE_CHANNELS(255, 255, 255, 0) : MERGE_CHANNELS(20, 200, 90, 0);
+    fill_noise(ref);
+    assert(gr_clone_image_data(img, ref) == RET_OK);
+
+    draw_string_reference(face, ref, texts[i], positions[i][0], positions[i][1], color);
+
+    const gcache_label_t * label = gcache_get_label(lc, texts[i]);
+    assert(label != NULL);
+    gcache_draw_label(img, label, positions[i][0], positions[i][1], color);
+
+    assert(memcmp(ref->map->mem, img->map->mem, 100 * 50 * BYTES_PER_PIXEL) == 0);
+  }
+
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+  gcache_labels_destroy(lc);
+  gcache_atlas_destroy(atlas);
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+}
+
+/* labels are taken from the cache and replaced on collisions */
+void test02(void) {
+  gcache_atlas_t * atlas = gcache_atlas_create(FONT_FILE, FONT_SIZE);
+  gcache_labels_t * lc = gcache_labels_create(atlas, 1);
+  assert(atlas != NULL && lc != NULL);
+
+  const gcache_label_t * a = gcache_get_label(lc, "INV");
+  assert(a != NULL && !strcmp(a->text, "INV"));
+  assert(gcache_get_label(lc, "INV") == a);
+
+  const gcache_label_t * b = gcache_get_label(lc, "NOR3");
+  assert(b != NULL && !strcmp(b->text, "NOR3"));
+  assert(b->width > 0 && b->height > 0 && b->height <= 2 * FONT_SIZE);
+
+  assert(gcache_atlas_create("./no_such_font.ttf", FONT_SIZE) == NULL);
+
+  gcache_labels_destroy(lc);
+  gcache_atlas_destroy(atlas);
+}
+
+int main(void) {
+  test01();
+  test02();
+  return 0;
+}
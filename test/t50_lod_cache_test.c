@@ -0,0 +1,289 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <lod_cache.h>
+#include <logic_model.h>
+#include <globals.h>
+
+#define DEBUG
+
+#define SIZE 2048
+
+logic_model_t * lmodel;
+lodcache_colors_t colors;
+
+void setup(void) {
+  assert((lmodel = lmodel_create(1, SIZE, SIZE)) != NULL);
+  assert(RET_IS_OK(lmodel_set_layer_type(lmodel, 0, LM_LAYER_TYPE_LOGIC)));
+
+  colors.gate_area_color = MERGE_CHANNELS(200U, 100U, 50U, 255U);
+  colors.wire_color = MERGE_CHANNELS(0U, 0U, 255U, 255U);
+  colors.il_up_color = MERGE_CHANNELS(0U, 255U, 0U, 255U);
+  colors.il_down_color = MERGE_CHANNELS(255U, 0U, 0U, 255U);
+}
+
+void add_gate(unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+  lmodel_gate_t * gate = lmodel_create_gate(lmodel, min_x, min_y, max_x, max_y, NULL, NULL, 0);
+  assert(gate != NULL);
+  assert(RET_IS_OK(lmodel_add_gate(lmodel, 0, gate)));
+}
+
+uint32_t get_cell(image_t * raster, unsigned int x, unsigned int y) {
+  return *(uint32_t *)mm_get_ptr(raster->map, x, y);
+}
+
+/* cells hold the premultiplied colour weighted by the covered area */
+void test01(void) {
+  lodcache_t * lc = lodcache_create();
+  assert(lc != NULL);
+  assert(lodcache_get_cell_size(lmodel) == LODCACHE_MIN_CELL_SIZE);
+
+  add_gate(160, 160, 191, 191); // covers the cells (10, 10) .. (11, 11)
+  add_gate(320, 320, 327, 335); // covers the left half of cell (20, 20)
+
+  lmodel_via_t * via = lmodel_create_via(lmodel, 408, 408, LM_VIA_UP, 8, NULL, 0);
+  assert(via != NULL);
+  assert(RET_IS_OK(lmodel_add_via(lmodel, 0, via)));
+
+  lodcache_raster_t * gate_raster = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(gate_raster != NULL);
+  image_t * gates = gate_raster->levels[0];
+  assert(gates->width == SIZE / LODCACHE_MIN_CELL_SIZE && gates->height == gates->width);
+
+  assert(get_cell(gates, 10, 10) == colors.gate_area_color);
+  assert(get_cell(gates, 11, 11) == colors.gate_area_color);
+  assert(get_cell(gates, 12, 11) == 0);
+
+  uint32_t half = get_cell(gates, 20, 20);
+  assert(abs((int)MASK_A(half) - 128) <= 1 && abs((int)MASK_R(half) - 100) <= 1);
+
+  // level 1 averages 2x2 cells
+  image_t * level1 = gate_raster->levels[1];
+  assert(level1 != NULL && level1->width == gates->width / 2);
+  assert(get_cell(level1, 5, 5) == colors.gate_area_color);
+  assert(abs((int)MASK_A(get_cell(level1, 10, 10)) - 32) <= 1);
+
+  // vias cover a circle, gates are not part of the via raster
+  lodcache_raster_t * via_raster = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_VIAS, &colors);
+  assert(via_raster != NULL);
+  image_t * vias = via_raster->levels[0];
+  assert(get_cell(vias, 10, 10) == 0);
+  uint32_t via_cell = get_cell(vias, 25, 25);
+  assert(abs((int)MASK_A(via_cell) - 50) <= 1 && MASK_G(via_cell) == MASK_A(via_cell));
+
+  assert(lodcache_get_raster(lc, lmodel, 1, LODCACHE_CLASS_GATES, &colors) == NULL);
+  assert(lodcache_get_raster(lc, lmodel, 0, LODCACHE_NUM_CLASSES, &colors) == NULL);
+
+  lodcache_release(lc, gate_raster);
+  lodcache_release(lc, via_raster);
+
+  assert(RET_IS_OK(lodcache_destroy(lc)));
+}
+
+/* rasters are rebuilt, if the logic model or the colours change */
+void test02(void) {
+  lodcache_t * lc = lodcache_create();
+  assert(lc != NULL);
+
+  lodcache_raster_t * old = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(old != NULL && get_cell(old->levels[0], 40, 40) == 0);
+
+  // a raster in use is replaced, it keeps its content until it is released
+  add_gate(640, 640, 655, 655);
+  lodcache_raster_t * gates = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(gates != NULL && gates != old);
+  assert(get_cell(gates->levels[0], 40, 40) == colors.gate_area_color);
+  assert(get_cell(old->levels[0], 40, 40) == 0 && old->stale);
+  lodcache_release(lc, old);
+  lodcache_release(lc, gates);
+
+  lodcache_colors_t other = colors;
+  other.gate_area_color = MERGE_CHANNELS(10U, 20U, 30U, 255U);
+  gates = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &other);
+  assert(gates != NULL && get_cell(gates->levels[0], 40, 40) == other.gate_area_color);
+
+  // rasters in use survive an invalidation
+  assert(RET_IS_OK(lodcache_invalidate(lc)));
+  assert(get_cell(gates->levels[0], 40, 40) == other.gate_area_color);
+  lodcache_release(lc, gates);
+
+  assert(RET_IS_OK(lodcache_destroy(lc)));
+}
+
+/* zoomed out views are drawn from the raster, zoomed in views from the objects */
+void test03(void) {
+  unsigned int i;
+  render_params_t render_params;
+  renderer_t * renderer;
+
+  setenv("DEGATE_HOME", ".", 0);
+  assert((renderer = renderer_create()) != NULL);
+  memset(&render_params, 0, sizeof(render_params_t));
+  renderer_initialize_params(&render_params);
+  render_params.lmodel = lmodel;
+  render_params.gate_area_color = colors.gate_area_color;
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+
+  // the whole die with one cell per screen pixel
+  unsigned int w = SIZE / LODCACHE_MIN_CELL_SIZE;
+  image_t * img = gr_create_memory_image(w, w, IMAGE_TYPE_RGBA);
+  image_t * ref = gr_create_memory_image(2 * w, 2 * w, IMAGE_TYPE_RGBA);
+  image_t * ref2 = gr_create_memory_image(2 * w, 2 * w, IMAGE_TYPE_RGBA);
+  assert(img != NULL && ref != NULL && ref2 != NULL);
+  assert((render_params.lod_cache = lodcache_create()) != NULL);
+
+  clock_t start = clock();
+  gr_map_clear(img);
+  render_region(renderer, img, 0, 0, 0, SIZE, SIZE);
+  debug(TM, "full die overview: %f ms", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+
+  lodcache_raster_t * gate_raster = lodcache_get_raster(render_params.lod_cache, lmodel, 0, 
+							 LODCACHE_CLASS_GATES, &colors);
+  assert(gate_raster != NULL);
+  image_t * gates = gate_raster->levels[0];
+  for(i = 0; i < w * w; i++) {
+    uint32_t cell = get_cell(gates, i % w, i / w);
+    uint32_t pix = *(uint32_t *)mm_get_ptr(img->map, i % w, i / w);
+    assert(MASK_R(pix) == MASK_R(cell) && MASK_G(pix) == MASK_G(cell) && MASK_B(pix) == MASK_B(cell));
+  }
+  lodcache_release(render_params.lod_cache, gate_raster);
+
+  // below one cell per screen pixel the objects are drawn
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, 0, 0, SIZE, SIZE);
+  lodcache_destroy(render_params.lod_cache);
+  render_params.lod_cache = NULL;
+  gr_map_clear(ref2);
+  render_region(renderer, ref2, 0, 0, 0, SIZE, SIZE);
+  assert(memcmp(ref->map->mem, ref2->map->mem, ref->width * ref->height * BYTES_PER_PIXEL) == 0);
+
+  gr_image_destroy(img);
+  gr_image_destroy(ref);
+  gr_image_destroy(ref2);
+  renderer_destroy(renderer);
+}
+
+/* selected objects are drawn over the raster */
+void test04(void) {
+  render_params_t render_params;
+  renderer_t * renderer;
+
+  assert((renderer = renderer_create()) != NULL);
+  memset(&render_params, 0, sizeof(render_params_t));
+  renderer_initialize_params(&render_params);
+  render_params.lmodel = lmodel;
+  render_params.gate_area_color = colors.gate_area_color;
+  assert((render_params.lod_cache = lodcache_create()) != NULL);
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+
+  // a gate, that covers the cells (100, 100) .. (103, 103)
+  lmodel_gate_t * gate = lmodel_create_gate(lmodel, 1600, 1600, 1663, 1663, NULL, NULL, 0);
+  assert(gate != NULL);
+  assert(RET_IS_OK(lmodel_add_gate(lmodel, 0, gate)));
+
+  unsigned int w = SIZE / LODCACHE_MIN_CELL_SIZE;
+  image_t * img = gr_create_memory_image(w, w, IMAGE_TYPE_RGBA);
+  image_t * sel = gr_create_memory_image(w, w, IMAGE_TYPE_RGBA);
+  assert(img != NULL && sel != NULL);
+
+  gr_map_clear(img);
+  render_region(renderer, img, 0, 0, 0, SIZE, SIZE);
+
+  assert(RET_IS_OK(lmodel_set_select_state(LM_TYPE_GATE, gate, SELECT_STATE_DIRECT)));
+  gr_map_clear(sel);
+  render_region(renderer, sel, 0, 0, 0, SIZE, SIZE);
+
+  lodcache_raster_t * raster = lodcache_get_raster(render_params.lod_cache, lmodel, 0, 
+						   LODCACHE_CLASS_GATES, &colors);
+  assert(raster != NULL);
+  assert(raster->num_selected == 1 && raster->selected[0] == gate);
+  assert(get_cell(raster->levels[0], 101, 101) == 0);
+  lodcache_release(render_params.lod_cache, raster);
+
+  // the gate is highlighted, the rest of the view is unchanged
+  assert(gr_get_pixval(sel, 100, 100) != gr_get_pixval(img, 100, 100));
+  assert(gr_get_pixval(sel, 110, 110) == gr_get_pixval(img, 110, 110));
+
+  assert(RET_IS_OK(lmodel_set_select_state(LM_TYPE_GATE, gate, SELECT_STATE_NOT)));
+  gr_map_clear(sel);
+  render_region(renderer, sel, 0, 0, 0, SIZE, SIZE);
+  assert(memcmp(img->map->mem, sel->map->mem, w * w * BYTES_PER_PIXEL) == 0);
+
+  assert(RET_IS_OK(lmodel_remove_object_by_ptr(lmodel, 0, gate, LM_TYPE_GATE)));
+  lodcache_destroy(render_params.lod_cache);
+  gr_image_destroy(img);
+  gr_image_destroy(sel);
+  renderer_destroy(renderer);
+}
+
+/* changes of other object classes keep a raster */
+void test05(void) {
+  lodcache_t * lc = lodcache_create();
+  assert(lc != NULL);
+
+  lodcache_raster_t * gates = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(gates != NULL);
+
+  lmodel_wire_t * wire = lmodel_create_wire(lmodel, 100, 100, 400, 100, 5, NULL, 0);
+  assert(wire != NULL);
+  assert(RET_IS_OK(lmodel_add_wire(lmodel, 0, wire)));
+
+  lodcache_raster_t * same = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(same == gates && !gates->stale);
+  lodcache_release(lc, same);
+
+  lodcache_raster_t * wires = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_WIRES, &colors);
+  assert(wires != NULL && get_cell(wires->levels[0], 10, 6) != 0);
+  lodcache_release(lc, wires);
+
+  // a change, that may affect any object, rebuilds all rasters
+  lmodel_report_damage(LM_TYPE_UNDEF, NULL);
+  same = lodcache_get_raster(lc, lmodel, 0, LODCACHE_CLASS_GATES, &colors);
+  assert(same != NULL && same != gates && gates->stale);
+  lodcache_release(lc, gates);
+  lodcache_release(lc, same);
+
+  assert(RET_IS_OK(lmodel_remove_object_by_ptr(lmodel, 0, wire, LM_TYPE_WIRE)));
+  assert(RET_IS_OK(lodcache_destroy(lc)));
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  test03();
+  test04();
+  test05();
+  lmodel_destroy(lmodel);
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <render_cache.h>
+#include <render_thread.h>
+#include <logic_model.h>
+#include <globals.h>
+
+#define DEBUG
+
+#include "render_fixture.h"
+
+volatile int num_frames = 0, num_previews = 0;
+
+void setup(void) {
+  fixture_setup();
+
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+  renderer_add_layer(renderer, (render_func_t) &render_vias, &render_params, 1, "Vias");
+
+  fixture_add_random_gates(100, 1);
+}
+
+void on_frame(void * arg) {
+  rthread_t * rt = *(rthread_t **)arg;
+  image_t * img = gr_create_memory_image(rt->frame->width, rt->frame->height, IMAGE_TYPE_RGBA);
+  int is_preview;
+  assert(img != NULL);
+  if(RET_IS_OK(rthread_get_frame(rt, img, &is_preview))) {
+    if(is_preview) num_previews++;
+    num_frames++;
+  }
+  gr_image_destroy(img);
+}
+
+/* wait for the full resolution frame of the latest request */
+void wait_for_frame(rthread_t * rt, image_t * img) {
+  unsigned int i;
+  int is_preview = 1;
+  for(i = 0; i < 10000; i++) {
+    if(RET_IS_OK(rthread_get_frame(rt, img, &is_preview)) && !is_preview) return;
+    usleep(1000);
+  }
+  assert(0);
+}
+
+/* frames are rendered in the background and equal synchronously rendered views */
+void test01(void) {
+  unsigned int w = 400, h = 300, min_x = 300, min_y = 200;
+  rthread_t * rt = NULL;
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(ref != NULL && img != NULL);
+  assert((rt = rthread_create(renderer, &on_frame, &rt)) != NULL);
+
+  // there is no frame yet
+  assert(RET_IS_NOT_OK(rthread_get_frame(rt, img, NULL)));
+
+  assert(RET_IS_OK(rthread_request_view(rt, 0, w, h, min_x, min_y, min_x + 2 * w, min_y + 2 * h)));
+  wait_for_frame(rt, img);
+  renderer_set_cancel_flag(renderer, NULL);
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, min_x + 2 * w, min_y + 2 * h);
+  renderer_set_cancel_flag(renderer, &rt->cancel);
+  assert(images_equal(ref, img));
+
+  // the first frame at a new scaling is preceded by a preview, the lock waits for
+  // the callback of the frame in progress
+  assert(RET_IS_OK(rthread_lock(rt)));
+  assert(num_previews == 1 && num_frames == 2);
+
+  // frames of older requests are not returned
+  assert(RET_IS_OK(rthread_request_view(rt, 0, w, h, min_x, min_y, min_x + 4 * w, min_y + 4 * h)));
+  usleep(10000);
+  assert(RET_IS_NOT_OK(rthread_get_frame(rt, img, NULL)));
+  assert(RET_IS_OK(rthread_unlock(rt)));
+  wait_for_frame(rt, img);
+
+  assert(RET_IS_OK(rthread_destroy(rt)));
+  assert(renderer->cancel == NULL);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* newer requests cancel older ones, the last request is rendered */
+void test02(void) {
+  unsigned int i, w = 500, h = 400;
+  rthread_t * rt = NULL;
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(ref != NULL && img != NULL && rc != NULL);
+  assert((rt = rthread_create(renderer, NULL, NULL)) != NULL);
+  assert(RET_IS_OK(rthread_set_render_cache(rt, rc)));
+
+  // views, that start at whole screen pixels, are composed from tiles without rounding
+  for(i = 0; i < 50; i++)
+    assert(RET_IS_OK(rthread_request_view(rt, 0, w, h, 9 * i, 6 * i, 9 * i + 3 * w, 6 * i + 3 * h)));
+  wait_for_frame(rt, img);
+
+  // render the reference without the cache, that may have been filled by cancelled frames
+  assert(RET_IS_OK(rthread_set_render_cache(rt, NULL)));
+  assert(RET_IS_OK(rthread_destroy(rt)));
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, 441, 294, 441 + 3 * w, 294 + 3 * h);
+  assert(images_equal(ref, img));
+
+  rcache_destroy(rc);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* cancelled tiles are not cached */
+void test03(void) {
+  unsigned int w = 256, h = 256;
+  volatile int cancel = 1;
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(ref != NULL && img != NULL && rc != NULL);
+
+  renderer_set_cancel_flag(renderer, &cancel);
+  assert(renderer_is_cancelled(renderer));
+  assert(rcache_render_region(rc, img, 0, 0, 0, 2 * w, 2 * h) == RET_CANCEL);
+
+  cancel = 0;
+  assert(RET_IS_OK(rcache_render_region(rc, img, 0, 0, 0, 2 * w, 2 * h)));
+  renderer_set_cancel_flag(renderer, NULL);
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, 0, 0, 2 * w, 2 * h);
+  assert(images_equal(ref, img));
+
+  rcache_destroy(rc);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  test03();
+  renderer_destroy(renderer);
+  return 0;
+}
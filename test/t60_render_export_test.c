@@ -0,0 +1,265 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <render_export.h>
+#include <logic_model.h>
+#include <globals.h>
+
+#define DEBUG
+
+#include "render_fixture.h"
+
+void setup(void) {
+  fixture_setup();
+
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+  renderer_add_layer(renderer, (render_func_t) &render_vias, &render_params, 1, "Vias");
+
+  fixture_add_random_gates(100, 1);
+}
+
+uint8_t * read_file(const char * const filename, size_t * size) {
+  FILE * f = fopen(filename, "rb");
+  assert(f != NULL);
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t * data = (uint8_t *)malloc(*size + 1);
+  assert(data != NULL);
+  assert(fread(data, 1, *size, f) == *size);
+  data[*size] = 0;
+  fclose(f);
+  return data;
+}
+
+uint64_t get_le(const uint8_t * p, unsigned int bytes) {
+  uint64_t v = 0;
+  while(bytes--) v = (v << 8) | p[bytes];
+  return v;
+}
+
+int pixel_equals(const uint8_t * rgb, image_t * img, unsigned int x, unsigned int y) {
+  uint32_t pix = gr_get_pixval(img, x, y);
+  return rgb[0] == MASK_R(pix) && rgb[1] == MASK_G(pix) && rgb[2] == MASK_B(pix);
+}
+
+image_t * render_reference(unsigned int min_x, unsigned int min_y, unsigned int max_x, unsigned int max_y) {
+  image_t * ref = gr_create_memory_image(max_x - min_x, max_y - min_y, IMAGE_TYPE_RGBA);
+  assert(ref != NULL);
+  gr_map_clear(ref);
+  render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+  return ref;
+}
+
+/* PPM exports, that span several bands, equal a single rendered region */
+void test01(void) {
+  unsigned int x, y, min_x = 100, min_y = 150, max_x = 1250, max_y = 1000;
+  const char * filename = "/tmp/t60_export.ppm";
+  size_t size;
+  char header[64];
+
+  assert(rexport_get_format_by_filename(filename) == REXPORT_FORMAT_PPM);
+  assert(RET_IS_OK(rexport_render_to_file(renderer, 0, min_x, min_y, max_x, max_y, 
+					  REXPORT_FORMAT_PPM, filename, NULL, NULL)));
+
+  image_t * ref = render_reference(min_x, min_y, max_x, max_y);
+  uint8_t * data = read_file(filename, &size);
+  snprintf(header, sizeof(header), "P6\n%d %d\n255\n", ref->width, ref->height);
+  assert(size == strlen(header) + ref->width * ref->height * 3);
+  assert(memcmp(data, header, strlen(header)) == 0);
+
+  const uint8_t * rgb = data + strlen(header);
+  for(y = 0; y < ref->height; y++)
+    for(x = 0; x < ref->width; x++, rgb += 3)
+      assert(pixel_equals(rgb, ref, x, y));
+
+  // the PPM writer of the renderer produces the same file
+  assert(RET_IS_OK(renderer_write_image(ref, "/tmp/t60_write_image.ppm")));
+  size_t size2;
+  uint8_t * data2 = read_file("/tmp/t60_write_image.ppm", &size2);
+  assert(size == size2 && memcmp(data, data2, size) == 0);
+
+  free(data);
+  free(data2);
+  gr_image_destroy(ref);
+  unlink(filename);
+  unlink("/tmp/t60_write_image.ppm");
+}
+
+/* tiled BigTIFF exports */
+void test02(void) {
+  unsigned int x, y, i, min_x = 300, min_y = 20, max_x = 900, max_y = 560;
+  const char * filename = "/tmp/t60_export.tif";
+  size_t size;
+
+  assert(rexport_get_format_by_filename(filename) == REXPORT_FORMAT_TIFF);
+  assert(rexport_get_format_by_filename("/tmp/T.TIFF") == REXPORT_FORMAT_TIFF);
+  assert(RET_IS_OK(rexport_render_to_file(renderer, 0, min_x, min_y, max_x, max_y, 
+					  REXPORT_FORMAT_TIFF, filename, NULL, NULL)));
+
+  image_t * ref = render_reference(min_x, min_y, max_x, max_y);
+  uint8_t * data = read_file(filename, &size);
+
+  assert(data[0] == 'I' && data[1] == 'I' && get_le(data + 2, 2) == 43 && get_le(data + 4, 2) == 8);
+  const uint8_t * ifd = data + get_le(data + 8, 8);
+  unsigned int num_entries = get_le(ifd, 8);
+  uint64_t offsets = 0, counts = 0, num_tiles = 0;
+  unsigned int width = 0, height = 0, tile_width = 0, tile_height = 0;
+
+  for(i = 0; i < num_entries; i++) {
+    const uint8_t * e = ifd + 8 + 20 * i;
+    uint64_t value = get_le(e + 12, 8);
+    switch(get_le(e, 2)) {
+    case 256: width = value; break;
+    case 257: height = value; break;
+    case 259: assert(value == 1); break;
+    case 277: assert(value == 3); break;
+    case 322: tile_width = value; break;
+    case 323: tile_height = value; break;
+    case 324: offsets = value; num_tiles = get_le(e + 4, 8); break;
+    case 325: counts = value; break;
+    }
+  }
+  assert(get_le(ifd + 8 + 20 * num_entries, 8) == 0); // no next IFD
+
+  unsigned int tiles_x = (width + tile_width - 1) / tile_width;
+  unsigned int tiles_y = (height + tile_height - 1) / tile_height;
+  assert(width == ref->width && height == ref->height && tile_width == REXPORT_TILE_SIZE);
+  assert(num_tiles == tiles_x * tiles_y && num_tiles > 1);
+
+  for(i = 0; i < num_tiles; i++) {
+    const uint8_t * tile = data + get_le(data + offsets + 8 * i, 8);
+    assert(get_le(data + counts + 8 * i, 8) == tile_width * tile_height * 3);
+
+    unsigned int tx = (i % tiles_x) * tile_width, ty = (i / tiles_x) * tile_height;
+    for(y = 0; y < tile_height; y++)
+      for(x = 0; x < tile_width; x++) {
+	const uint8_t * rgb = tile + (y * tile_width + x) * 3;
+	if(tx + x < width && ty + y < height) assert(pixel_equals(rgb, ref, tx + x, ty + y));
+	else assert(rgb[0] == 0 && rgb[1] == 0 && rgb[2] == 0);
+      }
+  }
+
+  free(data);
+  gr_image_destroy(ref);
+  unlink(filename);
+}
+
+/* DZI pyramids are built while the rows are streamed */
+void test03(void) {
+  unsigned int x, y, w = 600, h = 300;
+  size_t size;
+  image_t * img = gr_create_memory_image(w, REXPORT_BAND_HEIGHT, IMAGE_TYPE_RGBA);
+  assert(img != NULL);
+
+  assert(rexport_get_format_by_filename("/tmp/t60_export.dzi") == REXPORT_FORMAT_DZI);
+  rexport_writer_t * writer = rexport_writer_create(REXPORT_FORMAT_DZI, "/tmp/t60_export.dzi", w, h);
+  assert(writer != NULL);
+  writer->tile_format = "ppm";
+  assert(writer->num_levels == 11); // 1024 > 600 > 512
+
+  // rows of a tiled format must be passed in bands
+  assert(RET_IS_NOT_OK(rexport_writer_add_rows(writer, img, 100)));
+
+  for(y = 0; y < REXPORT_BAND_HEIGHT; y++)
+    for(x = 0; x < w; x++) gr_set_pixval(img, x, y, MERGE_CHANNELS((x & 0xff), (y & 0xff), 0x80, 0xff));
+  assert(RET_IS_OK(rexport_writer_add_rows(writer, img, REXPORT_BAND_HEIGHT)));
+  assert(RET_IS_NOT_OK(rexport_writer_finish(writer)));
+  assert(RET_IS_OK(rexport_writer_add_rows(writer, img, h - REXPORT_BAND_HEIGHT)));
+  assert(RET_IS_OK(rexport_writer_finish(writer)));
+  assert(RET_IS_OK(rexport_writer_destroy(writer)));
+
+  uint8_t * data = read_file("/tmp/t60_export.dzi", &size);
+  assert(strstr((char *)data, "TileSize=\"256\"") != NULL);
+  assert(strstr((char *)data, "Width=\"600\" Height=\"300\"") != NULL);
+  free(data);
+
+  // border tile of the full resolution level
+  data = read_file("/tmp/t60_export_files/10/2_1.ppm", &size);
+  assert(strncmp((char *)data, "P6\n88 44\n255\n", 13) == 0 && size == 13 + 88 * 44 * 3);
+  free(data);
+
+  // the next level is downsampled 2x2
+  data = read_file("/tmp/t60_export_files/9/1_0.ppm", &size);
+  assert(strncmp((char *)data, "P6\n44 150\n255\n", 14) == 0);
+  const uint8_t * rgb = data + 14 + (10 * 44 + 3) * 3; // (259, 10)
+  assert(rgb[0] == ((518 & 0xff) + (519 & 0xff) + 1) / 2 && rgb[1] == 21 && rgb[2] == 0x80);
+  free(data);
+
+  // the top level is a single pixel
+  data = read_file("/tmp/t60_export_files/0/0_0.ppm", &size);
+  assert(strncmp((char *)data, "P6\n1 1\n255\n", 11) == 0 && size == 11 + 3);
+  free(data);
+
+  assert(system("rm -rf /tmp/t60_export.dzi /tmp/t60_export_files") == 0);
+  gr_image_destroy(img);
+}
+
+/* a set cancel flag of the renderer does not cut parts out of the export */
+void test04(void) {
+  unsigned int x, y, min_x = 40, min_y = 500, max_x = 700, max_y = 1400;
+  const char * filename = "/tmp/t60_export_cancel.ppm";
+  volatile int cancel = 1;
+  size_t size;
+  char header[64];
+
+  image_t * ref = render_reference(min_x, min_y, max_x, max_y);
+
+  renderer_set_cancel_flag(renderer, &cancel);
+  assert(RET_IS_OK(rexport_render_to_file(renderer, 0, min_x, min_y, max_x, max_y, 
+					  REXPORT_FORMAT_PPM, filename, NULL, NULL)));
+  assert(renderer_get_cancel_flag(renderer) == &cancel);
+  renderer_set_cancel_flag(renderer, NULL);
+
+  uint8_t * data = read_file(filename, &size);
+  snprintf(header, sizeof(header), "P6\n%d %d\n255\n", ref->width, ref->height);
+  assert(size == strlen(header) + ref->width * ref->height * 3);
+
+  const uint8_t * rgb = data + strlen(header);
+  for(y = 0; y < ref->height; y++)
+    for(x = 0; x < ref->width; x++, rgb += 3)
+      assert(pixel_equals(rgb, ref, x, y));
+
+  free(data);
+  gr_image_destroy(ref);
+  unlink(filename);
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  test03();
+  test04();
+  renderer_destroy(renderer);
+  return 0;
+}
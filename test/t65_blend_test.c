@@ -0,0 +1,137 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <graphics.h>
+#include <image_view.h>
+#include <blend.h>
+#include <globals.h>
+
+#define DEBUG
+
+void fill_random(image_t * img) {
+  unsigned int x, y;
+  for(y = 0; y < img->height; y++)
+    for(x = 0; x < img->width; x++) gr_set_pixval(img, x, y, rand() | (rand() << 16));
+}
+
+/* spans are blended like single pixels */
+void test01(void) {
+  unsigned int i, offset, length;
+  uint32_t row[64], ref[64];
+
+  srand(23);
+  for(i = 0; i < 1000; i++) {
+    uint32_t col = rand() | (rand() << 16);
+    if(i % 10 == 0) col |= MERGE_CHANNELS(0, 0, 0, 0xffU);
+    if(i % 10 == 1) col &= ~MERGE_CHANNELS(0, 0, 0, 0xffU);
+
+    for(offset = 0; offset < 64; offset++) row[offset] = ref[offset] = rand() | (rand() << 16);
+
+    offset = rand() % 8;
+    length = rand() % (64 - offset);
+    blend_span(row + offset, col, length);
+
+    for(unsigned int x = offset; x < offset + length; x++) ref[x] = blend_alpha(ref[x], col);
+    assert(memcmp(row, ref, sizeof(row)) == 0);
+  }
+
+  // blending with an opaque color is not exact, but close to the color
+  uint32_t pix = blend_alpha(MERGE_CHANNELS(0, 0, 0, 0xffU), MERGE_CHANNELS(200, 100, 50, 0xffU));
+  assert(MASK_R(pix) == 199 && MASK_G(pix) == 99 && MASK_B(pix) == 49 && MASK_A(pix) == 0xff);
+}
+
+/* rectangles are clipped to the view */
+void test02(void) {
+  unsigned int x, y;
+  uint32_t col = MERGE_CHANNELS(10, 20, 30, 0x80U);
+  image_t * img = gr_create_memory_image(50, 40, IMAGE_TYPE_RGBA);
+  image_t * ref = gr_create_memory_image(50, 40, IMAGE_TYPE_RGBA);
+  assert(img != NULL && ref != NULL);
+
+  fill_random(img);
+  gr_clone_image_data(ref, img);
+
+  rgba_view_t dst(img);
+  blend_rect(dst, -5, 30, 20, 100, col);
+  blend_rect(dst, 40, 5, 30, 10, col); // empty
+
+  for(y = 0; y < 40; y++)
+    for(x = 0; x < 50; x++) {
+      uint32_t expected = gr_get_pixval(ref, x, y);
+      if(x < 20 && y >= 30) expected = blend_alpha(expected, col);
+      assert(gr_get_pixval(img, x, y) == expected);
+    }
+
+  gr_image_destroy(img);
+  gr_image_destroy(ref);
+}
+
+/* antialiased circles */
+void test03(void) {
+  unsigned int x, y;
+  const int size = 64, c = 32;
+  uint32_t col = MERGE_CHANNELS(0xffU, 0xffU, 0xffU, 0xffU);
+  image_t * img = gr_create_memory_image(size, size, IMAGE_TYPE_RGBA);
+  image_t * clipped = gr_create_memory_image(size / 2, size / 2, IMAGE_TYPE_RGBA);
+  assert(img != NULL && clipped != NULL);
+
+  gr_map_clear(img);
+  rgba_view_t dst(img);
+  blend_circle(dst, c, c, 10.3, col);
+
+  for(y = 0; y < (unsigned int)size; y++)
+    for(x = 0; x < (unsigned int)size; x++) {
+      double d = sqrt((double)((x - c) * (x - c) + (y - c) * (y - c)));
+      unsigned int v = MASK_R(gr_get_pixval(img, x, y));
+      if(d <= 9.8) assert(v == 254);
+      else if(d >= 10.8) assert(v == 0);
+      else assert(v < 254);
+
+      // the circle is symmetric
+      if(2 * c - x < (unsigned int)size) assert(gr_get_pixval(img, x, y) == gr_get_pixval(img, 2 * c - x, y));
+    }
+
+  // circles, that are clipped, look like the visible part of the whole circle
+  gr_map_clear(clipped);
+  rgba_view_t dst_clipped(clipped);
+  blend_circle(dst_clipped, c - size / 2 + 4, c - size / 2 + 4, 10.3, col);
+  for(y = 0; y < (unsigned int)size / 2; y++)
+    for(x = 0; x < (unsigned int)size / 2; x++)
+      assert(gr_get_pixval(clipped, x, y) == gr_get_pixval(img, x + size / 2 - 4, y + size / 2 - 4));
+
+  gr_image_destroy(img);
+  gr_image_destroy(clipped);
+}
+
+int main(void) {
+  test01();
+  test02();
+  test03();
+  return 0;
+}
@@ -0,0 +1,298 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <graphics.h>
+#include <renderer.h>
+#include <render_cache.h>
+#include <sprite_cache.h>
+#include <blend.h>
+#include <logic_model.h>
+#include <globals.h>
+
+#define DEBUG
+
+#include "render_fixture.h"
+
+lmodel_gate_template_t * tmpl;
+lmodel_gate_t * gates[60];
+spcache_t * sprite_cache;
+
+void add_port(unsigned int id, unsigned int x, unsigned int y, const char * name) {
+  lmodel_gate_template_port_t * port = lmodel_create_gate_template_port();
+  assert(port != NULL);
+  port->id = id;
+  port->port_name = strdup(name);
+  port->port_type = LM_PT_IN;
+  port->relative_x_coord = x;
+  port->relative_y_coord = y;
+  port->diameter = 6;
+  port->next = tmpl->ports;
+  tmpl->ports = port;
+}
+
+void setup(void) {
+  unsigned int i;
+  LM_TEMPLATE_ORIENTATION orientations[] = {
+    LM_TEMPLATE_ORIENTATION_NORMAL, LM_TEMPLATE_ORIENTATION_FLIPPED_UP_DOWN,
+    LM_TEMPLATE_ORIENTATION_FLIPPED_LEFT_RIGHT, LM_TEMPLATE_ORIENTATION_FLIPPED_BOTH };
+
+  fixture_setup();
+  assert((sprite_cache = spcache_create(SPCACHE_DEFAULT_SIZE)) != NULL);
+
+  renderer_add_layer(renderer, (render_func_t) &render_gates, &render_params, 1, "Logic Gates");
+
+  assert((tmpl = lmodel_create_gate_template()) != NULL);
+  assert(RET_IS_OK(lmodel_add_gate_template(lmodel, tmpl, 0)));
+  assert(RET_IS_OK(lmodel_gate_template_set_master_region(tmpl, 0, 0, 120, 80)));
+  assert(RET_IS_OK(lmodel_gate_template_set_text(tmpl, "AND", "and gate")));
+  assert(RET_IS_OK(lmodel_gate_template_set_color(tmpl, MERGE_CHANNELS(0x20, 0x80, 0x40, 0x60),
+						  MERGE_CHANNELS(0x20, 0xc0, 0x40, 0xa0))));
+  add_port(1, 10, 20, "A");
+  add_port(2, 10, 60, "B");
+  add_port(3, 110, 40, "Y");
+  lmodel_report_template_change();
+
+  for(i = 0; i < 60; i++) {
+    unsigned int x = 100 + rand() % (SIZE - 300), y = 100 + rand() % (SIZE - 300);
+    lmodel_gate_t * gate = lmodel_create_gate(lmodel, x, y, x + 120, y + 80, NULL, strdup("G"), 0);
+    assert(gate != NULL);
+    assert(RET_IS_OK(lmodel_add_gate(lmodel, 0, gate)));
+    gates[i] = gate;
+    assert(RET_IS_OK(lmodel_set_template_for_gate(lmodel, gate, tmpl)));
+    assert(RET_IS_OK(lmodel_set_gate_orientation(gate, orientations[i % 4])));
+    if(i % 7 == 0) gate->is_selected = SELECT_STATE_DIRECT;
+    if(i % 11 == 0) gate->ports->is_selected = SELECT_STATE_DIRECT;
+  }
+}
+
+image_t * create_sprite_image(unsigned int width, unsigned int height) {
+  image_t * img = gr_create_memory_image(width, height, IMAGE_TYPE_RGBA);
+  assert(img != NULL);
+  return img;
+}
+
+spcache_key_t make_key(unsigned int width) {
+  spcache_key_t key;
+  memset(&key, 0, sizeof(spcache_key_t));
+  key.tmpl = tmpl;
+  key.orientation = LM_TEMPLATE_ORIENTATION_NORMAL;
+  key.width = width;
+  key.height = 10;
+  key.scaling_x = key.scaling_y = 1;
+  return key;
+}
+
+/* sprites are shared, dropped on template changes and evicted */
+void test01(void) {
+  unsigned long version;
+  spcache_t * sc = spcache_create(2 * 20 * 20 * sizeof(uint32_t));
+  spcache_key_t key1 = make_key(10), key2 = make_key(11), key3 = make_key(12);
+  assert(sc != NULL);
+
+  assert(spcache_get(sc, &key1, &version) == NULL);
+  spcache_sprite_t * s1 = spcache_insert(sc, &key1, version, create_sprite_image(20, 20), 5, 5);
+  assert(s1 != NULL && s1->refs == 1 && !s1->stale);
+
+  // a sprite, that was inserted twice, is shared
+  spcache_sprite_t * s2 = spcache_insert(sc, &key1, version, create_sprite_image(20, 20), 5, 5);
+  assert(s2 == s1 && s1->refs == 2);
+  assert(spcache_get(sc, &key1, &version) == s1 && s1->refs == 3);
+  spcache_release(sc, s1);
+  spcache_release(sc, s1);
+  spcache_release(sc, s1);
+
+  // the least recently used sprite is evicted
+  spcache_release(sc, spcache_insert(sc, &key2, version, create_sprite_image(20, 20), 5, 5));
+  spcache_release(sc, spcache_get(sc, &key1, &version));
+  spcache_release(sc, spcache_insert(sc, &key3, version, create_sprite_image(20, 20), 5, 5));
+  assert(sc->size == 2 * 20 * 20 * sizeof(uint32_t));
+  assert(spcache_get(sc, &key2, &version) == NULL);
+  s1 = spcache_get(sc, &key1, &version);
+  assert(s1 != NULL);
+
+  // template changes drop all sprites, sprites in use are freed on release
+  unsigned long old_version = version;
+  lmodel_report_template_change();
+  assert(spcache_get(sc, &key3, &version) == NULL);
+  assert(version != old_version && s1->stale && sc->size == 0);
+  spcache_release(sc, s1);
+
+  // sprites, that were rendered from outdated templates, are not cached
+  s1 = spcache_insert(sc, &key1, old_version, create_sprite_image(20, 20), 5, 5);
+  assert(s1 != NULL && s1->stale);
+  spcache_release(sc, s1);
+  assert(spcache_get(sc, &key1, &version) == NULL);
+
+  assert(RET_IS_OK(spcache_destroy(sc)));
+}
+
+unsigned int max_difference(image_t * a, image_t * b) {
+  unsigned int i, max_diff = 0;
+  const uint32_t * pa = (const uint32_t *)a->map->mem, * pb = (const uint32_t *)b->map->mem;
+
+  for(i = 0; i < a->width * a->height; i++) {
+    max_diff = MAX(max_diff, (unsigned int)abs((int)MASK_R(pa[i]) - (int)MASK_R(pb[i])));
+    max_diff = MAX(max_diff, (unsigned int)abs((int)MASK_G(pa[i]) - (int)MASK_G(pb[i])));
+    max_diff = MAX(max_diff, (unsigned int)abs((int)MASK_B(pa[i]) - (int)MASK_B(pb[i])));
+  }
+  return max_diff;
+}
+
+void render_view(image_t * img, double min_x, double min_y, double max_x, double max_y, int use_sprites) {
+  render_params.sprite_cache = use_sprites ? sprite_cache : NULL;
+  gr_map_clear(img);
+  render_region(renderer, img, 0, min_x, min_y, max_x, max_y);
+  render_params.sprite_cache = NULL;
+}
+
+/* gates, that are stamped from sprites, look like gates, that are drawn directly */
+void test02(void) {
+  unsigned int i, w = 800, h = 600;
+  double scalings[] = {0.25, 0.5, 1, 1.5, 2.5};
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(ref != NULL && img != NULL);
+
+  for(i = 0; i < 5; i++) {
+    // the views are centered on gates with different orientations
+    double s = scalings[i];
+    double min_x = gates[i + 1]->min_x - 0.37 * w * s, min_y = gates[i + 1]->min_y - 0.41 * h * s;
+
+    render_view(ref, min_x, min_y, min_x + w * s, min_y + h * s, 0);
+    render_view(img, min_x, min_y, min_x + w * s, min_y + h * s, 1);
+    unsigned int diff = max_difference(ref, img);
+    debug(TM, "scaling %f: max. difference %d", s, diff);
+    assert(diff <= 4 && sprite_cache->size > 0);
+
+    // the second frame is stamped from cached sprites
+    render_view(img, min_x, min_y, min_x + w * s, min_y + h * s, 1);
+    assert(max_difference(ref, img) == diff);
+  }
+
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* a view, that is composed from tiles, equals a view, that is rendered at once */
+void test03(void) {
+  unsigned int i, w = 700, h = 500;
+  double scalings[] = {0.5, 1, 2};
+
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(ref != NULL && img != NULL);
+
+  render_params.sprite_cache = sprite_cache;
+  rcache_t * rc = rcache_create(renderer, &render_params, rcache_get_num_tiles_for_view(w, h));
+  assert(rc != NULL);
+
+  for(i = 0; i < 3; i++) {
+    double s = scalings[i];
+    unsigned int min_x = lrint(floor((gates[i + 2]->min_x - 0.3 * w * s) / s) * s);
+    unsigned int min_y = lrint(floor((gates[i + 2]->min_y - 0.6 * h * s) / s) * s);
+    unsigned int max_x = min_x + lrint(w * s), max_y = min_y + lrint(h * s);
+
+    gr_map_clear(ref);
+    render_region(renderer, ref, 0, min_x, min_y, max_x, max_y);
+    assert(RET_IS_OK(rcache_render_region(rc, img, 0, min_x, min_y, max_x, max_y)));
+    assert(images_equal(ref, img));
+  }
+
+  rcache_destroy(rc);
+  render_params.sprite_cache = NULL;
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* template changes are visible in the next frame */
+void test04(void) {
+  unsigned int w = 600, h = 600;
+  image_t * before = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * ref = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  image_t * img = gr_create_memory_image(w, h, IMAGE_TYPE_RGBA);
+  assert(before != NULL && ref != NULL && img != NULL);
+
+  render_view(before, 0, 0, SIZE, SIZE, 1);
+
+  assert(RET_IS_OK(lmodel_gate_template_set_color(tmpl, MERGE_CHANNELS(0xc0, 0x20, 0x20, 0x80),
+						  MERGE_CHANNELS(0xff, 0x20, 0x20, 0xc0))));
+  render_view(ref, 0, 0, SIZE, SIZE, 0);
+  render_view(img, 0, 0, SIZE, SIZE, 1);
+  assert(max_difference(before, img) > 4);
+  assert(max_difference(ref, img) <= 4);
+
+  // moved ports
+  assert(RET_IS_OK(lmodel_adjust_templates_port_locations(tmpl, LM_TEMPLATE_ORIENTATION_FLIPPED_LEFT_RIGHT)));
+  render_view(ref, 0, 0, SIZE, SIZE, 0);
+  render_view(img, 0, 0, SIZE, SIZE, 1);
+  assert(max_difference(ref, img) <= 4);
+
+  gr_image_destroy(before);
+  gr_image_destroy(ref);
+  gr_image_destroy(img);
+}
+
+/* spans of premultiplied pixels are blended like single pixels */
+void test05(void) {
+  unsigned int i, length;
+  uint32_t dst[19], ref[19], src[19];
+
+  srand(7);
+  for(length = 0; length < 19; length++) {
+    for(i = 0; i < length; i++) {
+      unsigned int alpha = rand() % 256;
+      // color channels of premultiplied pixels do not exceed the alpha channel
+      src[i] = MERGE_CHANNELS((rand() % (alpha + 1)), (rand() % (alpha + 1)), (rand() % (alpha + 1)), alpha);
+      if(i % 5 == 0) src[i] = 0;
+      dst[i] = ref[i] = MERGE_CHANNELS((rand() & 0xff), (rand() & 0xff), (rand() & 0xff), 0xffU);
+    }
+
+    blend_premultiplied_span(dst, src, length);
+    for(i = 0; i < length; i++) {
+      ref[i] = blend_premultiplied(ref[i], src[i]);
+      assert(dst[i] == ref[i]);
+    }
+  }
+
+  // a transparent pixel leaves the background unchanged
+  assert(blend_premultiplied(MERGE_CHANNELS(1, 2, 3, 0xffU), 0) == MERGE_CHANNELS(1, 2, 3, 0xffU));
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  test03();
+  test04();
+  test05();
+  spcache_destroy(sprite_cache);
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <graphics.h>
+#include <mosaic.h>
+#include <globals.h>
+
+#define DEBUG
+
+#define SIZE 200
+#define TILE_SIZE 120
+#define TILE_STEP 80
+
+image_t * ref;
+
+/* a smooth random texture, so that tiles can be matched */
+void setup(void) {
+  unsigned int x, y;
+  assert((ref = gr_create_memory_image(SIZE, SIZE, IMAGE_TYPE_RGBA)) != NULL);
+
+  srand(42);
+  for(y = 0; y < SIZE; y++)
+    for(x = 0; x < SIZE; x++) {
+      unsigned int v = rand() % 256;
+      if(x > 0 && y > 0) v = (v + MASK_G(gr_get_pixval(ref, x - 1, y)) + MASK_G(gr_get_pixval(ref, x, y - 1))) / 3;
+      gr_set_pixval(ref, x, y, MERGE_CHANNELS((v / 2), v, (255 - v), 0xffU));
+    }
+}
+
+void write_tile(const char * filename, unsigned int min_x, unsigned int min_y) {
+  unsigned int x, y;
+  FILE * f = fopen(filename, "wb");
+  assert(f != NULL);
+  fprintf(f, "P6\n%d %d\n255\n", TILE_SIZE, TILE_SIZE);
+  for(y = min_y; y < min_y + TILE_SIZE; y++)
+    for(x = min_x; x < min_x + TILE_SIZE; x++) {
+      uint32_t pix = gr_get_pixval(ref, x, y);
+      fputc(MASK_R(pix), f);
+      fputc(MASK_G(pix), f);
+      fputc(MASK_B(pix), f);
+    }
+  fclose(f);
+}
+
+/* a 2x2 mosaic with shifted nominal positions is stitched into the original image */
+void test01(void) {
+  unsigned int i;
+  const char * files[] = {"/tmp/t75 tile 0.ppm", "/tmp/t75 tile 1.ppm", "/tmp/t75 tile 2.ppm", "/tmp/t75 tile 3.ppm"};
+  int shift_x[] = {0, 3, -2, 4}, shift_y[] = {0, -3, 2, 1};
+
+  FILE * f = fopen("/tmp/t75_tiles.txt", "w");
+  assert(f != NULL);
+  fprintf(f, "# tile list\n\n");
+  for(i = 0; i < 4; i++) {
+    unsigned int x = (i % 2) * TILE_STEP, y = (i / 2) * TILE_STEP;
+    write_tile(files[i], x, y);
+    // filenames may contain spaces, relative to the directory of the list
+    fprintf(f, "%s  %d %d \n", files[i] + 5, x + shift_x[i], y + shift_y[i]);
+  }
+  fclose(f);
+
+  mosaic_t * mosaic = mosaic_load_tile_list("/tmp/t75_tiles.txt");
+  assert(mosaic != NULL && mosaic->num_tiles == 4);
+  for(i = 0; i < 4; i++) {
+    assert(strcmp(mosaic->tiles[i].filename, files[i]) == 0);
+    assert(mosaic->tiles[i].width == TILE_SIZE && mosaic->tiles[i].height == TILE_SIZE);
+  }
+
+  // the positions are correct relative to each other, the mosaic may be shifted as a whole
+  assert(RET_IS_OK(mosaic_refine_offsets(mosaic, 8, NULL, NULL)));
+  for(i = 1; i < 4; i++) {
+    assert(mosaic->tiles[i].x - mosaic->tiles[0].x == (int)((i % 2) * TILE_STEP));
+    assert(mosaic->tiles[i].y - mosaic->tiles[0].y == (int)((i / 2) * TILE_STEP));
+  }
+
+  // the tiles agree within overlaps, so the blended image equals the original
+  int origin_x = mosaic->tiles[0].x, origin_y = mosaic->tiles[0].y;
+  for(i = 0; i < 4; i++) {
+    mosaic->tiles[i].x -= origin_x;
+    mosaic->tiles[i].y -= origin_y;
+  }
+  image_t * img = gr_create_memory_image(SIZE, SIZE, IMAGE_TYPE_RGBA);
+  assert(img != NULL);
+  assert(RET_IS_OK(mosaic_import(img, mosaic, NULL, NULL)));
+  assert(memcmp(img->map->mem, ref->map->mem, SIZE * SIZE * sizeof(uint32_t)) == 0);
+
+  gr_image_destroy(img);
+  mosaic_destroy(mosaic);
+  for(i = 0; i < 4; i++) unlink(files[i]);
+  unlink("/tmp/t75_tiles.txt");
+}
+
+/* invalid lines are rejected */
+void test02(void) {
+  const char * lines[] = {"tile.ppm 10\n", "tile.ppm 10 x\n", " 10 20\n"};
+  unsigned int i;
+
+  for(i = 0; i < 3; i++) {
+    FILE * f = fopen("/tmp/t75_tiles.txt", "w");
+    assert(f != NULL);
+    fputs(lines[i], f);
+    fclose(f);
+    assert(mosaic_load_tile_list("/tmp/t75_tiles.txt") == NULL);
+  }
+  unlink("/tmp/t75_tiles.txt");
+}
+
+int main(void) {
+  setup();
+  test01();
+  test02();
+  gr_image_destroy(ref);
+  return 0;
+}
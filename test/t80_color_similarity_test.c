@@ -0,0 +1,111 @@
+/*                                                                              
+                                                                                
+This file is part of the IC reverse engineering tool degate.                    
+                                                                                
+Copyright 2008, 2009 by Martin Schobert                                         
+                                                                                
+Degate is free software: you can redistribute it and/or modify                  
+it under the terms of the GNU General Public License as published by            
+the Free Software Foundation, either version 3 of the License, or               
+any later version.                                                              
+                                                                                
+Degate is distributed in the hope that it will be useful,                       
+but WITHOUT ANY WARRANTY; without even the implied warranty of                  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                   
+GNU General Public License for more details.                                    
+                                                                                
+You should have received a copy of the GNU General Public License               
+along with degate. If not, see <http://www.gnu.org/licenses/>.                  
+                                                                                
+*/
+
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <graphics.h>
+#include <img_algorithms.h>
+#include <globals.h>
+
+#define DEBUG
+
+/* the hue formula, the lookup table was derived from */
+uint8_t scalar_hue(uint8_t red, uint8_t green, uint8_t blue) {
+  int max = MAX(red, MAX(green, blue));
+  int min = MIN(red, MIN(green, blue));
+  double delta = max - min;
+  double h = 0;
+
+  if(max == min) h = 0;
+  else if(max == red) h = 60 *  (green-blue)/delta;
+  else if(max == green) h = 60 * (2+(blue-red)/delta);
+  else if(max == blue) h = 60 * (4 + (red-green)/delta);
+  if(h < 0) h+=360;
+
+  h *= 255.0/360.0;
+  return (uint8_t)rint(h);
+}
+
+uint8_t scalar_distance(uint32_t pix, uint8_t ref_hue) {
+  uint8_t h = scalar_hue(MASK_R(pix), MASK_G(pix), MASK_B(pix));
+  return ref_hue > h ? ref_hue - h : h - ref_hue;
+}
+
+/* random rows of any length and alignment match the scalar formula */
+void test01(void) {
+  unsigned int i, x;
+  uint32_t src[100];
+  uint8_t dst[100 + 1];
+
+  srand(42);
+  for(i = 0; i < 2000; i++) {
+    unsigned int offset = rand() % 4;
+    unsigned int width = rand() % (100 - offset);
+    uint8_t ref_hue = rand();
+
+    for(x = 0; x < 100; x++) src[x] = rand() | (rand() << 16);
+    // equal channels make ties for the maximum
+    if(i % 3 == 0) for(x = 0; x < 100; x += 2) src[x] = (src[x] & 0xff00ffffU) | ((src[x] & 0xff) << 16);
+    if(i % 3 == 1) for(x = 0; x < 100; x += 2) src[x] = (src[x] & 0xffff00ffU) | ((src[x] & 0xff) << 8);
+
+    // the row must not be written beyond its end
+    dst[width] = 0xab;
+    imgalgo_color_similarity_row(src + offset, dst, width, ref_hue);
+    for(x = 0; x < width; x++) assert(dst[x] == scalar_distance(src[offset + x], ref_hue));
+    assert(dst[width] == 0xab);
+  }
+}
+
+/* every hue, including grey and the sector boundaries */
+void test02(void) {
+  unsigned int r, g, b, x = 0;
+  uint32_t src[64];
+  uint8_t dst[64];
+
+  for(r = 0; r < 256; r += 5)
+    for(g = 0; g < 256; g += 3)
+      for(b = 0; b < 256; b += 1) {
+	src[x++] = MERGE_CHANNELS(r, g, b, 0xffU);
+	if(x == 64) {
+	  imgalgo_color_similarity_row(src, dst, x, 0);
+	  for(x = 0; x < 64; x++) {
+	    assert(dst[x] == scalar_distance(src[x], 0));
+	    assert(rgb_to_h(MASK_R(src[x]), MASK_G(src[x]), MASK_B(src[x])) == 
+		   scalar_hue(MASK_R(src[x]), MASK_G(src[x]), MASK_B(src[x])));
+	  }
+	  x = 0;
+	}
+      }
+}
+
+int main(void) {
+  test01();
+  test02();
+  return 0;
+}